@@ -0,0 +1,329 @@
+/***************************************************************
+*                                                              *
+* bench_codec.c                                                *
+*                                                              *
+* Description:                                                 *
+* Microbenchmarks of the codec layers: rcx_encode(),           *
+* rcx_decode(), rcx_lnp_encode(), rcx_lnp_decode(),            *
+* lirc_encode(), lirc_decode() and lirc_byte_decode(). Each    *
+* runs on a packet of BENCH_PACKET data bytes, with these      *
+* inputs:                                                      *
+*                                                              *
+*   random       Bytes of a fixed pseudo random sequence       *
+*   alternating  0x55, every bit a run of its own: the most    *
+*                items per byte                                *
+*   runs         0x00 and 0xff: long runs, the fewest items    *
+*   corrupted    Random packet with a damaged byte or item in  *
+*                the middle, so the decoders take their error  *
+*                path (decoders only)                          *
+*                                                              *
+* Every measurement is repeated BENCH_REPEATS times, and the   *
+* fastest one is reported, which is the one least disturbed by *
+* the rest of the system.                                      *
+*                                                              *
+* Reported per measurement:                                    *
+*   bytes        Bytes on the byte side of the codec: data     *
+*                bytes for the rcx_ layer, packet bytes for    *
+*                the lirc_ layer                               *
+*   items        Units on the other side: packet bytes for the *
+*                rcx_ layer, lirc_t items for the lirc_ layer. *
+*                A LNP packet has about half the bytes of a    *
+*                RCX packet with the same data.                *
+*   ns_per_byte  Time per byte                                 *
+*   items_per_s  Items produced or consumed per second         *
+*   allocs       Heap allocations per call (malloc(), calloc() *
+*                and realloc() are wrapped by the linker)      *
+*                                                              *
+* Output is one line per measurement, as key=value pairs.      *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lirc.h"
+#include "rcxcode.h"
+#include "lirccode.h"
+#include "bench_rcx.h"
+
+#define BENCH_PACKET          200
+#define BENCH_RCX_BYTES       (BENCH_PACKET*2+5)
+#define BENCH_LNP_DEST        0x01
+#define BENCH_LNP_SRC         0x82
+#define BENCH_ITEMS           (BENCH_RCX_BYTES*LIRC_BYTE_ITEMS+1)
+#define BENCH_REPEATS         5
+#define BENCH_MIN_NS          20000000LL
+
+#define INPUT_RANDOM          0
+#define INPUT_ALTERNATING     1
+#define INPUT_RUNS            2
+#define INPUT_CORRUPTED       3
+#define INPUTS                4
+
+static const char* input_names[INPUTS] =
+{
+    "random", "alternating", "runs", "corrupted"
+};
+
+/* Wrapped allocation functions */
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+static long allocs = 0;
+
+/* The inputs of the codec under test */
+static unsigned char data[BENCH_PACKET];
+static unsigned char rcxbuf[BENCH_RCX_BYTES];
+static int rcxlen;
+static unsigned char lnpbuf[BENCH_RCX_BYTES];
+static int lnplen;
+static lirc_t items[BENCH_ITEMS];
+static int item_count;
+static lirc_profile_t* profile;
+
+/* Outputs, kept global so nothing is optimized away. The    */
+/* decoders want room for a byte more than they will decode. */
+static unsigned char out_bytes[BENCH_RCX_BYTES+LIRC_BYTE_ITEMS];
+static lirc_t out_items[BENCH_ITEMS];
+static volatile int sink;
+
+
+void* __wrap_malloc(size_t size)
+{
+    allocs++;
+    return __real_malloc(size);
+}
+
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+    allocs++;
+    return __real_calloc(count, size);
+}
+
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    allocs++;
+    return __real_realloc(ptr, size);
+}
+
+
+/* Fill data, rcxbuf and items with the given input */
+static void make_input(int input)
+{
+    int n;
+    unsigned int seed = 12345;
+
+    for (n=0; n<BENCH_PACKET; n++)
+    {
+        switch (input)
+        {
+        case INPUT_ALTERNATING:
+            data[n] = 0x55;
+            break;
+
+        case INPUT_RUNS:
+            data[n] = (n%2==0) ? 0x00 : 0xff;
+            break;
+
+        default:
+            seed = seed*1103515245U + 12345U;
+            data[n] = (unsigned char) (seed>>16);
+        }
+    }
+
+    rcxlen = rcx_encode(data, BENCH_PACKET, rcxbuf, sizeof(rcxbuf));
+    lnplen = rcx_lnp_encode(BENCH_LNP_DEST, BENCH_LNP_SRC, data, BENCH_PACKET,
+                            lnpbuf, sizeof(lnpbuf));
+    item_count = lirc_encode(profile, rcxbuf, rcxlen, items, BENCH_ITEMS);
+
+    /* As reported by the driver: pulses flagged, and the space */
+    /* after the last pulse                                     */
+    for (n=0; n<item_count; n++)
+    {
+        if (n%2==0)
+        {
+            items[n] |= PULSE_BIT;
+        }
+    }
+    items[item_count++] = profile->bit_period*10;
+
+    if (input==INPUT_CORRUPTED)
+    {
+        /* A complement that does not match its data byte */
+        rcxbuf[rcxlen/2] ^= 0x10;
+
+        /* A data byte that does not match the checksum */
+        lnpbuf[lnplen/2] ^= 0x10;
+
+        /* A pulse one bit too long: parity or framing error */
+        n = (item_count/2) & ~1;
+        items[n] += profile->bit_period;
+    }
+}
+
+
+static int run_rcx_encode(void)
+{
+    return rcx_encode(data, BENCH_PACKET, out_bytes, sizeof(out_bytes));
+}
+
+
+static int run_rcx_decode(void)
+{
+    return rcx_decode(rcxbuf, rcxlen, out_bytes, sizeof(out_bytes));
+}
+
+
+static int run_lnp_encode(void)
+{
+    return rcx_lnp_encode(BENCH_LNP_DEST, BENCH_LNP_SRC, data, BENCH_PACKET,
+                          out_bytes, sizeof(out_bytes));
+}
+
+
+static int run_lnp_decode(void)
+{
+    int dest;
+    int src;
+
+    return rcx_lnp_decode(lnpbuf, lnplen, out_bytes, sizeof(out_bytes),
+                          &dest, &src);
+}
+
+
+static int run_lirc_encode(void)
+{
+    return lirc_encode(profile, rcxbuf, rcxlen, out_items, BENCH_ITEMS);
+}
+
+
+static int run_lirc_decode(void)
+{
+    lirc_decoder_t decoder;
+
+    lirc_decoder_init(&decoder, profile->bit_period);
+    return lirc_decode(&decoder, items, item_count,
+                       out_bytes, sizeof(out_bytes));
+}
+
+
+static int run_lirc_byte_decode(void)
+{
+    int n;
+    int len = 0;
+    lirc_decoder_t decoder;
+
+    lirc_decoder_init(&decoder, profile->bit_period);
+    for (n=0; n<item_count; n++)
+    {
+        if (lirc_byte_decode(&decoder, items[n], &out_bytes[len])>0)
+        {
+            len++;
+        }
+    }
+    return len;
+}
+
+
+struct bench_codec
+{
+    const char* name;
+    int         (*run)(void);
+    int         decoder;     /* Takes the corrupted input       */
+    int         lirc;        /* Bytes are packet bytes          */
+    int         lnp;         /* Items are LNP packet bytes      */
+};
+
+static struct bench_codec codecs[] =
+{
+    { "rcx_encode",       run_rcx_encode,       0, 0, 0 },
+    { "rcx_decode",       run_rcx_decode,       1, 0, 0 },
+    { "rcx_lnp_encode",   run_lnp_encode,       0, 0, 1 },
+    { "rcx_lnp_decode",   run_lnp_decode,       1, 0, 1 },
+    { "lirc_encode",      run_lirc_encode,      0, 1, 0 },
+    { "lirc_decode",      run_lirc_decode,      1, 1, 0 },
+    { "lirc_byte_decode", run_lirc_byte_decode, 1, 1, 0 },
+};
+
+
+static void run(struct bench_codec* codec, int input)
+{
+    int n;
+    int result = 0;
+    int bytes;
+    int units;
+    long calls;
+    long calls_total = 0;
+    long allocs_start;
+    long long start;
+    long long time;
+    long long best = 0;
+
+    make_input(input);
+    bytes = codec->lirc ? rcxlen : BENCH_PACKET;
+    units = codec->lirc ? item_count : codec->lnp ? lnplen : rcxlen;
+
+    allocs_start = allocs;
+    for (n=0; n<BENCH_REPEATS; n++)
+    {
+        calls = 0;
+        start = bench_now_ns();
+        do
+        {
+            result = codec->run();
+            calls++;
+            time = bench_now_ns() - start;
+        }
+        while (time<BENCH_MIN_NS);
+        sink = result;
+
+        calls_total += calls;
+        if ((best==0) || (time*1000/calls<best))
+        {
+            best = time*1000/calls;
+        }
+    }
+
+    /* best is in ps per call */
+    printf("bench=codec func=%s input=%s result=%d bytes=%d items=%d"
+           " ns_per_byte=%.3f items_per_s=%.0f allocs=%.3f\n",
+           codec->name, input_names[input], result, bytes, units,
+           best/1000.0/bytes, units*1e12/best,
+           (double) (allocs - allocs_start)/calls_total);
+}
+
+
+int main(void)
+{
+    int n;
+    int input;
+
+    profile = lirc_profile(LIRC_PROFILE_NOMINAL);
+    if (profile==NULL)
+    {
+        fprintf(stderr, "bench_codec: lirc_profile() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    for (n=0; n<(int) (sizeof(codecs)/sizeof(codecs[0])); n++)
+    {
+        for (input=0; input<INPUTS; input++)
+        {
+            if ((input!=INPUT_CORRUPTED) || codecs[n].decoder)
+            {
+                run(&codecs[n], input);
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
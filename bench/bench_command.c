@@ -0,0 +1,327 @@
+/***************************************************************
+*                                                              *
+* bench_command.c                                              *
+*                                                              *
+* Description:                                                 *
+* Measures the round trip time of rcx_command(). Each command  *
+* is run once the way rcx_command() used to work: send, and    *
+* receive until the line becomes silent. Then it is run with   *
+* rcx_command(), which returns as soon as the reply is         *
+* complete.                                                    *
+*                                                              *
+* The LIRC device is emulated, see bench_dev.h. The write()    *
+* calls are wrapped as well: they last as long as the packet   *
+* takes on the IR link, after which the 'RCX' starts sending   *
+* its reply, one byte at a time.                               *
+*                                                              *
+* Path 'async' queues the commands with rcx_command_async(),   *
+* and takes the results from the completion queue. It shows   *
+* how long the caller is blocked by queueing (submit_us).      *
+*                                                              *
+* The line can be 'clean', or the receiver can hear the echo   *
+* of each transmission ('echo'). With 'collision', the first   *
+* transmission of each command collides: its echo is corrupted *
+* and the RCX does not reply to it.                            *
+*                                                              *
+* The reply follows the toggle bit of the opcode sent, see     *
+* rcx_command().                                               *
+*                                                              *
+* Output is one line per measurement, as key=value pairs.      *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lirc.h"
+#include "rcx.h"
+#include "rcxcode.h"
+#include "lirccode.h"
+#include "lircfile.h"
+#include "bench_dev.h"
+
+#define BENCH_RUNS            3
+#define BENCH_BUFFER          256
+
+struct bench_command
+{
+    const char*   name;
+    int           len;
+    unsigned char data[4];
+    int           reply_len;
+    unsigned char reply[4];
+};
+
+static struct bench_command commands[] =
+{
+    { "ping",    1, { 0x10 },             1, { 0xef } },
+    { "battery", 1, { 0x30 },             3, { 0xcf, 0x2c, 0x24 } },
+    { "motor",   2, { 0x21, 0x81 },       1, { 0xde } },
+    { "message", 2, { 0xf7, 0x12 },       0, { 0 } },
+};
+
+/* The reply to the command being sent, if any */
+static struct bench_command* current = NULL;
+
+/* Condition of the line, see above */
+#define LINE_CLEAN            0
+#define LINE_ECHO             1
+#define LINE_COLLISION        2
+
+static int line = LINE_CLEAN;
+static int line_writes = 0;
+static const char* line_names[] = { "clean", "echo", "collision" };
+
+/* Second handle on the device, for the old reception */
+static lirc_device_t device = { LIRC_NO_FD };
+
+/* Wrapped system call, see -Wl,--wrap in the Makefile */
+ssize_t __real_write(int fd, const void* buf, size_t count);
+
+
+/* The opcode of a transmission, as the RCX decodes it, or -1 */
+static int sent_opcode(const lirc_t* list, int item_count)
+{
+    int n;
+    int len;
+    lirc_decoder_t decoder;
+    lirc_t items[BENCH_BUFFER*LIRC_BYTE_ITEMS+1];
+    unsigned char bytes[BENCH_BUFFER];
+    unsigned char data[BENCH_BUFFER];
+
+    if (item_count>BENCH_BUFFER*LIRC_BYTE_ITEMS)
+    {
+        return -1;
+    }
+    for (n=0; n<item_count; n++)
+    {
+        items[n] = (n%2==0) ? (list[n] | PULSE_BIT) : list[n];
+    }
+    items[n++] = 417*10U;
+
+    lirc_decoder_init(&decoder, 417);
+    len = lirc_decode(&decoder, items, n, bytes, sizeof(bytes));
+    if (len>0)
+    {
+        len = rcx_decode(bytes, len, data, sizeof(data));
+    }
+    return (len>0) ? data[0] : -1;
+}
+
+
+/* Block for as long as the items last, then let the RCX reply */
+ssize_t __wrap_write(int fd, const void* buf, size_t count)
+{
+    size_t n;
+    int opcode;
+    long airtime = 0;
+    const lirc_t* list = buf;
+    unsigned char reply[4];
+    struct timespec ts;
+
+    /* The reply itself is written to the pipe */
+    if (!bench_is_device(fd))
+    {
+        return __real_write(fd, buf, count);
+    }
+
+    for (n=0; n<count/sizeof(lirc_t); n++)
+    {
+        airtime += list[n]&PULSE_MASK;
+    }
+
+    ts.tv_sec = airtime / 1000000;
+    ts.tv_nsec = (airtime % 1000000) * 1000;
+    nanosleep(&ts, NULL);
+
+    /* The echo arrives while transmitting */
+    line_writes++;
+    if (line!=LINE_CLEAN)
+    {
+        bench_echo(list, count/sizeof(lirc_t),
+                   (line==LINE_COLLISION) && (line_writes==1));
+    }
+    if ((line==LINE_COLLISION) && (line_writes==1))
+    {
+        return count;
+    }
+
+    if ((current!=NULL) && (current->reply_len>0))
+    {
+        memcpy(reply, current->reply, current->reply_len);
+        opcode = sent_opcode(list, count/sizeof(lirc_t));
+        if (opcode>=0)
+        {
+            reply[0] = (unsigned char) ~opcode;
+        }
+        bench_reply_start(reply, current->reply_len, 1);
+    }
+    return count;
+}
+
+
+/* Old command path: send, and receive until the line is silent */
+static int command_wait(unsigned char* buf, int buf_size, int* buf_len)
+{
+    int result;
+    lirc_decoder_t decoder;
+    lirc_t list[BENCH_BUFFER*LIRC_BYTE_ITEMS];
+    unsigned char bytes[BENCH_BUFFER];
+
+    result = rcx_encode(buf, *buf_len, bytes, sizeof(bytes));
+    result = lirc_encode(lirc_profile(LIRC_PROFILE_NOMINAL), bytes, result,
+                         list, BENCH_BUFFER*LIRC_BYTE_ITEMS);
+    if (lirc_send(&device, list, result)!=LIRC_OK)
+    {
+        return RCX_E_DEVICE_ERROR;
+    }
+
+    result = lirc_receive(&device, list, BENCH_BUFFER*LIRC_BYTE_ITEMS);
+    if (result<=0)
+    {
+        return RCX_E_RECV_NOTHING;
+    }
+
+    lirc_decoder_init(&decoder, 417);
+    result = lirc_decode(&decoder, list, result, bytes, sizeof(bytes));
+    if (result>0)
+    {
+        result = rcx_decode(bytes, result, buf, buf_size);
+    }
+    if (result<=0)
+    {
+        return RCX_E_RECV_ERROR;
+    }
+
+    *buf_len = result;
+    return RCX_OK;
+}
+
+
+static void run(struct bench_command* c, const char* path,
+                int (*command)(unsigned char*, int, int*))
+{
+    int n;
+    int len;
+    int writes = 0;
+    int result = RCX_OK;
+    long start;
+    long wall;
+    unsigned char buf[BENCH_BUFFER];
+
+    current = c;
+
+    start = bench_now_us();
+    for (n=0; n<BENCH_RUNS; n++)
+    {
+        buf[0] = c->data[0];
+        buf[1] = c->data[1];
+        len = c->len;
+        line_writes = 0;
+        result = command(buf, sizeof(buf), &len);
+        writes += line_writes;
+        bench_reply_join();
+    }
+    wall = bench_now_us() - start;
+
+    printf("bench=command opcode=%s line=%s path=%s result=%d writes=%d"
+           " reply_len=%d airtime_us=%d rtt_us=%ld\n",
+           c->name, line_names[line], path, result, writes/BENCH_RUNS,
+           c->reply_len,
+           ((c->len*2+5) + (c->reply_len ? c->reply_len*2+5 : 0))
+           *11*417,
+           wall/BENCH_RUNS);
+}
+
+
+/* Queue all runs at once, then take the completions */
+static void run_async(struct bench_command* c)
+{
+    int n;
+    int len;
+    int result = RCX_OK;
+    long start;
+    long submit;
+    long wall;
+    rcx_completion_t completion;
+
+    current = c;
+    line_writes = 0;
+
+    start = bench_now_us();
+    for (n=0; n<BENCH_RUNS; n++)
+    {
+        rcx_command_async(c->data, c->len, NULL, NULL);
+    }
+    submit = bench_now_us() - start;
+
+    len = 0;
+    for (n=0; n<BENCH_RUNS; n++)
+    {
+        if (rcx_poll_completion(&completion, 2000)!=RCX_OK)
+        {
+            fprintf(stderr, "bench_command: command not completed\n");
+            exit(EXIT_FAILURE);
+        }
+        if (completion.result!=RCX_OK)
+        {
+            result = completion.result;
+        }
+        len = completion.buf_len;
+    }
+    wall = bench_now_us() - start;
+    bench_reply_join();
+
+    printf("bench=command opcode=%s line=%s path=async result=%d writes=%d"
+           " reply_len=%d submit_us=%ld rtt_us=%ld\n",
+           c->name, line_names[line], result, line_writes/BENCH_RUNS,
+           len, submit/BENCH_RUNS, wall/BENCH_RUNS);
+}
+
+
+int main(void)
+{
+    unsigned int n;
+
+    if (bench_reply_open()!=0)
+    {
+        perror("bench_command: pipe");
+        return EXIT_FAILURE;
+    }
+    if (lirc_open(&device, BENCH_DEVICE)!=LIRC_OK)
+    {
+        fprintf(stderr, "bench_command: lirc_open() failed\n");
+        return EXIT_FAILURE;
+    }
+    if (rcx_open()!=RCX_OK)
+    {
+        fprintf(stderr, "bench_command: rcx_open() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    for (n=0; n<sizeof(commands)/sizeof(commands[0]); n++)
+    {
+        run(&commands[n], "wait", command_wait);
+        run(&commands[n], "early", rcx_command);
+        run_async(&commands[n]);
+    }
+
+    for (line=LINE_ECHO; line<=LINE_COLLISION; line++)
+    {
+        run(&commands[0], "wait", command_wait);
+        run(&commands[0], "early", rcx_command);
+    }
+
+    rcx_close();
+    lirc_close(&device);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,218 @@
+/***************************************************************
+*                                                              *
+* bench_dev.c                                                  *
+*                                                              *
+* Description:                                                 *
+* Emulation of the LIRC device for the benchmarks, see         *
+* bench_dev.h.                                                 *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "lirc.h"
+#include "rcxcode.h"
+#include "lirccode.h"
+#include "bench_dev.h"
+
+#define BENCH_REPLY_BYTES     512
+#define BENCH_REPLY_ITEMS     (BENCH_REPLY_BYTES*LIRC_BYTE_ITEMS)
+#define BENCH_FDS             64
+
+/* Wrapped system calls */
+int __real_open(const char* path, int flags, ...);
+int __real_ioctl(int fd, unsigned long request, ...);
+
+int bench_device_fd = -1;
+int bench_reply_bytes = 0;
+int bench_reply_items = 0;
+
+/* File descriptors of the opened device */
+static char device_fds[BENCH_FDS];
+
+/* The reply, as delivered by the driver */
+static lirc_t reply_items[BENCH_REPLY_ITEMS];
+static int reply_offset[BENCH_REPLY_BYTES];
+static int reply_writer = -1;
+static int reply_paced;
+static int reply_started = 0;
+static pthread_t reply_tid;
+
+
+/* Redirect the LIRC device */
+int __wrap_open(const char* path, int flags, ...)
+{
+    int fd;
+
+    if (strcmp(path, BENCH_DEVICE)==0)
+    {
+        if ((bench_device_fd==-1) && (bench_reply_open()!=0))
+        {
+            return -1;
+        }
+        fd = dup(bench_device_fd);
+        if ((fd>=0) && (fd<BENCH_FDS))
+        {
+            device_fds[fd] = 1;
+        }
+        return fd;
+    }
+    return __real_open(path, flags);
+}
+
+
+/* Make the redirected device look like a mode2 LIRC driver */
+int __wrap_ioctl(int fd, unsigned long request, ...)
+{
+    va_list ap;
+    unsigned long* mode;
+
+    va_start(ap, request);
+    mode = va_arg(ap, unsigned long*);
+    va_end(ap);
+
+    if (request==LIRC_GET_REC_MODE)
+    {
+        *mode = LIRC_MODE_MODE2;
+        return 0;
+    }
+    return __real_ioctl(fd, request, mode);
+}
+
+
+int bench_is_device(int fd)
+{
+    return (fd>=0) && (fd<BENCH_FDS) && device_fds[fd];
+}
+
+
+long bench_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000L + ts.tv_nsec/1000;
+}
+
+
+int bench_reply_open(void)
+{
+    int pipefd[2];
+
+    if (pipe(pipefd)!=0)
+    {
+        return -1;
+    }
+    bench_device_fd = pipefd[0];
+    reply_writer = pipefd[1];
+    return 0;
+}
+
+
+/* Feed the reply to the device, in one go or byte by byte */
+static void* reply_thread(void* arg)
+{
+    int n;
+    int first;
+    int last;
+    int step;
+    struct timespec ts;
+
+    step = reply_paced ? 1 : bench_reply_bytes;
+
+    for (n=0; n<bench_reply_bytes; n+=step)
+    {
+        first = reply_offset[n];
+        last = (n+step<bench_reply_bytes) ?
+               reply_offset[n+step] : bench_reply_items;
+        if (reply_paced)
+        {
+            /* Airtime of one byte: 11 bits at 2400 baud */
+            ts.tv_sec = 0;
+            ts.tv_nsec = 11*417*1000;
+            nanosleep(&ts, NULL);
+        }
+        if (write(reply_writer, &reply_items[first],
+                  (last-first)*sizeof(lirc_t))<0)
+        {
+            perror("bench: write");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return NULL;
+}
+
+
+void bench_reply_start(unsigned char* data, int len, int paced)
+{
+    int n;
+    unsigned char rcxbuf[BENCH_REPLY_BYTES];
+    lirc_profile_t* profile = lirc_profile(LIRC_PROFILE_NOMINAL);
+
+    /* The previous reply has been delivered, if it was received */
+    bench_reply_join();
+
+    bench_reply_bytes = rcx_encode(data, len, rcxbuf, sizeof(rcxbuf));
+    bench_reply_items = lirc_encode(profile, rcxbuf, bench_reply_bytes,
+                                    reply_items, BENCH_REPLY_ITEMS);
+
+    /* The driver reports IR pulses, the 'space' bits, with    */
+    /* the PULSE_BIT set. Each byte starts with a space.       */
+    for (n=0; n<bench_reply_items; n+=2)
+    {
+        reply_items[n] |= PULSE_BIT;
+    }
+    reply_offset[0] = 0;
+    for (n=1; n<bench_reply_bytes; n++)
+    {
+        reply_offset[n] = reply_offset[n-1] + profile->count[rcxbuf[n-1]];
+    }
+
+    reply_paced = paced;
+    reply_started = 1;
+    pthread_create(&reply_tid, NULL, reply_thread, NULL);
+}
+
+
+void bench_reply_join(void)
+{
+    if (reply_started)
+    {
+        pthread_join(reply_tid, NULL);
+        reply_started = 0;
+    }
+}
+
+
+void bench_echo(const lirc_t* list, int count, int corrupt)
+{
+    int n;
+    lirc_t echo[BENCH_REPLY_ITEMS];
+
+    for (n=0; (n<count) && (n<BENCH_REPLY_ITEMS); n++)
+    {
+        echo[n] = (n%2==0) ? (list[n]|PULSE_BIT) : list[n];
+    }
+    if (corrupt && (n>4))
+    {
+        echo[4] += 3*417;
+    }
+
+    if (write(reply_writer, echo, n*sizeof(lirc_t))<0)
+    {
+        perror("bench: write");
+        exit(EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,60 @@
+/***************************************************************
+*                                                              *
+* bench_dev.h                                                  *
+*                                                              *
+* Description:                                                 *
+* Emulation of the LIRC device for the benchmarks. The linker  *
+* wraps open() and ioctl() (-Wl,--wrap), so that opening       *
+* /dev/lirc gives a mode2 'driver' without the real hardware.  *
+*                                                              *
+* Received data comes from a pipe, fed by a thread that plays  *
+* the part of the RCX sending a reply.                         *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#ifndef _BENCH_DEV_H
+#define _BENCH_DEV_H
+
+/* Filename of the emulated device */
+#define BENCH_DEVICE          "/dev/lirc"
+
+/* File descriptor behind the emulated device. Opening the    */
+/* device returns a duplicate of it. If it is -1, the pipe is  */
+/* created by the first open, see bench_reply_open().          */
+extern int bench_device_fd;
+
+
+/* Size of the last reply started, in RCX bytes and items */
+extern int bench_reply_bytes;
+extern int bench_reply_items;
+
+/* Returns 1 if fd has been returned by an open of the device */
+int bench_is_device(int fd);
+
+/* Current time of the monotonic clock, in us */
+long bench_now_us(void);
+
+/* Create the pipe behind the device, and set bench_device_fd */
+/* to its reading end. Returns 0, or -1 on errors.             */
+int bench_reply_open(void);
+
+/* Start sending a reply packet with the given data bytes. If  */
+/* paced is set, the bytes are delivered one at a time, at the */
+/* speed of the IR link, otherwise all at once.                */
+void bench_reply_start(unsigned char* data, int len, int paced);
+
+/* Wait until the reply has been delivered completely */
+void bench_reply_join(void);
+
+/* Let the receiver hear the items just sent. If corrupt is    */
+/* set, one pulse of the echo is stretched, as in a collision. */
+void bench_echo(const lirc_t* list, int count, int corrupt);
+
+#else
+#error -- bench_dev.h -- included twice, or more...
+#endif /* _BENCH_DEV_H */
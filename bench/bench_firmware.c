@@ -0,0 +1,342 @@
+/***************************************************************
+*                                                              *
+* bench_firmware.c                                             *
+*                                                              *
+* Description:                                                 *
+* Runs rcx_download_firmware() over the in-memory loopback     *
+* transport (lircloop.h) against the emulated ROM of an RCX.   *
+* It takes the delete, start, transfer and unlock opcodes,     *
+* checks the sequence numbers and the block checksums, and     *
+* writes the blocks into an image of its own, which is         *
+* compared with the one sent (verified=1). Like the real one,  *
+* it ignores an opcode that equals the one before.             *
+*                                                              *
+* The image is BENCH_IMAGE bytes, made up as S-records and     *
+* read back with rcx_firmware_parse() (path 'parse'). It is    *
+* downloaded with fixed block sizes, and with the size         *
+* chosen by rcx_firmware_block_size() ('auto'). The virtual    *
+* time is what the download would take on the IR link.         *
+*                                                              *
+* Then the ROM misses every BENCH_LOSE-th transfer, and drops  *
+* the reply of the one half way in between, so only those      *
+* blocks are sent again (retransmits=). Last, the block sizes  *
+* the cost model picks for a few byte error rates are shown.   *
+*                                                              *
+* Output is one line per measurement, as key=value pairs.      *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lirc.h"
+#include "rcx.h"
+#include "rcxcode.h"
+#include "rcxfirm.h"
+#include "lirccode.h"
+#include "lircfile.h"
+#include "lirctransport.h"
+#include "lircloop.h"
+#include "bench_rcx.h"
+
+#define BENCH_IMAGE           16384
+#define BENCH_RECORD          32
+#define BENCH_BUFFER          512
+#define BENCH_LINE            "rom"
+#define BENCH_LOSE            20
+
+/* State of the emulated ROM */
+static int rom_last = -1;         /* Opcode it ran last        */
+static int rom_active = 0;        /* Download started          */
+static int rom_checksum = 0;      /* Of the image, as announced*/
+static int rom_sequence = 0;      /* Of the last block taken   */
+static int rom_offset = 0;        /* Of the last block taken   */
+static int rom_length = 0;        /* Bytes taken so far        */
+static int rom_unlocked = 0;
+static unsigned char rom_image[RCX_FIRMWARE_SIZE];
+
+/* Every rom_lose-th transfer is missed; the reply of the one */
+/* half way in between is dropped                             */
+static int rom_lose = 0;
+static int rom_transfers = 0;
+
+static rcx_firmware_t firmware;
+
+
+/* A block of a download. Returns the status of the reply. */
+static int rom_transfer(const unsigned char* data, int len)
+{
+    int n;
+    int sum = 0;
+    int sequence = data[1] | (data[2]<<8);
+    int length = data[3] | (data[4]<<8);
+    int offset;
+
+    if (!rom_active)
+    {
+        return 6;
+    }
+    if ((len!=length+6) || (rom_length+length>RCX_FIRMWARE_SIZE))
+    {
+        return 3;
+    }
+    for (n=0; n<length; n++)
+    {
+        sum += data[5+n];
+    }
+    if ((sum&0xff)!=data[5+length])
+    {
+        return 3;
+    }
+
+    /* The block before, again, or the next one */
+    if ((rom_length>0) && (sequence==rom_sequence))
+    {
+        offset = rom_offset;
+    }
+    else if ((sequence==rom_sequence+1) || (sequence==0))
+    {
+        offset = rom_length;
+        rom_length += length;
+    }
+    else
+    {
+        return 3;
+    }
+    memcpy(&rom_image[offset], &data[5], length);
+    rom_sequence = sequence;
+    rom_offset = offset;
+
+    /* The last block ends the download */
+    if (sequence==0)
+    {
+        sum = 0;
+        for (n=0; (n<rom_length) &&
+                  (n<RCX_FIRMWARE_SUM_END-RCX_FIRMWARE_START); n++)
+        {
+            sum += rom_image[n];
+        }
+        if ((sum&0xffff)!=rom_checksum)
+        {
+            return 4;
+        }
+    }
+    return 0;
+}
+
+
+/* The emulated ROM */
+static int rom_respond(void* user, const lirc_t* list, int item_count,
+                       lirc_t* reply, int reply_max)
+{
+    int len;
+    int opcode;
+    int lost = 0;
+    unsigned char data[BENCH_BUFFER];
+    static const char greeting[] = "Just a bit off the block!";
+
+    len = bench_rcx_hear(list, item_count, LIRC_BIT_PERIOD_2400,
+                         data, sizeof(data));
+    if ((len==0) || (data[0]==rom_last))
+    {
+        return 0;
+    }
+
+    opcode = data[0] & ~RCX_TOGGLE;
+    if ((opcode==0x45) && (rom_lose>0))
+    {
+        rom_transfers++;
+        if (rom_transfers%rom_lose==0)
+        {
+            return 0;
+        }
+        lost = (rom_transfers%rom_lose==rom_lose/2);
+    }
+    rom_last = data[0];
+
+    data[0] = (unsigned char) ~data[0];
+    switch (opcode)
+    {
+    case 0x65: /* Delete firmware */
+        rom_active = 0;
+        rom_unlocked = 0;
+        len = 1;
+        break;
+
+    case 0x75: /* Start firmware download */
+        rom_active = 1;
+        rom_checksum = data[3] | (data[4]<<8);
+        rom_sequence = 0;
+        rom_offset = 0;
+        rom_length = 0;
+        data[1] = 0;
+        len = 2;
+        break;
+
+    case 0x45: /* Transfer data */
+        data[1] = (unsigned char) rom_transfer(data, len);
+        len = 2;
+        break;
+
+    case 0xa5: /* Unlock firmware */
+        if ((len!=6) || (memcmp(&data[1], "LEGO", 4)!=0) || !rom_active)
+        {
+            return 0;
+        }
+        rom_active = 0;
+        rom_unlocked = 1;
+        memcpy(&data[1], greeting, sizeof(greeting)-1);
+        len = sizeof(greeting);
+        break;
+
+    default:
+        return 0;
+    }
+
+    if (lost)
+    {
+        return 0;
+    }
+
+    return bench_rcx_reply(lirc_profile(LIRC_PROFILE_NOMINAL), data, len,
+                           reply, reply_max);
+}
+
+
+/* Made up image, as S1 records */
+static char* make_srec(int* size)
+{
+    int n;
+    int k;
+    int sum;
+    int address;
+    char* text;
+    char* p;
+    unsigned int seed = 1;
+    unsigned char image[BENCH_IMAGE];
+
+    for (n=0; n<BENCH_IMAGE; n++)
+    {
+        seed = seed*1103515245U + 12345U;
+        image[n] = (unsigned char) (seed>>16);
+    }
+
+    text = (char*) malloc(BENCH_IMAGE*4);
+    p = text;
+    p += sprintf(p, "S00600004844521B\n");
+    for (n=0; n<BENCH_IMAGE; n+=BENCH_RECORD)
+    {
+        address = RCX_FIRMWARE_START+n;
+        sum = (BENCH_RECORD+3) + (address>>8) + (address&0xff);
+        p += sprintf(p, "S1%02X%04X", BENCH_RECORD+3, address);
+        for (k=0; k<BENCH_RECORD; k++)
+        {
+            p += sprintf(p, "%02X", image[n+k]);
+            sum += image[n+k];
+        }
+        p += sprintf(p, "%02X\n", ~sum & 0xff);
+    }
+    sum = 3 + (RCX_FIRMWARE_START>>8) + (RCX_FIRMWARE_START&0xff);
+    p += sprintf(p, "S903%04X%02X\n", RCX_FIRMWARE_START, ~sum & 0xff);
+
+    *size = p-text;
+    return text;
+}
+
+
+static void run(rcx_handle_t* handle, lirc_loop_t* line, const char* path,
+                int block_size)
+{
+    int result;
+    int verified;
+    long virtual_start;
+    long long start;
+    rcx_download_t download;
+
+    memset(rom_image, 0, sizeof(rom_image));
+    rom_unlocked = 0;
+    rom_transfers = 0;
+
+    download.block_size = block_size;
+    virtual_start = lirc_loop_now(line);
+    start = bench_now_ns();
+    result = rcx_download_firmware_dev(handle, &firmware, &download);
+
+    verified = (result==RCX_OK) && rom_unlocked &&
+               (rom_length==firmware.length) &&
+               (memcmp(rom_image, firmware.image, firmware.length)==0);
+
+    printf("bench=firmware path=%s result=%d block_size=%d blocks=%d"
+           " retransmits=%d verified=%d wall_us=%lld virtual_ms=%ld"
+           " bytes_per_s=%ld\n",
+           path, result, download.block_size, download.blocks,
+           download.retransmits, verified, (bench_now_ns() - start)/1000,
+           (lirc_loop_now(line) - virtual_start)/1000,
+           firmware.length*1000000L/
+           (lirc_loop_now(line) - virtual_start + 1));
+}
+
+
+int main(void)
+{
+    int size;
+    int result;
+    long long start;
+    char* text;
+    rcx_handle_t* handle;
+    lirc_loop_t* line;
+    static const int ppm[] = { 0, 100, 1000, 5000, 20000 };
+    unsigned int n;
+
+    text = make_srec(&size);
+    start = bench_now_ns();
+    result = rcx_firmware_parse(text, size, &firmware);
+    printf("bench=firmware path=parse result=%d srec_bytes=%d"
+           " image_bytes=%d wall_us=%lld\n",
+           result, size, firmware.length, (bench_now_ns() - start)/1000);
+    free(text);
+    if (result!=RCX_OK)
+    {
+        return 1;
+    }
+
+    line = lirc_loop_create(BENCH_LINE);
+    if (line==NULL)
+    {
+        fprintf(stderr, "bench_firmware: lirc_loop_create() failed\n");
+        return 1;
+    }
+    lirc_loop_responder(line, rom_respond, NULL);
+
+    if (rcx_open_transport(&lirc_loop_transport, BENCH_LINE,
+                           RCX_TARGET_NOMINAL, &handle)!=RCX_OK)
+    {
+        fprintf(stderr, "bench_firmware: rcx_open_transport() failed\n");
+        return 1;
+    }
+
+    run(handle, line, "block_50", 50);
+    run(handle, line, "block_100", 100);
+    run(handle, line, "block_200", RCX_FIRMWARE_BLOCK_MAX);
+    run(handle, line, "auto", 0);
+
+    rom_lose = BENCH_LOSE;
+    run(handle, line, "lossy_auto", 0);
+    rom_lose = 0;
+
+    for (n=0; n<sizeof(ppm)/sizeof(ppm[0]); n++)
+    {
+        printf("bench=firmware path=model error_ppm=%d block_size=%d\n",
+               ppm[n], rcx_firmware_block_size(firmware.length, ppm[n]));
+    }
+
+    rcx_close_dev(handle);
+    lirc_loop_destroy(line);
+    return 0;
+}
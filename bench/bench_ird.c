@@ -0,0 +1,477 @@
+/***************************************************************
+*                                                              *
+* bench_ird.c                                                  *
+*                                                              *
+* Description:                                                 *
+* Runs the rcxird server (rcxird.h) in a thread, on a device   *
+* of the in-memory loopback transport (lircloop.h), against an *
+* emulated RCX. It answers pings with the inverted opcode, and *
+* ignores an opcode that equals the one before. A message      *
+* (opcode 0xf7) it hears, it sends back, as a program on the   *
+* RCX that answers messages would.                             *
+*                                                              *
+* Path 'direct' pings with rcx_command() on the device itself, *
+* 'ird' through the server, from one client: the difference    *
+* of wall_ns is the cost of the socket per command.            *
+*                                                              *
+* In 'fair', BENCH_CLIENTS clients ping at the same time; the  *
+* server takes them in turn, so each runs about as many        *
+* commands (clientN=).                                         *
+*                                                              *
+* In 'fanout', a client sends BENCH_MESSAGES messages with     *
+* rcx_ird_send(), and waits for each to come back. It and      *
+* BENCH_LISTENERS other clients subscribed, so each gets every *
+* message (clientN=).                                          *
+*                                                              *
+* In 'during', the emulated RCX sends a message before each    *
+* reply to a ping, so it comes while the command waits. A      *
+* client pings BENCH_MESSAGES times; BENCH_LISTENERS others    *
+* subscribed, and each gets every message (clientN=).          *
+*                                                              *
+* Output is one line per measurement, as key=value pairs.      *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "lirc.h"
+#include "rcx.h"
+#include "rcxcode.h"
+#include "rcxird.h"
+#include "lirccode.h"
+#include "lircfile.h"
+#include "lirctransport.h"
+#include "lircloop.h"
+#include "bench_rcx.h"
+
+#define BENCH_COMMANDS        1000
+#define BENCH_CLIENTS         4
+#define BENCH_MESSAGES        100
+#define BENCH_LISTENERS       2
+#define BENCH_BUFFER          256
+#define BENCH_LINE            "rcx"
+#define BENCH_PING            0x10
+#define BENCH_MESSAGE         0xf7
+#define BENCH_RECEIVE_TIME    1000  /* ms a message may take      */
+
+/* Opcode the emulated RCX ran last */
+static int rcx_last = -1;
+
+/* Set in 'during': a message goes before each reply to a ping, */
+/* numbered from 0                                              */
+static int rcx_during = 0;
+static int rcx_during_sent = 0;
+
+/* Socket of the server */
+static char bench_socket[64];
+
+/* A client of the 'fair' and 'fanout' paths */
+typedef struct bench_client
+{
+    pthread_t          thread;
+    rcx_ird_client_t*  client;
+    int                count;   /* Commands run, messages taken */
+    int                failed;
+} bench_client_t;
+
+/* Ends the clients of 'fair' */
+static int fair_stop = 0;
+
+
+/* The emulated RCX */
+static int rcx_respond(void* user, const lirc_t* list, int item_count,
+                       lirc_t* reply, int reply_max)
+{
+    int len;
+    int items = 0;
+    unsigned char data[BENCH_BUFFER];
+    unsigned char message[2];
+    lirc_profile_t* profile = lirc_profile(LIRC_PROFILE_NOMINAL);
+
+    len = bench_rcx_hear(list, item_count, LIRC_BIT_PERIOD_2400,
+                         data, sizeof(data));
+    if (len==0)
+    {
+        return 0;
+    }
+
+    /* The message goes back as it is; a ping is answered */
+    if (data[0]!=BENCH_MESSAGE)
+    {
+        if (((data[0] & ~RCX_TOGGLE)!=BENCH_PING) || (data[0]==rcx_last))
+        {
+            return 0;
+        }
+        rcx_last = data[0];
+        data[0] = (unsigned char) ~data[0];
+        len = 1;
+
+        /* A message first; its stop bit ends in a gap of silence */
+        if (rcx_during)
+        {
+            message[0] = BENCH_MESSAGE;
+            message[1] = (unsigned char) rcx_during_sent++;
+            items = bench_rcx_reply(profile, message, sizeof(message),
+                                    reply, reply_max);
+            if (items>0)
+            {
+                reply[items-1] += LIRC_BIT_PERIOD_2400*10U;
+            }
+        }
+    }
+
+    len = bench_rcx_reply(profile, data, len, &reply[items],
+                          reply_max-items);
+    return (len>0) ? items+len : 0;
+}
+
+
+/* Runs the server, until rcx_ird_server_stop() */
+static void* serve(void* arg)
+{
+    rcx_ird_server_run((rcx_ird_server_t*) arg);
+    return NULL;
+}
+
+
+/* A ping through the server. Returns 1 if answered. */
+static int ping(rcx_ird_client_t* client)
+{
+    int len = 1;
+    unsigned char buf[BENCH_BUFFER];
+
+    buf[0] = BENCH_PING;
+    return (rcx_ird_command(client, buf, sizeof(buf), &len)==RCX_OK) &&
+           (len>=1) && (buf[0]==(unsigned char) ~BENCH_PING);
+}
+
+
+static void run_direct(rcx_handle_t* handle, lirc_loop_t* line)
+{
+    int n;
+    int len;
+    int failed = 0;
+    long virtual_start;
+    long long start;
+    unsigned char buf[BENCH_BUFFER];
+
+    virtual_start = lirc_loop_now(line);
+    start = bench_now_ns();
+    for (n=0; n<BENCH_COMMANDS; n++)
+    {
+        buf[0] = BENCH_PING;
+        len = 1;
+        if ((rcx_command_dev(handle, buf, sizeof(buf), &len)!=RCX_OK) ||
+            (len<1) || (buf[0]!=(unsigned char) ~BENCH_PING))
+        {
+            failed++;
+        }
+    }
+
+    printf("bench=ird path=direct commands=%d failed=%d wall_ns=%lld"
+           " virtual_us=%ld\n",
+           BENCH_COMMANDS, failed, (bench_now_ns() - start)/BENCH_COMMANDS,
+           (lirc_loop_now(line) - virtual_start)/BENCH_COMMANDS);
+}
+
+
+static void run_ird(lirc_loop_t* line)
+{
+    int n;
+    int failed = 0;
+    long virtual_start;
+    long long start;
+    rcx_ird_client_t* client;
+
+    if (rcx_ird_connect(bench_socket, &client)!=RCX_OK)
+    {
+        printf("bench=ird path=ird failed=%d\n", BENCH_COMMANDS);
+        return;
+    }
+
+    virtual_start = lirc_loop_now(line);
+    start = bench_now_ns();
+    for (n=0; n<BENCH_COMMANDS; n++)
+    {
+        failed += !ping(client);
+    }
+
+    printf("bench=ird path=ird commands=%d failed=%d wall_ns=%lld"
+           " virtual_us=%ld\n",
+           BENCH_COMMANDS, failed, (bench_now_ns() - start)/BENCH_COMMANDS,
+           (lirc_loop_now(line) - virtual_start)/BENCH_COMMANDS);
+    rcx_ird_close(client);
+}
+
+
+/* A client of 'fair': pings until told to stop */
+static void* fair_client(void* arg)
+{
+    bench_client_t* bench = (bench_client_t*) arg;
+
+    while (!__atomic_load_n(&fair_stop, __ATOMIC_ACQUIRE))
+    {
+        if (ping(bench->client))
+        {
+            __atomic_add_fetch(&bench->count, 1, __ATOMIC_RELEASE);
+        }
+        else
+        {
+            bench->failed++;
+        }
+    }
+    return NULL;
+}
+
+
+static void run_fair(void)
+{
+    int n;
+    int total;
+    int failed = 0;
+    long long start;
+    bench_client_t clients[BENCH_CLIENTS];
+
+    memset(clients, 0, sizeof(clients));
+    for (n=0; n<BENCH_CLIENTS; n++)
+    {
+        if (rcx_ird_connect(bench_socket, &clients[n].client)!=RCX_OK)
+        {
+            printf("bench=ird path=fair failed=%d\n", BENCH_COMMANDS);
+            return;
+        }
+    }
+
+    __atomic_store_n(&fair_stop, 0, __ATOMIC_RELEASE);
+    start = bench_now_ns();
+    for (n=0; n<BENCH_CLIENTS; n++)
+    {
+        pthread_create(&clients[n].thread, NULL, fair_client, &clients[n]);
+    }
+
+    /* Until the clients ran BENCH_COMMANDS commands together */
+    do
+    {
+        usleep(1000);
+        total = 0;
+        for (n=0; n<BENCH_CLIENTS; n++)
+        {
+            total += __atomic_load_n(&clients[n].count, __ATOMIC_ACQUIRE);
+        }
+    }
+    while (total<BENCH_COMMANDS);
+    __atomic_store_n(&fair_stop, 1, __ATOMIC_RELEASE);
+
+    total = 0;
+    for (n=0; n<BENCH_CLIENTS; n++)
+    {
+        pthread_join(clients[n].thread, NULL);
+        total += clients[n].count;
+        failed += clients[n].failed;
+    }
+
+    printf("bench=ird path=fair commands=%d failed=%d", total, failed);
+    for (n=0; n<BENCH_CLIENTS; n++)
+    {
+        printf(" client%d=%d", n, clients[n].count);
+        rcx_ird_close(clients[n].client);
+    }
+    printf(" wall_ns=%lld\n", (bench_now_ns() - start)/total);
+}
+
+
+/* A listener of 'fanout': takes messages until none comes */
+static void* fanout_client(void* arg)
+{
+    int len;
+    unsigned char buf[BENCH_BUFFER];
+    bench_client_t* bench = (bench_client_t*) arg;
+
+    while (rcx_ird_receive(bench->client, buf, sizeof(buf), &len,
+                           BENCH_RECEIVE_TIME)==RCX_OK)
+    {
+        if ((len==2) && (buf[0]==BENCH_MESSAGE) && (buf[1]==bench->count))
+        {
+            bench->count++;
+        }
+        else
+        {
+            bench->failed++;
+        }
+    }
+    return NULL;
+}
+
+
+static void run_fanout(void)
+{
+    int n;
+    int len;
+    int failed = 0;
+    long long start;
+    unsigned char buf[BENCH_BUFFER];
+    bench_client_t clients[BENCH_LISTENERS+1];
+    bench_client_t* sender = &clients[BENCH_LISTENERS];
+
+    memset(clients, 0, sizeof(clients));
+    for (n=0; n<=BENCH_LISTENERS; n++)
+    {
+        if ((rcx_ird_connect(bench_socket, &clients[n].client)!=RCX_OK) ||
+            (rcx_ird_subscribe(clients[n].client, 1)!=RCX_OK))
+        {
+            printf("bench=ird path=fanout failed=%d\n", BENCH_MESSAGES);
+            return;
+        }
+    }
+    for (n=0; n<BENCH_LISTENERS; n++)
+    {
+        pthread_create(&clients[n].thread, NULL, fanout_client, &clients[n]);
+    }
+
+    start = bench_now_ns();
+    for (n=0; n<BENCH_MESSAGES; n++)
+    {
+        buf[0] = BENCH_MESSAGE;
+        buf[1] = (unsigned char) n;
+        if ((rcx_ird_send(sender->client, buf, 2)!=RCX_OK) ||
+            (rcx_ird_receive(sender->client, buf, sizeof(buf), &len,
+                             BENCH_RECEIVE_TIME)!=RCX_OK) ||
+            (len!=2) || (buf[1]!=n))
+        {
+            sender->failed++;
+        }
+        else
+        {
+            sender->count++;
+        }
+    }
+    printf("bench=ird path=fanout messages=%d wall_ns=%lld",
+           BENCH_MESSAGES, (bench_now_ns() - start)/BENCH_MESSAGES);
+
+    /* The listeners end when no message came for a while */
+    for (n=0; n<=BENCH_LISTENERS; n++)
+    {
+        if (n<BENCH_LISTENERS)
+        {
+            pthread_join(clients[n].thread, NULL);
+        }
+        printf(" client%d=%d", n, clients[n].count);
+        failed += clients[n].failed;
+        rcx_ird_close(clients[n].client);
+    }
+    printf(" failed=%d\n", failed);
+}
+
+
+static void run_during(void)
+{
+    int n;
+    int failed = 0;
+    long long start;
+    bench_client_t clients[BENCH_LISTENERS+1];
+    bench_client_t* pinger = &clients[BENCH_LISTENERS];
+
+    memset(clients, 0, sizeof(clients));
+    for (n=0; n<=BENCH_LISTENERS; n++)
+    {
+        if ((rcx_ird_connect(bench_socket, &clients[n].client)!=RCX_OK) ||
+            ((n<BENCH_LISTENERS) &&
+             (rcx_ird_subscribe(clients[n].client, 1)!=RCX_OK)))
+        {
+            printf("bench=ird path=during failed=%d\n", BENCH_MESSAGES);
+            return;
+        }
+    }
+    for (n=0; n<BENCH_LISTENERS; n++)
+    {
+        pthread_create(&clients[n].thread, NULL, fanout_client, &clients[n]);
+    }
+
+    rcx_during = 1;
+    rcx_during_sent = 0;
+    start = bench_now_ns();
+    for (n=0; n<BENCH_MESSAGES; n++)
+    {
+        if (ping(pinger->client))
+        {
+            pinger->count++;
+        }
+        else
+        {
+            pinger->failed++;
+        }
+    }
+    printf("bench=ird path=during commands=%d messages=%d wall_ns=%lld",
+           pinger->count, rcx_during_sent,
+           (bench_now_ns() - start)/BENCH_MESSAGES);
+
+    /* The listeners end when no message came for a while */
+    for (n=0; n<=BENCH_LISTENERS; n++)
+    {
+        if (n<BENCH_LISTENERS)
+        {
+            pthread_join(clients[n].thread, NULL);
+            printf(" client%d=%d", n, clients[n].count);
+        }
+        failed += clients[n].failed;
+        rcx_ird_close(clients[n].client);
+    }
+    printf(" failed=%d\n", failed);
+    rcx_during = 0;
+}
+
+
+int main(void)
+{
+    pthread_t thread;
+    lirc_loop_t* line;
+    rcx_handle_t* handle;
+    rcx_ird_server_t* server;
+
+    line = lirc_loop_create(BENCH_LINE);
+    if (line==NULL)
+    {
+        fprintf(stderr, "bench_ird: lirc_loop_create() failed\n");
+        return EXIT_FAILURE;
+    }
+    lirc_loop_responder(line, rcx_respond, NULL);
+
+    if (rcx_open_transport(&lirc_loop_transport, BENCH_LINE,
+                           RCX_TARGET_NOMINAL, &handle)!=RCX_OK)
+    {
+        fprintf(stderr, "bench_ird: rcx_open_transport() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    run_direct(handle, line);
+
+    sprintf(bench_socket, "/tmp/bench_ird.%d", (int) getpid());
+    if ((rcx_ird_server_create(handle, bench_socket, &server)!=RCX_OK) ||
+        (pthread_create(&thread, NULL, serve, server)!=0))
+    {
+        fprintf(stderr, "bench_ird: rcx_ird_server_create() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    run_ird(line);
+    run_fair();
+    run_fanout();
+    run_during();
+
+    rcx_ird_server_stop(server);
+    pthread_join(thread, NULL);
+    rcx_ird_server_destroy(server);
+
+    rcx_close_dev(handle);
+    lirc_loop_destroy(line);
+    return EXIT_SUCCESS;
+}
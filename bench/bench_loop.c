@@ -0,0 +1,510 @@
+/***************************************************************
+*                                                              *
+* bench_loop.c                                                 *
+*                                                              *
+* Description:                                                 *
+* Runs rcx_command() over the in-memory loopback transport     *
+* (lircloop.h) against an emulated RCX, which answers each     *
+* command with the inverted opcode and the reply length of     *
+* rcx_reply_length(). Like the real one, it ignores an opcode  *
+* that equals the one before, so the commands only pass with   *
+* the toggle bit managed.                                      *
+*                                                              *
+* Nothing waits for real, so the benchmark shows the CPU time  *
+* of the whole protocol stack per command (wall_ns), next to   *
+* the time the command would take on the IR link (virtual_us). *
+* Path 'timeout' sends a command the RCX does not answer: it   *
+* costs virtual time only.                                     *
+*                                                              *
+* Then the statistics of the device are shown, see             *
+* rcx_get_stats(). The round trip histogram is in virtual time.*
+*                                                              *
+* Then the RCX holds back every BENCH_HOLD-th reply, and sends *
+* it late, before the next one. Path 'late' loses those        *
+* commands. With rcx_set_retry(), 'late_retry' sends them      *
+* again, and skips the late replies. 'late_add' does the same  *
+* with an opcode that is not idempotent: the retries are       *
+* ignored, so the RCX runs each command once (runs=).          *
+*                                                              *
+* Path 'ping_4800' runs at 4800 baud. The 'auto' paths let     *
+* the rate follow the link, see rcx_set_baud(): the RCX first  *
+* hears both rates, then only 2400 baud, then both again. The  *
+* link falls back to 2400 baud, and probes its way up again.   *
+*                                                              *
+* Path 'lnp' sends brickOS LNP addressing packets, see         *
+* rcx_lnp_send(), to BENCH_LNP_ROBOTS emulated robots in turn. *
+* Each sends the data back from its own address, and           *
+* rcx_lnp_poll() hands it to the handler of the port (robotN=).*
+* In 'lnp_other' the robots send to another host, so nothing   *
+* is handled.                                                  *
+*                                                              *
+* At the end, the line echoes, and the host skews its pulses   *
+* and spaces by BENCH_PULSE_SKEW and BENCH_SPACE_SKEW, beyond  *
+* what the RCX decodes. Path 'skewed' fails; rcx_calibrate()   *
+* then finds the adjustments, so 'calibrated' passes, and so   *
+* does 'reopened', with the profile saved by the calibration.  *
+* The second calibration hears the replies of the RCX as well. *
+*                                                              *
+* Output is one line per measurement, as key=value pairs.      *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lirc.h"
+#include "rcx.h"
+#include "rcxcode.h"
+#include "lirccode.h"
+#include "lircfile.h"
+#include "lirctransport.h"
+#include "lircloop.h"
+#include "bench_rcx.h"
+
+#define BENCH_COMMANDS        1000
+#define BENCH_TIMEOUTS        10
+#define BENCH_BUFFER          256
+#define BENCH_LINE            "rcx"
+#define BENCH_DEAF            300
+#define BENCH_HOLD            4
+#define BENCH_ATTEMPTS        3
+#define BENCH_PULSE_SKEW      250
+#define BENCH_SPACE_SKEW      (-100)
+#define BENCH_LNP_ROBOTS      2     /* Hosts 0 and 1            */
+#define BENCH_LNP_ROBOT_PORT  1
+#define BENCH_LNP_PORT        2     /* Of the host of the bench */
+#define BENCH_LNP_OTHER       0x92  /* A host that is not there */
+#define BENCH_LNP_DATA        8
+
+/* The emulated RCX stays silent while this is set, or does */
+/* not hear commands at 4800 baud                           */
+static int rcx_silent = 0;
+static int rcx_deaf_4800 = 0;
+
+/* Opcode the emulated RCX ran last, and the number of commands */
+/* it ran                                                        */
+static int rcx_last = -1;
+static int rcx_runs = 0;
+
+/* Every rcx_hold-th reply is held back, and sent before the */
+/* next one                                                   */
+static int rcx_hold = 0;
+static int rcx_answered = 0;
+static int rcx_held_count = 0;
+static lirc_t rcx_held[BENCH_BUFFER*LIRC_BYTE_ITEMS];
+
+/* Timing of the replies at 4800 baud */
+static lirc_profile_t rcx_fast;
+
+/* The robots speak LNP; they send each packet back to its   */
+/* source, or to rcx_lnp_to when it is set                   */
+static int rcx_lnp = 0;
+static int rcx_lnp_to = -1;
+static int lnp_handled[BENCH_LNP_ROBOTS];
+
+
+/* Decode an LNP packet at 2400 baud. Returns the number of   */
+/* data bytes, or 0.                                           */
+static int lnp_hear(const lirc_t* list, int item_count,
+                    unsigned char* data, int data_size, int* dest, int* src)
+{
+    int len;
+    unsigned char lnpbuf[BENCH_BUFFER];
+
+    len = bench_line_bytes(list, item_count, LIRC_BIT_PERIOD_2400,
+                           lnpbuf, sizeof(lnpbuf));
+    if (len==0)
+    {
+        return 0;
+    }
+    len = rcx_lnp_decode(lnpbuf, len, data, data_size, dest, src);
+    return (len<0) ? 0 : len;
+}
+
+
+/* The emulated robots, with brickOS. The one addressed sends */
+/* the data back from its port.                               */
+static int lnp_respond(const lirc_t* list, int item_count,
+                       lirc_t* reply, int reply_max)
+{
+    int len;
+    int dest;
+    int src;
+    unsigned char lnpbuf[BENCH_BUFFER];
+    unsigned char data[BENCH_BUFFER];
+
+    len = lnp_hear(list, item_count, data, sizeof(data), &dest, &src);
+    if ((len==0) || (dest<0) ||
+        ((dest>>4)>=BENCH_LNP_ROBOTS) ||
+        ((dest&RCX_LNP_PORT_MASK)!=BENCH_LNP_ROBOT_PORT))
+    {
+        return 0;
+    }
+
+    len = rcx_lnp_encode((rcx_lnp_to>=0) ? rcx_lnp_to : src, dest,
+                         data, len, lnpbuf, sizeof(lnpbuf));
+    if (len<0)
+    {
+        return 0;
+    }
+    len = lirc_encode(lirc_profile(LIRC_PROFILE_NOMINAL), lnpbuf, len,
+                      reply, reply_max);
+    return (len<0) ? 0 : len;
+}
+
+
+/* The emulated RCX. It answers at the bit rate it is addressed */
+/* with.                                                         */
+static int rcx_respond(void* user, const lirc_t* list, int item_count,
+                       lirc_t* reply, int reply_max)
+{
+    int len;
+    int held;
+    unsigned char data[BENCH_BUFFER];
+    lirc_profile_t* profile = lirc_profile(LIRC_PROFILE_NOMINAL);
+
+    if (rcx_silent)
+    {
+        return 0;
+    }
+    if (rcx_lnp)
+    {
+        return lnp_respond(list, item_count, reply, reply_max);
+    }
+
+    len = bench_rcx_hear(list, item_count, LIRC_BIT_PERIOD_2400,
+                         data, sizeof(data));
+    if ((len==0) && !rcx_deaf_4800)
+    {
+        profile = &rcx_fast;
+        len = bench_rcx_hear(list, item_count, LIRC_BIT_PERIOD_4800,
+                             data, sizeof(data));
+    }
+    if ((len==0) || (data[0]==rcx_last))
+    {
+        return 0;
+    }
+    rcx_last = data[0];
+    rcx_runs++;
+
+    len = rcx_reply_length(data[0]);
+    if (len<=0)
+    {
+        return 0;
+    }
+    data[0] = (unsigned char) ~data[0];
+    memset(&data[1], 0, len-1);
+
+    /* A held reply goes first, with a gap after it. The items */
+    /* alternate, starting with a pulse.                        */
+    held = rcx_held_count;
+    if (held>0)
+    {
+        memcpy(reply, rcx_held, held*sizeof(lirc_t));
+        if (held%2==0)
+        {
+            reply[held-1] += profile->bit_period*20;
+        }
+        else
+        {
+            reply[held++] = profile->bit_period*20;
+        }
+        rcx_held_count = 0;
+    }
+
+    len = bench_rcx_reply(profile, data, len, &reply[held], reply_max-held);
+    if (len==0)
+    {
+        return 0;
+    }
+
+    rcx_answered++;
+    if ((rcx_hold>0) && (held==0) && (rcx_answered%rcx_hold==0))
+    {
+        memcpy(rcx_held, reply, len*sizeof(lirc_t));
+        rcx_held_count = len;
+        return 0;
+    }
+    return held+len;
+}
+
+
+static void run(rcx_handle_t* handle, lirc_loop_t* line, const char* path,
+                unsigned char opcode, int count)
+{
+    int n;
+    int len;
+    int result;
+    int failed = 0;
+    long virtual_start;
+    long long start;
+    unsigned char buf[BENCH_BUFFER];
+
+    virtual_start = lirc_loop_now(line);
+    start = bench_now_ns();
+    for (n=0; n<count; n++)
+    {
+        buf[0] = opcode;
+        len = 1;
+        result = rcx_command_dev(handle, buf, sizeof(buf), &len);
+        if (result!=RCX_OK || len<1 || buf[0]!=(unsigned char) ~opcode)
+        {
+            failed++;
+        }
+    }
+
+    printf("bench=loop path=%s commands=%d failed=%d wall_ns=%lld"
+           " virtual_us=%ld\n",
+           path, count, failed, (bench_now_ns() - start)/count,
+           (lirc_loop_now(line) - virtual_start)/count);
+}
+
+
+/* Takes the packets to BENCH_LNP_PORT, and counts them per robot */
+static void lnp_handler(void* user, const unsigned char* data, int length,
+                        int src)
+{
+    int host = src>>4;
+
+    if ((length==BENCH_LNP_DATA) && (host<BENCH_LNP_ROBOTS) &&
+        (data[0]==host))
+    {
+        lnp_handled[host]++;
+    }
+}
+
+
+/* Sends LNP packets to the robots in turn, and polls for what */
+/* they send back                                               */
+static void run_lnp(rcx_handle_t* handle, lirc_loop_t* line,
+                    const char* path, int count)
+{
+    int n;
+    int host;
+    int result;
+    int packets = 0;
+    int failed = 0;
+    long virtual_start;
+    long long start;
+    unsigned char buf[BENCH_LNP_DATA];
+    rcx_stats_t before;
+    rcx_stats_t after;
+
+    memset(lnp_handled, 0, sizeof(lnp_handled));
+    memset(buf, 0x55, sizeof(buf));
+    rcx_get_stats_dev(handle, &before);
+    virtual_start = lirc_loop_now(line);
+    start = bench_now_ns();
+    for (n=0; n<count; n++)
+    {
+        host = n%BENCH_LNP_ROBOTS;
+        buf[0] = (unsigned char) host;
+        result = rcx_lnp_send_dev(handle, (host<<4) | BENCH_LNP_ROBOT_PORT,
+                                  BENCH_LNP_PORT, buf, sizeof(buf));
+        if (result==RCX_OK)
+        {
+            result = rcx_lnp_poll_dev(handle);
+        }
+        if (result<0)
+        {
+            failed++;
+        }
+        else
+        {
+            packets += result;
+        }
+    }
+
+    rcx_get_stats_dev(handle, &after);
+
+    printf("bench=loop path=%s packets=%d failed=%d handled=%d"
+           " bytes_received=%lu",
+           path, count, failed, packets,
+           after.bytes_received-before.bytes_received);
+    for (n=0; n<BENCH_LNP_ROBOTS; n++)
+    {
+        printf(" robot%d=%d", n, lnp_handled[n]);
+    }
+    printf(" wall_ns=%lld virtual_us=%ld\n",
+           (bench_now_ns() - start)/count,
+           (lirc_loop_now(line) - virtual_start)/count);
+}
+
+
+static void show_stats(rcx_handle_t* handle)
+{
+    int n;
+    rcx_stats_t stats;
+
+    rcx_get_stats_dev(handle, &stats);
+    printf("bench=loop path=stats bytes_sent=%lu packets_sent=%lu"
+           " bytes_received=%lu packets_received=%lu timeouts=%lu"
+           " retries=%lu errors=%lu",
+           stats.bytes_sent, stats.packets_sent, stats.bytes_received,
+           stats.packets_received, stats.timeouts, stats.retries,
+           stats.parity_errors + stats.framing_errors +
+           stats.break_errors + stats.complement_errors +
+           stats.checksum_errors);
+    for (n=0; n<RCX_STATS_BUCKETS; n++)
+    {
+        if (stats.command_time[n]>0)
+        {
+            printf(" rtt_bucket%d=%lu", n, stats.command_time[n]);
+        }
+    }
+    printf("\n");
+}
+
+
+static void show_rate(rcx_handle_t* handle, const char* path)
+{
+    rcx_stats_t stats;
+
+    rcx_get_stats_dev(handle, &stats);
+    printf("bench=loop path=%s baud=%d rate_fallbacks=%lu"
+           " rate_probes=%lu\n", path, rcx_get_baud_dev(handle),
+           stats.rate_fallbacks, stats.rate_probes);
+}
+
+
+/* Shows the retries and late replies since the last call */
+static void show_retry(rcx_handle_t* handle, const char* path)
+{
+    static unsigned long retries = 0;
+    static unsigned long late_replies = 0;
+    rcx_stats_t stats;
+
+    rcx_get_stats_dev(handle, &stats);
+    printf("bench=loop path=%s runs=%d retries=%lu late_replies=%lu\n",
+           path, rcx_runs, stats.retries - retries,
+           stats.late_replies - late_replies);
+    retries = stats.retries;
+    late_replies = stats.late_replies;
+}
+
+
+static void calibrate(rcx_handle_t* handle)
+{
+    int result;
+    rcx_calibration_t cal;
+
+    memset(&cal, 0, sizeof(cal));
+    result = rcx_calibrate_dev(handle, &cal);
+    printf("bench=loop path=calibrate result=%d mark_adjust=%d"
+           " space_adjust=%d tx_mark_error=%d tx_space_error=%d"
+           " rx_mark_error=%d rx_space_error=%d echo_samples=%d"
+           " reply_samples=%d\n",
+           result, cal.mark_adjust, cal.space_adjust, cal.tx_mark_error,
+           cal.tx_space_error, cal.rx_mark_error, cal.rx_space_error,
+           cal.echo_samples, cal.reply_samples);
+}
+
+
+int main(void)
+{
+    char profile[64];
+    rcx_retry_t retry;
+    lirc_loop_t* line;
+    rcx_handle_t* handle;
+
+    line = lirc_loop_create(BENCH_LINE);
+    if (line==NULL)
+    {
+        fprintf(stderr, "bench_loop: lirc_loop_create() failed\n");
+        return EXIT_FAILURE;
+    }
+    lirc_loop_responder(line, rcx_respond, NULL);
+
+    if (rcx_open_transport(&lirc_loop_transport, BENCH_LINE,
+                           RCX_TARGET_NOMINAL, &handle)!=RCX_OK)
+    {
+        fprintf(stderr, "bench_loop: rcx_open_transport() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    run(handle, line, "ping", 0x10, BENCH_COMMANDS);
+    run(handle, line, "battery", 0x30, BENCH_COMMANDS);
+
+    rcx_silent = 1;
+    run(handle, line, "timeout", 0x10, BENCH_TIMEOUTS);
+    show_stats(handle);
+    rcx_silent = 0;
+
+    /* At 4800 baud, and then at the rate that follows the link: */
+    /* good, deaf at 4800 baud, and good again                   */
+    lirc_profile_init(&rcx_fast, LIRC_BIT_PERIOD_4800, 0, 0);
+    rcx_set_baud_dev(handle, RCX_BAUD_4800);
+    run(handle, line, "ping_4800", 0x10, BENCH_COMMANDS);
+    rcx_set_baud_dev(handle, RCX_BAUD_AUTO);
+    run(handle, line, "auto_good", 0x10, BENCH_COMMANDS);
+    show_rate(handle, "auto_good");
+    rcx_deaf_4800 = 1;
+    run(handle, line, "auto_deaf", 0x10, BENCH_DEAF);
+    show_rate(handle, "auto_deaf");
+    rcx_deaf_4800 = 0;
+    run(handle, line, "auto_recovered", 0x10, BENCH_COMMANDS);
+    show_rate(handle, "auto_recovered");
+    rcx_set_baud_dev(handle, RCX_BAUD_2400);
+
+    /* Late replies, without and with retries */
+    rcx_hold = BENCH_HOLD;
+    rcx_runs = 0;
+    run(handle, line, "late", 0x10, BENCH_COMMANDS);
+    show_retry(handle, "late");
+    rcx_get_retry_dev(handle, &retry);
+    retry.attempts = BENCH_ATTEMPTS;
+    rcx_set_retry_dev(handle, &retry);
+    rcx_runs = 0;
+    run(handle, line, "late_retry", 0x10, BENCH_COMMANDS);
+    show_retry(handle, "late_retry");
+    rcx_runs = 0;
+    run(handle, line, "late_add", 0x24, BENCH_COMMANDS);
+    show_retry(handle, "late_add");
+    retry.attempts = RCX_RETRY_ATTEMPTS;
+    rcx_set_retry_dev(handle, &retry);
+    rcx_hold = 0;
+    rcx_held_count = 0;
+
+    /* LNP packets to the robots, and to another host */
+    rcx_lnp = 1;
+    rcx_lnp_set_handler_dev(handle, BENCH_LNP_PORT, lnp_handler, NULL);
+    run_lnp(handle, line, "lnp", BENCH_COMMANDS);
+    rcx_lnp_to = BENCH_LNP_OTHER;
+    run_lnp(handle, line, "lnp_other", BENCH_TIMEOUTS);
+    rcx_lnp_to = -1;
+    rcx_lnp_set_handler_dev(handle, BENCH_LNP_PORT, NULL, NULL);
+    rcx_lnp = 0;
+
+    /* Keep the profile of the calibration out of $HOME */
+    snprintf(profile, sizeof(profile), "/tmp/bench_loop.%d", (int) getpid());
+    setenv("RCX_PROFILE", profile, 1);
+
+    lirc_loop_echo(line, 1);
+    lirc_loop_skew(line, BENCH_PULSE_SKEW, BENCH_SPACE_SKEW);
+    run(handle, line, "skewed", 0x10, BENCH_TIMEOUTS);
+    calibrate(handle);
+    run(handle, line, "calibrated", 0x10, BENCH_COMMANDS);
+    calibrate(handle);
+    rcx_close_dev(handle);
+
+    if (rcx_open_transport(&lirc_loop_transport, BENCH_LINE,
+                           RCX_TARGET_DEFAULT, &handle)!=RCX_OK)
+    {
+        fprintf(stderr, "bench_loop: rcx_open_transport() failed\n");
+        return EXIT_FAILURE;
+    }
+    run(handle, line, "reopened", 0x10, BENCH_COMMANDS);
+
+    rcx_close_dev(handle);
+    remove(profile);
+    lirc_loop_destroy(line);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,436 @@
+/***************************************************************
+*                                                              *
+* bench_motor.c                                                *
+*                                                              *
+* Description:                                                 *
+* Runs the motor queue (rcxmotor.h) over the in-memory         *
+* loopback transport (lircloop.h) against an emulated RCX that *
+* keeps the state of its outputs.                              *
+*                                                              *
+* The input is a remote control with keys held down: every    *
+* BENCH_INPUT ms of the virtual clock an event gives the       *
+* direction and on/off commands of a key for outputs A and C,  *
+* and their power from a throttle, the way the GUI of the      *
+* example sends them. A key is held for BENCH_HOLD events.     *
+* This comes much faster than the IR link takes commands.      *
+*                                                              *
+* Path 'fifo' sends all commands in order from a queue of its  *
+* own, 'motor' gives them to the motor queue. latency is the   *
+* time from an input to the reply of the RCX to it, in ms of   *
+* the virtual clock. verified=1 when the outputs of the RCX    *
+* end in the state of the last input. submitted, dropped and   *
+* merged count per output, as the counters of rcxmotor.h.      *
+*                                                              *
+* Output is one line per measurement, as key=value pairs.      *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "lirc.h"
+#include "rcx.h"
+#include "rcxcode.h"
+#include "rcxmotor.h"
+#include "lirccode.h"
+#include "lircfile.h"
+#include "lirctransport.h"
+#include "lircloop.h"
+#include "bench_rcx.h"
+
+#define BENCH_EVENTS          200
+#define BENCH_INPUT           20    /* ms between the events      */
+#define BENCH_HOLD            10    /* Events a key is held       */
+#define BENCH_COMMANDS        6     /* Most commands of an event  */
+#define BENCH_FIFO            (BENCH_EVENTS*BENCH_COMMANDS)
+#define BENCH_IDLE            10    /* Looks at a still clock     */
+#define BENCH_POLL            100   /* us between the looks       */
+#define BENCH_BUFFER          256
+#define BENCH_LINE            "rcx"
+
+/* Keys of the remote control */
+enum { KEY_FORWARD, KEY_LEFT, KEY_RIGHT, KEY_BACKWARD, KEY_STOP, KEYS };
+
+/* State of the outputs A, B and C */
+typedef struct bench_state
+{
+    int onoff[RCX_MOTOR_OUTPUTS];
+    int direction[RCX_MOTOR_OUTPUTS];
+    int power[RCX_MOTOR_OUTPUTS];
+} bench_state_t;
+
+/* Opcode the emulated RCX ran last, and its outputs */
+static int rcx_last = -1;
+static bench_state_t rcx_state;
+
+/* Queue of path 'fifo' */
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             head;
+    int             count;
+    int             done;       /* No more input                  */
+    unsigned char   data[BENCH_FIFO][RCX_MOTOR_SIZE];
+    int             length[BENCH_FIFO];
+    long            submitted[BENCH_FIFO];
+    unsigned long   sent;
+    long            latency_max;
+    long            latency_total;
+} fifo;
+
+static rcx_handle_t* fifo_handle;
+
+
+/* Runs a motor command on a state */
+static void state_apply(bench_state_t* state, const unsigned char* data,
+                        int len)
+{
+    int n;
+
+    for (n=0; n<RCX_MOTOR_OUTPUTS; n++)
+    {
+        if (!(data[1] & (1<<n)))
+        {
+            continue;
+        }
+        switch (data[0] & ~RCX_TOGGLE)
+        {
+        case RCX_MOTOR_ONOFF:
+            state->onoff[n] = data[1] & 0xc0;
+            break;
+
+        case RCX_MOTOR_DIRECTION:
+            state->direction[n] = data[1] & 0xc0;
+            break;
+
+        case RCX_MOTOR_POWER:
+            if (len==4)
+            {
+                state->power[n] = data[3];
+            }
+            break;
+        }
+    }
+}
+
+
+/* The emulated RCX */
+static int rcx_respond(void* user, const lirc_t* list, int item_count,
+                       lirc_t* reply, int reply_max)
+{
+    int len;
+    unsigned char data[BENCH_BUFFER];
+
+    len = bench_rcx_hear(list, item_count, LIRC_BIT_PERIOD_2400,
+                         data, sizeof(data));
+    if ((len<2) || (data[0]==rcx_last))
+    {
+        return 0;
+    }
+
+    switch (data[0] & ~RCX_TOGGLE)
+    {
+    case RCX_MOTOR_ONOFF:
+    case RCX_MOTOR_DIRECTION:
+    case RCX_MOTOR_POWER:
+        state_apply(&rcx_state, data, len);
+        break;
+
+    default:
+        return 0;
+    }
+    rcx_last = data[0];
+
+    data[0] = (unsigned char) ~data[0];
+    return bench_rcx_reply(lirc_profile(LIRC_PROFILE_NOMINAL), data, 1,
+                           reply, reply_max);
+}
+
+
+/* The commands of an event, as the GUI sends them, one output */
+/* at a time. Returns the number of commands.                   */
+static int event_commands(int event, unsigned char cmd[][4], int* len)
+{
+    int n = 0;
+    int key = (event/BENCH_HOLD) % KEYS;
+    int a = RCX_MOTOR_OFF;
+    int c = RCX_MOTOR_OFF;
+    int direction = RCX_MOTOR_FORWARD;
+
+    switch (key)
+    {
+    case KEY_FORWARD:  a = c = RCX_MOTOR_ON; break;
+    case KEY_BACKWARD: a = c = RCX_MOTOR_ON;
+                       direction = RCX_MOTOR_BACKWARD; break;
+    case KEY_LEFT:     c = RCX_MOTOR_ON; break;
+    case KEY_RIGHT:    a = RCX_MOTOR_ON; break;
+    }
+
+    /* The throttle moves with every event */
+    cmd[n][0] = RCX_MOTOR_POWER;
+    cmd[n][1] = RCX_MOTOR_A;
+    cmd[n][2] = 2;                          /* Constant */
+    cmd[n][3] = (unsigned char) (event % 8);
+    len[n++] = 4;
+    cmd[n][0] = RCX_MOTOR_POWER;
+    cmd[n][1] = RCX_MOTOR_C;
+    cmd[n][2] = 2;
+    cmd[n][3] = (unsigned char) (event % 8);
+    len[n++] = 4;
+
+    if ((key==KEY_FORWARD) || (key==KEY_BACKWARD))
+    {
+        cmd[n][0] = RCX_MOTOR_DIRECTION;
+        cmd[n][1] = (unsigned char) (direction | RCX_MOTOR_A);
+        len[n++] = 2;
+        cmd[n][0] = RCX_MOTOR_DIRECTION;
+        cmd[n][1] = (unsigned char) (direction | RCX_MOTOR_C);
+        len[n++] = 2;
+    }
+
+    cmd[n][0] = RCX_MOTOR_ONOFF;
+    cmd[n][1] = (unsigned char) (a | RCX_MOTOR_A);
+    len[n++] = 2;
+    cmd[n][0] = RCX_MOTOR_ONOFF;
+    cmd[n][1] = (unsigned char) (c | RCX_MOTOR_C);
+    len[n++] = 2;
+
+    return n;
+}
+
+
+/* Puts a command in the queue of path 'fifo' */
+static int fifo_submit(void* queue, const unsigned char* buf, int buf_len)
+{
+    int tail;
+
+    pthread_mutex_lock(&fifo.lock);
+    if (fifo.count==BENCH_FIFO)
+    {
+        pthread_mutex_unlock(&fifo.lock);
+        return RCX_E_QUEUE_FULL;
+    }
+    tail = (fifo.head+fifo.count) % BENCH_FIFO;
+    memcpy(fifo.data[tail], buf, buf_len);
+    fifo.length[tail] = buf_len;
+    fifo.submitted[tail] = rcx_get_time_dev(fifo_handle);
+    fifo.count++;
+    pthread_cond_signal(&fifo.cond);
+    pthread_mutex_unlock(&fifo.lock);
+    return RCX_OK;
+}
+
+
+/* Sends the queue of path 'fifo', in order */
+static void* fifo_thread(void* arg)
+{
+    int len;
+    long latency;
+    long submitted;
+    unsigned char buf[RCX_MOTOR_SIZE];
+
+    pthread_mutex_lock(&fifo.lock);
+    while (1)
+    {
+        while ((fifo.count==0) && !fifo.done)
+        {
+            pthread_cond_wait(&fifo.cond, &fifo.lock);
+        }
+        if (fifo.count==0)
+        {
+            break;
+        }
+        len = fifo.length[fifo.head];
+        memcpy(buf, fifo.data[fifo.head], len);
+        submitted = fifo.submitted[fifo.head];
+        fifo.head = (fifo.head+1) % BENCH_FIFO;
+        fifo.count--;
+        pthread_mutex_unlock(&fifo.lock);
+
+        rcx_command_dev(fifo_handle, buf, sizeof(buf), &len);
+        latency = rcx_get_time_dev(fifo_handle)-submitted;
+
+        pthread_mutex_lock(&fifo.lock);
+        fifo.sent++;
+        fifo.latency_total += latency;
+        if (latency>fifo.latency_max)
+        {
+            fifo.latency_max = latency;
+        }
+    }
+    pthread_mutex_unlock(&fifo.lock);
+
+    return NULL;
+}
+
+
+/* Puts a command in the motor queue */
+static int motor_submit(void* queue, const unsigned char* buf, int buf_len)
+{
+    return rcx_motor_submit((rcx_motor_t*) queue, buf, buf_len);
+}
+
+
+/* Gives the events to a queue at their time of the virtual     */
+/* clock. The clock only moves while the queue sends: when it    */
+/* stands still, the queue is idle, and the event is given now.  */
+/* Returns the number of commands given, and of failed ones.     */
+static int input(lirc_loop_t* line,
+                 int (*submit)(void*, const unsigned char*, int),
+                 void* queue, bench_state_t* model, int* failed)
+{
+    int n;
+    int k;
+    int count;
+    int idle;
+    int commands = 0;
+    long due;
+    long now;
+    long last;
+    long start;
+    int len[BENCH_COMMANDS];
+    unsigned char cmd[BENCH_COMMANDS][4];
+
+    start = lirc_loop_now(line);
+    for (n=0; n<BENCH_EVENTS; n++)
+    {
+        due = start + n*BENCH_INPUT*1000L;
+        idle = 0;
+        last = -1;
+        while (((now = lirc_loop_now(line))<due) && (idle<BENCH_IDLE))
+        {
+            idle = (now==last) ? idle+1 : 0;
+            last = now;
+            usleep(BENCH_POLL);
+        }
+
+        count = event_commands(n, cmd, len);
+        for (k=0; k<count; k++)
+        {
+            state_apply(model, cmd[k], len[k]);
+            if (submit(queue, cmd[k], len[k])!=RCX_OK)
+            {
+                (*failed)++;
+            }
+        }
+        commands += count;
+    }
+
+    return commands;
+}
+
+
+/* Runs the input through path 'fifo' */
+static void run_fifo(lirc_loop_t* line, rcx_handle_t* handle)
+{
+    int failed = 0;
+    int commands;
+    long long start;
+    pthread_t thread;
+    bench_state_t model;
+
+    memset(&model, 0, sizeof(model));
+    memset(&rcx_state, 0, sizeof(rcx_state));
+    pthread_mutex_init(&fifo.lock, NULL);
+    pthread_cond_init(&fifo.cond, NULL);
+    fifo_handle = handle;
+
+    start = bench_now_ns();
+    pthread_create(&thread, NULL, fifo_thread, NULL);
+    commands = input(line, fifo_submit, NULL, &model, &failed);
+
+    pthread_mutex_lock(&fifo.lock);
+    fifo.done = 1;
+    pthread_cond_signal(&fifo.cond);
+    pthread_mutex_unlock(&fifo.lock);
+    pthread_join(thread, NULL);
+
+    printf("bench=motor path=fifo events=%d commands=%d failed=%d"
+           " submitted=%d sent=%lu dropped=0 merged=0 latency_max_ms=%ld"
+           " latency_avg_ms=%ld verified=%d wall_ms=%lld\n",
+           BENCH_EVENTS, commands, failed, commands-failed, fifo.sent,
+           fifo.latency_max/1000,
+           (fifo.sent>0) ? (long) (fifo.latency_total/fifo.sent/1000) : 0L,
+           memcmp(&model, &rcx_state, sizeof(model))==0,
+           (bench_now_ns() - start)/1000000);
+
+    pthread_cond_destroy(&fifo.cond);
+    pthread_mutex_destroy(&fifo.lock);
+}
+
+
+/* Runs the input through the motor queue */
+static void run_motor(lirc_loop_t* line, rcx_handle_t* handle)
+{
+    int failed = 0;
+    int commands;
+    long long start;
+    rcx_motor_t* motor;
+    rcx_motor_stats_t stats;
+    bench_state_t model;
+
+    if (rcx_motor_create(handle, &motor)!=RCX_OK)
+    {
+        printf("bench=motor path=motor failed=%d\n", BENCH_EVENTS);
+        return;
+    }
+    memset(&model, 0, sizeof(model));
+    memset(&rcx_state, 0, sizeof(rcx_state));
+
+    start = bench_now_ns();
+    commands = input(line, motor_submit, motor, &model, &failed);
+    rcx_motor_flush(motor);
+    rcx_motor_get_stats(motor, &stats);
+
+    printf("bench=motor path=motor events=%d commands=%d failed=%d"
+           " submitted=%lu sent=%lu dropped=%lu merged=%lu"
+           " latency_max_ms=%ld latency_avg_ms=%ld verified=%d"
+           " wall_ms=%lld\n",
+           BENCH_EVENTS, commands, failed, stats.submitted, stats.sent,
+           stats.dropped,
+           stats.merged, stats.latency_max/1000,
+           (stats.sent>0) ? (long) (stats.latency_total/stats.sent/1000)
+                          : 0L,
+           memcmp(&model, &rcx_state, sizeof(model))==0,
+           (bench_now_ns() - start)/1000000);
+
+    rcx_motor_destroy(motor);
+}
+
+
+int main(void)
+{
+    lirc_loop_t* line;
+    rcx_handle_t* handle;
+
+    line = lirc_loop_create(BENCH_LINE);
+    if (line==NULL)
+    {
+        fprintf(stderr, "bench_motor: lirc_loop_create() failed\n");
+        return EXIT_FAILURE;
+    }
+    lirc_loop_responder(line, rcx_respond, NULL);
+
+    if (rcx_open_transport(&lirc_loop_transport, BENCH_LINE,
+                           RCX_TARGET_NOMINAL, &handle)!=RCX_OK)
+    {
+        fprintf(stderr, "bench_motor: rcx_open_transport() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    run_fifo(line, handle);
+    run_motor(line, handle);
+
+    rcx_close_dev(handle);
+    lirc_loop_destroy(line);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+/***************************************************************
+*                                                              *
+* bench_rcx.c                                                  *
+*                                                              *
+* Description:                                                 *
+* Helpers of the emulated RCX of the benchmarks, see           *
+* bench_rcx.h.                                                 *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <stdio.h>
+#include <time.h>
+
+#include "lirc.h"
+#include "rcxcode.h"
+#include "lirccode.h"
+#include "bench_rcx.h"
+
+#define BENCH_RCX_ITEMS       (BENCH_RCX_HEARD*LIRC_BYTE_ITEMS)
+
+
+/* Current time of the monotonic clock, in ns */
+long long bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+
+/* Decode a transmission into the bytes on the air. The line */
+/* gives durations only, starting with a pulse, and not the   */
+/* space after the last one.                                  */
+int bench_line_bytes(const lirc_t* list, int item_count, int bit_period,
+                     unsigned char* buf, int buf_size)
+{
+    int n;
+    int len;
+    lirc_t items[BENCH_RCX_ITEMS];
+    lirc_decoder_t decoder;
+
+    if (item_count>=BENCH_RCX_ITEMS)
+    {
+        return 0;
+    }
+    for (n=0; n<item_count; n++)
+    {
+        items[n] = (n%2==0) ? (list[n] | PULSE_BIT) : list[n];
+    }
+    items[n++] = bit_period*10U;
+
+    lirc_decoder_init(&decoder, bit_period);
+    len = lirc_decode(&decoder, items, n, buf, buf_size);
+    return (len<0) ? 0 : len;
+}
+
+
+/* Decode an RCX packet */
+int bench_rcx_hear(const lirc_t* list, int item_count, int bit_period,
+                   unsigned char* data, int data_size)
+{
+    int len;
+    unsigned char rcxbuf[BENCH_RCX_HEARD];
+
+    len = bench_line_bytes(list, item_count, bit_period,
+                           rcxbuf, sizeof(rcxbuf));
+    if (len==0)
+    {
+        return 0;
+    }
+    len = rcx_decode(rcxbuf, len, data, data_size);
+    return (len<0) ? 0 : len;
+}
+
+
+/* Encode a reply packet of the RCX */
+int bench_rcx_reply(lirc_profile_t* profile, unsigned char* data, int len,
+                    lirc_t* reply, int reply_max)
+{
+    unsigned char rcxbuf[BENCH_RCX_HEARD];
+
+    len = rcx_encode(data, len, rcxbuf, sizeof(rcxbuf));
+    if (len<0)
+    {
+        return 0;
+    }
+    len = lirc_encode(profile, rcxbuf, len, reply, reply_max);
+    return (len<0) ? 0 : len;
+}
@@ -0,0 +1,45 @@
+/***************************************************************
+*                                                              *
+* bench_rcx.h                                                  *
+*                                                              *
+* Description:                                                 *
+* Helpers of the benchmarks that emulate an RCX on the         *
+* in-memory loopback transport (lircloop.h): a responder       *
+* decodes what it hears, and encodes its reply, with these.    *
+* The responder itself is up to each benchmark.                *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#ifndef _BENCH_RCX_H
+#define _BENCH_RCX_H
+
+/* Most bytes on the air of a transmission that is heard */
+#define BENCH_RCX_HEARD       1024
+
+/* Current time of the monotonic clock, in ns */
+long long bench_now_ns(void);
+
+/* Decode a transmission at a bit period into the bytes on the */
+/* air, the way the driver reports it. The list is as a        */
+/* responder gets it. Returns the number of bytes, or 0.       */
+int bench_line_bytes(const lirc_t* list, int item_count, int bit_period,
+                     unsigned char* buf, int buf_size);
+
+/* Decode an RCX packet at a bit period. Returns the number of */
+/* data bytes, or 0.                                            */
+int bench_rcx_hear(const lirc_t* list, int item_count, int bit_period,
+                   unsigned char* data, int data_size);
+
+/* Encode a reply packet of the RCX with a timing profile, as   */
+/* the reply of a responder. Returns the number of items, or 0. */
+int bench_rcx_reply(lirc_profile_t* profile, unsigned char* data, int len,
+                    lirc_t* reply, int reply_max);
+
+#else
+#error -- bench_rcx.h -- included twice, or more...
+#endif /* _BENCH_RCX_H */
@@ -0,0 +1,222 @@
+/***************************************************************
+*                                                              *
+* bench_receive.c                                              *
+*                                                              *
+* Description:                                                 *
+* Measures the receive path of librcx. A RCX reply is fed to   *
+* the emulated LIRC device through a pipe, and read back once  *
+* with the old loop, which did a select() and a read() for     *
+* every single item, and once with rcx_receive(), which        *
+* drains all available items per wakeup. Path 'uring' runs    *
+* rcx_receive() on a device opened with RCX_OPEN_URING.        *
+*                                                              *
+* The reply is delivered in two ways: 'burst' writes all       *
+* items at once, like a driver buffer filled while the process *
+* was not scheduled. 'byte' writes the items of one byte at a  *
+* time, at the pace of the IR link.                            *
+*                                                              *
+* The LIRC device is emulated, see bench_dev.h. The select(),  *
+* read() and syscall() calls are wrapped as well, to count     *
+* them.                                                        *
+*                                                              *
+* Output is one line per measurement, as key=value pairs.      *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/syscall.h>
+
+#include "lirc.h"
+#include "rcx.h"
+#include "bench_dev.h"
+
+#define BENCH_RUNS            3
+#define BENCH_ITEMS           1024
+
+/* Time to wait before data arrives, as in lircfile.c */
+#define REPLY_TIME            350
+
+/* Wrapped system calls, see -Wl,--wrap in the Makefile */
+int __real_select(int nfds, fd_set* readfds, fd_set* writefds,
+                  fd_set* exceptfds, struct timeval* timeout);
+ssize_t __real_read(int fd, void* buf, size_t count);
+long __real_syscall(long number, ...);
+
+/* Counters, updated by the wrappers */
+static long select_calls = 0;
+static long read_calls = 0;
+static long enter_calls = 0;
+
+int __wrap_select(int nfds, fd_set* readfds, fd_set* writefds,
+                  fd_set* exceptfds, struct timeval* timeout)
+{
+    select_calls++;
+    return __real_select(nfds, readfds, writefds, exceptfds, timeout);
+}
+
+
+ssize_t __wrap_read(int fd, void* buf, size_t count)
+{
+    read_calls++;
+    return __real_read(fd, buf, count);
+}
+
+
+/* io_uring is used through syscall(), which takes at most */
+/* six arguments                                           */
+long __wrap_syscall(long number, ...)
+{
+    int n;
+    long arg[6];
+    va_list ap;
+
+    va_start(ap, number);
+    for (n=0; n<6; n++)
+    {
+        arg[n] = va_arg(ap, long);
+    }
+    va_end(ap);
+
+    if (number==__NR_io_uring_enter)
+    {
+        enter_calls++;
+    }
+    return __real_syscall(number, arg[0], arg[1], arg[2], arg[3], arg[4],
+                          arg[5]);
+}
+
+
+/* Old receive loop: a select() and a read() for each item */
+static int receive_per_item(int fd, lirc_t* list, int items_max)
+{
+    int result;
+    int item_count = 0;
+    struct timeval tv;
+    fd_set fds;
+
+    while (item_count<items_max)
+    {
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+
+        tv.tv_sec = 0;
+        tv.tv_usec = REPLY_TIME*1000;
+
+        if (select(FD_SETSIZE, &fds, NULL, NULL, &tv) == -1)
+        {
+            return -1;
+        }
+        if (!FD_ISSET(fd, &fds))
+        {
+            break;
+        }
+
+        result = read(fd, &list[item_count++], sizeof(lirc_t));
+        if (result != sizeof(lirc_t))
+        {
+            return -1;
+        }
+    }
+    return item_count;
+}
+
+
+static int receive_old(int fd)
+{
+    lirc_t list[BENCH_ITEMS];
+
+    return receive_per_item(fd, list, BENCH_ITEMS);
+}
+
+
+static int receive_new(int fd)
+{
+    int len;
+    unsigned char buf[64];
+
+    return rcx_receive(buf, sizeof(buf), &len)==RCX_OK ? len : -1;
+}
+
+
+static void run(const char* mode, const char* path, int fd,
+                int (*receive)(int))
+{
+    int n;
+    long start;
+    long wall;
+    unsigned char reply[] = { 0xcf, 0x2c, 0x24 };
+
+    select_calls = 0;
+    read_calls = 0;
+    enter_calls = 0;
+
+    start = bench_now_us();
+    for (n=0; n<BENCH_RUNS; n++)
+    {
+        bench_reply_start(reply, sizeof(reply), strcmp(mode, "byte")==0);
+        if (receive(fd)<0)
+        {
+            fprintf(stderr, "bench_receive: receive failed\n");
+            exit(EXIT_FAILURE);
+        }
+        bench_reply_join();
+    }
+    wall = bench_now_us() - start;
+
+    printf("bench=receive mode=%s path=%s bytes=%d items=%d"
+           " selects=%ld reads=%ld enters=%ld syscalls=%ld wall_us=%ld\n",
+           mode, path, bench_reply_bytes, bench_reply_items,
+           select_calls/BENCH_RUNS, read_calls/BENCH_RUNS,
+           enter_calls/BENCH_RUNS,
+           (select_calls+read_calls+enter_calls)/BENCH_RUNS,
+           wall/BENCH_RUNS);
+}
+
+
+int main(void)
+{
+    int fd;
+
+    if (bench_reply_open()!=0)
+    {
+        perror("bench_receive: pipe");
+        return EXIT_FAILURE;
+    }
+    if (rcx_open()!=RCX_OK)
+    {
+        fprintf(stderr, "bench_receive: rcx_open() failed\n");
+        return EXIT_FAILURE;
+    }
+    fd = open(BENCH_DEVICE, O_RDONLY);
+
+    run("burst", "per-item", fd, receive_old);
+    run("burst", "drain", fd, receive_new);
+    run("byte", "per-item", fd, receive_old);
+    run("byte", "drain", fd, receive_new);
+    rcx_close();
+
+    if (rcx_open_target(RCX_TARGET_DEFAULT|RCX_OPEN_URING)!=RCX_OK)
+    {
+        fprintf(stderr, "bench_receive: rcx_open_target() failed\n");
+        return EXIT_FAILURE;
+    }
+    run("burst", "uring", fd, receive_new);
+    run("byte", "uring", fd, receive_new);
+    rcx_close();
+
+    close(fd);
+
+    return EXIT_SUCCESS;
+}
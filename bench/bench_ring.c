@@ -0,0 +1,166 @@
+/***************************************************************
+*                                                              *
+* bench_ring.c                                                 *
+*                                                              *
+* Description:                                                 *
+* Measures the cost of reading received bytes. A RCX reply is  *
+* delivered at the pace of the IR link, and read once with     *
+* rcx_receive_byte() on a device without receiver thread, the  *
+* way the Java read() used to work, and once by polling        *
+* rcx_receive_bytes() on a device opened with                  *
+* RCX_OPEN_RECEIVER.                                           *
+*                                                              *
+* Then the ring is overrun: many packets are delivered while   *
+* nobody reads, and the statistics of the receiver thread show *
+* what has been dropped.                                       *
+*                                                              *
+* The LIRC device is emulated, see bench_dev.h.                *
+*                                                              *
+* Output is one line per measurement, as key=value pairs.      *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "lirc.h"
+#include "rcx.h"
+#include "rcxring.h"
+#include "lirccode.h"
+#include "bench_dev.h"
+#include "bench_rcx.h"
+
+#define BENCH_RUNS            3
+#define BENCH_OVERRUN         10
+#define BENCH_OVERRUN_BYTES   250
+
+static unsigned char reply[] = { 0xcf, 0x2c, 0x24 };
+
+
+/* Old read path: one rcx_receive_byte() per byte */
+static int read_byte(unsigned char* buf, int size)
+{
+    return (rcx_receive_byte(buf)==RCX_OK) ? 1 : 0;
+}
+
+
+/* New read path: whatever the receiver thread has decoded */
+static int read_ring(unsigned char* buf, int size)
+{
+    int result;
+
+    result = rcx_receive_bytes(buf, size);
+    return (result>0) ? result : 0;
+}
+
+
+static void run(const char* path, int (*read_bytes)(unsigned char*, int))
+{
+    int n;
+    int len;
+    int bytes;
+    long calls = 0;
+    long long start;
+    long long call;
+    long long call_max = 0;
+    long long call_total = 0;
+    unsigned char buf[64];
+
+    for (n=0; n<BENCH_RUNS; n++)
+    {
+        bench_reply_start(reply, sizeof(reply), 1);
+        for (bytes=0; bytes<bench_reply_bytes; bytes+=len)
+        {
+            start = bench_now_ns();
+            len = read_bytes(buf, sizeof(buf));
+            call = bench_now_ns() - start;
+
+            calls++;
+            call_total += call;
+            if (call>call_max)
+            {
+                call_max = call;
+            }
+        }
+        bench_reply_join();
+    }
+
+    printf("bench=ring path=%s bytes=%d calls=%ld call_ns=%lld"
+           " call_max_ns=%lld\n",
+           path, bench_reply_bytes, calls/BENCH_RUNS,
+           call_total/calls, call_max);
+}
+
+
+static void overrun(void)
+{
+    int n;
+    int len;
+    int total = 0;
+    unsigned char data[BENCH_OVERRUN_BYTES];
+    unsigned char buf[RCX_RING_SIZE];
+    rcx_receiver_stats_t stats;
+    struct timespec ts;
+
+    for (n=0; n<BENCH_OVERRUN_BYTES; n++)
+    {
+        data[n] = (unsigned char) n;
+    }
+
+    /* Nobody reads while the packets arrive */
+    for (n=0; n<BENCH_OVERRUN; n++)
+    {
+        bench_reply_start(data, sizeof(data), 0);
+        bench_reply_join();
+        total += bench_reply_bytes;
+    }
+
+    /* Let the thread complete the last character */
+    ts.tv_sec = 0;
+    ts.tv_nsec = 100000000L;
+    nanosleep(&ts, NULL);
+    rcx_receiver_stats(&stats);
+
+    len = rcx_receive_bytes(buf, sizeof(buf));
+
+    printf("bench=ring path=overrun bytes=%d ring=%d read=%d"
+           " received=%lu dropped=%lu overflows=%lu errors=%lu"
+           " fill_max=%d\n",
+           total, RCX_RING_SIZE, len, stats.bytes, stats.dropped,
+           stats.overflows, stats.errors, stats.fill_max);
+}
+
+
+int main(void)
+{
+    if (bench_reply_open()!=0)
+    {
+        perror("bench_ring: pipe");
+        return EXIT_FAILURE;
+    }
+
+    if (rcx_open()!=RCX_OK)
+    {
+        fprintf(stderr, "bench_ring: rcx_open() failed\n");
+        return EXIT_FAILURE;
+    }
+    run("receive-byte", read_byte);
+    rcx_close();
+
+    if (rcx_open_target(RCX_TARGET_DEFAULT|RCX_OPEN_RECEIVER)!=RCX_OK)
+    {
+        fprintf(stderr, "bench_ring: rcx_open_target() failed\n");
+        return EXIT_FAILURE;
+    }
+    run("receive-bytes", read_ring);
+    overrun();
+    rcx_close();
+
+    return EXIT_SUCCESS;
+}
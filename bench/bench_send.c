@@ -0,0 +1,163 @@
+/***************************************************************
+*                                                              *
+* bench_send.c                                                 *
+*                                                              *
+* Description:                                                 *
+* Measures the transmit path of librcx. A RCX packet is sent   *
+* once byte by byte with rcx_send_byte(), the way rcx_send()   *
+* used to work, and once with rcx_send(), which writes the     *
+* whole packet in one go.                                      *
+*                                                              *
+* The LIRC device is emulated, see bench_dev.h. The write()    *
+* calls are wrapped as well, to count them, and to sleep for   *
+* the duration of the pulses and spaces written, like the      *
+* lirc_sir driver does while it transmits.                     *
+*                                                              *
+* Output is one line per measurement, as key=value pairs.      *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lirc.h"
+#include "rcx.h"
+#include "rcxcode.h"
+#include "bench_dev.h"
+
+#define BENCH_BIT_PERIOD      417
+#define BENCH_RUNS            20
+
+/* Wrapped system call, see -Wl,--wrap in the Makefile */
+ssize_t __real_write(int fd, const void* buf, size_t count);
+
+/* Counters, updated by the write() wrapper */
+static long write_calls = 0;
+static long write_items = 0;
+static long write_airtime = 0;
+
+struct bench_packet
+{
+    const char*   name;
+    int           len;
+    unsigned char data[4];
+};
+
+static struct bench_packet packets[] =
+{
+    { "ping",    1, { 0x10 } },
+    { "battery", 1, { 0x30 } },
+    { "motor",   2, { 0x21, 0x81 } },
+    { "sound",   2, { 0x51, 0x03 } },
+};
+
+
+/* Count the write, and block for as long as the items last */
+ssize_t __wrap_write(int fd, const void* buf, size_t count)
+{
+    size_t n;
+    long airtime = 0;
+    const lirc_t* list = buf;
+    struct timespec ts;
+
+    if (!bench_is_device(fd))
+    {
+        return __real_write(fd, buf, count);
+    }
+
+    for (n=0; n<count/sizeof(lirc_t); n++)
+    {
+        airtime += list[n]&PULSE_MASK;
+    }
+
+    write_calls++;
+    write_items += count/sizeof(lirc_t);
+    write_airtime += airtime;
+
+    ts.tv_sec = airtime / 1000000;
+    ts.tv_nsec = (airtime % 1000000) * 1000;
+    nanosleep(&ts, NULL);
+
+    return count;
+}
+
+
+/* Old transmit path: one rcx_send_byte() per packet byte */
+static int send_per_byte(unsigned char* buf, int len)
+{
+    int n;
+    int rcxlen;
+    int result = RCX_OK;
+    unsigned char rcxbuf[64];
+
+    rcxlen = rcx_encode(buf, len, rcxbuf, sizeof(rcxbuf));
+    for (n=0; (n<rcxlen) && (result==RCX_OK); n++)
+    {
+        result = rcx_send_byte(rcxbuf[n]);
+    }
+    return result;
+}
+
+
+static void run(struct bench_packet* p, const char* path,
+                int (*send)(unsigned char*, int))
+{
+    int n;
+    long start;
+    long wall;
+    unsigned char rcxbuf[64];
+    int rcxlen;
+
+    rcxlen = rcx_encode(p->data, p->len, rcxbuf, sizeof(rcxbuf));
+
+    write_calls = 0;
+    write_items = 0;
+    write_airtime = 0;
+
+    start = bench_now_us();
+    for (n=0; n<BENCH_RUNS; n++)
+    {
+        if (send(p->data, p->len)!=RCX_OK)
+        {
+            fprintf(stderr, "bench_send: send failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    wall = bench_now_us() - start;
+
+    printf("bench=send packet=%s path=%s bytes=%d writes=%ld"
+           " items=%ld nominal_us=%d airtime_us=%ld wall_us=%ld\n",
+           p->name, path, rcxlen,
+           write_calls/BENCH_RUNS, write_items/BENCH_RUNS,
+           rcxlen*11*BENCH_BIT_PERIOD,
+           write_airtime/BENCH_RUNS, wall/BENCH_RUNS);
+}
+
+
+int main(void)
+{
+    unsigned int n;
+
+    if (rcx_open()!=RCX_OK)
+    {
+        fprintf(stderr, "bench_send: rcx_open() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    for (n=0; n<sizeof(packets)/sizeof(packets[0]); n++)
+    {
+        run(&packets[n], "per-byte", send_per_byte);
+        run(&packets[n], "packet", rcx_send);
+    }
+
+    rcx_close();
+
+    return EXIT_SUCCESS;
+}
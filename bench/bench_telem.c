@@ -0,0 +1,363 @@
+/***************************************************************
+*                                                              *
+* bench_telem.c                                                *
+*                                                              *
+* Description:                                                 *
+* Runs the telemetry cache (rcxtelem.h) over the in-memory     *
+* loopback transport (lircloop.h) against an emulated RCX. It  *
+* answers 'Get value' and 'Get battery power' with values that *
+* follow the virtual clock: sensor 1 changes every             *
+* BENCH_FAST ms, sensor 2 every BENCH_SLOW ms, variable 0 and  *
+* the battery not at all.                                      *
+*                                                              *
+* BENCH_CLIENTS clients each ask for the four values, then     *
+* wait BENCH_PERIOD ms, BENCH_ROUNDS times. Path 'direct'      *
+* sends a command for each query, 'cached' asks the cache.     *
+* airtime_ms is the time the queries kept the IR link busy;    *
+* stale= counts the values that were no longer true when       *
+* taken. Then the time to live of each value is shown: short   *
+* for the fast sensor, long for the others.                    *
+*                                                              *
+* In 'merged', BENCH_THREADS threads ask for the same value at *
+* the same time, while the RCX takes BENCH_DELAY us (for real) *
+* to answer: one polls, the others wait for its reply.         *
+*                                                              *
+* Output is one line per measurement, as key=value pairs.      *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "lirc.h"
+#include "rcx.h"
+#include "rcxcode.h"
+#include "rcxtelem.h"
+#include "lirccode.h"
+#include "lircfile.h"
+#include "lirctransport.h"
+#include "lircloop.h"
+#include "bench_rcx.h"
+
+#define BENCH_CLIENTS         4
+#define BENCH_ROUNDS          200
+#define BENCH_PERIOD          100   /* ms between the queries     */
+#define BENCH_FAST            20    /* ms a fast sensor holds     */
+#define BENCH_SLOW            5000  /* ms a slow sensor holds     */
+#define BENCH_VARIABLE        42
+#define BENCH_BATTERY         7800  /* mV                         */
+#define BENCH_THREADS         8
+#define BENCH_MERGES          20
+#define BENCH_DELAY           2000  /* us the RCX takes to answer */
+#define BENCH_BUFFER          256
+#define BENCH_LINE            "rcx"
+
+/* The values a client asks for */
+static const int bench_source[] =
+{
+    RCX_TELEM_SENSOR, RCX_TELEM_SENSOR, RCX_TELEM_VARIABLE, RCX_TELEM_BATTERY
+};
+static const int bench_argument[] = { 0, 1, 0, 0 };
+static const char* bench_name[] = { "fast", "slow", "variable", "battery" };
+#define BENCH_VALUES          4
+
+/* Opcode the emulated RCX ran last, and whether it is slow */
+static int rcx_last = -1;
+static int rcx_delay = 0;
+
+/* Virtual time of the query; the line cannot be asked while it */
+/* calls the RCX                                                 */
+static long rcx_now = 0;
+
+/* The threads of 'merged' start together */
+static pthread_barrier_t merge_start;
+static rcx_telem_t* merge_telem;
+
+
+/* The value of a source at a time of the virtual clock */
+static int rcx_value(int source, int argument, long now)
+{
+    if (source==RCX_TELEM_BATTERY)
+    {
+        return BENCH_BATTERY;
+    }
+    if (source==RCX_TELEM_SENSOR)
+    {
+        return (int) ((now/1000)/((argument==0) ? BENCH_FAST : BENCH_SLOW))
+               % 1024;
+    }
+    return BENCH_VARIABLE;
+}
+
+
+/* The emulated RCX */
+static int rcx_respond(void* user, const lirc_t* list, int item_count,
+                       lirc_t* reply, int reply_max)
+{
+    int len;
+    int value;
+    unsigned char data[BENCH_BUFFER];
+
+    len = bench_rcx_hear(list, item_count, LIRC_BIT_PERIOD_2400,
+                         data, sizeof(data));
+    if ((len==0) || (data[0]==rcx_last))
+    {
+        return 0;
+    }
+
+    switch (data[0] & ~RCX_TOGGLE)
+    {
+    case 0x12: /* Get value */
+        if (len!=3)
+        {
+            return 0;
+        }
+        value = rcx_value(data[1], data[2], rcx_now);
+        break;
+
+    case 0x30: /* Get battery power */
+        value = rcx_value(RCX_TELEM_BATTERY, 0, rcx_now);
+        break;
+
+    default:
+        return 0;
+    }
+    rcx_last = data[0];
+
+    data[0] = (unsigned char) ~data[0];
+    data[1] = (unsigned char) (value & 0xff);
+    data[2] = (unsigned char) (value >> 8);
+
+    if (rcx_delay)
+    {
+        usleep(BENCH_DELAY);
+    }
+
+    return bench_rcx_reply(lirc_profile(LIRC_PROFILE_NOMINAL), data, 3,
+                           reply, reply_max);
+}
+
+
+/* A query without the cache */
+static int direct_get(rcx_handle_t* handle, int source, int argument,
+                      int* value)
+{
+    int len;
+    int result;
+    unsigned char buf[BENCH_BUFFER];
+
+    if (source==RCX_TELEM_BATTERY)
+    {
+        buf[0] = 0x30;
+        len = 1;
+    }
+    else
+    {
+        buf[0] = 0x12;
+        buf[1] = (unsigned char) source;
+        buf[2] = (unsigned char) argument;
+        len = 3;
+    }
+
+    result = rcx_command_dev(handle, buf, sizeof(buf), &len);
+    if ((result==RCX_OK) && (len<3))
+    {
+        result = RCX_E_RECV_ERROR;
+    }
+    *value = (short) (buf[1] | (buf[2]<<8));
+    return result;
+}
+
+
+/* The clients ask for their values, with the cache if given */
+static void run(rcx_handle_t* handle, rcx_telem_t* telem, const char* path)
+{
+    int n;
+    int k;
+    int round;
+    int len;
+    int value;
+    int result;
+    int queries = 0;
+    int failed = 0;
+    int stale = 0;
+    long start;
+    long airtime = 0;
+    long long wall_start;
+    unsigned char buf[BENCH_BUFFER];
+    rcx_stats_t before;
+    rcx_stats_t after;
+
+    rcx_get_stats_dev(handle, &before);
+    wall_start = bench_now_ns();
+    for (round=0; round<BENCH_ROUNDS; round++)
+    {
+        for (n=0; n<BENCH_CLIENTS; n++)
+        {
+            for (k=0; k<BENCH_VALUES; k++)
+            {
+                start = rcx_get_time_dev(handle);
+                rcx_now = start;
+                if (telem!=NULL)
+                {
+                    result = rcx_telem_get(telem, bench_source[k],
+                                           bench_argument[k], &value);
+                }
+                else
+                {
+                    result = direct_get(handle, bench_source[k],
+                                        bench_argument[k], &value);
+                }
+                airtime += rcx_get_time_dev(handle)-start;
+                queries++;
+
+                if (result!=RCX_OK)
+                {
+                    failed++;
+                }
+                else if (value!=rcx_value(bench_source[k], bench_argument[k],
+                                          start))
+                {
+                    stale++;
+                }
+            }
+        }
+
+        /* The line is silent: this only passes virtual time */
+        rcx_receive_wait_dev(handle, buf, sizeof(buf), &len, BENCH_PERIOD);
+    }
+    rcx_get_stats_dev(handle, &after);
+
+    printf("bench=telem path=%s queries=%d failed=%d commands=%lu"
+           " stale=%d airtime_ms=%ld wall_ns=%lld\n",
+           path, queries, failed, after.packets_sent-before.packets_sent,
+           stale, airtime/1000, (bench_now_ns() - wall_start)/queries);
+}
+
+
+/* Shows the time to live of the values, and the counters */
+static void show_cache(rcx_telem_t* telem)
+{
+    int k;
+    rcx_telem_stats_t stats;
+
+    printf("bench=telem path=ttl");
+    for (k=0; k<BENCH_VALUES; k++)
+    {
+        printf(" %s_ms=%d", bench_name[k],
+               rcx_telem_ttl(telem, bench_source[k], bench_argument[k]));
+    }
+    printf("\n");
+
+    rcx_telem_get_stats(telem, &stats);
+    printf("bench=telem path=stats hits=%lu polls=%lu merged=%lu"
+           " changes=%lu errors=%lu evictions=%lu\n",
+           stats.hits, stats.polls, stats.merged, stats.changes,
+           stats.errors, stats.evictions);
+}
+
+
+/* A thread of 'merged' */
+static void* merge_client(void* arg)
+{
+    int value;
+
+    pthread_barrier_wait(&merge_start);
+    if (rcx_telem_get(merge_telem, RCX_TELEM_SENSOR, 2, &value)!=RCX_OK)
+    {
+        __atomic_add_fetch((int*) arg, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+
+/* Threads ask for a value the cache does not have, together */
+static void run_merged(rcx_handle_t* handle)
+{
+    int n;
+    int k;
+    int failed = 0;
+    long long start;
+    pthread_t threads[BENCH_THREADS];
+    rcx_telem_stats_t stats;
+
+    if (rcx_telem_create(handle, &merge_telem)!=RCX_OK)
+    {
+        printf("bench=telem path=merged failed=%d\n", BENCH_MERGES);
+        return;
+    }
+    pthread_barrier_init(&merge_start, NULL, BENCH_THREADS);
+
+    rcx_delay = 1;
+    start = bench_now_ns();
+    for (n=0; n<BENCH_MERGES; n++)
+    {
+        rcx_telem_flush(merge_telem);
+        for (k=0; k<BENCH_THREADS; k++)
+        {
+            pthread_create(&threads[k], NULL, merge_client, &failed);
+        }
+        for (k=0; k<BENCH_THREADS; k++)
+        {
+            pthread_join(threads[k], NULL);
+        }
+    }
+    rcx_delay = 0;
+
+    rcx_telem_get_stats(merge_telem, &stats);
+    printf("bench=telem path=merged queries=%d failed=%d polls=%lu"
+           " merged=%lu wall_us=%lld\n",
+           BENCH_MERGES*BENCH_THREADS, failed, stats.polls, stats.merged,
+           (bench_now_ns() - start)/1000/BENCH_MERGES);
+
+    pthread_barrier_destroy(&merge_start);
+    rcx_telem_destroy(merge_telem);
+}
+
+
+int main(void)
+{
+    lirc_loop_t* line;
+    rcx_handle_t* handle;
+    rcx_telem_t* telem;
+
+    line = lirc_loop_create(BENCH_LINE);
+    if (line==NULL)
+    {
+        fprintf(stderr, "bench_telem: lirc_loop_create() failed\n");
+        return EXIT_FAILURE;
+    }
+    lirc_loop_responder(line, rcx_respond, NULL);
+
+    if (rcx_open_transport(&lirc_loop_transport, BENCH_LINE,
+                           RCX_TARGET_NOMINAL, &handle)!=RCX_OK)
+    {
+        fprintf(stderr, "bench_telem: rcx_open_transport() failed\n");
+        return EXIT_FAILURE;
+    }
+
+    run(handle, NULL, "direct");
+
+    if (rcx_telem_create(handle, &telem)!=RCX_OK)
+    {
+        fprintf(stderr, "bench_telem: rcx_telem_create() failed\n");
+        return EXIT_FAILURE;
+    }
+    run(handle, telem, "cached");
+    show_cache(telem);
+    rcx_telem_destroy(telem);
+
+    run_merged(handle);
+
+    rcx_close_dev(handle);
+    lirc_loop_destroy(line);
+    return EXIT_SUCCESS;
+}
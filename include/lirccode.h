@@ -6,8 +6,8 @@
 * Converts between byte arrays and LIRC driver codes.          *
 *                                                              *
 * Flags:                                                       *
-* LIRC_TARGET_PC    Set timing values for laptop               *
-* LIRC_TARGET_IPAQ  Set timing values for iPAQ                 *
+* LIRC_TARGET_PC    Default to the timing values for laptop    *
+* LIRC_TARGET_IPAQ  Default to the timing values for iPAQ      *
 * APP_PRINT_DEBUG   Show debug data amd errors                 *
 * APP_PRINT_ERROR   Show errors                                *
 *                                                              *
@@ -39,18 +39,111 @@
 #define LIRC_OK                (   0)
 #define LIRC_E_BUF_SIZE        (-100)
 #define LIRC_E_NO_RS232        (-101)
+#define LIRC_E_BAD_TIMING      (-102)
+
+/* Bit periods of the link rates, in us. A profile is made  */
+/* for one of them, see lirc_profile_init().                */
+#define LIRC_BIT_PERIOD_2400   ( 417)
+#define LIRC_BIT_PERIOD_4800   ( 208)
+
+/* Worst case number of lirc_t items needed to encode one   */
+/* byte, including the terminating item. Size lists for     */
+/* lirc_encode() as a multiple of this value.               */
+#define LIRC_BYTE_ITEMS        12
+
+/* Built-in timing profiles, all at 2400 baud, see         */
+/* lirc_profile()                                           */
+#define LIRC_PROFILE_DEFAULT   (  -1)  /* Set by LIRC_TARGET_xxx */
+#define LIRC_PROFILE_NOMINAL   (   0)  /* Exact bit periods      */
+#define LIRC_PROFILE_PC        (   1)  /* Laptop, lirc_sir       */
+#define LIRC_PROFILE_IPAQ      (   2)  /* iPAQ                   */
+#define LIRC_PROFILES          (   3)
+
+/* Kind of the last decode error, see lirc_decoder_t        */
+#define LIRC_ERROR_NONE        (   0)
+#define LIRC_ERROR_PARITY      (   1)  /* Even number of marks   */
+#define LIRC_ERROR_FRAMING     (   2)  /* No stop bit            */
+#define LIRC_ERROR_BREAK       (   3)  /* Over 10 spaces in a row*/
+
+
+/**************************************************************/
+/************************* Types ******************************/
+/**************************************************************/
+
+/* Timing profile, with the precomputed 'mark' and 'space'   */
+/* items of all 256 byte values. Encoding a byte is a copy   */
+/* of its table row.                                         */
+typedef struct lirc_profile
+{
+    int           bit_period;    /* Duration of one bit, in us */
+    int           mark_adjust;   /* Fine tuning of mark runs   */
+    int           space_adjust;  /* Fine tuning of space runs  */
+    unsigned char count[256];    /* Number of items per byte   */
+    lirc_t        items[256][LIRC_BYTE_ITEMS];
+} lirc_profile_t;
+
+/* State of a 8O1 decoder. Owned by the caller, so several   */
+/* streams can be decoded at the same time.                  */
+typedef struct lirc_decoder
+{
+    int           bit_period;    /* Duration of one bit, in us */
+    int           bit_scale;     /* Fixed point 1/bit_period   */
+    int           total_bits;    /* Bits of current character  */
+    int           parity_bit;    /* Number of marks received   */
+    unsigned char data_byte;     /* Data bits received so far  */
+    int           error;         /* LIRC_ERROR_xxx, last error */
+} lirc_decoder_t;
 
 /**************************************************************/
 /*********************** Prototypes ***************************/
 /**************************************************************/
 
 
+/*************************************************************
+* lirc_profile returns one of the built-in timing profiles.  *
+* The waveform tables of all built-in profiles are computed  *
+* the first time this function is called.                    *
+*                                                            *
+* Input:  id        LIRC_PROFILE_xxx number of the profile   *
+*                                                            *
+* Return: !NULL     Pointer to the profile                   *
+*         NULL      Unknown profile                          *
+*                                                            *
+*************************************************************/
+lirc_profile_t* lirc_profile(int id);
+
+
+
+
+/*************************************************************
+* lirc_profile_init computes the waveform table of a timing  *
+* profile. For each of the 256 byte values the table holds   *
+* the 'mark' and 'space' items of the 8O1 character.        *
+*                                                            *
+* Input:  bit_period    Duration of a single bit, in us      *
+*         mark_adjust   Added to the first bit of a mark run *
+*         space_adjust  Added to the first bit of a space run*
+*                                                            *
+* Output: profile   The profile to initialize                *
+*                                                            *
+* Return: LIRC_OK            Profile initialized             *
+*         LIRC_E_BAD_TIMING  Timing values out of range      *
+*                                                            *
+*************************************************************/
+int lirc_profile_init(lirc_profile_t* profile, int bit_period,
+                      int mark_adjust, int space_adjust);
+
+
+
+
 /*************************************************************
 * lirc_encode generates a pattern of 'mark' and 'space'      *
 * signals from a byte array. The pattern simulates a         *
-* 2400baud 8O1 modem signal.                                 *
+* 2400baud 8O1 modem signal. The items of each byte are      *
+* copied from the waveform table of the profile.             *
 *                                                            *
-* Input:  buf       The characters to convert                *
+* Input:  profile   Timing profile to encode with            *
+*         buf       The characters to convert                *
 *         buf_len   Number of characters in buffer           *
 *         data_size Maximum number of lirc_t elements that   *
 *                   the 'data' array can store               *
@@ -62,8 +155,25 @@
           LIRC_E_BUF_SIZE   data elements exceeds data_size  *
 *                                                            *
 *************************************************************/
-int lirc_encode(unsigned char* buf, int buf_len, lirc_t* data,
-                int data_size);
+int lirc_encode(lirc_profile_t* profile, unsigned char* buf,
+                int buf_len, lirc_t* data, int data_size);
+
+
+
+
+/*************************************************************
+* lirc_decoder_init prepares a decoder for a new stream of   *
+* 'mark' and 'space' items. The decoder holds all state of   *
+* the decoding, so each stream needs its own decoder.        *
+*                                                            *
+* Input:  bit_period  Duration of a single bit, in us        *
+*                                                            *
+* Output: decoder     The decoder to initialize              *
+*                                                            *
+* Return: none                                               *
+*                                                            *
+*************************************************************/
+void lirc_decoder_init(lirc_decoder_t* decoder, int bit_period);
 
 
 
@@ -75,7 +185,9 @@ int lirc_encode(unsigned char* buf, int buf_len, lirc_t* data,
 *                                                            *
 * Input:  data      List of composed datatypes with a 'space'*
 *                   or 'mark' signal, plus the length of it. *
-*         buf_len   Size of the buf character array          *
+*         items     Number of items in 'data' array          *
+*         buf_size  Size of the buf character array          *
+* In/Out: decoder   Decoder state, see lirc_decoder_init()   *
 * Output: buf       Array of decoded characters              *
 *                   character to write the next char in.     *
 *                                                            *
@@ -85,8 +197,31 @@ int lirc_encode(unsigned char* buf, int buf_len, lirc_t* data,
 *         LIRC_E_BUF_SIZE Number of chars exceed buf_size    *
 *                                                            *
 *************************************************************/
-int lirc_decode(lirc_t* data, int items, unsigned char* buf,
-                int buf_size);
+int lirc_decode(lirc_decoder_t* decoder, lirc_t* data, int items,
+                unsigned char* buf, int buf_size);
+
+
+
+
+/*************************************************************
+* lirc_byte_decode parses a single 'space' or 'mark' time,   *
+* and regenerates an 2400baud 8odd1 modem signal. A run of   *
+* equal bits is consumed in one step.                        *
+*                                                            *
+* Input:  data      Composed datatype with a 'space' or      *
+*                   'mark' signal, plus the length of it.    *
+* In/Out: decoder   Decoder state, see lirc_decoder_init()   *
+* Output: pbuf      Pointer to receive character in          *
+*                                                            *
+* Return: 1         Success, and a character received        *
+*         0         Success, but no character received yet   *
+*         -1        Decoded signal does not comply with      *
+*                   an 2400 8O1 signal. decoder->error tells *
+*                   what was wrong.                          *
+*                                                            *
+*************************************************************/
+int lirc_byte_decode(lirc_decoder_t* decoder, lirc_t data,
+                     unsigned char* pbuf);
 
 #else
 #error -- lirccode.h -- included twice, or more...
@@ -39,6 +39,33 @@
 #define LIRC_E_DEVICE_ERROR      (-105)
 #define LIRC_E_BUFFERSIZE        (-106)
 
+/* File descriptor value of a closed device */
+#define LIRC_NO_FD               (  -1)
+
+/* Time to wait before data arrives, in ms */
+#define LIRC_REPLY_TIME          ( 350)
+
+/* Options of lirc_open_flags() */
+#define LIRC_OPEN_URING          (0x01)  /* Use io_uring, if there */
+
+
+/**************************************************************/
+/************************* Types ******************************/
+/**************************************************************/
+
+/* An opened lirc device. Set 'fd' to LIRC_NO_FD before the   */
+/* device is opened with lirc_open().                         */
+typedef struct lirc_device
+{
+    int fd;                      /* File descriptor of device */
+    int uring;                   /* Slot in the io_uring + 1, */
+                                 /* or 0 if it is not used    */
+    void* data;                  /* State of other transports,*/
+                                 /* see lirctransport.h       */
+    int bit_period;              /* Of the link, in us. Set to*/
+                                 /* 2400 baud by lirc_open()  */
+} lirc_device_t;
+
 
 /**************************************************************/
 /*********************** Prototypes ***************************/
@@ -53,7 +80,9 @@
 *                                                            *
 * For detailed decription, see headerfile rcx.h              *
 *                                                            *
-* Global: lirc_driver        File descriptor to lirc device  *
+* Input:  path               Filename of the lirc device     *
+*                                                            *
+* In/Out: dev                The device, must be closed      *
 *                                                            *
 * Return:                                                    *
 *   LIRC_OK                  Device opened succesfully       *
@@ -62,7 +91,28 @@
 *   LIRC_E_DEVICE_READONLY   Device is read-only             *
 *   LIRC_E_DEVICE_NO_LIRC    Device is not a lirc_sir driver *
 *************************************************************/
-int lirc_open(void);
+int lirc_open(lirc_device_t* dev, const char* path);
+
+
+
+
+/*************************************************************
+* lirc_open_flags: Opens the LIRC device, like lirc_open(),  *
+* with options.                                              *
+*                                                            *
+* With LIRC_OPEN_URING, the device I/O goes through an       *
+* io_uring that all devices opened this way share, see       *
+* lircuring.h. If the kernel has no io_uring, or it is not   *
+* allowed, the device is used the normal way.                *
+*                                                            *
+* Input:  path               Filename of the lirc device     *
+*         flags              LIRC_OPEN_xxx options           *
+*                                                            *
+* In/Out: dev                The device, must be closed      *
+*                                                            *
+* Return: See lirc_open()                                    *
+*************************************************************/
+int lirc_open_flags(lirc_device_t* dev, const char* path, int flags);
 
 
 
@@ -70,12 +120,12 @@ int lirc_open(void);
 /*************************************************************
 * lirc_close: Closes the LIRC device.                        *
 *                                                            *
-* Global: lirc_driver    File descriptor to the lirc device  *
+* In/Out: dev            The device to close                 *
 *                                                            *
 * Return: errorcodes                                         *
 *     LIRC_OK            Device closed succesfully           *
 *************************************************************/
-int lirc_close(void);
+int lirc_close(lirc_device_t* dev);
 
 
 
@@ -84,9 +134,7 @@ int lirc_close(void);
 * lirc_reset resets the lirc device, and clears the receive  *
 * buffer.                                                    *
 *                                                            *
-* Globals: lirc_driver  File descriptor of the lirc device   *
-*                                                            *
-* Input:   none                                              *
+* Input:   dev          The lirc device                      *
 *                                                            *
 * Output:  none                                              *
 *                                                            *
@@ -95,18 +143,42 @@ int lirc_close(void);
 *   LIRC_E_DEVICE_NOT_OPEN   Device has not been opened      *
 *   LIRC_E_DEVICE_ERROR      Lirc device errors              *
 *************************************************************/
-int lirc_reset(void);
+int lirc_reset(lirc_device_t* dev);
+
 
 
 
+/*************************************************************
+* lirc_read waits until data is available from the lirc      *
+* device, and then reads all available items with a single   *
+* read.                                                      *
+*                                                            *
+* Input:   dev          The lirc device                      *
+*          items_max    Size of the list, in lirc_t items    *
+*          timeout      Maximum time to wait for data, in ms *
+*                                                            *
+* Output:  list         List with received lirc_t items      *
+*                                                            *
+* Return:                                                    *
+*   > 0                      Number of items read            *
+*   0                        Nothing received before timeout *
+*   LIRC_E_DEVICE_NOT_OPEN   Device has not been opened      *
+*   LIRC_E_DEVICE_ERROR      Lirc device errors              *
+*************************************************************/
+int lirc_read(lirc_device_t* dev, lirc_t* list, int items_max,
+              int timeout);
+
+
 
 /***************************************************************
 * lirc_receive reads data from the lirc device. It stops       *
-* reading if nothing is received for a certain period          *
+* reading if nothing is received for a certain period. Each    *
+* wakeup reads all items the driver has available at once.     *
+* A half received character is completed with mark bits of the *
+* bit period of the device.                                    *
 *                                                              *
-* Globals: lirc_driver  File descriptor of the lirc device     *
-*                                                              *
-* Input:   items_max    Size of the list, in lirct_t items     *
+* Input:   dev          The lirc device                        *
+*          items_max    Size of the list, in lirct_t items     *
 *                                                              *
 * Output:  list         List with received lirc_t items        *
 *                                                              *
@@ -116,16 +188,15 @@ int lirc_reset(void);
 *   LIRC_E_DEVICE_ERROR      Lirc device errors                *
 *   LIRC_E_BUFFERSIZE        Number of items exceed items_max  *
 ***************************************************************/
-int lirc_receive(lirc_t* list, int items_max);
+int lirc_receive(lirc_device_t* dev, lirc_t* list, int items_max);
 
 
 
 /***************************************************************
 * lirc_send sends a lirc_t list to the LIRC device driver.     *
 *                                                              *
-* Global: lirc_driver  The file descriptor of the LIRC driver  *
-*                                                              *
-* Input:  list         An array that contains lirc_t items     *
+* Input:  dev          The LIRC device                         *
+*         list         An array that contains lirc_t items     *
 *         item_count   Number of items to send                 *
 *                                                              *
 * Output: none                                                 *
@@ -135,7 +206,7 @@ int lirc_receive(lirc_t* list, int items_max);
 *   LIRC_E_DEVICE_NOT_OPEN   Device has not been opened        *
 *   LIRC_E_DEVICE_ERROR      Lirc device errors                *
 ***************************************************************/
-int lirc_send(lirc_t* list, int item_count);
+int lirc_send(lirc_device_t* dev, lirc_t* list, int item_count);
 
 
 #else
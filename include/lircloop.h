@@ -0,0 +1,157 @@
+/***************************************************************
+*                                                              *
+* lircloop.h                                                   *
+*                                                              *
+* Description:                                                 *
+* In-memory loopback transport, see lirctransport.h. Devices   *
+* opened on the same line hear each other, the way IR heads in *
+* one room do. Nothing waits for real: the line has a virtual  *
+* clock, which moves on by the airtime of what is sent, and by *
+* the timeout of a receive that finds nothing. A full command  *
+* with its reply takes microseconds of CPU time.               *
+*                                                              *
+* The other end of the line can be a responder function, e.g. *
+* an emulated RCX, that answers each transmission.             *
+*                                                              *
+* The items are delivered the way the lirc_sir driver does:   *
+* pulses with the PULSE_BIT set, each item when it ends, and   *
+* the space after the last pulse only when the next pulse      *
+* starts. A device does not hear its own transmissions, unless *
+* the line echoes, see lirc_loop_echo().                       *
+*                                                              *
+* The IR hardware of the host can be made inexact with          *
+* lirc_loop_skew(), to try out timing profiles.                *
+*                                                              *
+* The virtual clock is meant for a single thread. It is safe   *
+* to use from several, but every wait of every thread moves    *
+* it on, so a receiver thread is of no use on a line.          *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#ifndef _LIRCLOOP_H
+#define _LIRCLOOP_H
+
+/**************************************************************/
+/************************ Defines  ****************************/
+/**************************************************************/
+
+/* Items a device can have waiting to be received */
+#define LIRC_LOOP_ITEMS          4096
+
+/* Time between the end of a transmission and the answer of */
+/* the responder, in us, as taken by the RCX                 */
+#define LIRC_LOOP_TURNAROUND     2000
+
+
+/**************************************************************/
+/************************* Types ******************************/
+/**************************************************************/
+
+/* A line, see lirc_loop_create() */
+typedef struct lirc_loop lirc_loop_t;
+
+/* Answers a transmission on the line. The list is as it is on */
+/* the air: durations without PULSE_BIT, starting with a pulse,*/
+/* skewed by the host, see lirc_loop_skew(). Returns the number of items put in reply, in  */
+/* the same form, or 0 to stay silent. It is called with the   */
+/* line locked, and must not use the line itself.              */
+typedef int (*lirc_loop_responder_t)(void* user, const lirc_t* list,
+                                     int item_count, lirc_t* reply,
+                                     int reply_max);
+
+
+/**************************************************************/
+/*********************** Prototypes ***************************/
+/**************************************************************/
+
+/*************************************************************
+* lirc_loop_create creates a line. Devices open it with its  *
+* name as path, see lirc_loop_transport.                     *
+*                                                            *
+* Input:  name               Name of the line                *
+*                                                            *
+* Return: The line, or NULL if out of memory or the name is  *
+*         in use                                             *
+*************************************************************/
+lirc_loop_t* lirc_loop_create(const char* name);
+
+
+
+/*************************************************************
+* lirc_loop_destroy removes a line. All devices on it must   *
+* have been closed.                                          *
+*                                                            *
+* In/Out: line               The line                        *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void lirc_loop_destroy(lirc_loop_t* line);
+
+
+
+/*************************************************************
+* lirc_loop_responder sets the function that answers each    *
+* transmission on the line, or removes it with NULL. The     *
+* answer starts LIRC_LOOP_TURNAROUND after the transmission, *
+* and is heard by all devices on the line.                   *
+*                                                            *
+* Input:  responder          The function, or NULL           *
+*         user               Passed to the function          *
+*                                                            *
+* In/Out: line               The line                        *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void lirc_loop_responder(lirc_loop_t* line, lirc_loop_responder_t responder,
+                         void* user);
+
+
+
+/*************************************************************
+* lirc_loop_echo makes the devices on the line hear their    *
+* own transmissions, the way most IR heads do.               *
+*                                                            *
+* Input:  echo               1 to hear the echo, 0 not to    *
+*                                                            *
+* In/Out: line               The line                        *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void lirc_loop_echo(lirc_loop_t* line, int echo);
+
+
+
+/*************************************************************
+* lirc_loop_skew makes the transmissions of the devices on   *
+* the line inexact: every pulse and every space written is   *
+* stretched, or shortened, on the air. The responder is      *
+* exact, like the RCX.                                       *
+*                                                            *
+* Input:  pulse              Added to every pulse, in us     *
+*         space              Added to every space, in us     *
+*                                                            *
+* In/Out: line               The line                        *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void lirc_loop_skew(lirc_loop_t* line, int pulse, int space);
+
+
+
+/*************************************************************
+* lirc_loop_now returns the virtual clock of a line.         *
+*                                                            *
+* Input:  line               The line                        *
+*                                                            *
+* Return: Time since the line was created, in us             *
+*************************************************************/
+long lirc_loop_now(lirc_loop_t* line);
+
+#else
+#error -- lircloop.h -- included twice, or more...
+#endif /* _LIRCLOOP_H */
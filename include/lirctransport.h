@@ -0,0 +1,69 @@
+/***************************************************************
+*                                                              *
+* lirctransport.h                                              *
+*                                                              *
+* Description:                                                 *
+* The transport of a device: the functions that move lirc_t    *
+* items to and from the IR hardware. librcx calls the LIRC     *
+* device through it, so other transports can be plugged in,    *
+* see rcx_open_transport().                                    *
+*                                                              *
+* Transports:                                                  *
+* lirc_file_transport   The LIRC driver, see lircfile.h        *
+* lirc_loop_transport   In memory, virtual time, see lircloop.h*
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#ifndef _LIRCTRANSPORT_H
+#define _LIRCTRANSPORT_H
+
+
+/**************************************************************/
+/************************* Types ******************************/
+/**************************************************************/
+
+/* The functions have the meaning, arguments and return codes */
+/* of the lircfile.h functions named after them.              */
+typedef struct lirc_transport
+{
+    const char* name;
+
+    /* lirc_open_flags() */
+    int  (*open)(lirc_device_t* dev, const char* path, int flags);
+
+    /* lirc_close() */
+    int  (*close)(lirc_device_t* dev);
+
+    /* lirc_send() */
+    int  (*send)(lirc_device_t* dev, lirc_t* list, int item_count);
+
+    /* lirc_read() */
+    int  (*receive)(lirc_device_t* dev, lirc_t* list, int items_max,
+                    int timeout);
+
+    /* lirc_reset() */
+    int  (*reset)(lirc_device_t* dev);
+
+    /* Current time of the transport, in us */
+    long (*now)(lirc_device_t* dev);
+} lirc_transport_t;
+
+
+/**************************************************************/
+/*********************** Transports ***************************/
+/**************************************************************/
+
+/* The LIRC driver, see lircfile.c */
+extern const lirc_transport_t lirc_file_transport;
+
+/* In-memory loopback with a virtual clock, see lircloop.c */
+extern const lirc_transport_t lirc_loop_transport;
+
+#else
+#error -- lirctransport.h -- included twice, or more...
+#endif /* _LIRCTRANSPORT_H */
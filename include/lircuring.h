@@ -0,0 +1,98 @@
+/***************************************************************
+*                                                              *
+* lircuring.h                                                  *
+*                                                              *
+* Description:                                                 *
+* io_uring backend of lircfile.c. All devices opened with      *
+* LIRC_OPEN_URING share a single ring. Each device gets a      *
+* slot in it, with a registered receive buffer.                *
+*                                                              *
+* Only lircfile.c calls these functions. The caller checks     *
+* that the device is open.                                     *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#ifndef _LIRCURING_H
+#define _LIRCURING_H
+
+/**************************************************************/
+/************************ Defines  ****************************/
+/**************************************************************/
+
+/* Number of devices that can share the ring */
+#define LIRC_URING_SLOTS        32
+
+/* Size of the registered receive buffer of a slot, in items */
+#define LIRC_URING_ITEMS        256
+
+
+/**************************************************************/
+/*********************** Prototypes ***************************/
+/**************************************************************/
+
+/*************************************************************
+* lirc_uring_attach gives an opened device a slot in the     *
+* shared ring. The first device sets up the ring.            *
+*                                                            *
+* In/Out: dev                The opened device               *
+*                                                            *
+* Return:                                                    *
+*   LIRC_OK                  Device uses the ring            *
+*   LIRC_E_DEVICE_ERROR      io_uring is not available, or   *
+*                            all slots are in use            *
+*************************************************************/
+int lirc_uring_attach(lirc_device_t* dev);
+
+
+
+/*************************************************************
+* lirc_uring_detach frees the slot of a device. The last     *
+* device tears down the ring. No I/O may be in progress.     *
+*                                                            *
+* In/Out: dev                The device                      *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void lirc_uring_detach(lirc_device_t* dev);
+
+
+
+/*************************************************************
+* lirc_uring_read does what lirc_read() does, with a read    *
+* linked to a timeout. Waiting and reading take a single     *
+* system call.                                               *
+*                                                            *
+* Input:   dev          The lirc device                      *
+*          items_max    Size of the list, in lirc_t items    *
+*          timeout      Maximum time to wait for data, in ms *
+*                                                            *
+* Output:  list         List with received lirc_t items      *
+*                                                            *
+* Return:  See lirc_read()                                   *
+*************************************************************/
+int lirc_uring_read(lirc_device_t* dev, lirc_t* list, int items_max,
+                    int timeout);
+
+
+
+/*************************************************************
+* lirc_uring_write does what lirc_send() does, with a write  *
+* linked to a timeout, so a driver that hangs cannot block   *
+* the caller forever.                                        *
+*                                                            *
+* Input:  dev          The LIRC device                       *
+*         list         An array that contains lirc_t items   *
+*         item_count   Number of items to send               *
+*                                                            *
+* Return:  See lirc_send()                                   *
+*************************************************************/
+int lirc_uring_write(lirc_device_t* dev, lirc_t* list, int item_count);
+
+#else
+#error -- lircuring.h -- included twice, or more...
+#endif /* _LIRCURING_H */
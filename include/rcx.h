@@ -6,6 +6,13 @@
 * Interface to RCX command communicator. This RCX program      *
 * relies on the Lirc driver. (www.lirc.org)                    *
 *                                                              *
+* Each rcx_xxx() function has a rcx_xxx_dev() variant, that    *
+* takes the handle of a device opened by rcx_open_dev(). Any   *
+* number of devices can be open at the same time. A handle can *
+* be shared between threads, e.g. a transmit and a receive     *
+* thread. The functions without handle use a single default    *
+* device, opened by rcx_open().                                *
+*                                                              *
 * Author:    Henk Dekker                                       *
 * begin      Wed Nov 13 2002                                   *
 * copyright  (C) 2002 by Henk Dekker                           *
@@ -41,6 +48,170 @@
 #define RCX_E_DEVICE_ERROR      (-106)
 #define RCX_E_RECV_NOTHING      (-107)
 #define RCX_E_RECV_ERROR        (-108)
+#define RCX_E_BAD_ARGUMENT      (-109)
+#define RCX_E_COLLISION         (-110)
+#define RCX_E_QUEUE_FULL        (-111)
+#define RCX_E_NO_ECHO           (-112)
+#define RCX_E_PROFILE_FILE      (-113)
+#define RCX_E_FIRMWARE_FILE     (-114)
+#define RCX_E_FIRMWARE          (-115)
+
+/* Default LIRC device, used by rcx_open() */
+#define RCX_DEFAULT_DEVICE      "/dev/lirc"
+
+/* Timing targets, see rcx_open_target() and rcx_open_dev() */
+#define RCX_TARGET_DEFAULT      (   0)  /* Calibrated, or chosen at */
+                                        /* compile time             */
+#define RCX_TARGET_NOMINAL      (   1)  /* Exact 2400 baud timing   */
+#define RCX_TARGET_PC           (   2)  /* Laptop, lirc_sir driver  */
+#define RCX_TARGET_IPAQ         (   3)  /* iPAQ                     */
+#define RCX_TARGET_MASK         (0x0f)
+
+/* Options, to be or'ed with the target */
+#define RCX_OPEN_RECEIVER       (0x10)  /* Receive in a thread      */
+#define RCX_OPEN_URING          (0x20)  /* I/O through io_uring     */
+
+/* Asynchronous commands, see rcx_command_async() */
+#define RCX_ASYNC_SIZE          ( 256)  /* Max command/reply bytes  */
+#define RCX_ASYNC_QUEUE         (  16)  /* Max commands in progress */
+
+/* Bit rates of the link, see rcx_set_baud() */
+#define RCX_BAUD_AUTO           (   0)  /* 4800, 2400 on a bad link */
+#define RCX_BAUD_2400           (2400)  /* Standard firmware        */
+#define RCX_BAUD_4800           (4800)  /* E.g. brickOS             */
+
+/* Default retry policy, see rcx_set_retry() */
+#define RCX_RETRY_ATTEMPTS      (   1)  /* Sent once, no retries    */
+#define RCX_RETRY_BACKOFF       (  20)  /* First wait, in ms        */
+#define RCX_RETRY_BACKOFF_MAX   ( 320)  /* Longest wait, in ms      */
+
+/* LNP of brickOS, see rcx_lnp_send(). An address is the host */
+/* number in the high nibble, and the port in the low one.     */
+#define RCX_LNP_HOST            (   8)  /* Host number of this side */
+#define RCX_LNP_PORTS           (  16)  /* Ports of a host          */
+#define RCX_LNP_INTEGRITY_PORT  (  -1)  /* Takes integrity packets  */
+
+/* Calibration, see rcx_calibrate() */
+#define RCX_CALIBRATE_ROUNDS    (  16)  /* Packets sent             */
+#define RCX_CALIBRATE_SAMPLES   (  32)  /* Min runs per kind        */
+
+/* Buckets of the time histograms, see rcx_stats_t. Bucket 0   */
+/* counts times below 1 ms, bucket n times from 2^(n-1) ms up */
+/* to 2^n ms, and the last one everything longer.              */
+#define RCX_STATS_BUCKETS       (  16)
+
+
+/**************************************************************/
+/************************* Types ******************************/
+/**************************************************************/
+
+/* Handle of an opened device, see rcx_open_dev() */
+typedef struct rcx_handle rcx_handle_t;
+
+/* Transport of a device, see lirctransport.h */
+struct lirc_transport;
+
+/* Firmware image, see rcxfirm.h */
+struct rcx_firmware;
+
+/* Statistics of the receiver thread, see rcx_receiver_stats() */
+typedef struct rcx_receiver_stats
+{
+    unsigned long bytes;        /* Bytes put in the ring          */
+    unsigned long dropped;      /* Bytes lost, the ring was full  */
+    unsigned long overflows;    /* Times the ring was full        */
+    unsigned long errors;       /* Parity, framing, break errors  */
+    int           fill;         /* Bytes in the ring now          */
+    int           fill_max;     /* Most bytes ever in the ring    */
+} rcx_receiver_stats_t;
+
+/* Statistics of a device since it was opened, see             */
+/* rcx_get_stats(). Bytes are counted as they are on the air,   */
+/* with header, complements and checksum.                       */
+typedef struct rcx_stats
+{
+    unsigned long parity_errors;     /* Decoded from the stream   */
+    unsigned long framing_errors;
+    unsigned long break_errors;
+    unsigned long complement_errors; /* Packets skipped           */
+    unsigned long checksum_errors;
+    unsigned long timeouts;          /* Commands without reply    */
+    unsigned long retries;           /* Collision, or rcx_retry_t */
+    unsigned long bytes_sent;
+    unsigned long bytes_received;
+    unsigned long packets_sent;
+    unsigned long packets_received;
+    unsigned long command_time[RCX_STATS_BUCKETS]; /* Round trip  */
+    unsigned long reply_wait[RCX_STATS_BUCKETS];   /* Sent, until */
+                                                   /* reply done  */
+    unsigned long rate_fallbacks;    /* To 2400, see RCX_BAUD_AUTO*/
+    unsigned long rate_probes;       /* Back up to 4800           */
+    unsigned long late_replies;      /* Of an earlier attempt     */
+} rcx_stats_t;
+
+/* Retry policy of the commands of a device, see rcx_set_retry().*/
+/* The wait before a retry doubles each time, up to backoff_max. */
+typedef struct rcx_retry
+{
+    int           attempts;     /* Times a command is sent, >= 1  */
+    int           backoff;      /* Wait before the first retry, ms*/
+    int           backoff_max;  /* Longest wait, in ms            */
+    int         (*idempotent)(unsigned char opcode); /* Safe to   */
+                                /* run twice; NULL: rcx_idempotent*/
+} rcx_retry_t;
+
+/* Result of rcx_calibrate(). Errors are the median deviation   */
+/* of the runs of marks and spaces from whole bit periods, in   */
+/* us. Marks are the idle level of the line, sent as spaces by  */
+/* the LIRC driver, spaces are sent as pulses.                  */
+typedef struct rcx_calibration
+{
+    int           bit_period;     /* The timing values now in use  */
+    int           mark_adjust;    /* See lirc_profile_init()       */
+    int           space_adjust;
+    int           tx_mark_error;  /* Of the transmitter            */
+    int           tx_space_error;
+    int           rx_mark_error;  /* Of the receiver, from replies */
+    int           rx_space_error;
+    int           echo_samples;   /* Runs measured in the echoes   */
+    int           reply_samples;  /* Runs measured in the replies  */
+} rcx_calibration_t;
+
+/* Firmware download, see rcx_download_firmware() */
+typedef struct rcx_download
+{
+    int           block_size;   /* Data bytes per transfer, 0 to  */
+                                /* choose from the link; set to   */
+                                /* the size used                  */
+    int           blocks;       /* Transfers of the image         */
+    int           retransmits;  /* Transfers sent again           */
+    long          time;         /* Whole download, in us          */
+} rcx_download_t;
+
+/* Called with a LNP packet for a port, see rcx_lnp_set_handler().*/
+/* The data is only valid during the call. src is the address of */
+/* the sender, or -1 for an integrity packet.                    */
+typedef void (*rcx_lnp_handler_t)(void* user, const unsigned char* data,
+                                  int length, int src);
+
+/* Called with a packet that came while a command waited for   */
+/* its reply, and is no reply, see rcx_set_unsolicited(). The  */
+/* data is only valid during the call.                          */
+typedef void (*rcx_unsolicited_t)(void* user, const unsigned char* data,
+                                  int length);
+
+/* Result of an asynchronous command, see rcx_command_async() */
+typedef struct rcx_completion
+{
+    void*         user;         /* As passed with the command     */
+    int           result;       /* As returned by rcx_command()   */
+    int           buf_len;      /* Number of reply bytes          */
+    unsigned char buf[RCX_ASYNC_SIZE];  /* The reply              */
+} rcx_completion_t;
+
+/* Called by the worker thread when a command is done. The      */
+/* completion is only valid during the call.                    */
+typedef void (*rcx_callback_t)(rcx_completion_t* completion);
 
 
 /**************************************************************/
@@ -49,19 +220,35 @@
 
 
 /***************************************************************
-* rcx_open:   Initializes the LIRC driver.                     *
+* rcx_open:   Initializes the LIRC driver, with the timing     *
+*             values of the default target.                    *
 *                                                              *
 * Input:   none                                                *
 * Output:  none                                                *
+* Return:  See rcx_open_target()                               *
+***************************************************************/
+int rcx_open(void);
+
+
+
+
+/***************************************************************
+* rcx_open_target: Initializes the LIRC driver, and selects    *
+*             the timing values of the host platform. A single *
+*             library build supports all targets.              *
+*                                                              *
+* Input:   target                 RCX_TARGET_xxx platform      *
+* Output:  none                                                *
 * Return:  RCX_OK                 Device is opened normally    *
 *          RCX_E_DEVICE_NOT_FOUND Cannot open the LIRC driver  *
 *          RCX_E_DEVICE_READONLY  No permissions to write to   *
 *                                 the LIRC driver              *
 *          RCX_E_DEVICE_NO_LIRC   Device is not a LIRC driver  *
 *          RCX_E_DEVICE_IS_OPEN   Device is already open       *
+*          RCX_E_BAD_ARGUMENT     Unknown target               *
 *          RCX_E_PROGRAM_FAILURE  Internal error               *
 ***************************************************************/
-int rcx_open(void);
+int rcx_open_target(int target);
 
 
 
@@ -90,7 +277,18 @@ int rcx_reset(void);
 *              receiving input.                                *
 *                                                              *
 *              This is a non-blocking function, but it can     *
-*              take a second before the call returns.          *
+*              take a second before the call returns. If the   *
+*              reply length of the opcode is known, the call   *
+*              returns as soon as the reply is complete. For   *
+*              opcodes without a reply, the call returns right *
+*              after sending, with buf_len set to 0.           *
+*                                                              *
+*              The RCX does not run an opcode that equals the  *
+*              one before, so the toggle bit (0x08) is flipped *
+*              when the same opcode is sent twice in a row.    *
+*              The reply starts with the inverted opcode as    *
+*              given, either way. Failed commands are sent     *
+*              again as rcx_set_retry() tells.                 *
 *                                                              *
 *              ------------------Example---------------------- *
 *              int           errorcode;                        *
@@ -111,6 +309,8 @@ int rcx_reset(void);
 *          RCX_E_DEVICE_ERROR     Cannot send to LIRC driver   *
 *          RCX_E_RECV_NOTHING     No data received             *
 *          RCX_E_RECV_ERROR       Data received, with errors   *
+*          RCX_E_COLLISION        Every send attempt collided  *
+*          RCX_E_BAD_ARGUMENT     No bytes to send             *
 *          RCX_E_PROGRAM_FAILURE  Internal error               *
 ***************************************************************/
 int rcx_command(unsigned char* buf, int buf_size, int* buf_len);
@@ -118,11 +318,68 @@ int rcx_command(unsigned char* buf, int buf_size, int* buf_len);
 
 
 
+/***************************************************************
+* rcx_command_async: Queue a command, and return at once.      *
+*                                                              *
+*              A worker thread sends the queued commands in    *
+*              order, and receives their replies, like         *
+*              rcx_command() does. The next command is encoded *
+*              while the current one is on the air.            *
+*                                                              *
+*              When a command is done, the callback is called  *
+*              from the worker thread. Without a callback, the *
+*              result is put in the completion queue, see      *
+*              rcx_poll_completion(). Commands in progress and *
+*              completions not yet taken count for the limit   *
+*              of RCX_ASYNC_QUEUE.                             *
+*                                                              *
+* Input:   buf                    Command bytes to send        *
+*          buf_len                Number of bytes to send      *
+*          callback               Called when done, or NULL    *
+*          user                   Passed with the completion   *
+* Output:                                                      *
+* Return:  RCX_OK                 Command queued               *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_BAD_ARGUMENT     More than RCX_ASYNC_SIZE     *
+*                                 bytes, or none               *
+*          RCX_E_QUEUE_FULL       Too many commands in progress*
+*          RCX_E_PROGRAM_FAILURE  Cannot start the worker      *
+***************************************************************/
+int rcx_command_async(unsigned char* buf, int buf_len,
+                      rcx_callback_t callback, void* user);
+
+
+
+
+/***************************************************************
+* rcx_poll_completion: Take the result of a command queued     *
+*              without callback, see rcx_command_async().      *
+*              Results are taken in the order of completion.   *
+*                                                              *
+* Input:   timeout                Time to wait in ms, 0 to poll*
+* Output:  completion             Result of the command        *
+* Return:  RCX_OK                 Completion taken             *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_RECV_NOTHING     No command completed in time *
+***************************************************************/
+int rcx_poll_completion(rcx_completion_t* completion, int timeout);
+
+
+
+
 /***************************************************************
 * rcx_send:    Send a RCX packet to the LIRC driver            *
 *                                                              *
 *              The buffer holds the RCX opcode, plus arguments *
-*              to be sent                                      *
+*              to be sent. The whole packet is handed to the   *
+*              driver in a single write, without gaps between  *
+*              the bytes.                                      *
+*                                                              *
+*              If the receiver hears the transmission, the     *
+*              echo is taken from the receive stream and       *
+*              compared with what was sent. A corrupted echo   *
+*              means a collision, and the packet is sent       *
+*              again at once.                                  *
 *                                                              *
 * Input:   buf_len                Number of bytes to send      *
 *          buf                    Send buffer                  *
@@ -130,6 +387,7 @@ int rcx_command(unsigned char* buf, int buf_size, int* buf_len);
 * Return:  RCX_OK                 Command has been sent        *
 *          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
 *          RCX_E_DEVICE_ERROR     Cannot send to LIRC driver   *
+*          RCX_E_COLLISION        Every attempt collided       *
 *          RCX_E_PROGRAM_FAILURE  Internal error               *
 ***************************************************************/
 int rcx_send(unsigned char* buf, int buf_len);
@@ -141,7 +399,11 @@ int rcx_send(unsigned char* buf, int buf_len);
 * rcx_receive: Receive a RCX packet from the LIRC driver       *
 *                                                              *
 *              This is a non-blocking function, but it can     *
-*              take a second before the call returns.          *
+*              take a second before the call returns. It       *
+*              returns as soon as a packet is complete.        *
+*              Packets sent back-to-back are returned by the   *
+*              next calls, and garbage between packets is      *
+*              skipped.                                        *
 *                                                              *
 * Input:   buf                    Receive buffer               *
 *          buf_size               Size of receive buffer       *
@@ -158,6 +420,26 @@ int rcx_receive(unsigned char* buf, int buf_size, int* buf_len);
 
 
 
+/***************************************************************
+* rcx_receive_wait: Receive a RCX packet from the LIRC driver, *
+*              like rcx_receive(), but wait no more than 'wait'*
+*              ms for a packet to start. Once bytes come in,   *
+*              the packet ends at silence, as with             *
+*              rcx_receive(). A short wait lets a thread that  *
+*              listens for packets send commands in between.   *
+*                                                              *
+* Input:   buf                    Receive buffer               *
+*          buf_size               Size of receive buffer       *
+*          wait                   Time to wait, in ms          *
+* Output:  buf_len                Number of bytes received     *
+* Return:  See rcx_receive()                                   *
+***************************************************************/
+int rcx_receive_wait(unsigned char* buf, int buf_size, int* buf_len,
+                     int wait);
+
+
+
+
 /***************************************************************
 * rcx_close:    Closes the LIRC driver.                        *
 *                                                              *
@@ -189,7 +471,8 @@ int rcx_send_byte(unsigned char tx_byte);
 * rcx_receive_byte: Receive a byte from the LIRC driver        *
 *                                                              *
 *              This is a non-blocking function, but it can     *
-*              take a second before the call returns.          *
+*              take a second before the call returns. With a   *
+*              receiver thread it returns at once.             *
 *                                                              *
 * Input:                                                       *
 * Output:  rx_byte                Pointer to receive byte in   *
@@ -202,6 +485,452 @@ int rcx_send_byte(unsigned char tx_byte);
 int rcx_receive_byte(unsigned char* rx_byte);
 
 
+
+/***************************************************************
+* rcx_receive_bytes: Take the bytes the receiver thread has    *
+*              decoded so far, without waiting.                *
+*                                                              *
+*              Only for a device opened with RCX_OPEN_RECEIVER.*
+*              While a command waits for its reply, the bytes  *
+*              belong to the command, and nothing is returned. *
+*                                                              *
+* Input:   size                   Size of buf                  *
+* Output:  buf                    Received bytes               *
+* Return:  >= 0                   Number of bytes in buf       *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_DEVICE_ERROR     Receiver thread stopped on a *
+*                                 device error                 *
+*          RCX_E_BAD_ARGUMENT     No receiver thread           *
+***************************************************************/
+int rcx_receive_bytes(unsigned char* buf, int size);
+
+
+
+
+/***************************************************************
+* rcx_receiver_stats: Statistics of the receiver thread.       *
+*                                                              *
+* Input:                                                       *
+* Output:  stats                  The statistics               *
+* Return:  RCX_OK                 Statistics copied            *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_BAD_ARGUMENT     No receiver thread           *
+***************************************************************/
+int rcx_receiver_stats(rcx_receiver_stats_t* stats);
+
+
+
+/***************************************************************
+* rcx_get_stats: Error counters, traffic and timing of the     *
+*              device. The counters are kept all the time, at  *
+*              the cost of an atomic add each.                 *
+*                                                              *
+* Input:                                                       *
+* Output:  stats                  The statistics               *
+* Return:  RCX_OK                 Statistics copied            *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+***************************************************************/
+int rcx_get_stats(rcx_stats_t* stats);
+
+
+
+/***************************************************************
+* rcx_calibrate: Measure the timing of the IR hardware of the  *
+*              host, and use the timing values that make up    *
+*              for it. They are saved in the profile file, see *
+*              rcxprofile.h, for the next rcx_open().          *
+*                                                              *
+* Note:        RCX_CALIBRATE_ROUNDS alive commands are sent.   *
+*              The echo of each shows how the transmitter and  *
+*              the receiver together distort the pulses, the   *
+*              reply of the RCX, if it is in range, how the    *
+*              receiver alone does. Without replies the        *
+*              receiver is taken to be exact. Input pending on *
+*              the device is dropped.                          *
+*                                                              *
+* Input:                                                       *
+* Output:  calibration            What was measured, and the   *
+*                                 timing values now in use     *
+* Return:  RCX_OK                 Timing values in use, saved  *
+*          RCX_E_PROFILE_FILE     Timing values in use, but    *
+*                                 the profile file cannot be   *
+*                                 written                      *
+*          RCX_E_NO_ECHO          The receiver does not hear   *
+*                                 the transmissions, or too    *
+*                                 few of them                  *
+*          RCX_E_BAD_ARGUMENT     A receiver or worker thread  *
+*                                 runs on the device           *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_DEVICE_ERROR     Error in LIRC device         *
+***************************************************************/
+int rcx_calibrate(rcx_calibration_t* calibration);
+
+
+
+/***************************************************************
+* rcx_set_baud: Select the bit rate of the link. A device is   *
+*              opened at 2400 baud, the rate of the standard   *
+*              firmware. Other firmwares, such as brickOS, can *
+*              run at 4800 baud, which halves the airtime of   *
+*              each packet.                                    *
+*                                                              *
+* Note:        With RCX_BAUD_AUTO the link runs at 4800 baud,  *
+*              and the share of failed commands is followed as *
+*              a moving average. Once it exceeds a quarter,    *
+*              the link falls back to 2400 baud. When the link *
+*              has been good at 2400 baud for a while, 4800    *
+*              baud is tried again; a probe that fails doubles *
+*              the time to the next one. The RCX has to answer *
+*              at the rate it is addressed with.               *
+*                                                              *
+* Input:   baud                   RCX_BAUD_xxx rate            *
+* Output:                                                      *
+* Return:  RCX_OK                 Rate selected                *
+*          RCX_E_BAD_ARGUMENT     Unknown rate, or the timing  *
+*                                 values of the host do not    *
+*                                 allow 4800 baud              *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_PROGRAM_FAILURE  Internal error               *
+***************************************************************/
+int rcx_set_baud(int baud);
+
+
+
+/***************************************************************
+* rcx_get_baud: The bit rate the link runs at now.             *
+*                                                              *
+* Input:                                                       *
+* Output:                                                      *
+* Return:  2400 or 4800          Bit rate                      *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+***************************************************************/
+int rcx_get_baud(void);
+
+
+
+/***************************************************************
+* rcx_get_time: The clock of the device, in us. It is the      *
+*              monotonic clock, or the virtual one of a        *
+*              transport like lirc_loop_transport.             *
+*                                                              *
+* Input:                                                       *
+* Output:                                                      *
+* Return:  >=0                    Time, in us                  *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+***************************************************************/
+long rcx_get_time(void);
+
+
+
+/***************************************************************
+* rcx_set_retry: Select how failed commands are sent again,    *
+*              see rcx_retry_t. A command is retried when no   *
+*              reply, or a corrupted one, came back. Opcodes   *
+*              without a reply are sent once, as nothing tells *
+*              if they were lost. A collision is not retried   *
+*              here: the packet is sent again at once, see     *
+*              rcx_send().                                     *
+*                                                              *
+* Note:        A lost command and a lost reply look the same.  *
+*              An opcode that is idempotent is sent again with *
+*              the toggle bit flipped on each retry, so one of *
+*              two retries gets through whether or not the RCX *
+*              ran the attempt before. Other opcodes keep the  *
+*              toggle bit, so the RCX runs them at most once.  *
+*              While waiting, a late reply of an attempt is    *
+*              taken from the line, and dropped, see           *
+*              rcx_stats_t.                                    *
+*                                                              *
+* Input:   retry                  The policy                   *
+* Output:                                                      *
+* Return:  RCX_OK                 Policy selected              *
+*          RCX_E_BAD_ARGUMENT     Less than one attempt, a     *
+*                                 negative wait, or backoff_max*
+*                                 below backoff                *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+***************************************************************/
+int rcx_set_retry(const rcx_retry_t* retry);
+
+
+
+/***************************************************************
+* rcx_get_retry: The retry policy in use, see rcx_set_retry(). *
+*              A device is opened with RCX_RETRY_ATTEMPTS,     *
+*              RCX_RETRY_BACKOFF and RCX_RETRY_BACKOFF_MAX.    *
+*                                                              *
+* Input:                                                       *
+* Output:  retry                  The policy                   *
+* Return:  RCX_OK                 Policy copied                *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+***************************************************************/
+int rcx_get_retry(rcx_retry_t* retry);
+
+
+
+/***************************************************************
+* rcx_download_firmware: Replaces the firmware of the RCX, see *
+*              rcxfirm.h for reading an image. The old firmware*
+*              is deleted, the image is sent in blocks, and    *
+*              the RCX is told to start it.                    *
+*                                                              *
+* Note:        The download holds the device, and runs at 2400 *
+*              baud, the rate of the ROM; the rate is selected *
+*              again afterwards. All transfer packets are      *
+*              encoded before the first is sent, so each goes  *
+*              out as soon as the reply of the one before is   *
+*              in. A block that failed is sent again on its    *
+*              own, with the toggle bit flipped on every other *
+*              try, as for an idempotent command.              *
+*                                                              *
+* Input:   firmware               The image                    *
+*          download->block_size   Data bytes per transfer, or  *
+*                                 0 to choose from the errors  *
+*                                 seen on the link             *
+* Output:  download               Blocks, retransmits, time    *
+* Return:  RCX_OK                 Firmware is running          *
+*          RCX_E_BAD_ARGUMENT     Empty image, or a block size *
+*                                 out of RCX_FIRMWARE_BLOCK_MIN*
+*                                 up to RCX_FIRMWARE_BLOCK_MAX *
+*          RCX_E_FIRMWARE         The RCX refused the download,*
+*                                 e.g. a bad image checksum    *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_RECV_NOTHING     A block got no reply         *
+*          RCX_E_RECV_ERROR       See rcx_command()            *
+*          RCX_E_PROGRAM_FAILURE  Out of memory                *
+***************************************************************/
+int rcx_download_firmware(const struct rcx_firmware* firmware,
+                          rcx_download_t* download);
+
+
+
+/***************************************************************
+* rcx_lnp_send: Send a LNP packet, the protocol of brickOS, see*
+*              rcx_lnp_encode(). Bytes are not complemented,   *
+*              so a packet takes about half the airtime of one *
+*              of the standard firmware. brickOS does not      *
+*              reply; answers come as packets of their own,    *
+*              see rcx_lnp_poll().                             *
+*                                                              *
+* Input:   dest                   Address to send to, or -1    *
+*                                 for an integrity packet      *
+*          port                   Port sent from, on the host  *
+*                                 of rcx_lnp_set_host()        *
+*          buf                    Data bytes                   *
+*          buf_len                Number of data bytes, up to  *
+*                                 253 with an address, 255     *
+*                                 without                      *
+* Output:                                                      *
+* Return:  RCX_OK                 Packet has been sent         *
+*          RCX_E_BAD_ARGUMENT     Too many bytes, or a bad     *
+*                                 address or port              *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_DEVICE_ERROR     Cannot send to LIRC driver   *
+*          RCX_E_COLLISION        Every send attempt collided  *
+***************************************************************/
+int rcx_lnp_send(int dest, int port, unsigned char* buf, int buf_len);
+
+
+
+/***************************************************************
+* rcx_lnp_set_host: Select the host number of this side. Only  *
+*              addressing packets to this host are handed to   *
+*              the port handlers. A device is opened with      *
+*              RCX_LNP_HOST.                                   *
+*                                                              *
+* Input:   host                   Host number, 0 up to 15      *
+* Output:                                                      *
+* Return:  RCX_OK                 Host number selected         *
+*          RCX_E_BAD_ARGUMENT     Host number out of range     *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+***************************************************************/
+int rcx_lnp_set_host(int host);
+
+
+
+/***************************************************************
+* rcx_lnp_set_handler: Select the function that takes the LNP  *
+*              packets to a port, see rcx_lnp_poll(). Packets  *
+*              to a port without handler are dropped.          *
+*                                                              *
+* Input:   port                   Port, 0 up to RCX_LNP_PORTS-1*
+*                                 or RCX_LNP_INTEGRITY_PORT    *
+*          handler                The function, or NULL        *
+*          user                   Passed to the function       *
+* Output:                                                      *
+* Return:  RCX_OK                 Handler selected             *
+*          RCX_E_BAD_ARGUMENT     Unknown port                 *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+***************************************************************/
+int rcx_lnp_set_handler(int port, rcx_lnp_handler_t handler, void* user);
+
+
+
+/***************************************************************
+* rcx_lnp_poll: Wait up to LIRC_REPLY_TIME for LNP packets,    *
+*              and hand each to the handler of its port. It    *
+*              returns once the packets at hand are handled.   *
+*                                                              *
+* Note:        Handlers are called in the calling thread,      *
+*              without the device held, so they can send. A    *
+*              packet that ends in silence is dropped, as      *
+*              brickOS does.                                   *
+*                                                              *
+* Input:                                                       *
+* Output:                                                      *
+* Return:  >=0                    Packets handed to a handler  *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_DEVICE_ERROR     Error in LIRC device         *
+***************************************************************/
+int rcx_lnp_poll(void);
+
+
+
+/***************************************************************
+* rcx_set_unsolicited: Select the function that takes the      *
+*              packets a command skips while it waits for its  *
+*              reply, like a message of another RCX. Without   *
+*              a function they are dropped.                    *
+*                                                              *
+* Note:        The function is called in the thread that waits *
+*              for the reply, with the device held. It must not*
+*              use the device, and should return at once.      *
+*                                                              *
+* Input:   handler                The function, or NULL        *
+*          user                   Passed to the function       *
+* Output:                                                      *
+* Return:  RCX_OK                 Function selected            *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+***************************************************************/
+int rcx_set_unsolicited(rcx_unsolicited_t handler, void* user);
+
+
+
+/***************************************************************
+* rcx_open_dev: Opens a LIRC device, and selects the timing    *
+*             values of the host platform.                     *
+*                                                              *
+* Input:   device                 Filename of the LIRC device  *
+*          flags                  RCX_TARGET_xxx platform, or'ed*
+*                                 with RCX_OPEN_xxx options    *
+* Output:  handle                 Handle of the opened device  *
+* Return:  RCX_OK                 Device is opened normally    *
+*          RCX_E_DEVICE_NOT_FOUND Cannot open the LIRC driver  *
+*          RCX_E_DEVICE_READONLY  No permissions to write to   *
+*                                 the LIRC driver              *
+*          RCX_E_DEVICE_NO_LIRC   Device is not a LIRC driver  *
+*          RCX_E_BAD_ARGUMENT     Unknown target               *
+*          RCX_E_PROGRAM_FAILURE  Internal error               *
+*                                                              *
+*              With RCX_OPEN_RECEIVER, a thread decodes all    *
+*              input of the device into a ring buffer. Reading *
+*              bytes then never waits, see rcx_receive_bytes().*
+*              Receivers that hear the transmissions put the   *
+*              echo in the ring, and collisions are not seen.  *
+*                                                              *
+*              With RCX_OPEN_URING, the device I/O goes        *
+*              through an io_uring shared by all devices       *
+*              opened this way. Without io_uring support, the  *
+*              device is used the normal way.                  *
+*                                                              *
+*              With RCX_TARGET_DEFAULT, the timing values saved*
+*              by rcx_calibrate() for this host and device are *
+*              used, if there are.                             *
+***************************************************************/
+int rcx_open_dev(const char* device, int flags, rcx_handle_t** handle);
+
+
+
+
+/***************************************************************
+* rcx_open_transport: Opens a device of another transport than *
+*             the LIRC driver, e.g. lirc_loop_transport, an    *
+*             in-memory loopback with a virtual clock. See     *
+*             lirctransport.h.                                 *
+*                                                              *
+* Input:   transport              Functions of the transport   *
+*          device                 Path, as the transport takes *
+*          flags                  See rcx_open_dev()           *
+* Output:  handle                 Handle of the opened device  *
+* Return:  See rcx_open_dev()                                  *
+***************************************************************/
+int rcx_open_transport(const struct lirc_transport* transport,
+                       const char* device, int flags, rcx_handle_t** handle);
+
+
+
+
+/***************************************************************
+* rcx_reset_dev, rcx_command_dev, rcx_send_dev,                *
+* rcx_receive_dev, rcx_receive_wait_dev, rcx_send_byte_dev,    *
+* rcx_receive_byte_dev,                                        *
+* rcx_receive_bytes_dev, rcx_receiver_stats_dev,               *
+* rcx_get_stats_dev, rcx_calibrate_dev, rcx_set_baud_dev,      *
+* rcx_get_baud_dev, rcx_get_time_dev, rcx_set_retry_dev,       *
+* rcx_get_retry_dev,                                           *
+* rcx_download_firmware_dev, rcx_lnp_send_dev,                 *
+* rcx_lnp_set_host_dev, rcx_lnp_set_handler_dev,               *
+* rcx_lnp_poll_dev, rcx_set_unsolicited_dev,                   *
+* rcx_command_async_dev, rcx_poll_completion_dev:              *
+*              Same as the functions without '_dev', but on    *
+*              the device of 'handle'.                         *
+*                                                              *
+*              A command holds the device until its reply has  *
+*              been received. Other sends and receives on the  *
+*              same handle wait for it. A send holds the       *
+*              receiver as well, while it takes the echo.      *
+***************************************************************/
+int rcx_reset_dev(rcx_handle_t* handle);
+int rcx_command_dev(rcx_handle_t* handle, unsigned char* buf,
+                    int buf_size, int* buf_len);
+int rcx_send_dev(rcx_handle_t* handle, unsigned char* buf, int buf_len);
+int rcx_receive_dev(rcx_handle_t* handle, unsigned char* buf,
+                    int buf_size, int* buf_len);
+int rcx_receive_wait_dev(rcx_handle_t* handle, unsigned char* buf,
+                         int buf_size, int* buf_len, int wait);
+int rcx_send_byte_dev(rcx_handle_t* handle, unsigned char tx_byte);
+int rcx_receive_byte_dev(rcx_handle_t* handle, unsigned char* rx_byte);
+int rcx_receive_bytes_dev(rcx_handle_t* handle, unsigned char* buf,
+                          int size);
+int rcx_receiver_stats_dev(rcx_handle_t* handle,
+                           rcx_receiver_stats_t* stats);
+int rcx_get_stats_dev(rcx_handle_t* handle, rcx_stats_t* stats);
+int rcx_calibrate_dev(rcx_handle_t* handle, rcx_calibration_t* calibration);
+int rcx_set_baud_dev(rcx_handle_t* handle, int baud);
+int rcx_get_baud_dev(rcx_handle_t* handle);
+long rcx_get_time_dev(rcx_handle_t* handle);
+int rcx_set_retry_dev(rcx_handle_t* handle, const rcx_retry_t* retry);
+int rcx_get_retry_dev(rcx_handle_t* handle, rcx_retry_t* retry);
+int rcx_download_firmware_dev(rcx_handle_t* handle,
+                              const struct rcx_firmware* firmware,
+                              rcx_download_t* download);
+int rcx_lnp_send_dev(rcx_handle_t* handle, int dest, int port,
+                     unsigned char* buf, int buf_len);
+int rcx_lnp_set_host_dev(rcx_handle_t* handle, int host);
+int rcx_lnp_set_handler_dev(rcx_handle_t* handle, int port,
+                            rcx_lnp_handler_t handler, void* user);
+int rcx_lnp_poll_dev(rcx_handle_t* handle);
+int rcx_set_unsolicited_dev(rcx_handle_t* handle, rcx_unsolicited_t handler,
+                            void* user);
+int rcx_command_async_dev(rcx_handle_t* handle, unsigned char* buf,
+                          int buf_len, rcx_callback_t callback,
+                          void* user);
+int rcx_poll_completion_dev(rcx_handle_t* handle,
+                            rcx_completion_t* completion, int timeout);
+
+
+
+
+/***************************************************************
+* rcx_close_dev: Closes a LIRC device, and frees its handle.   *
+*               No other thread may use the handle anymore.    *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+* Output:  none                                                *
+* Return:  RCX_OK                 Device is closed succesfully *
+***************************************************************/
+int rcx_close_dev(rcx_handle_t* handle);
+
+
 #else
 #error -- rcx.h -- included twice, or more...
 #endif /* _RCX_H */
@@ -34,6 +34,60 @@
 #define RCX_E_NO_RCX            (-100)
 #define RCX_E_BUFFER            (-101)
 
+/* Reply length of an opcode that is not known, or that has */
+/* a reply of variable length                               */
+#define RCX_REPLY_UNKNOWN       (-1)
+
+/* Bit of an opcode that tells two equal commands apart. The */
+/* RCX does not run an opcode that equals the one before.    */
+#define RCX_TOGGLE              (0x08)
+
+/* Maximum number of data bytes in a packet of the parser   */
+#define RCX_PARSER_SIZE         256
+
+/* Why the parser skipped the last broken packet            */
+#define RCX_PARSE_OK            (   0)
+#define RCX_PARSE_COMPLEMENT    (   1)  /* Byte not complemented */
+#define RCX_PARSE_CHECKSUM      (   2)  /* No matching checksum  */
+
+/* LNP, the packet protocol of brickOS, see rcx_lnp_encode()  */
+#define RCX_LNP_INTEGRITY       (0xf0)  /* Header: data only     */
+#define RCX_LNP_ADDRESSING      (0xf1)  /* Header: addresses too */
+#define RCX_LNP_SIZE            ( 255)  /* Max bytes after length*/
+#define RCX_LNP_HOST_MASK       (0xf0)  /* Address: host number, */
+#define RCX_LNP_PORT_MASK       (0x0f)  /* then port number      */
+
+
+/**************************************************************/
+/************************* Types ******************************/
+/**************************************************************/
+
+/* State of the streaming packet parser, see rcx_parser_push() */
+typedef struct rcx_parser
+{
+    int           state;        /* Position in the packet         */
+    int           count;        /* Number of data bytes in buf    */
+    int           expect;       /* Packet length, if known, or 0  */
+    int           candidate;    /* Length at the last checksum    */
+    unsigned char sum;          /* Checksum of the data bytes     */
+    unsigned char last;         /* Byte waiting for complement    */
+    int           error;        /* RCX_PARSE_xxx, last broken one */
+    unsigned char buf[RCX_PARSER_SIZE]; /* Data bytes of packet   */
+} rcx_parser_t;
+
+/* State of the streaming LNP parser, see rcx_lnp_parser_push()*/
+typedef struct rcx_lnp_parser
+{
+    int           state;        /* Position in the packet         */
+    int           header;       /* RCX_LNP_xxx of the packet      */
+    int           length;       /* Bytes after the length byte,   */
+                                /* checksum not counted           */
+    int           count;        /* Number of them received        */
+    unsigned char sum;          /* Checksum so far                */
+    int           error;        /* RCX_PARSE_xxx, last broken one */
+    unsigned char buf[RCX_LNP_SIZE]; /* Addresses and data bytes  */
+} rcx_lnp_parser_t;
+
 
 /**************************************************************/
 /*********************** Prototypes ***************************/
@@ -76,6 +130,194 @@ int rcx_encode(unsigned char* databuf, int datalen,
 int rcx_decode(unsigned char* rcxbuf, int rcxlen,
                unsigned char* databuf, int datasize);
 
+
+
+
+/*************************************************************
+* rcx_reply_length returns the number of data bytes in the   *
+* reply of the RCX to an opcode, including the inverted      *
+* opcode at the start of the reply. The toggle bit (0x08) of *
+* the opcode is ignored.                                     *
+*                                                            *
+* Input:  opcode    Opcode sent to the RCX                   *
+*                                                            *
+* Return: > 0               Number of data bytes in reply    *
+*         0                 The RCX does not reply           *
+*         RCX_REPLY_UNKNOWN Length of the reply is not known *
+*************************************************************/
+int rcx_reply_length(unsigned char opcode);
+
+
+
+/*************************************************************
+* rcx_idempotent tells if running an opcode twice has the    *
+* same effect as running it once, so that it can be sent     *
+* again when its reply is lost. The toggle bit is ignored.   *
+*                                                            *
+* Input:  opcode    Opcode sent to the RCX                   *
+*                                                            *
+* Return: 1         Safe to run again                        *
+*         0         Not safe, or not known                   *
+*************************************************************/
+int rcx_idempotent(unsigned char opcode);
+
+
+
+/*************************************************************
+* rcx_parser_init prepares a parser for a new stream of RCX  *
+* bytes. The parser holds all state, and needs no other      *
+* memory, so streams can be of any length.                   *
+*                                                            *
+* Output: parser    The parser to initialize                 *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_parser_init(rcx_parser_t* parser);
+
+
+
+/*************************************************************
+* rcx_parser_push feeds the next received byte to the        *
+* parser. Bytes before a 55 ff 00 header are skipped, and    *
+* after a broken packet the parser looks for the next        *
+* header.                                                    *
+*                                                            *
+* The end of a packet is found at the checksum. If the       *
+* reply length of the opcode is known (see                   *
+* rcx_reply_length()), the packet is complete as soon as its *
+* checksum arrives. Otherwise a checksum might just as well  *
+* be data, and the packet ends at the first byte that does   *
+* not continue it, like the header of the next packet.       *
+*                                                            *
+* Input:  byte      The received byte                        *
+*                                                            *
+* In/Out: parser    Parser state, see rcx_parser_init()      *
+*                                                            *
+* Return: > 0           A packet is complete. The data bytes *
+*                       are in parser->buf, until the next   *
+*                       call. The value is the number of     *
+*                       data bytes.                          *
+*         0             No packet complete yet               *
+*         RCX_E_NO_RCX  A packet was broken, and skipped.    *
+*                       parser->error tells why.             *
+*************************************************************/
+int rcx_parser_push(rcx_parser_t* parser, unsigned char byte);
+
+
+
+/*************************************************************
+* rcx_parser_flush tells the parser that the stream has      *
+* ended, for example when the line became silent. A packet   *
+* of unknown length completes here, and the parser looks for *
+* a new header afterwards.                                   *
+*                                                            *
+* In/Out: parser    Parser state, see rcx_parser_init()      *
+*                                                            *
+* Return: See rcx_parser_push()                              *
+*************************************************************/
+int rcx_parser_flush(rcx_parser_t* parser);
+
+
+
+/*************************************************************
+* rcx_lnp_encode encodes a LNP packet, as brickOS sends and  *
+* takes them. Bytes go on the air without complements, so a  *
+* packet takes about half the time of a RCX packet.          *
+*                                                            *
+* An integrity packet is f0, length, data, checksum. An      *
+* addressing packet is f1, length, destination, source,      *
+* data, checksum; the length counts the addresses. The       *
+* checksum is 0xff plus all bytes before it.                 *
+*                                                            *
+* Input:  dest      Address to send to, host and port, or -1 *
+*                   for an integrity packet                  *
+*         src       Address of the sender, for addressing    *
+*         databuf   Pointer to buffer that contains data     *
+*         datalen   Number of data bytes in buffer           *
+*         lnpsize   Size of the output buffer                *
+*                                                            *
+* Output: lnpbuf    The packet                               *
+*                                                            *
+* Return: >= 0          Ok, number of bytes in lnp buffer    *
+*         RCX_E_BUFFER  Too many data bytes, or buffer size  *
+*                       too small                            *
+*************************************************************/
+int rcx_lnp_encode(int dest, int src, unsigned char* databuf, int datalen,
+                   unsigned char* lnpbuf, int lnpsize);
+
+
+
+/*************************************************************
+* rcx_lnp_decode decodes a LNP packet to a data byte buffer, *
+* see rcx_lnp_encode(). Bytes before the header are skipped. *
+*                                                            *
+* Input:  lnpbuf    Pointer to buffer that contains a packet *
+*         lnplen    Number of bytes in buffer                *
+*         datasize  Size of data bytes output buffer         *
+*                                                            *
+* Output: databuf   Pointer to data bytes output buffer      *
+*         dest      Address sent to, or -1 for integrity     *
+*         src       Address of the sender, or -1             *
+*                                                            *
+* Return: >= 0            Decoding ok, number of data bytes  *
+*         RCX_E_NO_RCX    Error, input is not a LNP packet   *
+*         RCX_E_BUFFER    Error, buffer size too small       *
+*************************************************************/
+int rcx_lnp_decode(unsigned char* lnpbuf, int lnplen,
+                   unsigned char* databuf, int datasize,
+                   int* dest, int* src);
+
+
+
+/*************************************************************
+* rcx_lnp_parser_init prepares a parser for a new stream of  *
+* LNP bytes.                                                 *
+*                                                            *
+* Output: parser    The parser to initialize                 *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_lnp_parser_init(rcx_lnp_parser_t* parser);
+
+
+
+/*************************************************************
+* rcx_lnp_parser_push feeds the next received byte to the    *
+* parser. Bytes before a f0 or f1 header are skipped. The    *
+* length byte tells where a packet ends, so it completes at  *
+* its checksum.                                              *
+*                                                            *
+* Input:  byte      The received byte                        *
+*                                                            *
+* In/Out: parser    Parser state, see rcx_lnp_parser_init()  *
+*                                                            *
+* Return: > 0           A packet is complete: its header,    *
+*                       RCX_LNP_INTEGRITY or _ADDRESSING.    *
+*                       parser->buf holds parser->length     *
+*                       bytes until the next call: the data, *
+*                       after destination and source for an  *
+*                       addressing packet.                   *
+*         0             No packet complete yet               *
+*         RCX_E_NO_RCX  A packet was broken, and skipped.    *
+*                       parser->error tells why.             *
+*************************************************************/
+int rcx_lnp_parser_push(rcx_lnp_parser_t* parser, unsigned char byte);
+
+
+
+/*************************************************************
+* rcx_lnp_parser_flush tells the parser that the stream has  *
+* ended. brickOS drops a packet when its bytes stop coming,  *
+* and so does the parser: it looks for a new header          *
+* afterwards.                                                *
+*                                                            *
+* In/Out: parser    Parser state, see rcx_lnp_parser_init()  *
+*                                                            *
+* Return: 0             No packet was broken off             *
+*         RCX_E_NO_RCX  A packet was not complete            *
+*************************************************************/
+int rcx_lnp_parser_flush(rcx_lnp_parser_t* parser);
+
 #else
 #error -- rcxcode.h -- included twice, or more...
 #endif /* _RCXCODE_H */
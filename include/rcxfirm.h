@@ -0,0 +1,122 @@
+/***************************************************************
+*                                                              *
+* rcxfirm.h                                                    *
+*                                                              *
+* Description:                                                 *
+* Firmware images for rcx_download_firmware(): reading them    *
+* from S-record files, as the firmware of the RCX comes, and   *
+* the checksum and block size of a download.                   *
+*                                                              *
+* An image starts at RCX_FIRMWARE_START. The records of an     *
+* S-record file must all fall in RCX_FIRMWARE_SIZE bytes from  *
+* there; bytes no record sets are 0.                           *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#ifndef _RCXFIRM_H
+#define _RCXFIRM_H
+
+/**************************************************************/
+/************************ Defines  ****************************/
+/**************************************************************/
+
+/* Place of the firmware in the memory of the RCX */
+#define RCX_FIRMWARE_START      (0x8000)  /* First byte of an image */
+#define RCX_FIRMWARE_SIZE       (0x7000)  /* Largest image          */
+#define RCX_FIRMWARE_SUM_END    (0xcc00)  /* Checksum stops here    */
+
+/* Data bytes of a transfer, see rcx_firmware_block_size() */
+#define RCX_FIRMWARE_BLOCK_MIN  (  16)
+#define RCX_FIRMWARE_BLOCK_MAX  ( 200)  /* Largest the RCX takes    */
+
+
+/**************************************************************/
+/************************* Types ******************************/
+/**************************************************************/
+
+/* A firmware image */
+typedef struct rcx_firmware
+{
+    int           start;        /* Entry point, from the S7/8/9   */
+                                /* record, or RCX_FIRMWARE_START  */
+    int           length;       /* Bytes in image                 */
+    unsigned char image[RCX_FIRMWARE_SIZE];
+} rcx_firmware_t;
+
+
+/**************************************************************/
+/*********************** Prototypes ***************************/
+/**************************************************************/
+
+/*************************************************************
+* rcx_firmware_parse reads an image from S-records. The      *
+* checksum of each record is checked. Header (S0) and count  *
+* (S5, S6) records are skipped, as are empty lines.          *
+*                                                            *
+* Input:  text          The S-records                        *
+*         size          Number of characters in text         *
+*                                                            *
+* Output: firmware      The image                            *
+*                                                            *
+* Return: RCX_OK               Image read                    *
+*         RCX_E_FIRMWARE_FILE  Not S-records, a bad checksum,*
+*                              or data outside the image     *
+*************************************************************/
+int rcx_firmware_parse(const char* text, int size,
+                       rcx_firmware_t* firmware);
+
+
+
+/*************************************************************
+* rcx_firmware_load reads an image from an S-record file,    *
+* see rcx_firmware_parse().                                  *
+*                                                            *
+* Input:  path          Path of the file                     *
+*                                                            *
+* Output: firmware      The image                            *
+*                                                            *
+* Return: RCX_OK               Image read                    *
+*         RCX_E_FIRMWARE_FILE  File cannot be read, or is    *
+*                              not an image                  *
+*************************************************************/
+int rcx_firmware_load(const char* path, rcx_firmware_t* firmware);
+
+
+
+/*************************************************************
+* rcx_firmware_checksum returns the checksum the RCX checks  *
+* the downloaded image with: the sum of the bytes below      *
+* RCX_FIRMWARE_SUM_END, in 16 bits.                          *
+*                                                            *
+* Input:  firmware      The image                            *
+*                                                            *
+* Return: The checksum                                       *
+*************************************************************/
+int rcx_firmware_checksum(const rcx_firmware_t* firmware);
+
+
+
+/*************************************************************
+* rcx_firmware_block_size chooses the data bytes per         *
+* transfer that make a download the shortest. Large blocks   *
+* spend less time on headers and replies, small ones lose    *
+* less when a byte is corrupted. The image is split in       *
+* blocks of equal size, so the last one is not a short one.  *
+*                                                            *
+* Input:  length        Bytes in the image                   *
+*         error_ppm     Bytes corrupted on the link, per     *
+*                       million                              *
+*                                                            *
+* Return: Block size, from RCX_FIRMWARE_BLOCK_MIN up to      *
+*         RCX_FIRMWARE_BLOCK_MAX                             *
+*************************************************************/
+int rcx_firmware_block_size(int length, int error_ppm);
+
+#else
+#error -- rcxfirm.h -- included twice, or more...
+#endif /* _RCXFIRM_H */
@@ -0,0 +1,257 @@
+/***************************************************************
+*                                                              *
+* rcxird.h                                                     *
+*                                                              *
+* Description:                                                 *
+* rcxird shares one device among the processes of a host. The  *
+* server owns the device, and takes clients on a Unix domain   *
+* socket. A client sends commands and packets through it,      *
+* without opening and resetting the device itself.             *
+*                                                              *
+* A frame on the socket is a 4 byte header and its payload:    *
+*                                                              *
+*   type     RCX_IRD_xxx                                       *
+*   tag      Chosen by the client, returned in the reply       *
+*   length   Bytes of payload, 2 bytes, low byte first         *
+*                                                              *
+* A client sends RCX_IRD_COMMAND, RCX_IRD_SEND and             *
+* RCX_IRD_SUBSCRIBE frames. Each is answered by an             *
+* RCX_IRD_REPLY frame with the same tag. Its payload is the    *
+* RCX_OK or RCX_E_xxx result as a signed byte, followed by the *
+* reply of the RCX to a command. A client that subscribed gets *
+* the packets nobody asked for as RCX_IRD_PACKET frames.       *
+*                                                              *
+* The device is given to the clients with requests in turn,    *
+* one request each, so a busy client cannot starve the others. *
+* A packet that comes in while a command waits for its reply   *
+* goes to the subscribers once the command is done.            *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#ifndef _RCXIRD_H
+#define _RCXIRD_H
+
+/**************************************************************/
+/************************ Defines  ****************************/
+/**************************************************************/
+
+/* Environment variable with the path of the socket */
+#define RCX_IRD_ENV             "RCXIRD_SOCKET"
+
+/* Socket, if RCXIRD_SOCKET is not set */
+#define RCX_IRD_SOCKET          "/tmp/rcxird"
+
+/* Frame types, client to server */
+#define RCX_IRD_COMMAND         (0x01)  /* Command, wait for reply  */
+#define RCX_IRD_SEND            (0x02)  /* Packet, no reply         */
+#define RCX_IRD_SUBSCRIBE       (0x03)  /* Payload 1 or 0: on, off  */
+
+/* Frame types, server to client */
+#define RCX_IRD_REPLY           (0x81)  /* Result, and RCX reply    */
+#define RCX_IRD_PACKET          (0x82)  /* Packet nobody asked for  */
+
+#define RCX_IRD_HEADER          (4)     /* Bytes of a frame header  */
+#define RCX_IRD_PAYLOAD         (257)   /* Largest payload: result  */
+                                        /* and RCX_PARSER_SIZE      */
+
+#define RCX_IRD_CLIENTS         (32)    /* Clients at the same time */
+#define RCX_IRD_QUEUE           (8)     /* Requests of a client in  */
+                                        /* the server               */
+#define RCX_IRD_STASH           (16)    /* Packets a client keeps,  */
+                                        /* see rcx_ird_receive(),   */
+                                        /* and the server during a  */
+                                        /* command                  */
+
+/* Time the server listens for packets between requests, in ms */
+#define RCX_IRD_LISTEN_TIME     (5)
+
+
+/**************************************************************/
+/************************* Types ******************************/
+/**************************************************************/
+
+struct rcx_handle;
+
+/* A server, see rcx_ird_server_create() */
+typedef struct rcx_ird_server rcx_ird_server_t;
+
+/* A connection to a server, see rcx_ird_connect() */
+typedef struct rcx_ird_client rcx_ird_client_t;
+
+
+/**************************************************************/
+/*********************** Prototypes ***************************/
+/**************************************************************/
+
+/*************************************************************
+* rcx_ird_server_create binds the socket of a server for a   *
+* device. A socket file at the path that no server answers  *
+* on is replaced.                                            *
+*                                                            *
+* Input:  handle        Device the server owns               *
+*         path          Path of the socket, NULL for the     *
+*                       default, see RCX_IRD_ENV             *
+*                                                            *
+* Output: server        The server                           *
+*                                                            *
+* Return: RCX_OK                 Server created              *
+*         RCX_E_BAD_ARGUMENT     Path too long               *
+*         RCX_E_DEVICE_IS_OPEN   A server runs on the path   *
+*         RCX_E_DEVICE_ERROR     Socket cannot be bound      *
+*         RCX_E_PROGRAM_FAILURE  Out of memory               *
+*************************************************************/
+int rcx_ird_server_create(struct rcx_handle* handle, const char* path,
+                          rcx_ird_server_t** server);
+
+
+
+/*************************************************************
+* rcx_ird_server_run serves the clients until                *
+* rcx_ird_server_stop() is called. The requests run in a     *
+* thread of the server, which listens for packets to the     *
+* subscribers while there are no requests. Meanwhile it      *
+* takes the packets the commands skip, see                   *
+* rcx_set_unsolicited().                                     *
+*                                                            *
+* Input:  server        The server                           *
+*                                                            *
+* Return: RCX_OK                 Stopped                     *
+*         RCX_E_DEVICE_ERROR     Socket failed               *
+*         RCX_E_PROGRAM_FAILURE  Cannot start the thread     *
+*************************************************************/
+int rcx_ird_server_run(rcx_ird_server_t* server);
+
+
+
+/*************************************************************
+* rcx_ird_server_stop makes rcx_ird_server_run() return.     *
+* It may be called from any thread, and from a signal        *
+* handler.                                                   *
+*                                                            *
+* Input:  server        The server                           *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_ird_server_stop(rcx_ird_server_t* server);
+
+
+
+/*************************************************************
+* rcx_ird_server_destroy closes the clients and the socket,  *
+* and removes the socket file. The device stays open.        *
+*                                                            *
+* Input:  server        The server, not running              *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_ird_server_destroy(rcx_ird_server_t* server);
+
+
+
+/*************************************************************
+* rcx_ird_connect connects to a server. A connection may be  *
+* used by one thread at a time.                              *
+*                                                            *
+* Input:  path          Path of the socket, NULL for the     *
+*                       default, see RCX_IRD_ENV             *
+*                                                            *
+* Output: client        The connection                       *
+*                                                            *
+* Return: RCX_OK                 Connected                   *
+*         RCX_E_DEVICE_NOT_FOUND No server at the path       *
+*         RCX_E_PROGRAM_FAILURE  Out of memory               *
+*************************************************************/
+int rcx_ird_connect(const char* path, rcx_ird_client_t** client);
+
+
+
+/*************************************************************
+* rcx_ird_command runs a command on the device of the        *
+* server, see rcx_command().                                 *
+*                                                            *
+* Input:  client        The connection                       *
+*         buf           Command bytes                        *
+*         buf_size      Size of buf                          *
+*         buf_len       Number of command bytes              *
+*                                                            *
+* Output: buf           The reply                            *
+*         buf_len       Number of reply bytes                *
+*                                                            *
+* Return: See rcx_command(), and:                            *
+*         RCX_E_QUEUE_FULL       Too many requests queued    *
+*         RCX_E_DEVICE_ERROR     Connection lost             *
+*************************************************************/
+int rcx_ird_command(rcx_ird_client_t* client, unsigned char* buf,
+                    int buf_size, int* buf_len);
+
+
+
+/*************************************************************
+* rcx_ird_send sends a packet on the device of the server,   *
+* see rcx_send().                                            *
+*                                                            *
+* Input:  client        The connection                       *
+*         buf           Packet bytes                         *
+*         buf_len       Number of bytes                      *
+*                                                            *
+* Return: See rcx_send(), and:                               *
+*         RCX_E_QUEUE_FULL       Too many requests queued    *
+*         RCX_E_DEVICE_ERROR     Connection lost             *
+*************************************************************/
+int rcx_ird_send(rcx_ird_client_t* client, unsigned char* buf,
+                 int buf_len);
+
+
+
+/*************************************************************
+* rcx_ird_subscribe selects whether the client gets the      *
+* packets nobody asked for, see rcx_ird_receive().           *
+*                                                            *
+* Input:  client        The connection                       *
+*         on            1 to get them, 0 not to              *
+*                                                            *
+* Return: RCX_OK                 Selected                    *
+*         RCX_E_DEVICE_ERROR     Connection lost             *
+*************************************************************/
+int rcx_ird_subscribe(rcx_ird_client_t* client, int on);
+
+
+
+/*************************************************************
+* rcx_ird_receive takes the next packet nobody asked for.    *
+* Packets that came in while the client waited for a reply   *
+* are kept, up to RCX_IRD_STASH; the oldest are dropped.     *
+*                                                            *
+* Input:  client        The connection                       *
+*         buf_size      Size of buf                          *
+*         timeout       Time to wait in ms, 0 to poll        *
+*                                                            *
+* Output: buf           The packet                           *
+*         buf_len       Number of bytes                      *
+*                                                            *
+* Return: RCX_OK                 Packet taken                *
+*         RCX_E_RECV_NOTHING     No packet in time           *
+*         RCX_E_DEVICE_ERROR     Connection lost             *
+*************************************************************/
+int rcx_ird_receive(rcx_ird_client_t* client, unsigned char* buf,
+                    int buf_size, int* buf_len, int timeout);
+
+
+
+/*************************************************************
+* rcx_ird_close closes a connection.                         *
+*                                                            *
+* Input:  client        The connection                       *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_ird_close(rcx_ird_client_t* client);
+
+#else
+#error -- rcxird.h -- included twice, or more...
+#endif /* _RCXIRD_H */
@@ -0,0 +1,160 @@
+/***************************************************************
+*                                                              *
+* rcxmotor.h                                                   *
+*                                                              *
+* Description:                                                 *
+* A queue in front of rcx_command() for input that comes       *
+* faster than the IR link takes it, like keys held down in a   *
+* remote control program. A thread of the queue sends the      *
+* commands in turn.                                            *
+*                                                              *
+* Motor commands supersede: a command for an output and a      *
+* class (on/off/float, direction, power) that is still in the  *
+* queue is replaced by a newer one for the same output and     *
+* class, so only the latest intent goes on the air. It keeps   *
+* the place of the one it replaces, which bounds the time a    *
+* motor takes to follow the input. Outputs with the same       *
+* intent are sent in one command.                              *
+*                                                              *
+* Other commands are sent as they are, in order. A motor       *
+* command is not moved ahead of one of them, nor is a flip of  *
+* the direction merged, as two flips do not make one.          *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#ifndef _RCXMOTOR_H
+#define _RCXMOTOR_H
+
+/**************************************************************/
+/************************ Defines  ****************************/
+/**************************************************************/
+
+/* Motor commands of the RCX */
+#define RCX_MOTOR_ONOFF         (0x21)  /* Motors | RCX_MOTOR_xxx   */
+#define RCX_MOTOR_DIRECTION     (0xe1)  /* Motors | RCX_MOTOR_xxx   */
+#define RCX_MOTOR_POWER         (0x13)  /* Motors, source, power    */
+
+/* Outputs, or'ed in the motor list */
+#define RCX_MOTOR_A             (0x01)
+#define RCX_MOTOR_B             (0x02)
+#define RCX_MOTOR_C             (0x04)
+#define RCX_MOTOR_OUTPUTS       (3)
+
+/* Modes of RCX_MOTOR_ONOFF and RCX_MOTOR_DIRECTION */
+#define RCX_MOTOR_FLOAT         (0x00)
+#define RCX_MOTOR_OFF           (0x40)
+#define RCX_MOTOR_ON            (0x80)
+#define RCX_MOTOR_BACKWARD      (0x00)
+#define RCX_MOTOR_FLIP          (0x40)
+#define RCX_MOTOR_FORWARD       (0x80)
+
+#define RCX_MOTOR_QUEUE         (32)    /* Commands in the queue    */
+#define RCX_MOTOR_SIZE          (16)    /* Bytes of a command       */
+
+
+/**************************************************************/
+/************************* Types ******************************/
+/**************************************************************/
+
+struct rcx_handle;
+
+/* A queue, see rcx_motor_create() */
+typedef struct rcx_motor rcx_motor_t;
+
+/* Counters of a queue, see rcx_motor_get_stats(). submitted, */
+/* dropped and merged count a motor command once per output.   */
+typedef struct rcx_motor_stats
+{
+    unsigned long submitted;    /* Commands given to the queue    */
+    unsigned long sent;         /* Commands sent to the RCX       */
+    unsigned long dropped;      /* Commands for an output that    */
+                                /* were replaced before sent      */
+    unsigned long merged;       /* Commands for an output sent in */
+                                /* the command of another         */
+    unsigned long errors;       /* Commands that failed           */
+    long          latency_max;  /* Longest time from the input to */
+    long          latency_total;/* the reply, and all, in us      */
+} rcx_motor_stats_t;
+
+
+/**************************************************************/
+/*********************** Prototypes ***************************/
+/**************************************************************/
+
+/*************************************************************
+* rcx_motor_create creates an empty queue for a device, and  *
+* starts its thread.                                         *
+*                                                            *
+* Input:  handle        Device the commands are sent on      *
+*                                                            *
+* Output: motor         The queue                            *
+*                                                            *
+* Return: RCX_OK                 Queue created               *
+*         RCX_E_PROGRAM_FAILURE  Out of memory, or no thread *
+*************************************************************/
+int rcx_motor_create(struct rcx_handle* handle, rcx_motor_t** motor);
+
+
+
+/*************************************************************
+* rcx_motor_destroy stops the thread of a queue, and frees   *
+* it. Commands still in the queue are not sent, see          *
+* rcx_motor_flush().                                         *
+*                                                            *
+* Input:  motor         The queue                            *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_motor_destroy(rcx_motor_t* motor);
+
+
+
+/*************************************************************
+* rcx_motor_submit puts a command in the queue, or replaces  *
+* the commands it supersedes. It does not wait for the RCX.  *
+* May be called from any thread.                             *
+*                                                            *
+* Input:  motor         The queue                            *
+*         buf           Command bytes, see rcx_command()     *
+*         buf_len       Number of command bytes              *
+*                                                            *
+* Return: RCX_OK                 Queued                      *
+*         RCX_E_BAD_ARGUMENT     No bytes, or too many       *
+*         RCX_E_QUEUE_FULL       No room in the queue        *
+*************************************************************/
+int rcx_motor_submit(rcx_motor_t* motor, const unsigned char* buf,
+                     int buf_len);
+
+
+
+/*************************************************************
+* rcx_motor_flush waits until the commands in the queue are  *
+* sent, and answered.                                        *
+*                                                            *
+* Input:  motor         The queue                            *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_motor_flush(rcx_motor_t* motor);
+
+
+
+/*************************************************************
+* rcx_motor_get_stats returns the counters of a queue.       *
+*                                                            *
+* Input:  motor         The queue                            *
+*                                                            *
+* Output: stats         The counters                         *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_motor_get_stats(rcx_motor_t* motor, rcx_motor_stats_t* stats);
+
+#else
+#error -- rcxmotor.h -- included twice, or more...
+#endif /* _RCXMOTOR_H */
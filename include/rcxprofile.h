@@ -0,0 +1,80 @@
+/***************************************************************
+*                                                              *
+* rcxprofile.h                                                 *
+*                                                              *
+* Description:                                                 *
+* Timing values found by rcx_calibrate(), kept in a file per   *
+* user, so the next rcx_open() on the same host and device     *
+* starts with them.                                            *
+*                                                              *
+* The file is $RCX_PROFILE, or else $HOME/.rcxprofile. It      *
+* holds a line per host and device:                            *
+*                                                              *
+*   # host device bit_period mark_adjust space_adjust          *
+*   mylaptop /dev/lirc 417 28 140                              *
+*                                                              *
+* Lines of other hosts are kept, so a home directory can be    *
+* shared.                                                      *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#ifndef _RCXPROFILE_H
+#define _RCXPROFILE_H
+
+/**************************************************************/
+/************************ Defines  ****************************/
+/**************************************************************/
+
+/* Environment variable with the path of the profile file */
+#define RCX_PROFILE_ENV         "RCX_PROFILE"
+
+/* File in the home directory, if RCX_PROFILE is not set */
+#define RCX_PROFILE_FILE        ".rcxprofile"
+
+
+/**************************************************************/
+/*********************** Prototypes ***************************/
+/**************************************************************/
+
+/*************************************************************
+* rcx_profile_load looks up the timing values of this host   *
+* and a device.                                              *
+*                                                            *
+* Input:  device        Path of the device                   *
+*                                                            *
+* Output: bit_period    See lirc_profile_init()              *
+*         mark_adjust                                        *
+*         space_adjust                                       *
+*                                                            *
+* Return: 1             Timing values found                  *
+*         0             None, or no profile file             *
+*************************************************************/
+int rcx_profile_load(const char* device, int* bit_period,
+                     int* mark_adjust, int* space_adjust);
+
+
+
+/*************************************************************
+* rcx_profile_save stores the timing values of this host and *
+* a device, in place of the old ones. The file is replaced   *
+* as a whole, so a reader never sees it half written.        *
+*                                                            *
+* Input:  device        Path of the device                   *
+*         bit_period    See lirc_profile_init()              *
+*         mark_adjust                                        *
+*         space_adjust                                       *
+*                                                            *
+* Return: RCX_OK              Timing values stored           *
+*         RCX_E_PROFILE_FILE  File cannot be written         *
+*************************************************************/
+int rcx_profile_save(const char* device, int bit_period,
+                     int mark_adjust, int space_adjust);
+
+#else
+#error -- rcxprofile.h -- included twice, or more...
+#endif /* _RCXPROFILE_H */
@@ -0,0 +1,103 @@
+/***************************************************************
+*                                                              *
+* rcxring.h                                                    *
+*                                                              *
+* Description:                                                 *
+* Lock-free byte ring for a single producer and a single       *
+* consumer thread. The producer only writes 'head', the        *
+* consumer only writes 'tail', so neither needs a lock.        *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#ifndef _RCXRING_H
+#define _RCXRING_H
+
+/**************************************************************/
+/************************ Defines  ****************************/
+/**************************************************************/
+
+/* Size of the ring in bytes, must be a power of two */
+#define RCX_RING_SIZE           4096
+
+
+/**************************************************************/
+/************************* Types ******************************/
+/**************************************************************/
+
+/* The counters run freely, and wrap around. The number of    */
+/* bytes in the ring is head-tail.                            */
+typedef struct rcx_ring
+{
+    unsigned int  head;               /* Written by producer */
+    unsigned int  tail;               /* Written by consumer */
+    unsigned char buf[RCX_RING_SIZE];
+} rcx_ring_t;
+
+
+/**************************************************************/
+/*********************** Prototypes ***************************/
+/**************************************************************/
+
+/*************************************************************
+* rcx_ring_init empties a ring. No thread may use the ring   *
+* at the same time.                                          *
+*                                                            *
+* Output: ring      The ring to initialize                   *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_ring_init(rcx_ring_t* ring);
+
+
+
+/*************************************************************
+* rcx_ring_put adds bytes to the ring. Only the producer     *
+* thread may call this function.                             *
+*                                                            *
+* Input:  buf       Bytes to add                             *
+*         len       Number of bytes in buf                   *
+*                                                            *
+* In/Out: ring      The ring                                 *
+*                                                            *
+* Return: >= 0      Number of bytes added. Less than len if  *
+*                   the ring is full.                        *
+*************************************************************/
+int rcx_ring_put(rcx_ring_t* ring, const unsigned char* buf, int len);
+
+
+
+/*************************************************************
+* rcx_ring_get takes bytes from the ring, without waiting.   *
+* Only the consumer thread may call this function.           *
+*                                                            *
+* Input:  size      Size of buf                              *
+*                                                            *
+* Output: buf       The bytes taken from the ring            *
+*                                                            *
+* In/Out: ring      The ring                                 *
+*                                                            *
+* Return: >= 0      Number of bytes taken, 0 if the ring is  *
+*                   empty                                    *
+*************************************************************/
+int rcx_ring_get(rcx_ring_t* ring, unsigned char* buf, int size);
+
+
+
+/*************************************************************
+* rcx_ring_count returns the number of bytes in the ring.    *
+* Seen from the other thread, it is a snapshot.              *
+*                                                            *
+* Input:  ring      The ring                                 *
+*                                                            *
+* Return: >= 0      Number of bytes in the ring              *
+*************************************************************/
+int rcx_ring_count(rcx_ring_t* ring);
+
+#else
+#error -- rcxring.h -- included twice, or more...
+#endif /* _RCXRING_H */
@@ -0,0 +1,191 @@
+/***************************************************************
+*                                                              *
+* rcxtelem.h                                                   *
+*                                                              *
+* Description:                                                 *
+* A cache of the values of an RCX: sensors, variables, timers  *
+* and the battery. A value that was polled less than its time  *
+* to live ago is taken from the cache, without a command on    *
+* the IR link. Threads that ask for a value while it is polled *
+* wait for that poll, instead of sending the command again.    *
+*                                                              *
+* The time to live of a value follows how fast it changes:     *
+* when a poll finds it changed, the time is halved, when it    *
+* did not, it is doubled, within the range of its source, see  *
+* rcx_telem_set_ttl(). A value may be that old when it is      *
+* taken from the cache.                                        *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#ifndef _RCXTELEM_H
+#define _RCXTELEM_H
+
+/**************************************************************/
+/************************ Defines  ****************************/
+/**************************************************************/
+
+/* Sources, as of the 'Get value' command of the RCX (0x12) */
+#define RCX_TELEM_VARIABLE      (   0)  /* Argument 0..31           */
+#define RCX_TELEM_TIMER         (   1)  /* Argument 0..3            */
+#define RCX_TELEM_SENSOR        (   9)  /* Argument 0..2            */
+#define RCX_TELEM_SENSOR_RAW    (  12)  /* Argument 0..2            */
+#define RCX_TELEM_SENSOR_BOOL   (  13)  /* Argument 0..2            */
+
+/* Not a source of the RCX: 'Get battery power' (0x30), in mV */
+#define RCX_TELEM_BATTERY       ( 256)
+#define RCX_TELEM_SOURCES       ( 257)
+
+/* Values cached at the same time */
+#define RCX_TELEM_ENTRIES       (  64)
+
+/* Default range of the time to live, in ms */
+#define RCX_TELEM_TTL_MIN       ( 100)
+#define RCX_TELEM_TTL_MAX       (2000)
+#define RCX_TELEM_SENSOR_MIN    (  50)  /* All sensor sources       */
+#define RCX_TELEM_SENSOR_MAX    ( 800)
+#define RCX_TELEM_BATTERY_MIN   (10000)
+#define RCX_TELEM_BATTERY_MAX   (60000)
+
+
+/**************************************************************/
+/************************* Types ******************************/
+/**************************************************************/
+
+struct rcx_handle;
+
+/* A cache, see rcx_telem_create() */
+typedef struct rcx_telem rcx_telem_t;
+
+/* Counters of a cache, see rcx_telem_get_stats() */
+typedef struct rcx_telem_stats
+{
+    unsigned long hits;         /* Values taken from the cache    */
+    unsigned long polls;        /* Commands sent                  */
+    unsigned long merged;       /* Waited for the poll of another */
+    unsigned long changes;      /* Polls that found a new value   */
+    unsigned long errors;       /* Polls that failed              */
+    unsigned long evictions;    /* Values dropped for room        */
+} rcx_telem_stats_t;
+
+
+/**************************************************************/
+/*********************** Prototypes ***************************/
+/**************************************************************/
+
+/*************************************************************
+* rcx_telem_create creates an empty cache for a device. The  *
+* time to live of each source has its default range.         *
+*                                                            *
+* Input:  handle        Device the values are polled on      *
+*                                                            *
+* Output: telem         The cache                            *
+*                                                            *
+* Return: RCX_OK                 Cache created               *
+*         RCX_E_PROGRAM_FAILURE  Out of memory               *
+*************************************************************/
+int rcx_telem_create(struct rcx_handle* handle, rcx_telem_t** telem);
+
+
+
+/*************************************************************
+* rcx_telem_destroy frees a cache. No thread may use it.     *
+*                                                            *
+* Input:  telem         The cache                            *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_telem_destroy(rcx_telem_t* telem);
+
+
+
+/*************************************************************
+* rcx_telem_set_ttl sets the range of the time to live of    *
+* the values of a source. Values in the cache keep their     *
+* time until they are polled again.                          *
+*                                                            *
+* Input:  telem         The cache                            *
+*         source        RCX_TELEM_xxx, or another source of  *
+*                       the 'Get value' command              *
+*         ttl_min       Shortest time to live, in ms; 0      *
+*                       polls a value that changed each time *
+*         ttl_max       Longest time to live, in ms          *
+*                                                            *
+* Return: RCX_OK                 Range set                   *
+*         RCX_E_BAD_ARGUMENT     Unknown source, or a bad    *
+*                                range                       *
+*************************************************************/
+int rcx_telem_set_ttl(rcx_telem_t* telem, int source, int ttl_min,
+                      int ttl_max);
+
+
+
+/*************************************************************
+* rcx_telem_get takes a value from the cache, or polls it    *
+* with rcx_command() when it is older than its time to live. *
+* May be called from any thread.                             *
+*                                                            *
+* Input:  telem         The cache                            *
+*         source        RCX_TELEM_xxx, or another source of  *
+*                       the 'Get value' command              *
+*         argument      Number of the sensor, variable, ...; *
+*                       0 for RCX_TELEM_BATTERY              *
+*                                                            *
+* Output: value         The value                            *
+*                                                            *
+* Return: RCX_OK                 Value taken                 *
+*         RCX_E_BAD_ARGUMENT     Unknown source or argument  *
+*         RCX_E_RECV_ERROR       Reply too short             *
+*         See rcx_command() for the errors of a poll. A      *
+*         thread that waited for the poll gets its error too.*
+*************************************************************/
+int rcx_telem_get(rcx_telem_t* telem, int source, int argument,
+                  int* value);
+
+
+
+/*************************************************************
+* rcx_telem_ttl returns the time to live a value has now.    *
+*                                                            *
+* Input:  telem         The cache                            *
+*         source        See rcx_telem_get()                  *
+*         argument      See rcx_telem_get()                  *
+*                                                            *
+* Return: >=0                    Time to live, in ms         *
+*         RCX_E_BAD_ARGUMENT     Value not in the cache      *
+*************************************************************/
+int rcx_telem_ttl(rcx_telem_t* telem, int source, int argument);
+
+
+
+/*************************************************************
+* rcx_telem_flush drops all values, so each is polled when   *
+* asked for next, e.g. after a program of the RCX changed    *
+* its variables. Polls in progress are finished.             *
+*                                                            *
+* Input:  telem         The cache                            *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_telem_flush(rcx_telem_t* telem);
+
+
+
+/*************************************************************
+* rcx_telem_get_stats returns the counters of a cache.       *
+*                                                            *
+* Input:  telem         The cache                            *
+*                                                            *
+* Output: stats         The counters                         *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_telem_get_stats(rcx_telem_t* telem, rcx_telem_stats_t* stats);
+
+#else
+#error -- rcxtelem.h -- included twice, or more...
+#endif /* _RCXTELEM_H */
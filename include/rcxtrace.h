@@ -0,0 +1,115 @@
+/***************************************************************
+*                                                              *
+* rcxtrace.h                                                   *
+*                                                              *
+* Description:                                                 *
+* Binary trace of the library. The debug and error messages of *
+* verbose.h are recorded as fixed-size events in a ring per    *
+* thread, instead of being printed. Recording an event takes a *
+* clock read and a few stores, without locks or system calls,  *
+* so tracing can stay on. The rings are formatted on demand by *
+* rcx_trace_dump().                                            *
+*                                                              *
+* Which events are compiled in is chosen by APP_PRINT_DEBUG    *
+* and APP_PRINT_ERROR, see verbose.h. Which of those are       *
+* recorded is chosen at runtime, with rcx_trace_level() or the *
+* RCX_TRACE environment variable (a level number). The         *
+* variable is read when the library is loaded; a call of       *
+* rcx_trace_level() takes precedence over it.                  *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#ifndef _RCXTRACE_H
+#define _RCXTRACE_H
+
+#include <stdio.h>
+
+/**************************************************************/
+/************************ Defines  ****************************/
+/**************************************************************/
+
+/* Trace levels. Events up to the current level are recorded. */
+#define RCX_TRACE_OFF           (   0)
+#define RCX_TRACE_ERROR         (   1)  /* Errors (default)         */
+#define RCX_TRACE_DEBUG         (   2)  /* Calls and decisions      */
+#define RCX_TRACE_DATA          (   3)  /* Every byte decoded       */
+
+/* Number of events kept per thread. The oldest are overwritten. */
+#define RCX_TRACE_EVENTS        (1024)
+
+
+/**************************************************************/
+/************************* Types ******************************/
+/**************************************************************/
+
+/* An event. The strings are literals of the library, so only */
+/* their addresses are recorded.                              */
+typedef struct rcx_trace_event
+{
+    long long     time;         /* CLOCK_MONOTONIC, in ns         */
+    const char*   file;         /* Source file                    */
+    const char*   function;     /* Function name                  */
+    const char*   format;       /* printf() format, one int arg   */
+    int           arg;          /* The argument of the format     */
+    short         line;         /* Source line                    */
+    short         level;        /* RCX_TRACE_xxx                  */
+} rcx_trace_event_t;
+
+/* Current level. Read by the verbose.h macros before each     */
+/* event; set it with rcx_trace_level().                       */
+extern int rcx_trace_current;
+
+
+/**************************************************************/
+/*********************** Prototypes ***************************/
+/**************************************************************/
+
+/*************************************************************
+* rcx_trace_level selects the events that are recorded from  *
+* now on.                                                    *
+*                                                            *
+* Input:  level     RCX_TRACE_xxx level                      *
+*                                                            *
+* Return: The previous level                                 *
+*************************************************************/
+int rcx_trace_level(int level);
+
+
+
+/*************************************************************
+* rcx_trace_event records an event in the ring of the        *
+* calling thread. Use the macros of verbose.h instead.       *
+*                                                            *
+* Input:  level     RCX_TRACE_xxx level of the event         *
+*         file      Source file, a string literal            *
+*         line      Source line                              *
+*         function  Function name, __func__                  *
+*         format    printf() format, a string literal        *
+*         arg       Argument of the format                   *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_trace_event(int level, const char* file, int line,
+                     const char* function, const char* format, int arg);
+
+
+
+/*************************************************************
+* rcx_trace_dump formats the events of all threads, oldest   *
+* first. Threads go on recording while this runs; events     *
+* they overwrite in the meantime are left out.               *
+*                                                            *
+* Input:  out       Stream to write to                       *
+*                                                            *
+* Return: Number of events written                           *
+*************************************************************/
+int rcx_trace_dump(FILE* out);
+
+#else
+#error -- rcxtrace.h -- included twice, or more...
+#endif /* _RCXTRACE_H */
@@ -4,6 +4,8 @@
 *                                                              *
 * Description:                                                 *
 * Headerfile which is used to display debug and error messages *
+* The messages are recorded in the trace rings of rcxtrace.h,  *
+* and shown by rcx_trace_dump().                               *
 *                                                              *
 * Author:                                                      *
 * begin      Wed Nov 27 2002                                   *
@@ -24,7 +26,7 @@
 #ifndef _VERBOSE_H
 #define _VERBOSE_H
 
-/* Automatically print errors if debugging is enabled */
+/* Automatically trace errors if debugging is enabled */
 #ifdef APP_PRINT_DEBUG
 #  define APP_PRINT_ERROR
 #endif
@@ -35,31 +37,40 @@
 #  define APP_PRINT_ENABLE
 #endif
 
-#define APP_SOURCE            " " __FILE__ ":" __FUNCTION__ "()\t"
-
+/* The messages are events in the trace rings, see rcxtrace.h. */
+/* Recording is checked against the level set at runtime.      */
 #ifdef APP_PRINT_ENABLE
-#  include <stdio.h>
-#  define APP_FLUSH           fflush(stderr);
-#else
-#  define APP_FLUSH           ;
+#  include "rcxtrace.h"
+#  define APP_TRACE(level,str,arg) \
+          do { \
+              if ((level)<=__atomic_load_n(&rcx_trace_current, \
+                                           __ATOMIC_RELAXED)) \
+              { \
+                  rcx_trace_event((level), __FILE__, __LINE__, __func__, \
+                                  (str), (int) (arg)); \
+              } \
+          } while (0)
 #endif
 
+/* Nothing is buffered anymore */
+#define APP_FLUSH             ;
+
 #ifdef APP_PRINT_ERROR
-#  define APP_ERROR(str)      fprintf(stderr, "ERROR:" \
-                                      APP_SOURCE str "!\n");APP_FLUSH
+#  define APP_ERROR(str)      APP_TRACE(RCX_TRACE_ERROR, str, 0)
 #else
 #  define APP_ERROR(str)      ;
 #endif
 
 #ifdef APP_PRINT_DEBUG
-#  define APP_PRINT(str)      fprintf(stderr, str)
-#  define APP_PRINT2(str,arg) fprintf(stderr, str, arg)
-#  define APP_DEBUG(str)      fprintf(stderr, "DEBUG:" \
-                                      APP_SOURCE str ".\n");APP_FLUSH
+#  define APP_PRINT(str)      APP_TRACE(RCX_TRACE_DEBUG, str, 0)
+#  define APP_PRINT2(str,arg) APP_TRACE(RCX_TRACE_DEBUG, str, arg)
+#  define APP_DEBUG(str)      APP_TRACE(RCX_TRACE_DEBUG, str, 0)
+#  define APP_DATA(str,arg)   APP_TRACE(RCX_TRACE_DATA, str, arg)
 #else
 #  define APP_PRINT(str)      ;
 #  define APP_PRINT2(str,arg) ;
 #  define APP_DEBUG(str)      ;
+#  define APP_DATA(str,arg)   ;
 #endif
 
 #else
@@ -0,0 +1,181 @@
+package jnilirc;
+/***************************************************************
+*                                                              *
+* BenchRcxIr.java                                              *
+*                                                              *
+* Description:                                                 *
+* Pings the RCX through JniRcxIr, and shows the calls per      *
+* second of the two ways to do it:                             *
+*                                                              *
+* 'write'    The raw packet is written byte by byte, one       *
+*            native call per byte, and the reply is polled     *
+*            for with read()                                   *
+* 'command'  command() sends the packet and receives the       *
+*            reply in a single native call                     *
+*                                                              *
+* Usage: java jnilirc.BenchRcxIr [calls]                       *
+*                                                              *
+* Output is one line per path, and one of the statistics of    *
+* the link at the end, as key=value pairs, like the benchmarks *
+* of librcx.                                                   *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+public class BenchRcxIr
+{
+	/**
+	 * Ping; raw packets flip the toggle bit themselves, as the
+	 * RCX does not run an opcode that equals the one before
+	 */
+	private static final byte PING			= 0x10;
+	private static final byte TOGGLE		= 0x08;
+
+	/**
+	 * Time to wait for a reply in the 'write' path, in ms
+	 */
+	private static final long REPLY_TIME	= 1000;
+
+	private static final int CALLS			= 100;
+
+	/**
+	 * Ping with the raw packet, byte by byte
+	 */
+	private static boolean pingWrite(JniRcxIr rcx, byte opcode)
+	{
+		byte packet[] = { (byte) 0x55, (byte) 0xff, 0x00,
+			opcode, (byte) ~opcode, opcode, (byte) ~opcode };
+		byte reply[] = { (byte) 0x55, (byte) 0xff, 0x00,
+			(byte) ~opcode, opcode, (byte) ~opcode, opcode };
+		byte received[] = new byte[64];
+		byte chunk[] = new byte[64];
+		int count = 0;
+		int n;
+		long stop;
+
+		if (rcx.write(packet, packet.length) != 0)
+		{
+			return false;
+		}
+
+		// The echo of the packet comes first, then the reply
+		stop = System.currentTimeMillis() + REPLY_TIME;
+		while (System.currentTimeMillis() < stop)
+		{
+			n = rcx.read(chunk);
+			if (n > 0)
+			{
+				n = Math.min(n, received.length - count);
+				System.arraycopy(chunk, 0, received, count, n);
+				count += n;
+				if (endsWith(received, count, reply))
+				{
+					return true;
+				}
+			}
+			else
+			{
+				Thread.yield();
+			}
+		}
+		return false;
+	}
+
+	/**
+	 * Ping with a single command() call
+	 */
+	private static boolean pingCommand(JniRcxIr rcx, byte buf[])
+	{
+		buf[0] = PING;
+		return (rcx.command(buf, 1) >= 1) && (buf[0] == (byte) ~PING);
+	}
+
+	private static boolean endsWith(byte buf[], int count, byte tail[])
+	{
+		int i;
+
+		if (count < tail.length)
+		{
+			return false;
+		}
+		for (i = 0; i < tail.length; i++)
+		{
+			if (buf[count - tail.length + i] != tail[i])
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	private static void run(JniRcxIr rcx, String path, int calls)
+	{
+		byte buf[] = new byte[32];
+		int failed = 0;
+		int i;
+		boolean ok;
+		long start;
+		long time;
+
+		start = System.currentTimeMillis();
+		for (i = 0; i < calls; i++)
+		{
+			if (path.equals("write"))
+			{
+				ok = pingWrite(rcx, (byte) ((i % 2 == 0) ? PING : PING | TOGGLE));
+			}
+			else
+			{
+				ok = pingCommand(rcx, buf);
+			}
+			if (!ok)
+			{
+				failed++;
+			}
+		}
+		time = System.currentTimeMillis() - start;
+
+		System.out.println("bench=jni path=" + path + " calls=" + calls +
+			" failed=" + failed + " ms_per_call=" + (time / calls) +
+			" calls_per_s=" + (calls * 1000L / Math.max(time, 1)));
+	}
+
+	private static void stats(JniRcxIr rcx)
+	{
+		long counters[] = rcx.stats();
+
+		if (counters == null)
+		{
+			return;
+		}
+		System.out.println("bench=jni path=stats" +
+			" bytes_sent=" + counters[JniRcxIr.STATS_BYTES_SENT] +
+			" packets_sent=" + counters[JniRcxIr.STATS_PACKETS_SENT] +
+			" bytes_received=" + counters[JniRcxIr.STATS_BYTES_RECEIVED] +
+			" packets_received=" +
+			counters[JniRcxIr.STATS_PACKETS_RECEIVED] +
+			" timeouts=" + counters[JniRcxIr.STATS_TIMEOUTS] +
+			" retries=" + counters[JniRcxIr.STATS_RETRIES]);
+	}
+
+	public static void main(String args[])
+	{
+		int calls = CALLS;
+		JniRcxIr rcx = new JniRcxIr();
+
+		if (args.length > 0)
+		{
+			calls = Integer.parseInt(args[0]);
+		}
+
+		rcx.open();
+		run(rcx, "write", calls);
+		run(rcx, "command", calls);
+		stats(rcx);
+		rcx.close();
+	}
+}
@@ -32,6 +32,33 @@ public class JniRcxIr
 	/**
 	 * -----------------------------
 	 */
+
+	/**
+	 * Indices of the counters returned by stats(), as the fields
+	 * of rcx_stats_t in rcx.h. The round trip times and the reply
+	 * wait times take STATS_BUCKETS entries each
+	 */
+	public static final int STATS_PARITY_ERRORS		= 0;
+	public static final int STATS_FRAMING_ERRORS	= 1;
+	public static final int STATS_BREAK_ERRORS		= 2;
+	public static final int STATS_COMPLEMENT_ERRORS	= 3;
+	public static final int STATS_CHECKSUM_ERRORS	= 4;
+	public static final int STATS_TIMEOUTS			= 5;
+	public static final int STATS_RETRIES			= 6;
+	public static final int STATS_BYTES_SENT		= 7;
+	public static final int STATS_BYTES_RECEIVED	= 8;
+	public static final int STATS_PACKETS_SENT		= 9;
+	public static final int STATS_PACKETS_RECEIVED	= 10;
+	public static final int STATS_BUCKETS			= 16;
+	public static final int STATS_COMMAND_TIME		= 11;
+	public static final int STATS_REPLY_WAIT		= 27;
+	public static final int STATS_RATE_FALLBACKS	= 43;
+	public static final int STATS_RATE_PROBES		= 44;
+	public static final int STATS_LATE_REPLIES		= 45;
+	public static final int STATS_LENGTH			= 46;
+	/**
+	 * -----------------------------
+	 */
 			
 	/**
 	 * Load library
@@ -73,6 +100,15 @@ public class JniRcxIr
    	 */
     public native int send(byte b[], int n);
     
+    /** Send a command to the RCX and receive its reply, in a single
+   	 * native call, see rcx_command() in rcx.h
+   	 * @param b command bytes, e.g 0x10 for ping; the reply is put
+   	 * in their place, starting with the inverted opcode
+   	 * @param n number of command bytes
+   	 * @return number of reply bytes, or the negative error number
+   	 */
+    public native int command(byte b[], int n);
+    
     /** Write low-level bytes to the tower, e.g 0xff550010ef10ef for ping
    	 * @param b bytes to send
    	 * @param n number of bytes
@@ -85,6 +121,34 @@ public class JniRcxIr
    	 * @return number of bytes read
    	 */
  	public native int read(byte b[]);
+
+    /** Start a native listener, which receives packets without
+   	 * polling. The packets received within 'window' ms of the first
+   	 * are handed to the listener in one call, from a thread of its
+   	 * own. A listener in place is stopped first. Commands wait
+   	 * while the listener receives, up to LIRC_REPLY_TIME
+   	 * @param listener takes the batches of packets
+   	 * @param window ms to collect packets, 0 to hand each at once
+   	 * @return error number or zero for success
+   	 */
+ 	public native int listen(RcxListener listener, int window);
+
+    /** Stop the listener, see listen(). It is stopped by close() as
+   	 * well. Cannot be called from the listener itself
+   	 * @return error number or zero for success
+   	 */
+ 	public native int unlisten();
+
+    /** Statistics of the link, see rcx_get_stats() in rcx.h
+   	 * @return STATS_LENGTH counters in the order of rcx_stats_t:
+   	 * parity, framing, break, complement and checksum errors,
+   	 * timeouts, retries, bytes sent, bytes received, packets sent,
+   	 * packets received, then 16 buckets of round trip times and 16
+   	 * of reply wait times, then the 4800 baud fallbacks and probes,
+   	 * and the late replies skipped; index them with the STATS_
+   	 * constants. null if the device is not open
+   	 */
+ 	public native long[] stats();
  	
  	public native void test();
  	
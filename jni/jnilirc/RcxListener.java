@@ -0,0 +1,27 @@
+package jnilirc;
+/***************************************************************
+*                                                              *
+* RcxListener.java                                             *
+*                                                              *
+* Description:                                                 *
+* Takes the packets received by the native listener, see       *
+* JniRcxIr.listen().                                           *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+public interface RcxListener
+{
+	/** A batch of packets, called from the listener thread. The
+	 * arrays are reused for the next batch, so copy what is kept.
+	 * @param data the packets, one after the other, each starting
+	 * with its opcode
+	 * @param lengths number of bytes of each packet
+	 * @param count number of packets
+	 */
+	public void received(byte data[], int lengths[], int count);
+}
@@ -24,11 +24,58 @@
 
 #include<stdio.h>
 #include<string.h>
+#include <pthread.h>
+#include <time.h>
 #include <jni.h>
 
 #include "jnilirc_JniRcxIr.h"
 #include "rcx.h"
 
+// *** stats() lays out the buckets of rcx_stats_t as JniRcxIr says ***
+#if jnilirc_JniRcxIr_STATS_BUCKETS != RCX_STATS_BUCKETS
+#error -- jnilirc_JniRcxIr.c -- STATS_BUCKETS differs from rcx.h
+#endif
+
+// *** Largest packet send() and command() take or return ***
+#define JNI_PACKET_SIZE 256
+
+// *** Most packets and bytes delivered to the listener at once ***
+#define JNI_BATCH_PACKETS 64
+#define JNI_BATCH_SIZE    4096
+
+// *** A batch of received packets, one after the other ***
+typedef struct jni_batch
+{
+	int           count;                       // Packets
+	int           size;                        // Bytes
+	jint          lengths[JNI_BATCH_PACKETS];  // Of each packet
+	unsigned char data[JNI_BATCH_SIZE];
+} jni_batch_t;
+
+// *** State of the listener, see listen() ***
+// The receive thread takes packets with rcx_receive(), and adds
+// them to the batch. The deliver thread is attached to the JVM. It
+// waits until the first packet of a batch is 'window' ms old, and
+// hands the batch to the listener object in one call.
+static JavaVM*         listen_vm = NULL;
+static jobject         listen_object = NULL;
+static jmethodID       listen_method;
+static int             listen_window;
+static int             listen_running = 0;
+static int             listen_stop;
+static int             listen_ready;    // 0 starting, 1 ready, <0 failed
+static struct timespec listen_deadline;
+static jni_batch_t     listen_batch;
+static pthread_t       listen_receiver;
+static pthread_t       listen_deliverer;
+static pthread_mutex_t listen_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  listen_cond = PTHREAD_COND_INITIALIZER;
+
+// *** Prototypes ***
+static void* jni_receive(void* arg);
+static void* jni_deliver(void* arg);
+static int jni_unlisten(JNIEnv* env);
+
 // *** Use this function in case of testing without RCX ***
 int rcx_sendTest(int* len, char* buf)
 {
@@ -94,7 +141,8 @@ JNIEXPORT jint JNICALL Java_jnilirc_JniRcxIr_open
 	int result = 0;
 	printf("JNI lirc: rcx_init called.\n");
 	
-	result = rcx_open();
+	/* read() takes what the receiver thread has decoded */
+	result = rcx_open_target(RCX_TARGET_DEFAULT | RCX_OPEN_RECEIVER);
 	result = 1;
 	
 	return (jint)result;	
@@ -106,6 +154,8 @@ JNIEXPORT jint JNICALL Java_jnilirc_JniRcxIr_close
 	int result = 0;
 	printf("JNI lirc: rcx_close called.\n");
 	
+	// *** The listener receives from the device ***
+	jni_unlisten(env);
 	result = rcx_close();
 	result = 1;
 	
@@ -115,63 +165,396 @@ JNIEXPORT jint JNICALL Java_jnilirc_JniRcxIr_close
 JNIEXPORT jint JNICALL Java_jnilirc_JniRcxIr_send
   (JNIEnv * env, jobject object, jbyteArray aArray, jint aInt)
 {
-	
+	unsigned char buffer[JNI_PACKET_SIZE];
+	int length = (int) aInt;
+
+	// *** The packet is copied, as rcx_send() blocks while on the air ***
+	if (length < 0 || length > sizeof(buffer) ||
+	    length > (*env)->GetArrayLength(env, aArray))
+	{
+		return (jint)RCX_E_BAD_ARGUMENT;
+	}
+	(*env)->GetByteArrayRegion(env, aArray, 0, length, (jbyte*) buffer);
+
+	return (jint)rcx_send(buffer, length);
+}
+
+JNIEXPORT jint JNICALL Java_jnilirc_JniRcxIr_command
+  (JNIEnv * env, jobject object, jbyteArray aArray, jint aInt)
+{
+	int result;
+	unsigned char buffer[JNI_PACKET_SIZE];
+	int length = (int) aInt;
+	jsize size = (*env)->GetArrayLength(env, aArray);
+
+	// *** One crossing for the whole round trip. A critical array   ***
+	// *** would hold off the garbage collector while the command is ***
+	// *** on the air, so the few bytes are copied in and out.       ***
+	if (size > sizeof(buffer))
+	{
+		size = sizeof(buffer);
+	}
+	if (length <= 0 || length > size)
+	{
+		return (jint)RCX_E_BAD_ARGUMENT;
+	}
+	(*env)->GetByteArrayRegion(env, aArray, 0, length, (jbyte*) buffer);
+
+	result = rcx_command(buffer, size, &length);
+	if (result != RCX_OK)
+	{
+		return (jint)result;
+	}
+
+	(*env)->SetByteArrayRegion(env, aArray, 0, length, (jbyte*) buffer);
+	return (jint)length;
 }
 
 JNIEXPORT jint JNICALL Java_jnilirc_JniRcxIr_write
   (JNIEnv * env, jobject object, jbyteArray aArray, jint aInt) 
 {
-  	int result = 0;
+  	int result = RCX_OK;
 	
-	const char *cbuf;
+	jbyte *cbuf;
 	int i;	
-	// *** RCX len[0] = Java jlen ***;
-	//(*env)->GetIntArrayRegion(env, jlen, 0, 1, len); 
 	// Typecast the given length
 	int givenLength = ((int) aInt);
+
+	if (givenLength < 0 || givenLength > (*env)->GetArrayLength(env, aArray))
+	{
+		return (jint)RCX_E_BAD_ARGUMENT;
+	}
+
 	// *** RCX bufffer = Java jbuffer ***
-	cbuf = (*env)->GetByteArrayElements(env, aArray, 0); 
-   
-    //printf("JNI lirc: rcx_send called, with messageID=%d.and length %d\n", cbuf[3], aInt);
-    
-	
-	for (i=0; i < givenLength; i++)
+	cbuf = (*env)->GetByteArrayElements(env, aArray, NULL); 
+	if (cbuf == NULL)
 	{
-		result = rcx_send_byte(cbuf[i]);  
+		return (jint)RCX_E_PROGRAM_FAILURE;
 	}
-		
-	/*printf("\nJNI lirc: TEST MODUS CALL\n");
-	result = rcx_sendTest(len, buffer);*/
 	
-	// *** Store RCX results in Java references ***
-	if (result == RCX_OK)
+	for (i=0; i < givenLength && result == RCX_OK; i++)
 	{
-		printf("Send successful\n");
+		result = rcx_send_byte((unsigned char) cbuf[i]);  
 	}
-	 
-	
-	return (jint)1;		
+
+	// *** Nothing was changed, so a copy is freed without copying back ***
+	(*env)->ReleaseByteArrayElements(env, aArray, cbuf, JNI_ABORT);
+		
+	return (jint)result;		
 }
 
 JNIEXPORT jint JNICALL Java_jnilirc_JniRcxIr_read
   (JNIEnv * env, jobject object, jbyteArray aArray)
 {
+	int result;
+	jsize length;
+	unsigned char buffer[256];
 
-	char buffer[3];
-	
-	const char *cbuf;
-	cbuf = (*env)->GetByteArrayElements(env, aArray, 0);
-	strcpy(buffer, cbuf);
-	/*
-	buffer[0] = 0x7; //has to return
-	printf("JNI:: Set ACKBYTE: %d", buffer[0]);
-	(*env)->SetByteArrayRegion(env, aArray, 0, 1, buffer);
-	
-    printf("Reading byte:%d.\n", buffer[0]);*/
-    
-    rcx_receive_byte(&buffer[0]);
- 	(*env)->SetByteArrayRegion(env, aArray, 0, 1, buffer);   
-    return 1; 	
+	// *** Take the bytes received so far, without waiting ***
+	length = (*env)->GetArrayLength(env, aArray);
+	if (length > sizeof(buffer))
+	{
+		length = sizeof(buffer);
+	}
+
+	result = rcx_receive_bytes(buffer, length);
+	if (result > 0)
+	{
+		(*env)->SetByteArrayRegion(env, aArray, 0, result, (jbyte*) buffer);
+	}
+	return (jint)result;
+}
+
+/*
+ * Class:     jnilirc_JniRcxIr
+ * Method:    listen
+ * Signature: (Ljnilirc/RcxListener;I)I
+ */
+JNIEXPORT jint JNICALL Java_jnilirc_JniRcxIr_listen
+  (JNIEnv * env, jobject obj, jobject listener, jint window)
+{
+	jclass cls;
+
+	if (listener == NULL || window < 0)
+	{
+		return (jint)RCX_E_BAD_ARGUMENT;
+	}
+
+	// *** A new listener takes the place of the old one ***
+	jni_unlisten(env);
+
+	cls = (*env)->GetObjectClass(env, listener);
+	listen_method = (*env)->GetMethodID(env, cls, "received", "([B[II)V");
+	if (listen_method == NULL ||
+	    (*env)->GetJavaVM(env, &listen_vm) != 0)
+	{
+		return (jint)RCX_E_BAD_ARGUMENT;
+	}
+
+	listen_object = (*env)->NewGlobalRef(env, listener);
+	if (listen_object == NULL)
+	{
+		return (jint)RCX_E_PROGRAM_FAILURE;
+	}
+
+	listen_window = (int) window;
+	listen_stop = 0;
+	listen_ready = 0;
+	listen_batch.count = 0;
+	listen_batch.size = 0;
+
+	if (pthread_create(&listen_deliverer, NULL, jni_deliver, NULL) != 0)
+	{
+		(*env)->DeleteGlobalRef(env, listen_object);
+		listen_object = NULL;
+		return (jint)RCX_E_PROGRAM_FAILURE;
+	}
+
+	// *** The deliver thread must attach and make its arrays ***
+	pthread_mutex_lock(&listen_lock);
+	while (listen_ready == 0)
+	{
+		pthread_cond_wait(&listen_cond, &listen_lock);
+	}
+	pthread_mutex_unlock(&listen_lock);
+	if (listen_ready < 0)
+	{
+		pthread_join(listen_deliverer, NULL);
+		(*env)->DeleteGlobalRef(env, listen_object);
+		listen_object = NULL;
+		return (jint)RCX_E_PROGRAM_FAILURE;
+	}
+
+	if (pthread_create(&listen_receiver, NULL, jni_receive, NULL) != 0)
+	{
+		pthread_mutex_lock(&listen_lock);
+		listen_stop = 1;
+		pthread_cond_broadcast(&listen_cond);
+		pthread_mutex_unlock(&listen_lock);
+		pthread_join(listen_deliverer, NULL);
+		(*env)->DeleteGlobalRef(env, listen_object);
+		listen_object = NULL;
+		return (jint)RCX_E_PROGRAM_FAILURE;
+	}
+
+	listen_running = 1;
+	return (jint)RCX_OK;
+}
+
+/*
+ * Class:     jnilirc_JniRcxIr
+ * Method:    unlisten
+ * Signature: ()I
+ */
+JNIEXPORT jint JNICALL Java_jnilirc_JniRcxIr_unlisten
+  (JNIEnv * env, jobject obj)
+{
+	return (jint)jni_unlisten(env);
+}
+
+// *** Stop the listener threads, and drop the listener.      ***
+// *** Not from the listener itself: it would wait for itself ***
+static int jni_unlisten(JNIEnv* env)
+{
+	if (!listen_running)
+	{
+		return RCX_OK;
+	}
+	if (pthread_equal(pthread_self(), listen_deliverer))
+	{
+		return RCX_E_BAD_ARGUMENT;
+	}
+
+	pthread_mutex_lock(&listen_lock);
+	listen_stop = 1;
+	pthread_cond_broadcast(&listen_cond);
+	pthread_mutex_unlock(&listen_lock);
+
+	// *** rcx_receive() returns within LIRC_REPLY_TIME ***
+	pthread_join(listen_receiver, NULL);
+	pthread_join(listen_deliverer, NULL);
+
+	(*env)->DeleteGlobalRef(env, listen_object);
+	listen_object = NULL;
+	listen_running = 0;
+	return RCX_OK;
+}
+
+// *** The receive thread: whole packets into the batch ***
+static void* jni_receive(void* arg)
+{
+	int result;
+	int length;
+	unsigned char buffer[JNI_PACKET_SIZE];
+
+	while (!__atomic_load_n(&listen_stop, __ATOMIC_ACQUIRE))
+	{
+		result = rcx_receive(buffer, sizeof(buffer), &length);
+		if (result == RCX_E_RECV_NOTHING || result == RCX_E_RECV_ERROR)
+		{
+			continue;
+		}
+		if (result != RCX_OK)
+		{
+			// *** The device is gone; the deliver thread goes on ***
+			break;
+		}
+
+		pthread_mutex_lock(&listen_lock);
+
+		// *** Wait for room, while the listener takes a full batch ***
+		while (!listen_stop &&
+		       (listen_batch.count == JNI_BATCH_PACKETS ||
+		        listen_batch.size + length > JNI_BATCH_SIZE))
+		{
+			pthread_cond_wait(&listen_cond, &listen_lock);
+		}
+
+		if (!listen_stop)
+		{
+			if (listen_batch.count == 0)
+			{
+				clock_gettime(CLOCK_REALTIME, &listen_deadline);
+				listen_deadline.tv_sec += listen_window / 1000;
+				listen_deadline.tv_nsec += (listen_window % 1000) * 1000000L;
+				if (listen_deadline.tv_nsec >= 1000000000L)
+				{
+					listen_deadline.tv_sec++;
+					listen_deadline.tv_nsec -= 1000000000L;
+				}
+			}
+			memcpy(&listen_batch.data[listen_batch.size], buffer, length);
+			listen_batch.lengths[listen_batch.count++] = length;
+			listen_batch.size += length;
+			pthread_cond_broadcast(&listen_cond);
+		}
+
+		pthread_mutex_unlock(&listen_lock);
+	}
+
+	return NULL;
+}
+
+// *** The deliver thread: batches to the listener object ***
+static void* jni_deliver(void* arg)
+{
+	int full;
+	JNIEnv* env;
+	jbyteArray data;
+	jintArray lengths;
+	static jni_batch_t batch;
+
+	if ((*listen_vm)->AttachCurrentThread(listen_vm, (void**) &env, NULL) != 0)
+	{
+		pthread_mutex_lock(&listen_lock);
+		listen_ready = -1;
+		pthread_cond_broadcast(&listen_cond);
+		pthread_mutex_unlock(&listen_lock);
+		return NULL;
+	}
+
+	// *** The arrays are made once, and reused for every batch ***
+	data = (*env)->NewByteArray(env, JNI_BATCH_SIZE);
+	lengths = (*env)->NewIntArray(env, JNI_BATCH_PACKETS);
+	if (data == NULL || lengths == NULL)
+	{
+		(*env)->ExceptionClear(env);
+	}
+
+	// *** listen() waits for this, and fails without the arrays ***
+	pthread_mutex_lock(&listen_lock);
+	listen_ready = (data != NULL && lengths != NULL) ? 1 : -1;
+	pthread_cond_broadcast(&listen_cond);
+	while (!listen_stop && listen_ready > 0)
+	{
+		if (listen_batch.count == 0)
+		{
+			pthread_cond_wait(&listen_cond, &listen_lock);
+			continue;
+		}
+
+		full = (listen_batch.count == JNI_BATCH_PACKETS);
+		if (!full && listen_window > 0 &&
+		    pthread_cond_timedwait(&listen_cond, &listen_lock,
+		                           &listen_deadline) == 0)
+		{
+			// *** More packets, or stopped; the deadline holds ***
+			continue;
+		}
+
+		// *** Take the batch, so receiving goes on meanwhile ***
+		memcpy(&batch, &listen_batch, sizeof(batch));
+		listen_batch.count = 0;
+		listen_batch.size = 0;
+		pthread_cond_broadcast(&listen_cond);
+		pthread_mutex_unlock(&listen_lock);
+
+		(*env)->SetByteArrayRegion(env, data, 0, batch.size,
+		                           (jbyte*) batch.data);
+		(*env)->SetIntArrayRegion(env, lengths, 0, batch.count,
+		                          batch.lengths);
+		(*env)->CallVoidMethod(env, listen_object, listen_method,
+		                       data, lengths, (jint) batch.count);
+		if ((*env)->ExceptionCheck(env))
+		{
+			(*env)->ExceptionDescribe(env);
+			(*env)->ExceptionClear(env);
+		}
+
+		pthread_mutex_lock(&listen_lock);
+	}
+	pthread_mutex_unlock(&listen_lock);
+
+	(*listen_vm)->DetachCurrentThread(listen_vm);
+	return NULL;
+}
+
+/*
+ * Class:     jnilirc_JniRcxIr
+ * Method:    stats
+ * Signature: ()[J
+ */
+JNIEXPORT jlongArray JNICALL Java_jnilirc_JniRcxIr_stats
+  (JNIEnv * env, jobject obj)
+{
+	int i;
+	jlongArray array;
+	rcx_stats_t stats;
+	jlong values[jnilirc_JniRcxIr_STATS_LENGTH];
+
+	if (rcx_get_stats(&stats) != RCX_OK)
+	{
+		return NULL;
+	}
+
+	// *** At the indices of the STATS_ constants of JniRcxIr ***
+	values[jnilirc_JniRcxIr_STATS_PARITY_ERRORS] = stats.parity_errors;
+	values[jnilirc_JniRcxIr_STATS_FRAMING_ERRORS] = stats.framing_errors;
+	values[jnilirc_JniRcxIr_STATS_BREAK_ERRORS] = stats.break_errors;
+	values[jnilirc_JniRcxIr_STATS_COMPLEMENT_ERRORS] = stats.complement_errors;
+	values[jnilirc_JniRcxIr_STATS_CHECKSUM_ERRORS] = stats.checksum_errors;
+	values[jnilirc_JniRcxIr_STATS_TIMEOUTS] = stats.timeouts;
+	values[jnilirc_JniRcxIr_STATS_RETRIES] = stats.retries;
+	values[jnilirc_JniRcxIr_STATS_BYTES_SENT] = stats.bytes_sent;
+	values[jnilirc_JniRcxIr_STATS_BYTES_RECEIVED] = stats.bytes_received;
+	values[jnilirc_JniRcxIr_STATS_PACKETS_SENT] = stats.packets_sent;
+	values[jnilirc_JniRcxIr_STATS_PACKETS_RECEIVED] = stats.packets_received;
+	for (i=0; i < RCX_STATS_BUCKETS; i++)
+	{
+		values[jnilirc_JniRcxIr_STATS_COMMAND_TIME+i] = stats.command_time[i];
+		values[jnilirc_JniRcxIr_STATS_REPLY_WAIT+i] = stats.reply_wait[i];
+	}
+	values[jnilirc_JniRcxIr_STATS_RATE_FALLBACKS] = stats.rate_fallbacks;
+	values[jnilirc_JniRcxIr_STATS_RATE_PROBES] = stats.rate_probes;
+	values[jnilirc_JniRcxIr_STATS_LATE_REPLIES] = stats.late_replies;
+
+	array = (*env)->NewLongArray(env, jnilirc_JniRcxIr_STATS_LENGTH);
+	if (array != NULL)
+	{
+		(*env)->SetLongArrayRegion(env, array, 0,
+			jnilirc_JniRcxIr_STATS_LENGTH, values);
+	}
+	return array;
 }
 
 /*
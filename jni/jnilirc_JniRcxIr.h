@@ -7,6 +7,42 @@
 #ifdef __cplusplus
 extern "C" {
 #endif
+#undef jnilirc_JniRcxIr_STATS_PARITY_ERRORS
+#define jnilirc_JniRcxIr_STATS_PARITY_ERRORS 0L
+#undef jnilirc_JniRcxIr_STATS_FRAMING_ERRORS
+#define jnilirc_JniRcxIr_STATS_FRAMING_ERRORS 1L
+#undef jnilirc_JniRcxIr_STATS_BREAK_ERRORS
+#define jnilirc_JniRcxIr_STATS_BREAK_ERRORS 2L
+#undef jnilirc_JniRcxIr_STATS_COMPLEMENT_ERRORS
+#define jnilirc_JniRcxIr_STATS_COMPLEMENT_ERRORS 3L
+#undef jnilirc_JniRcxIr_STATS_CHECKSUM_ERRORS
+#define jnilirc_JniRcxIr_STATS_CHECKSUM_ERRORS 4L
+#undef jnilirc_JniRcxIr_STATS_TIMEOUTS
+#define jnilirc_JniRcxIr_STATS_TIMEOUTS 5L
+#undef jnilirc_JniRcxIr_STATS_RETRIES
+#define jnilirc_JniRcxIr_STATS_RETRIES 6L
+#undef jnilirc_JniRcxIr_STATS_BYTES_SENT
+#define jnilirc_JniRcxIr_STATS_BYTES_SENT 7L
+#undef jnilirc_JniRcxIr_STATS_BYTES_RECEIVED
+#define jnilirc_JniRcxIr_STATS_BYTES_RECEIVED 8L
+#undef jnilirc_JniRcxIr_STATS_PACKETS_SENT
+#define jnilirc_JniRcxIr_STATS_PACKETS_SENT 9L
+#undef jnilirc_JniRcxIr_STATS_PACKETS_RECEIVED
+#define jnilirc_JniRcxIr_STATS_PACKETS_RECEIVED 10L
+#undef jnilirc_JniRcxIr_STATS_BUCKETS
+#define jnilirc_JniRcxIr_STATS_BUCKETS 16L
+#undef jnilirc_JniRcxIr_STATS_COMMAND_TIME
+#define jnilirc_JniRcxIr_STATS_COMMAND_TIME 11L
+#undef jnilirc_JniRcxIr_STATS_REPLY_WAIT
+#define jnilirc_JniRcxIr_STATS_REPLY_WAIT 27L
+#undef jnilirc_JniRcxIr_STATS_RATE_FALLBACKS
+#define jnilirc_JniRcxIr_STATS_RATE_FALLBACKS 43L
+#undef jnilirc_JniRcxIr_STATS_RATE_PROBES
+#define jnilirc_JniRcxIr_STATS_RATE_PROBES 44L
+#undef jnilirc_JniRcxIr_STATS_LATE_REPLIES
+#define jnilirc_JniRcxIr_STATS_LATE_REPLIES 45L
+#undef jnilirc_JniRcxIr_STATS_LENGTH
+#define jnilirc_JniRcxIr_STATS_LENGTH 46L
 /*
  * Class:     jnilirc_JniRcxIr
  * Method:    open
@@ -31,6 +67,14 @@ JNIEXPORT jint JNICALL Java_jnilirc_JniRcxIr_close
 JNIEXPORT jint JNICALL Java_jnilirc_JniRcxIr_send
   (JNIEnv *, jobject, jbyteArray, jint);
 
+/*
+ * Class:     jnilirc_JniRcxIr
+ * Method:    command
+ * Signature: ([BI)I
+ */
+JNIEXPORT jint JNICALL Java_jnilirc_JniRcxIr_command
+  (JNIEnv *, jobject, jbyteArray, jint);
+
 /*
  * Class:     jnilirc_JniRcxIr
  * Method:    write
@@ -47,6 +91,30 @@ JNIEXPORT jint JNICALL Java_jnilirc_JniRcxIr_write
 JNIEXPORT jint JNICALL Java_jnilirc_JniRcxIr_read
   (JNIEnv *, jobject, jbyteArray);
 
+/*
+ * Class:     jnilirc_JniRcxIr
+ * Method:    listen
+ * Signature: (Ljnilirc/RcxListener;I)I
+ */
+JNIEXPORT jint JNICALL Java_jnilirc_JniRcxIr_listen
+  (JNIEnv *, jobject, jobject, jint);
+
+/*
+ * Class:     jnilirc_JniRcxIr
+ * Method:    unlisten
+ * Signature: ()I
+ */
+JNIEXPORT jint JNICALL Java_jnilirc_JniRcxIr_unlisten
+  (JNIEnv *, jobject);
+
+/*
+ * Class:     jnilirc_JniRcxIr
+ * Method:    stats
+ * Signature: ()[J
+ */
+JNIEXPORT jlongArray JNICALL Java_jnilirc_JniRcxIr_stats
+  (JNIEnv *, jobject);
+
 /*
  * Class:     jnilirc_JniRcxIr
  * Method:    test
@@ -6,8 +6,8 @@
 * Converts between byte arrays and LIRC driver codes.          *
 *                                                              *
 * Flags:                                                       *
-* LIRC_TARGET_PC    Set timing values for laptop               *
-* LIRC_TARGET_IPAQ  Set timing values for iPAQ                 *
+* LIRC_TARGET_PC    Default to the timing values for laptop    *
+* LIRC_TARGET_IPAQ  Default to the timing values for iPAQ      *
 * APP_PRINT_DEBUG   Show debug data amd errors                 *
 * APP_PRINT_ERROR   Show errors                                *
 *                                                              *
@@ -27,6 +27,9 @@
 * v 0.1   Nov 27 2002   Henk Dekker <henk.dekker@ordina.nl>    *
 *         Initial version                                      *
 ***************************************************************/
+#include <string.h>
+#include <pthread.h>
+
 #include "verbose.h"
 #include "lirc.h"
 #include "lirccode.h"
@@ -34,22 +37,149 @@
 /* LIRC_DRIVER define sets the platform. Options "ipaq" or "sir" */
 #define LIRC_DRIVER           "ipaq"   
 
-#define BIT_PERIOD            417
+/* Bit counts are computed as (period*bit_scale)>>BIT_SCALE_SHIFT */
+/* instead of dividing by the bit period. Runs longer than       */
+/* BIT_RUN_MAX bits are clipped first, which keeps the product   */
+/* in range, and the result exact for bit periods up to 1200 us. */
+#define BIT_SCALE_SHIFT       24
+#define BIT_RUN_MAX           11
+
+/* Profile used by LIRC_PROFILE_DEFAULT, set by the flags */
+#if defined(LIRC_TARGET_PC)
+#  define LIRC_PROFILE_BUILD  LIRC_PROFILE_PC
+#elif defined(LIRC_TARGET_IPAQ)
+#  define LIRC_PROFILE_BUILD  LIRC_PROFILE_IPAQ
+#else
+#  define LIRC_PROFILE_BUILD  LIRC_PROFILE_NOMINAL
+#endif
 
 /* Prototypes */
-void pc_adjust(int bit, int* lirc_t);
-void ipaq_adjust(int bit, int* lirc_t);
-int lirc_byte_encode(unsigned char data, lirc_t* list);
-int lirc_byte_decode(lirc_t data, unsigned char* pbuf);
-void add_to_list(unsigned int bit, unsigned int* signal_ptr,
-                 int* index_ptr,  lirc_t* list);
+int lirc_byte_encode(lirc_profile_t* profile, unsigned char data,
+                     lirc_t* list);
+void add_to_list(lirc_profile_t* profile, unsigned int bit,
+                 unsigned int* signal_ptr, int* index_ptr,
+                 lirc_t* list);
+
+/* Timing values of the built-in profiles. The adjustment is   */
+/* added to the first bit of every run of marks or spaces.     */
+static const int lirc_timing[LIRC_PROFILES][3] =
+{
+    /* bit period,         mark,  space adjust */
+
+    /* LIRC_PROFILE_NOMINAL: Exact 2400 baud timing */
+    { LIRC_BIT_PERIOD_2400,  0,      0 },
+
+    /* LIRC_PROFILE_PC: Actually marks are sent as spaces by   */
+    /* the drivers. Fine tuned by measuring pulse and space    */
+    /* times by the lirc mode2 tool                            */
+    { LIRC_BIT_PERIOD_2400, 30,    145 },
+
+    /* LIRC_PROFILE_IPAQ */
+    { LIRC_BIT_PERIOD_2400,  0,    -20 }
+};
+
+/* Built-in profiles, the tables are computed on first use */
+static pthread_once_t lirc_profiles_once = PTHREAD_ONCE_INIT;
+static lirc_profile_t lirc_profiles[LIRC_PROFILES];
+
+void lirc_profiles_build(void);
+
+
+
+/*************************************************************
+* lirc_profile returns one of the built-in timing profiles.  *
+* The waveform tables of all built-in profiles are computed  *
+* the first time this function is called.                    *
+*                                                            *
+* Input:  id        LIRC_PROFILE_xxx number of the profile   *
+*                                                            *
+* Return: !NULL     Pointer to the profile                   *
+*         NULL      Unknown profile                          *
+*                                                            *
+*************************************************************/
+lirc_profile_t* lirc_profile(int id)
+{
+    if (id==LIRC_PROFILE_DEFAULT)
+    {
+        id = LIRC_PROFILE_BUILD;
+    }
+
+    if ((id<0) || (id>=LIRC_PROFILES))
+    {
+        APP_ERROR("Unknown timing profile");
+        return NULL;
+    }
+
+    pthread_once(&lirc_profiles_once, lirc_profiles_build);
+
+    return &lirc_profiles[id];
+}
+
+
+/* Compute the tables of the built-in profiles, called once */
+void lirc_profiles_build(void)
+{
+    int n;
+
+    for (n=0; n<LIRC_PROFILES; n++)
+    {
+        lirc_profile_init(&lirc_profiles[n], lirc_timing[n][0],
+                          lirc_timing[n][1], lirc_timing[n][2]);
+    }
+}
+
+
+
+/*************************************************************
+* lirc_profile_init computes the waveform table of a timing  *
+* profile. For each of the 256 byte values the table holds   *
+* the 'mark' and 'space' items of the 8O1 character.        *
+*                                                            *
+* Input:  bit_period    Duration of a single bit, in us      *
+*         mark_adjust   Added to the first bit of a mark run *
+*         space_adjust  Added to the first bit of a space run*
+*                                                            *
+* Output: profile   The profile to initialize                *
+*                                                            *
+* Return: LIRC_OK            Profile initialized             *
+*         LIRC_E_BAD_TIMING  Timing values out of range      *
+*                                                            *
+*************************************************************/
+int lirc_profile_init(lirc_profile_t* profile, int bit_period,
+                      int mark_adjust, int space_adjust)
+{
+    int n;
+
+    if ((bit_period<=0) ||
+        ((bit_period+mark_adjust)<=0) ||
+        ((bit_period+space_adjust)<=0))
+    {
+        APP_ERROR("Timing values out of range");
+        return LIRC_E_BAD_TIMING;
+    }
+
+    profile->bit_period = bit_period;
+    profile->mark_adjust = mark_adjust;
+    profile->space_adjust = space_adjust;
+
+    for (n=0; n<256; n++)
+    {
+        profile->count[n] = lirc_byte_encode(profile, (unsigned char) n,
+                                             profile->items[n]);
+    }
+
+    return LIRC_OK;
+}
+
 
 /*************************************************************
 * lirc_encode generates a pattern of 'mark' and 'space'      *
 * signals from a byte array. The pattern simulates a         *
-* 2400baud 8O1 modem signal.                                 *
+* 2400baud 8O1 modem signal. The items of each byte are      *
+* copied from the waveform table of the profile.             *
 *                                                            *
-* Input:  buf       The characters to convert                *
+* Input:  profile   Timing profile to encode with            *
+*         buf       The characters to convert                *
 *         buf_len   Number of characters in buffer           *
 *         data_size Maximum number of lirc_t elements that   *
 *                   the 'data' array can store               *
@@ -61,23 +191,28 @@ void add_to_list(unsigned int bit, unsigned int* signal_ptr,
           LIRC_E_BUF_SIZE   data elements exceeds data_size  *
 *                                                            *
 *************************************************************/
-int lirc_encode(unsigned char* buf, int buf_len, lirc_t* data,
-                int data_size)
+int lirc_encode(lirc_profile_t* profile, unsigned char* buf,
+                int buf_len, lirc_t* data, int data_size)
 {
     int n;
+    int count;
     int item_cnt = 0;
 
     for (n=0; n<buf_len; n++)
     {
         /* Check in advance if data_size is large */
         /* enough to accept the next character    */
-        if ((item_cnt+12)>data_size)
+        if ((item_cnt+LIRC_BYTE_ITEMS)>data_size)
         {
             return LIRC_E_BUF_SIZE;
         }
 
-        /* Convert the byte into lirc_t elements */
-        item_cnt += lirc_byte_encode(buf[n], &data[item_cnt]);
+        /* Copy the lirc_t elements of the byte, plus the */
+        /* cleared item that indicates the last item      */
+        count = profile->count[buf[n]];
+        memcpy(&data[item_cnt], profile->items[buf[n]],
+               (count+1)*sizeof(lirc_t));
+        item_cnt += count;
     }
 
     return item_cnt;
@@ -86,6 +221,30 @@ int lirc_encode(unsigned char* buf, int buf_len, lirc_t* data,
 
 
 
+/*************************************************************
+* lirc_decoder_init prepares a decoder for a new stream of   *
+* 'mark' and 'space' items. The decoder holds all state of   *
+* the decoding, so each stream needs its own decoder.        *
+*                                                            *
+* Input:  bit_period  Duration of a single bit, in us        *
+*                                                            *
+* Output: decoder     The decoder to initialize              *
+*                                                            *
+* Return: none                                               *
+*                                                            *
+*************************************************************/
+void lirc_decoder_init(lirc_decoder_t* decoder, int bit_period)
+{
+    decoder->bit_period = bit_period;
+    decoder->bit_scale = ((1<<BIT_SCALE_SHIFT)+bit_period-1)/bit_period;
+    decoder->total_bits = 0;
+    decoder->parity_bit = 0;
+    decoder->data_byte = 0;
+    decoder->error = LIRC_ERROR_NONE;
+}
+
+
+
 /*************************************************************
 * lirc_decode parses 'space' and 'mark' times and regenerates*
 * an 2400baud 8odd1 modem signal.                            *
@@ -95,6 +254,8 @@ int lirc_encode(unsigned char* buf, int buf_len, lirc_t* data,
 *         items     Number of items in 'data' array          *
 *         buf_size  Size of the buf character array          *
 *                                                            *
+* In/Out: decoder   Decoder state, see lirc_decoder_init()   *
+*                                                            *
 * Output: buf       Array of decoded characters              *
 *                   character to write the next char in.     *
 *                                                            *
@@ -104,8 +265,8 @@ int lirc_encode(unsigned char* buf, int buf_len, lirc_t* data,
 *         LIRC_E_BUF_SIZE Number of chars exceed buf_size    *
 *                                                            *
 *************************************************************/
-int lirc_decode(lirc_t* data, int items, unsigned char* buf,
-                int buf_size)
+int lirc_decode(lirc_decoder_t* decoder, lirc_t* data, int items,
+                unsigned char* buf, int buf_size)
 {
     int n;
     int result;
@@ -122,8 +283,8 @@ int lirc_decode(lirc_t* data, int items, unsigned char* buf,
             return LIRC_E_BUF_SIZE;
         }
 
-        /* Convert the byte into lirc_t elements */
-        result = lirc_byte_decode(data[n], &buf[byte_cnt]);
+        /* Convert the lirc_t element into a byte */
+        result = lirc_byte_decode(decoder, data[n], &buf[byte_cnt]);
         switch (result)
         {
         case (-1):
@@ -153,9 +314,11 @@ int lirc_decode(lirc_t* data, int items, unsigned char* buf,
 /*************************************************************
 * lirc_byte_encode generates from a character a pattern of   *
 * 'mark' and 'space' signals. The pattern simulates a        *
-* 2400baud 8O1 modem signal.                                 *
+* 2400baud 8O1 modem signal. Used to compute the waveform    *
+* tables, see lirc_profile_init().                           *
 *                                                            *
-* Input:  data      The character to decode to lirc elements *
+* Input:  profile   Timing values to use                     *
+*         data      The character to decode to lirc elements *
 *                                                            *
 * Output: list      Composed datatype with a 'space' or      *
 *                   'mark' signal, plus the length of it.    *
@@ -163,7 +326,8 @@ int lirc_decode(lirc_t* data, int items, unsigned char* buf,
 * Return:           Number of lirc_t elements                *
 *                                                            *
 *************************************************************/
-int lirc_byte_encode(unsigned char data, lirc_t* list)
+int lirc_byte_encode(lirc_profile_t* profile, unsigned char data,
+                     lirc_t* list)
 {
     int n;
     int parity;
@@ -180,7 +344,7 @@ int lirc_byte_encode(unsigned char data, lirc_t* list)
     item_index = -1;
 
     /* First bit, the startbit, is a 'space' */
-    add_to_list(0, &signal, &item_index, list);
+    add_to_list(profile, 0, &signal, &item_index, list);
 
     /* Then append data bits */
     for (n=0;n<8;n++)
@@ -193,14 +357,14 @@ int lirc_byte_encode(unsigned char data, lirc_t* list)
             parity++;
         }
 
-        add_to_list(bit, &signal, &item_index, list);
+        add_to_list(profile, bit, &signal, &item_index, list);
     }
 
     /* Append the ODD parity bit */
-    add_to_list((parity+1)%2, &signal, &item_index, list);
+    add_to_list(profile, (parity+1)%2, &signal, &item_index, list);
 
     /* At last append the 'mark' stop bit */
-    add_to_list(1, &signal, &item_index, list);
+    add_to_list(profile, 1, &signal, &item_index, list);
 
     /* Return item count */
     return item_index+1;
@@ -213,7 +377,8 @@ int lirc_byte_encode(unsigned char data, lirc_t* list)
 * The duration of 'pulse's and 'space's is simply increased if *
 * equal bits are successive.                                   *
 *                                                              *
-* Input:  bit        The bit to add to the list                *
+* Input:  profile    Timing values to use                      *
+*         bit        The bit to add to the list                *
 *                                                              *
 * In/Out: signal_ptr The current signal. If the bit differs    *
 *                    from the signal then a new item is added  *
@@ -226,14 +391,15 @@ int lirc_byte_encode(unsigned char data, lirc_t* list)
 * Return: none                                                 *
 *                                                              *
 ***************************************************************/
-void add_to_list(unsigned int bit, unsigned int* signal_ptr,
-                 int* index_ptr,  lirc_t* list)
+void add_to_list(lirc_profile_t* profile, unsigned int bit,
+                 unsigned int* signal_ptr, int* index_ptr,
+                 lirc_t* list)
 {
     if (*signal_ptr == bit)
     {
         /* If no signal change, then only increase the */
         /* signal period.                              */
-        list[*index_ptr] += BIT_PERIOD;
+        list[*index_ptr] += profile->bit_period;
     }
     else
     {
@@ -241,13 +407,9 @@ void add_to_list(unsigned int bit, unsigned int* signal_ptr,
         /* with a new item                                  */
         (*index_ptr)++;
 
-#ifdef LIRC_TARGET_IPAQ
-        ipaq_adjust(bit, &list[*index_ptr]);
-#endif /* LIRC_TARGET_IPAQ */
-
-#ifdef LIRC_TARGET_PC
-        pc_adjust(bit, &list[*index_ptr]);
-#endif /* LIRC_TARGET_PC */
+        /* The first bit of the run is fine tuned */
+        list[*index_ptr] = profile->bit_period +
+            (bit ? profile->mark_adjust : profile->space_adjust);
 
         /* Remember value of last bit */
         *signal_ptr = bit;
@@ -258,47 +420,17 @@ void add_to_list(unsigned int bit, unsigned int* signal_ptr,
 }
 
 
-/* Adjust time values for PC platform */
-void pc_adjust(int bit, int* lirc_t)
-{
-    /* Fine tuning, signal duration */
-    if (bit)
-    {
-        /* Actually these bits are sent as spaces by    */
-        /* the drivers. Fine tune by measuring pulse    */
-        /* and space times by the lirc mode2 tool       */
-        *lirc_t = BIT_PERIOD + 30;
-    }
-    else
-    {
-        *lirc_t = BIT_PERIOD + 145;
-    }
-}
-
-
-/* Adjust time values for iPAQ platform */
-void ipaq_adjust(int bit, int* lirc_t)
-{
-    if (bit)
-    {
-        *lirc_t = BIT_PERIOD;
-    }
-    else
-    {
-        *lirc_t = BIT_PERIOD - 20;
-    }
-}
-
-
 /*************************************************************
-* lirc_decode parses 'space' and 'mark' times and regenerates*
-* an 2400baud 8odd1 modem signal. The output are received    *
-* characters printed to stdout, and in case of errors RS232  *
-* compliant error messages.                                  *
+* lirc_byte_decode parses a single 'space' or 'mark' time,   *
+* and regenerates an 2400baud 8odd1 modem signal. A run of   *
+* equal bits is consumed in one step, so the time taken does *
+* not depend on the length of the run.                       *
 *                                                            *
 * Input:  data      Composed datatype with a 'space' or      *
 *                   'mark' signal, plus the length of it.    *
 *                                                            *
+* In/Out: decoder   Decoder state, see lirc_decoder_init()   *
+*                                                            *
 * In:     pbuf      Pointer to receive character in          *
 *                                                            *
 * Return: 1         Success, and a character received        *
@@ -307,25 +439,31 @@ void ipaq_adjust(int bit, int* lirc_t)
 *                   an 2400 8O1 signal                       *
 *                                                            *
 *************************************************************/
-int lirc_byte_decode(lirc_t data, unsigned char* pbuf)
+int lirc_byte_decode(lirc_decoder_t* decoder, lirc_t data,
+                     unsigned char* pbuf)
 {
     int is_mark;
     int is_space;
     int no_bits;
+    int count;
     int period;
     int returncode;
 
-    static int total_bits = 0;
-    static int parity_bit = 0;
-    static unsigned char data_byte = 0;
-
     returncode = 0;
     is_mark = (data&PULSE_BIT) ? 0 : 1;
     is_space = (is_mark) ? 0 : 1;
     period = (int) data&PULSE_MASK;
 
-    /* A single bit lasts 417 us. Round to nearest integer.*/
-    no_bits = (period+(BIT_PERIOD/2))/BIT_PERIOD;
+    /* Number of bits in the run, rounded to nearest integer */
+    if (period>(BIT_RUN_MAX*decoder->bit_period))
+    {
+        no_bits = BIT_RUN_MAX;
+    }
+    else
+    {
+        no_bits = ((period+(decoder->bit_period/2)) *
+                   decoder->bit_scale) >> BIT_SCALE_SHIFT;
+    }
 
     /* Optimalization and error-recovery routine, in case  */
     /* a long row of equal bits are received               */
@@ -343,11 +481,12 @@ int lirc_byte_decode(lirc_t data, unsigned char* pbuf)
             /* Never more then 10 spaces in a row can be   */
             /* received. Print error and clear buffer.     */
             APP_ERROR("Break error");
+            decoder->error = LIRC_ERROR_BREAK;
             returncode = -1;
 
-            data_byte = 0;
-            parity_bit = 0;
-            total_bits = 0;
+            decoder->data_byte = 0;
+            decoder->parity_bit = 0;
+            decoder->total_bits = 0;
 
             /* Last space bit can be the startbit of the   */
             /* next character to be received. Assume this  */
@@ -364,67 +503,87 @@ int lirc_byte_decode(lirc_t data, unsigned char* pbuf)
     /* bit1..bit8=data  Can be a mark or space              */
     /* bit9=parity      Total number of marks should be odd */
     /* bit10=stop       Should be a mark                    */
+    /* Each pass handles a whole field, so a run of up to   */
+    /* 10 bits takes no more than four passes.              */
     while (no_bits>0)
     {
-        no_bits--;
-
-        if (total_bits==0) /* Start bit */
+        if (decoder->total_bits==0) /* Start bit */
         {
             if (is_space)
             {
                 /* If startbit received, then clear buffer  */
                 /* and start filling the byte with databits.*/
-                total_bits = 1;
-                data_byte = 0;
-                parity_bit = 0;
+                decoder->total_bits = 1;
+                decoder->data_byte = 0;
+                decoder->parity_bit = 0;
+                no_bits--;
+            }
+            else
+            {
+                /* Marks between characters are idle line */
+                no_bits = 0;
             }
         }
-        else if (total_bits<9) /* Data bits */
+        else if (decoder->total_bits<9) /* Data bits */
         {
-            total_bits++;
-            /* Low databits are received first. Put bit in  */
-            /* byte and update the parity bit counter.      */
-            data_byte >>= 1;
+            /* Take all data bits of the run at once */
+            count = 9 - decoder->total_bits;
+            if (count>no_bits)
+            {
+                count = no_bits;
+            }
+            decoder->total_bits += count;
+            no_bits -= count;
+
+            /* Low databits are received first. Shift the  */
+            /* bits in at the top of the byte, and update   */
+            /* the parity bit counter.                      */
+            decoder->data_byte >>= count;
             if (is_mark) {
-                data_byte += 0x80;
-                parity_bit++;
+                decoder->data_byte |= (0xffU << (8-count)) & 0xffU;
+                decoder->parity_bit += count;
             }
         }
-        else if (total_bits==9) /* Parity bit */
+        else if (decoder->total_bits==9) /* Parity bit */
         {
-            total_bits++;
+            decoder->total_bits++;
+            no_bits--;
 
             /* At this point we received 8 bits of data. */
             /* Display it in advance, without knowing if */
             /* the parity bit is correct.                */
-            APP_PRINT2("0x%02x ", data_byte);
+            APP_DATA("Byte 0x%02x", decoder->data_byte);
 
             /* Add received byte to receive buffer */
-            *pbuf = data_byte;
+            *pbuf = decoder->data_byte;
             returncode = 1;
 
             /* Only update the parity bit counter */
             if (is_mark) {
-                parity_bit++;
+                decoder->parity_bit++;
             }
             /* The parity bit counter should be ODD */
-            if ((parity_bit%2)==0)
+            if ((decoder->parity_bit%2)==0)
             {
                 /* Received byte not ODD */
                 APP_ERROR("Parity error");
+                decoder->error = LIRC_ERROR_PARITY;
                 returncode = -1;
             }
         }
         else  /* Stopbit */
         {
+            no_bits--;
+
             /* The stopbit should be a mark */
             if (is_space)
             {
                 /* No stopbit received */
                 APP_ERROR("Framing error");
+                decoder->error = LIRC_ERROR_FRAMING;
                 returncode = -1;
             }
-            total_bits = 0;
+            decoder->total_bits = 0;
         }
     }
 
@@ -432,5 +591,3 @@ int lirc_byte_decode(lirc_t data, unsigned char* pbuf)
     APP_FLUSH
     return returncode;
 }
-
-
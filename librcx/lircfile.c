@@ -28,21 +28,32 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
-//#include <time.h>
+#include <time.h>
 #include <sys/time.h>
 
 #include "verbose.h"
 #include "lirc.h"
 #include "lircfile.h"
+#include "lirccode.h"
+#include "lircuring.h"
+#include "lirctransport.h"
 
-/* LIRC_DRIVER_DEVICE filename of the lirc device */
-#define LIRC_DRIVER_DEVICE    "/dev/lirc"
+/* Items read at once, while clearing the receive buffer */
+#define RESET_ITEMS           64
 
-/* Time to wait before data arrives */
-#define REPLY_TIME            350
+static long lirc_now(lirc_device_t* dev);
 
-/* Globals */
-static int lirc_driver = 0;
+/* The LIRC driver as transport, see lirctransport.h */
+const lirc_transport_t lirc_file_transport =
+{
+    "lirc",
+    lirc_open_flags,
+    lirc_close,
+    lirc_send,
+    lirc_read,
+    lirc_reset,
+    lirc_now
+};
 
 /*************************************************************
 * lirc_open: Opens the LIRC device. In Linux and Unix        *
@@ -53,7 +64,9 @@ static int lirc_driver = 0;
 *                                                            *
 * For detailed decription, see headerfile rcx.h              *
 *                                                            *
-* Global: lirc_driver        File descriptor to lirc device  *
+* Input:  path               Filename of the lirc device     *
+*                                                            *
+* In/Out: dev                The device, must be closed      *
 *                                                            *
 * Return:                                                    *
 *   LIRC_OK                  Device opened succesfully       *
@@ -62,48 +75,74 @@ static int lirc_driver = 0;
 *   LIRC_E_DEVICE_READONLY   Device is read-only             *
 *   LIRC_E_DEVICE_NO_LIRC    Device is not a lirc_sir driver *
 *************************************************************/
-int lirc_open(void)
+int lirc_open(lirc_device_t* dev, const char* path)
+{
+    return lirc_open_flags(dev, path, 0);
+}
+
+
+
+/*************************************************************
+* lirc_open_flags: Opens the LIRC device, like lirc_open(),  *
+* with options.                                              *
+*                                                            *
+* Input:  path               Filename of the lirc device     *
+*         flags              LIRC_OPEN_xxx options           *
+*                                                            *
+* In/Out: dev                The device, must be closed      *
+*                                                            *
+* Return: See lirc_open()                                    *
+*************************************************************/
+int lirc_open_flags(lirc_device_t* dev, const char* path, int flags)
 {
     unsigned long mode;
-    char *device=LIRC_DRIVER_DEVICE;
 
     APP_DEBUG("");
 
-    if (lirc_driver)
+    if (dev->fd != LIRC_NO_FD)
     {
         APP_ERROR("Device already open");
         return LIRC_E_DEVICE_IS_OPEN;
     }
     
-    lirc_driver = open(device,O_RDONLY);
-    if (lirc_driver == -1)
+    dev->fd = open(path,O_RDONLY);
+    if (dev->fd == -1)
     {
-        lirc_driver = 0;
+        dev->fd = LIRC_NO_FD;
         APP_ERROR("Device not found");
         return LIRC_E_DEVICE_NOT_FOUND;
     }
     else
     {
-        close(lirc_driver);
+        close(dev->fd);
     }
 
-    lirc_driver = open(device,O_RDWR);
-    if (lirc_driver == -1)
+    dev->fd = open(path,O_RDWR);
+    if (dev->fd == -1)
     {
-        lirc_driver = 0;
+        dev->fd = LIRC_NO_FD;
         APP_ERROR("Device is read only");
         return LIRC_E_DEVICE_READONLY;
     }
 
 
-    if (ioctl(lirc_driver,LIRC_GET_REC_MODE,&mode)==-1 || mode!=LIRC_MODE_MODE2 )
+    if (ioctl(dev->fd,LIRC_GET_REC_MODE,&mode)==-1 || mode!=LIRC_MODE_MODE2 )
     {
-        close(lirc_driver);
-        lirc_driver = 0;
+        close(dev->fd);
+        dev->fd = LIRC_NO_FD;
         APP_ERROR("Device is not a LIRC driver");
         return LIRC_E_DEVICE_NO_LIRC;
     }
 
+    dev->bit_period = LIRC_BIT_PERIOD_2400;
+
+    /* Fall back to read() and write(), without io_uring */
+    dev->uring = 0;
+    if ((flags&LIRC_OPEN_URING) && (lirc_uring_attach(dev)!=LIRC_OK))
+    {
+        APP_PRINT("io_uring not used");
+    }
+
     return LIRC_OK;
 }
 
@@ -111,19 +150,23 @@ int lirc_open(void)
 /*************************************************************
 * lirc_close: Closes the LIRC device.                        *
 *                                                            *
-* Global: lirc_driver    File descriptor to the lirc device  *
+* In/Out: dev            The device to close                 *
 *                                                            *
 * Return: errorcodes                                         *
 *     LIRC_OK            Device closed succesfully           *
 *************************************************************/
-int lirc_close(void)
+int lirc_close(lirc_device_t* dev)
 {
     APP_DEBUG("");
 
-    if (lirc_driver)
+    if (dev->fd != LIRC_NO_FD)
     {
-        close(lirc_driver);
-        lirc_driver = 0;
+        if (dev->uring)
+        {
+            lirc_uring_detach(dev);
+        }
+        close(dev->fd);
+        dev->fd = LIRC_NO_FD;
     }
 
     return LIRC_OK;
@@ -135,9 +178,7 @@ int lirc_close(void)
 * lirc_reset resets the lirc device, and clears the receive  *
 * buffer.                                                    *
 *                                                            *
-* Globals: lirc_driver  File descriptor of the lirc device   *
-*                                                            *
-* Input:   none                                              *
+* Input:   dev          The lirc device                      *
 *                                                            *
 * Output:  none                                              *
 *                                                            *
@@ -146,72 +187,105 @@ int lirc_close(void)
 *   LIRC_E_DEVICE_NOT_OPEN   Device has not been opened      *
 *   LIRC_E_DEVICE_ERROR      Lirc device errors              *
 *************************************************************/
-int lirc_reset(void)
+int lirc_reset(lirc_device_t* dev)
+{
+    int result;
+    lirc_t dummy[RESET_ITEMS];
+
+    if (dev->fd == LIRC_NO_FD)
+    {
+        APP_ERROR("Device is not open");
+        return LIRC_E_DEVICE_NOT_OPEN;
+    }
+
+    /* Read and discard data, until nothing is received anymore */
+    do
+    {
+        result = lirc_read(dev, dummy, RESET_ITEMS, LIRC_REPLY_TIME);
+    }
+    while (result>0);
+
+    return (result==0) ? LIRC_OK : result;
+}
+
+
+
+/*************************************************************
+* lirc_read waits until data is available from the lirc      *
+* device, and then reads all available items with a single   *
+* read.                                                      *
+*                                                            *
+* Input:   dev          The lirc device                      *
+*          items_max    Size of the list, in lirc_t items    *
+*          timeout      Maximum time to wait for data, in ms *
+*                                                            *
+* Output:  list         List with received lirc_t items      *
+*                                                            *
+* Return:                                                    *
+*   > 0                      Number of items read            *
+*   0                        Nothing received before timeout *
+*   LIRC_E_DEVICE_NOT_OPEN   Device has not been opened      *
+*   LIRC_E_DEVICE_ERROR      Lirc device errors              *
+*************************************************************/
+int lirc_read(lirc_device_t* dev, lirc_t* list, int items_max,
+              int timeout)
 {
     int result;
-    int errorcode;
     struct timeval tv;
-    lirc_t dummy;
     fd_set fds;
 
-    errorcode = LIRC_OK;
-
-    if (lirc_driver == 0)
+    if (dev->fd == LIRC_NO_FD)
     {
         APP_ERROR("Device is not open");
         return LIRC_E_DEVICE_NOT_OPEN;
     }
 
-    while(1)
+    if (dev->uring)
     {
-        /* Clear bits */
-        FD_ZERO(&fds);
-        FD_SET(lirc_driver, &fds);
+        return lirc_uring_read(dev, list, items_max, timeout);
+    }
 
-        /* The maximum 'wait for data' time is 1 second */
-        tv.tv_sec = 0;
-        tv.tv_usec = REPLY_TIME*1000;
+    /* Clear bits */
+    FD_ZERO(&fds);
+    FD_SET(dev->fd, &fds);
 
-        /* Wait until data received or timeout */
-        result = select(FD_SETSIZE, &fds, NULL, NULL, &tv);
-        if (result == -1)
-        {
-            APP_ERROR("Function select() failed");
-            errorcode = LIRC_E_DEVICE_ERROR;
-            break;
-        }
+    tv.tv_sec = timeout/1000;
+    tv.tv_usec = (timeout%1000)*1000;
 
-        /* If timeout occured then break this while loop */
-        if (!FD_ISSET(lirc_driver, &fds))
-        {
-            /* No data to be read anymore */
-            break;
-        }
+    /* Wait until data received or timeout */
+    if (select(dev->fd+1, &fds, NULL, NULL, &tv) == -1)
+    {
+        APP_ERROR("Function select() failed");
+        return LIRC_E_DEVICE_ERROR;
+    }
 
-        /* Data seems to be available, so read it */
-        result = read(lirc_driver, &dummy, sizeof(lirc_t));
-        if (result != sizeof(lirc_t))
-        {
-            APP_ERROR("Function read() failed, wrong number of bytes received");
-            errorcode = LIRC_E_DEVICE_ERROR;
-            break;
-        }
+    /* Nothing received before the timeout */
+    if (!FD_ISSET(dev->fd, &fds))
+    {
+        return 0;
     }
 
-    APP_PRINT("\n");
+    /* Data seems to be available. The driver returns all  */
+    /* buffered items, up to the size of the list.         */
+    result = read(dev->fd, list, items_max*sizeof(lirc_t));
+    if ((result <= 0) || ((result%sizeof(lirc_t)) != 0))
+    {
+        APP_ERROR("Function read() failed, wrong number of bytes received");
+        return LIRC_E_DEVICE_ERROR;
+    }
 
-    return errorcode;
+    return result/sizeof(lirc_t);
 }
 
 
 
 /*************************************************************
 * lirc_receive reads data from the lirc device. It stops     *
-* reading if nothing is received for a certain period        *
-*                                                            *
-* Globals: lirc_driver  File descriptor of the lirc device   *
+* reading if nothing is received for a certain period. Each  *
+* wakeup reads all items the driver has available at once.   *
 *                                                            *
-* Input:   items_max    Size of the list, in lirct_t items   *
+* Input:   dev          The lirc device                      *
+*          items_max    Size of the list, in lirct_t items   *
 *                                                            *
 * Output:  list         List with received lirc_t items      *
 *                                                            *
@@ -221,25 +295,22 @@ int lirc_reset(void)
 *   LIRC_E_DEVICE_ERROR      Lirc device errors              *
 *   LIRC_E_BUFFERSIZE        Number of items exceed items_max*
 *************************************************************/
-int lirc_receive(lirc_t* list, int items_max)
+int lirc_receive(lirc_device_t* dev, lirc_t* list, int items_max)
 {
     int result;
     int item_count;
     int errorcode;
-    struct timeval tv;
-    fd_set fds;
 
     item_count = 0;
     errorcode = LIRC_OK;
 
-    if (lirc_driver == 0)
+    if (dev->fd == LIRC_NO_FD)
     {
         APP_ERROR("Device is not open");
         return LIRC_E_DEVICE_NOT_OPEN;
     }
 
-    APP_PRINT("DEBUG:" APP_SOURCE "receiving data: ");
-    APP_FLUSH
+    APP_DEBUG("Receiving data");
 
     /* Decrease maximum number of items, because we always */
     /* append a dummy item, at the end of this function.   */
@@ -253,37 +324,23 @@ int lirc_receive(lirc_t* list, int items_max)
             return LIRC_E_BUFFERSIZE;
         }
 
-        /* Clear bits */
-        FD_ZERO(&fds);
-        FD_SET(lirc_driver, &fds);
-
-        /* The maximum 'wait for data' time is 1 second */
-        tv.tv_sec = 0;
-        tv.tv_usec = REPLY_TIME*1000;
-
-        /* Wait until data received or timeout */
-        if (select(FD_SETSIZE, &fds, NULL, NULL, &tv) == -1)
+        /* Wait for data, and drain everything available */
+        result = lirc_read(dev, &list[item_count],
+                           items_max-item_count, LIRC_REPLY_TIME);
+        if (result<0)
         {
-            APP_ERROR("Function select() failed");
-            errorcode = LIRC_E_DEVICE_ERROR;
+            errorcode = result;
             break;
         }
 
         /* If timeout occured then break this while loop */
-        if (!FD_ISSET(lirc_driver, &fds))
+        if (result==0)
         {
             /* No data to be read anymore */
             break;
         }
 
-        /* Data seems to be available, so read it */
-        result = read(lirc_driver, &list[item_count++], sizeof(lirc_t));
-        if (result != sizeof(lirc_t))
-        {
-            APP_ERROR("Function read() failed, wrong number of bytes received");
-            errorcode = LIRC_E_DEVICE_ERROR;
-            break;
-        }
+        item_count += result;
     }
 
     /* Put in some extra mark bits, to complete a half    */
@@ -292,11 +349,9 @@ int lirc_receive(lirc_t* list, int items_max)
     /* LIRC driver.                                       */
     if (item_count>0)
     {
-        list[item_count++] = 417U*10U;
+        list[item_count++] = dev->bit_period*10U;
     }
 
-    APP_PRINT("\n");
-
     return (errorcode==LIRC_OK) ? item_count : errorcode;
 }
 
@@ -305,9 +360,8 @@ int lirc_receive(lirc_t* list, int items_max)
 /***************************************************************
 * lirc_send sends a lirc_t list to the LIRC device driver.     *
 *                                                              *
-* Global: lirc_driver  The file descriptor of the LIRC driver  *
-*                                                              *
-* Input:  list         An array that contains lirc_t items     *
+* Input:  dev          The LIRC device                         *
+*         list         An array that contains lirc_t items     *
 *         item_count   Number of items to send                 *
 *                                                              *
 * Output: none                                                 *
@@ -317,41 +371,36 @@ int lirc_receive(lirc_t* list, int items_max)
 *   LIRC_E_DEVICE_NOT_OPEN   Device has not been opened        *
 *   LIRC_E_DEVICE_ERROR      Lirc device errors                *
 ***************************************************************/
-int lirc_send(lirc_t* list, int item_count)
+int lirc_send(lirc_device_t* dev, lirc_t* list, int item_count)
 {
-    int n;
     int done;
     int todo;
     int result;
 
-    if (lirc_driver == 0)
+    if (dev->fd == LIRC_NO_FD)
     {
         APP_ERROR("Device is not open");
         return LIRC_E_DEVICE_NOT_OPEN;
     }
 
+    if (dev->uring)
+    {
+        return lirc_uring_write(dev, list, item_count);
+    }
+
     /* Send the complete list in one go to the driver */
     done = 0;
     while (done<item_count)
     {
         todo = item_count - done;
 
-        result = write(lirc_driver, &list[done],
+        result = write(dev->fd, &list[done],
                        todo*sizeof(lirc_t));
 
         if (result>0)
         {
-            /*
-            APP_PRINT("DEBUG:" APP_SOURCE);
-            for (n=done; n<(done+result); n++)
-            {
-                APP_PRINT2("  0x%08x", list[done]);
-            }
-            APP_PRINT("\n");
-            */
-
-            /* Increase number of bytes sent */
-            done += result;
+            /* Increase number of items sent */
+            done += result/sizeof(lirc_t);
         }
         else
         {
@@ -363,3 +412,20 @@ int lirc_send(lirc_t* list, int item_count)
     return LIRC_OK;
 }
 
+
+
+/*************************************************************
+* lirc_now returns the time of the monotonic clock, for the  *
+* 'now' function of lirc_file_transport.                     *
+*                                                            *
+* Input:   dev          The lirc device                      *
+*                                                            *
+* Return:  Current time, in us                               *
+*************************************************************/
+static long lirc_now(lirc_device_t* dev)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000L + ts.tv_nsec/1000;
+}
@@ -0,0 +1,602 @@
+/***************************************************************
+*                                                              *
+* lircloop.c                                                   *
+*                                                              *
+* Description:                                                 *
+* In-memory loopback transport with a virtual clock, see       *
+* lircloop.h.                                                  *
+*                                                              *
+* Every device on a line has a queue of items, each stamped    *
+* with the virtual time at which the driver would report it.   *
+* A receive returns the items that are due. If none is, the    *
+* clock jumps to the next one, or by the whole timeout.        *
+*                                                              *
+* Debug flags:                                                 *
+* APP_PRINT_DEBUG   Show debug data and errors                 *
+* APP_PRINT_ERROR   Show errors                                *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "verbose.h"
+#include "lirc.h"
+#include "lircfile.h"
+#include "lirccode.h"
+#include "lirctransport.h"
+#include "lircloop.h"
+
+/* An item, and the time the driver reports it, in us */
+struct loop_item
+{
+    lirc_t item;
+    long   time;
+};
+
+/* A device on a line */
+struct loop_end
+{
+    struct loop_end* next;
+    lirc_loop_t*     line;
+    int              first;       /* Oldest item in the queue   */
+    int              count;       /* Items in the queue         */
+    long             space_start; /* Space not reported yet     */
+    struct loop_item items[LIRC_LOOP_ITEMS];
+};
+
+/* A line */
+struct lirc_loop
+{
+    struct lirc_loop*     next;
+    char*                 name;
+    pthread_mutex_t       lock;
+    long                  now;    /* The virtual clock          */
+    long                  busy;   /* End of the last transmission*/
+    struct loop_end*      ends;
+    lirc_loop_responder_t responder;
+    void*                 user;
+    int                   echo;   /* Senders hear themselves    */
+    int                   pulse_skew;  /* Added on the air, in us */
+    int                   space_skew;
+};
+
+/* All lines, by name */
+static lirc_loop_t* loop_lines = NULL;
+static pthread_mutex_t loop_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Prototypes */
+static int loop_open(lirc_device_t* dev, const char* path, int flags);
+static int loop_close(lirc_device_t* dev);
+static int loop_send(lirc_device_t* dev, lirc_t* list, int item_count);
+static int loop_receive(lirc_device_t* dev, lirc_t* list, int items_max,
+                        int timeout);
+static int loop_reset(lirc_device_t* dev);
+static long loop_now(lirc_device_t* dev);
+static long loop_deliver(lirc_loop_t* line, struct loop_end* from,
+                         const lirc_t* list, int item_count, long start);
+static void loop_push(struct loop_end* end, lirc_t item, long time);
+
+const lirc_transport_t lirc_loop_transport =
+{
+    "loop",
+    loop_open,
+    loop_close,
+    loop_send,
+    loop_receive,
+    loop_reset,
+    loop_now
+};
+
+
+
+/*************************************************************
+* lirc_loop_create creates a line. Devices open it with its  *
+* name as path, see lirc_loop_transport.                     *
+*                                                            *
+* Input:  name               Name of the line                *
+*                                                            *
+* Return: The line, or NULL if out of memory or the name is  *
+*         in use                                             *
+*************************************************************/
+lirc_loop_t* lirc_loop_create(const char* name)
+{
+    lirc_loop_t* line;
+
+    pthread_mutex_lock(&loop_lock);
+
+    for (line=loop_lines; line!=NULL; line=line->next)
+    {
+        if (strcmp(line->name, name)==0)
+        {
+            pthread_mutex_unlock(&loop_lock);
+            APP_ERROR("Line already exists");
+            return NULL;
+        }
+    }
+
+    line = (lirc_loop_t*) malloc(sizeof(lirc_loop_t));
+    if (line!=NULL)
+    {
+        line->name = strdup(name);
+    }
+    if ((line==NULL) || (line->name==NULL))
+    {
+        free(line);
+        pthread_mutex_unlock(&loop_lock);
+        APP_ERROR("Out of memory");
+        return NULL;
+    }
+
+    pthread_mutex_init(&line->lock, NULL);
+    line->now = 0;
+    line->busy = 0;
+    line->ends = NULL;
+    line->responder = NULL;
+    line->user = NULL;
+    line->echo = 0;
+    line->pulse_skew = 0;
+    line->space_skew = 0;
+
+    line->next = loop_lines;
+    loop_lines = line;
+
+    pthread_mutex_unlock(&loop_lock);
+
+    return line;
+}
+
+
+
+/*************************************************************
+* lirc_loop_destroy removes a line. All devices on it must   *
+* have been closed.                                          *
+*                                                            *
+* In/Out: line               The line                        *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void lirc_loop_destroy(lirc_loop_t* line)
+{
+    lirc_loop_t** link;
+
+    pthread_mutex_lock(&loop_lock);
+
+    for (link=&loop_lines; *link!=NULL; link=&(*link)->next)
+    {
+        if (*link==line)
+        {
+            *link = line->next;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&loop_lock);
+
+    pthread_mutex_destroy(&line->lock);
+    free(line->name);
+    free(line);
+}
+
+
+
+/*************************************************************
+* lirc_loop_responder sets the function that answers each    *
+* transmission on the line, or removes it with NULL.         *
+*                                                            *
+* Input:  responder          The function, or NULL           *
+*         user               Passed to the function          *
+*                                                            *
+* In/Out: line               The line                        *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void lirc_loop_responder(lirc_loop_t* line, lirc_loop_responder_t responder,
+                         void* user)
+{
+    pthread_mutex_lock(&line->lock);
+    line->responder = responder;
+    line->user = user;
+    pthread_mutex_unlock(&line->lock);
+}
+
+
+
+/*************************************************************
+* lirc_loop_echo makes the devices on the line hear their    *
+* own transmissions.                                         *
+*                                                            *
+* Input:  echo               1 to hear the echo, 0 not to    *
+*                                                            *
+* In/Out: line               The line                        *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void lirc_loop_echo(lirc_loop_t* line, int echo)
+{
+    pthread_mutex_lock(&line->lock);
+    line->echo = echo;
+    pthread_mutex_unlock(&line->lock);
+}
+
+
+
+/*************************************************************
+* lirc_loop_skew makes the transmissions of the devices on   *
+* the line inexact.                                          *
+*                                                            *
+* Input:  pulse              Added to every pulse, in us     *
+*         space              Added to every space, in us     *
+*                                                            *
+* In/Out: line               The line                        *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void lirc_loop_skew(lirc_loop_t* line, int pulse, int space)
+{
+    pthread_mutex_lock(&line->lock);
+    line->pulse_skew = pulse;
+    line->space_skew = space;
+    pthread_mutex_unlock(&line->lock);
+}
+
+
+
+/*************************************************************
+* lirc_loop_now returns the virtual clock of a line.         *
+*                                                            *
+* Input:  line               The line                        *
+*                                                            *
+* Return: Time since the line was created, in us             *
+*************************************************************/
+long lirc_loop_now(lirc_loop_t* line)
+{
+    long now;
+
+    pthread_mutex_lock(&line->lock);
+    now = line->now;
+    pthread_mutex_unlock(&line->lock);
+
+    return now;
+}
+
+
+
+/*************************************************************
+* loop_open puts a device on the line named by path.         *
+*                                                            *
+* Return: See lirc_open()                                    *
+*************************************************************/
+static int loop_open(lirc_device_t* dev, const char* path, int flags)
+{
+    lirc_loop_t* line;
+    struct loop_end* end;
+
+    if (dev->data!=NULL)
+    {
+        APP_ERROR("Device already open");
+        return LIRC_E_DEVICE_IS_OPEN;
+    }
+
+    pthread_mutex_lock(&loop_lock);
+    for (line=loop_lines; line!=NULL; line=line->next)
+    {
+        if (strcmp(line->name, path)==0)
+        {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&loop_lock);
+
+    if (line==NULL)
+    {
+        APP_ERROR("Line not found");
+        return LIRC_E_DEVICE_NOT_FOUND;
+    }
+
+    end = (struct loop_end*) malloc(sizeof(struct loop_end));
+    if (end==NULL)
+    {
+        APP_ERROR("Out of memory");
+        return LIRC_E_DEVICE_NOT_FOUND;
+    }
+
+    pthread_mutex_lock(&line->lock);
+    end->line = line;
+    end->first = 0;
+    end->count = 0;
+    end->space_start = line->now;
+    end->next = line->ends;
+    line->ends = end;
+    pthread_mutex_unlock(&line->lock);
+
+    dev->data = end;
+    dev->bit_period = LIRC_BIT_PERIOD_2400;
+    return LIRC_OK;
+}
+
+
+
+/*************************************************************
+* loop_close takes a device off its line.                    *
+*                                                            *
+* Return: See lirc_close()                                   *
+*************************************************************/
+static int loop_close(lirc_device_t* dev)
+{
+    struct loop_end* end = (struct loop_end*) dev->data;
+    struct loop_end** link;
+
+    if (end==NULL)
+    {
+        return LIRC_OK;
+    }
+
+    pthread_mutex_lock(&end->line->lock);
+    for (link=&end->line->ends; *link!=NULL; link=&(*link)->next)
+    {
+        if (*link==end)
+        {
+            *link = end->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&end->line->lock);
+
+    free(end);
+    dev->data = NULL;
+
+    return LIRC_OK;
+}
+
+
+
+/*************************************************************
+* loop_send puts the items on the air. Like the driver, it   *
+* returns when they have been sent, here by moving the clock *
+* on by their airtime. A transmission on the air is waited   *
+* for first. Then the responder, if any, answers.            *
+*                                                            *
+* Return: See lirc_send()                                    *
+*************************************************************/
+static int loop_send(lirc_device_t* dev, lirc_t* list, int item_count)
+{
+    int n;
+    int count;
+    long start;
+    lirc_t item;
+    struct loop_end* end = (struct loop_end*) dev->data;
+    lirc_loop_t* line;
+    lirc_t* air = NULL;
+    lirc_t reply[LIRC_LOOP_ITEMS];
+
+    if (end==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return LIRC_E_DEVICE_NOT_OPEN;
+    }
+    line = end->line;
+
+    pthread_mutex_lock(&line->lock);
+
+    /* The items as they are on the air */
+    if ((line->pulse_skew!=0) || (line->space_skew!=0))
+    {
+        air = (lirc_t*) malloc(item_count*sizeof(lirc_t));
+        if (air==NULL)
+        {
+            pthread_mutex_unlock(&line->lock);
+            APP_ERROR("Out of memory");
+            return LIRC_E_DEVICE_ERROR;
+        }
+        for (n=0; n<item_count; n++)
+        {
+            item = (list[n]&PULSE_MASK) +
+                   ((n%2==0) ? line->pulse_skew : line->space_skew);
+            air[n] = (item>0) ? item : 1;
+        }
+        list = air;
+    }
+
+    start = (line->busy>line->now) ? line->busy : line->now;
+    line->now = loop_deliver(line, line->echo ? NULL : end, list,
+                             item_count, start);
+    line->busy = line->now;
+
+    if (line->responder!=NULL)
+    {
+        count = line->responder(line->user, list, item_count,
+                                reply, LIRC_LOOP_ITEMS);
+        if (count>0)
+        {
+            line->busy = loop_deliver(line, NULL, reply, count,
+                                      line->now + LIRC_LOOP_TURNAROUND);
+        }
+    }
+
+    pthread_mutex_unlock(&line->lock);
+
+    free(air);
+    return LIRC_OK;
+}
+
+
+
+/*************************************************************
+* loop_receive returns the items that are due. If none is,   *
+* the clock jumps to the next item, or by the timeout if     *
+* nothing arrives before it.                                 *
+*                                                            *
+* Return: See lirc_read()                                    *
+*************************************************************/
+static int loop_receive(lirc_device_t* dev, lirc_t* list, int items_max,
+                        int timeout)
+{
+    int n;
+    long due;
+    struct loop_end* end = (struct loop_end*) dev->data;
+    lirc_loop_t* line;
+
+    if (end==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return LIRC_E_DEVICE_NOT_OPEN;
+    }
+    line = end->line;
+
+    pthread_mutex_lock(&line->lock);
+
+    if ((end->count==0) || (end->items[end->first].time>line->now))
+    {
+        due = (end->count>0) ? end->items[end->first].time : -1;
+        if ((due<0) || (due>line->now+timeout*1000L))
+        {
+            line->now += timeout*1000L;
+            pthread_mutex_unlock(&line->lock);
+            return 0;
+        }
+        line->now = due;
+    }
+
+    for (n=0; (n<items_max) && (end->count>0) &&
+              (end->items[end->first].time<=line->now); n++)
+    {
+        list[n] = end->items[end->first].item;
+        end->first = (end->first+1) % LIRC_LOOP_ITEMS;
+        end->count--;
+    }
+
+    pthread_mutex_unlock(&line->lock);
+
+    return n;
+}
+
+
+
+/*************************************************************
+* loop_reset drops everything the device has not received.   *
+*                                                            *
+* Return: See lirc_reset()                                   *
+*************************************************************/
+static int loop_reset(lirc_device_t* dev)
+{
+    struct loop_end* end = (struct loop_end*) dev->data;
+
+    if (end==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return LIRC_E_DEVICE_NOT_OPEN;
+    }
+
+    pthread_mutex_lock(&end->line->lock);
+    end->count = 0;
+    pthread_mutex_unlock(&end->line->lock);
+
+    return LIRC_OK;
+}
+
+
+
+/*************************************************************
+* loop_now returns the virtual clock of the line.            *
+*************************************************************/
+static long loop_now(lirc_device_t* dev)
+{
+    struct loop_end* end = (struct loop_end*) dev->data;
+
+    return (end!=NULL) ? lirc_loop_now(end->line) : 0;
+}
+
+
+
+/*************************************************************
+* loop_deliver lets all devices on the line, except the      *
+* sender, hear a transmission, the way the driver reports    *
+* it. The line is locked.                                    *
+*                                                            *
+* Input:  from        The sender, or NULL to let all hear it *
+*         list        Items as written, starting with a pulse*
+*         item_count  Number of items in list                *
+*         start       Time the transmission starts           *
+*                                                            *
+* In/Out: line        The line                               *
+*                                                            *
+* Return: Time the transmission ends                         *
+*************************************************************/
+static long loop_deliver(lirc_loop_t* line, struct loop_end* from,
+                         const lirc_t* list, int item_count, long start)
+{
+    int n;
+    long time;
+    long stop = start;
+    long space;
+    struct loop_end* end;
+
+    for (n=0; n<item_count; n++)
+    {
+        stop += list[n]&PULSE_MASK;
+    }
+
+    for (end=line->ends; end!=NULL; end=end->next)
+    {
+        if (end==from)
+        {
+            continue;
+        }
+
+        /* The space before the first pulse, which the driver */
+        /* reports only now                                   */
+        space = start - end->space_start;
+        if (space>PULSE_MASK)
+        {
+            space = PULSE_MASK;
+        }
+        if (space>0)
+        {
+            loop_push(end, (lirc_t) space, start);
+        }
+
+        /* Each item when it ends. A space at the end is held */
+        /* back, until the next pulse.                        */
+        time = start;
+        for (n=0; n<item_count; n++)
+        {
+            if ((n%2==1) && (n==item_count-1))
+            {
+                break;
+            }
+            time += list[n]&PULSE_MASK;
+            loop_push(end, (n%2==0) ? ((list[n]&PULSE_MASK)|PULSE_BIT) :
+                                      (list[n]&PULSE_MASK), time);
+        }
+        end->space_start = time;
+    }
+
+    return stop;
+}
+
+
+
+/*************************************************************
+* loop_push adds an item to the queue of a device. Items     *
+* that do not fit are lost, as in a driver buffer overrun.   *
+* The line is locked.                                        *
+*************************************************************/
+static void loop_push(struct loop_end* end, lirc_t item, long time)
+{
+    if (end->count==LIRC_LOOP_ITEMS)
+    {
+        APP_ERROR("Loop buffer overrun");
+        return;
+    }
+
+    end->items[(end->first+end->count) % LIRC_LOOP_ITEMS].item = item;
+    end->items[(end->first+end->count) % LIRC_LOOP_ITEMS].time = time;
+    end->count++;
+}
@@ -0,0 +1,583 @@
+/***************************************************************
+*                                                              *
+* lircuring.c                                                  *
+*                                                              *
+* Description:                                                 *
+* io_uring backend of lircfile.c, see lircuring.h. The ring is *
+* set up with the raw system calls, so no liburing is needed.  *
+*                                                              *
+* A read is submitted linked to a timeout, so waiting for data *
+* and reading it take one io_uring_enter() call, instead of a  *
+* select() and a read(). The data lands in a buffer that has   *
+* been registered with the ring once, per slot.                *
+*                                                              *
+* Any thread may submit. One thread at a time waits in the     *
+* kernel for completions, and hands the results of the other   *
+* threads to them.                                             *
+*                                                              *
+* Debug flags:                                                 *
+* APP_PRINT_DEBUG   Show debug data and errors                 *
+* APP_PRINT_ERROR   Show errors                                *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "verbose.h"
+#include "lirc.h"
+#include "lircfile.h"
+#include "lircuring.h"
+
+/* Entries of the submission queue. Each slot has at most a    */
+/* read and a write in flight, each with its timeout.          */
+#define URING_ENTRIES         (LIRC_URING_SLOTS*4)
+
+/* Time a write may take on top of its airtime, in ms */
+#define URING_WRITE_MARGIN    1000
+
+/* Kind of operation, in the low bits of the user_data */
+#define OP_READ               0
+#define OP_WRITE              1
+#define OP_TIMEOUT            2
+#define OP_KINDS              4
+
+/* An operation in flight */
+struct uring_op
+{
+    int pending;                 /* Set until it completes     */
+    int result;                  /* Result of the completion   */
+};
+
+/* A device attached to the ring */
+struct uring_slot
+{
+    int             used;
+    struct uring_op read;
+    struct uring_op write;
+    lirc_t          buf[LIRC_URING_ITEMS];
+};
+
+/* The ring, shared by all devices */
+static struct uring
+{
+    int                  fd;
+    int                  refs;
+    int                  fixed;   /* Receive buffers registered */
+    int                  reaping; /* A thread waits in the kernel*/
+    void*                sq_ptr;
+    size_t               sq_size;
+    void*                cq_ptr;
+    size_t               cq_size;
+    struct io_uring_sqe* sqes;
+    size_t               sqes_size;
+    unsigned*            sq_head;
+    unsigned*            sq_tail;
+    unsigned*            sq_mask;
+    unsigned*            sq_entries;
+    unsigned*            sq_array;
+    unsigned*            cq_head;
+    unsigned*            cq_tail;
+    unsigned*            cq_mask;
+    struct io_uring_cqe* cqes;
+    struct uring_slot    slots[LIRC_URING_SLOTS];
+} uring = { -1 };
+
+static pthread_mutex_t uring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  uring_cond = PTHREAD_COND_INITIALIZER;
+
+/* Prototypes */
+static int uring_setup(void);
+static void uring_teardown(void);
+static struct io_uring_sqe* uring_sqe(void);
+static int uring_run(struct uring_op* op, int count);
+static void uring_reap(void);
+
+
+
+/*************************************************************
+* lirc_uring_attach gives an opened device a slot in the     *
+* shared ring. The first device sets up the ring.            *
+*                                                            *
+* In/Out: dev                The opened device               *
+*                                                            *
+* Return:                                                    *
+*   LIRC_OK                  Device uses the ring            *
+*   LIRC_E_DEVICE_ERROR      io_uring is not available, or   *
+*                            all slots are in use            *
+*************************************************************/
+int lirc_uring_attach(lirc_device_t* dev)
+{
+    int n;
+
+    pthread_mutex_lock(&uring_lock);
+
+    if ((uring.refs==0) && (uring_setup()!=LIRC_OK))
+    {
+        pthread_mutex_unlock(&uring_lock);
+        return LIRC_E_DEVICE_ERROR;
+    }
+
+    for (n=0; n<LIRC_URING_SLOTS; n++)
+    {
+        if (!uring.slots[n].used)
+        {
+            uring.slots[n].used = 1;
+            uring.slots[n].read.pending = 0;
+            uring.slots[n].write.pending = 0;
+            uring.refs++;
+            dev->uring = n+1;
+
+            pthread_mutex_unlock(&uring_lock);
+            return LIRC_OK;
+        }
+    }
+
+    APP_ERROR("All io_uring slots in use");
+    if (uring.refs==0)
+    {
+        uring_teardown();
+    }
+    pthread_mutex_unlock(&uring_lock);
+
+    return LIRC_E_DEVICE_ERROR;
+}
+
+
+
+/*************************************************************
+* lirc_uring_detach frees the slot of a device. The last     *
+* device tears down the ring. No I/O may be in progress.     *
+*                                                            *
+* In/Out: dev                The device                      *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void lirc_uring_detach(lirc_device_t* dev)
+{
+    pthread_mutex_lock(&uring_lock);
+
+    uring.slots[dev->uring-1].used = 0;
+    dev->uring = 0;
+    uring.refs--;
+    if (uring.refs==0)
+    {
+        uring_teardown();
+    }
+
+    pthread_mutex_unlock(&uring_lock);
+}
+
+
+
+/*************************************************************
+* lirc_uring_read does what lirc_read() does, with a read    *
+* linked to a timeout. Waiting and reading take a single     *
+* system call.                                               *
+*                                                            *
+* Input:   dev          The lirc device                      *
+*          items_max    Size of the list, in lirc_t items    *
+*          timeout      Maximum time to wait for data, in ms *
+*                                                            *
+* Output:  list         List with received lirc_t items      *
+*                                                            *
+* Return:  See lirc_read()                                   *
+*************************************************************/
+int lirc_uring_read(lirc_device_t* dev, lirc_t* list, int items_max,
+                    int timeout)
+{
+    int result;
+    int slot = dev->uring-1;
+    struct io_uring_sqe* sqe;
+    struct __kernel_timespec ts;
+
+    if (items_max>LIRC_URING_ITEMS)
+    {
+        items_max = LIRC_URING_ITEMS;
+    }
+
+    ts.tv_sec = timeout/1000;
+    ts.tv_nsec = (timeout%1000)*1000000L;
+
+    pthread_mutex_lock(&uring_lock);
+
+    /* The read, into the registered buffer of the slot */
+    sqe = uring_sqe();
+    sqe->opcode = uring.fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->fd = dev->fd;
+    sqe->off = (__u64) -1;
+    sqe->addr = (unsigned long) uring.slots[slot].buf;
+    sqe->len = items_max*sizeof(lirc_t);
+    sqe->buf_index = uring.fixed ? slot : 0;
+    sqe->user_data = slot*OP_KINDS + OP_READ;
+
+    /* Cancels the read, if nothing arrives in time */
+    sqe = uring_sqe();
+    sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long) &ts;
+    sqe->len = 1;
+    sqe->user_data = slot*OP_KINDS + OP_TIMEOUT;
+
+    result = uring_run(&uring.slots[slot].read, 2);
+
+    if (result==-ECANCELED)
+    {
+        /* Nothing received before the timeout */
+        result = 0;
+    }
+    else if ((result <= 0) || ((result%sizeof(lirc_t)) != 0))
+    {
+        APP_ERROR("io_uring read failed, wrong number of bytes received");
+        result = LIRC_E_DEVICE_ERROR;
+    }
+    else
+    {
+        result /= sizeof(lirc_t);
+        memcpy(list, uring.slots[slot].buf, result*sizeof(lirc_t));
+    }
+
+    pthread_mutex_unlock(&uring_lock);
+
+    return result;
+}
+
+
+
+/*************************************************************
+* lirc_uring_write does what lirc_send() does, with a write  *
+* linked to a timeout, so a driver that hangs cannot block   *
+* the caller forever.                                        *
+*                                                            *
+* Input:  dev          The LIRC device                       *
+*         list         An array that contains lirc_t items   *
+*         item_count   Number of items to send               *
+*                                                            *
+* Return:  See lirc_send()                                   *
+*************************************************************/
+int lirc_uring_write(lirc_device_t* dev, lirc_t* list, int item_count)
+{
+    int n;
+    int done;
+    int result;
+    long airtime = 0;
+    int slot = dev->uring-1;
+    struct io_uring_sqe* sqe;
+    struct __kernel_timespec ts;
+
+    for (n=0; n<item_count; n++)
+    {
+        airtime += list[n]&PULSE_MASK;
+    }
+    airtime = airtime/1000 + URING_WRITE_MARGIN;
+    ts.tv_sec = airtime/1000;
+    ts.tv_nsec = (airtime%1000)*1000000L;
+
+    pthread_mutex_lock(&uring_lock);
+
+    /* The driver may take less than all items at once */
+    done = 0;
+    while (done<item_count)
+    {
+        sqe = uring_sqe();
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->fd = dev->fd;
+        sqe->off = (__u64) -1;
+        sqe->addr = (unsigned long) &list[done];
+        sqe->len = (item_count-done)*sizeof(lirc_t);
+        sqe->user_data = slot*OP_KINDS + OP_WRITE;
+
+        sqe = uring_sqe();
+        sqe->opcode = IORING_OP_LINK_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = (unsigned long) &ts;
+        sqe->len = 1;
+        sqe->user_data = slot*OP_KINDS + OP_TIMEOUT;
+
+        result = uring_run(&uring.slots[slot].write, 2);
+        if (result<=0)
+        {
+            pthread_mutex_unlock(&uring_lock);
+            APP_ERROR("io_uring write failed");
+            return LIRC_E_DEVICE_ERROR;
+        }
+        done += result/sizeof(lirc_t);
+    }
+
+    pthread_mutex_unlock(&uring_lock);
+
+    return LIRC_OK;
+}
+
+
+
+/*************************************************************
+* uring_setup creates the ring, maps its queues, and         *
+* registers the receive buffers of the slots. Without        *
+* registered buffers, plain reads are used.                  *
+* The caller holds uring_lock.                               *
+*                                                            *
+* Return:                                                    *
+*   LIRC_OK                  Ring set up                     *
+*   LIRC_E_DEVICE_ERROR      io_uring is not available       *
+*************************************************************/
+static int uring_setup(void)
+{
+    int n;
+    struct io_uring_params p;
+    struct iovec iov[LIRC_URING_SLOTS];
+
+    memset(&p, 0, sizeof(p));
+    uring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (uring.fd<0)
+    {
+        APP_ERROR("io_uring not available");
+        uring.fd = -1;
+        return LIRC_E_DEVICE_ERROR;
+    }
+
+    /* Reads and writes at the current position, as needed  */
+    /* for a character device, come with kernel 5.6          */
+    if (!(p.features&IORING_FEAT_RW_CUR_POS))
+    {
+        APP_ERROR("io_uring too old");
+        close(uring.fd);
+        uring.fd = -1;
+        return LIRC_E_DEVICE_ERROR;
+    }
+
+    uring.sq_size = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    uring.cq_size = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features&IORING_FEAT_SINGLE_MMAP)
+    {
+        if (uring.cq_size>uring.sq_size)
+        {
+            uring.sq_size = uring.cq_size;
+        }
+        uring.cq_size = uring.sq_size;
+    }
+    uring.sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+
+    uring.sq_ptr = mmap(NULL, uring.sq_size, PROT_READ|PROT_WRITE,
+                        MAP_SHARED|MAP_POPULATE, uring.fd, IORING_OFF_SQ_RING);
+    uring.cq_ptr = (p.features&IORING_FEAT_SINGLE_MMAP) ? uring.sq_ptr :
+                   mmap(NULL, uring.cq_size, PROT_READ|PROT_WRITE,
+                        MAP_SHARED|MAP_POPULATE, uring.fd, IORING_OFF_CQ_RING);
+    uring.sqes = mmap(NULL, uring.sqes_size, PROT_READ|PROT_WRITE,
+                      MAP_SHARED|MAP_POPULATE, uring.fd, IORING_OFF_SQES);
+    if ((uring.sq_ptr==MAP_FAILED) || (uring.cq_ptr==MAP_FAILED) ||
+        (uring.sqes==MAP_FAILED))
+    {
+        APP_ERROR("Cannot map io_uring");
+        uring_teardown();
+        return LIRC_E_DEVICE_ERROR;
+    }
+
+    uring.sq_head = (unsigned*) ((char*) uring.sq_ptr + p.sq_off.head);
+    uring.sq_tail = (unsigned*) ((char*) uring.sq_ptr + p.sq_off.tail);
+    uring.sq_mask = (unsigned*) ((char*) uring.sq_ptr + p.sq_off.ring_mask);
+    uring.sq_entries = (unsigned*) ((char*) uring.sq_ptr +
+                                    p.sq_off.ring_entries);
+    uring.sq_array = (unsigned*) ((char*) uring.sq_ptr + p.sq_off.array);
+    uring.cq_head = (unsigned*) ((char*) uring.cq_ptr + p.cq_off.head);
+    uring.cq_tail = (unsigned*) ((char*) uring.cq_ptr + p.cq_off.tail);
+    uring.cq_mask = (unsigned*) ((char*) uring.cq_ptr + p.cq_off.ring_mask);
+    uring.cqes = (struct io_uring_cqe*) ((char*) uring.cq_ptr +
+                                         p.cq_off.cqes);
+
+    /* Register the receive buffers once, so the kernel does */
+    /* not have to map them for every read. This may fail on */
+    /* the locked memory limit, which is not fatal.          */
+    for (n=0; n<LIRC_URING_SLOTS; n++)
+    {
+        iov[n].iov_base = uring.slots[n].buf;
+        iov[n].iov_len = sizeof(uring.slots[n].buf);
+    }
+    uring.fixed = (syscall(__NR_io_uring_register, uring.fd,
+                           IORING_REGISTER_BUFFERS, iov,
+                           LIRC_URING_SLOTS)==0);
+    if (!uring.fixed)
+    {
+        APP_PRINT("io_uring buffers not registered");
+    }
+
+    uring.reaping = 0;
+    return LIRC_OK;
+}
+
+
+
+/*************************************************************
+* uring_teardown unmaps the queues, and closes the ring.     *
+* The caller holds uring_lock.                               *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+static void uring_teardown(void)
+{
+    if ((uring.sqes!=NULL) && (uring.sqes!=MAP_FAILED))
+    {
+        munmap(uring.sqes, uring.sqes_size);
+    }
+    if ((uring.cq_ptr!=NULL) && (uring.cq_ptr!=MAP_FAILED) &&
+        (uring.cq_ptr!=uring.sq_ptr))
+    {
+        munmap(uring.cq_ptr, uring.cq_size);
+    }
+    if ((uring.sq_ptr!=NULL) && (uring.sq_ptr!=MAP_FAILED))
+    {
+        munmap(uring.sq_ptr, uring.sq_size);
+    }
+    uring.sqes = NULL;
+    uring.cq_ptr = NULL;
+    uring.sq_ptr = NULL;
+
+    close(uring.fd);
+    uring.fd = -1;
+}
+
+
+
+/*************************************************************
+* uring_sqe returns the next free submission queue entry,    *
+* cleared. There is always one, because every slot has at    *
+* most four entries in flight.                               *
+* The caller holds uring_lock.                               *
+*                                                            *
+* Return: The entry                                          *
+*************************************************************/
+static struct io_uring_sqe* uring_sqe(void)
+{
+    unsigned tail;
+    unsigned index;
+
+    tail = *uring.sq_tail;
+    index = tail & *uring.sq_mask;
+
+    memset(&uring.sqes[index], 0, sizeof(struct io_uring_sqe));
+    uring.sq_array[index] = index;
+    __atomic_store_n(uring.sq_tail, tail+1, __ATOMIC_RELEASE);
+
+    return &uring.sqes[index];
+}
+
+
+
+/*************************************************************
+* uring_run submits the entries just queued, and waits until *
+* the operation completes. If no other thread waits in the   *
+* kernel, submitting and waiting take one system call.       *
+* Entries the kernel does not take are submitted again.      *
+* The caller holds uring_lock.                               *
+*                                                            *
+* Input:  count      Number of entries queued                *
+*                                                            *
+* In/Out: op         The operation                           *
+*                                                            *
+* Return: The result of the completion: >= 0 on success, or  *
+*         a negative errno value                             *
+*************************************************************/
+static int uring_run(struct uring_op* op, int count)
+{
+    int result;
+    int wait;
+
+    op->pending = 1;
+
+    while (op->pending)
+    {
+        wait = !uring.reaping;
+        if (!wait && (count==0))
+        {
+            /* Another thread reaps, and hands over the result */
+            pthread_cond_wait(&uring_cond, &uring_lock);
+            continue;
+        }
+
+        uring.reaping |= wait;
+        pthread_mutex_unlock(&uring_lock);
+
+        result = syscall(__NR_io_uring_enter, uring.fd, count, wait ? 1 : 0,
+                         wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+
+        pthread_mutex_lock(&uring_lock);
+        if ((result<0) && (errno!=EINTR) && (errno!=EAGAIN) &&
+            (errno!=EBUSY))
+        {
+            APP_ERROR("Function io_uring_enter() failed");
+            op->pending = 0;
+            op->result = -errno;
+        }
+        if (result>=0)
+        {
+            /* The kernel may take fewer: submit the rest next */
+            count -= result;
+        }
+        if (wait)
+        {
+            uring_reap();
+            uring.reaping = 0;
+            pthread_cond_broadcast(&uring_cond);
+        }
+    }
+
+    return op->result;
+}
+
+
+
+/*************************************************************
+* uring_reap hands the results in the completion queue to    *
+* their operations. Completions of timeouts are dropped.     *
+* The caller holds uring_lock.                               *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+static void uring_reap(void)
+{
+    unsigned head;
+    unsigned tail;
+    struct io_uring_cqe* cqe;
+    struct uring_slot* slot;
+
+    head = *uring.cq_head;
+    tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head!=tail)
+    {
+        cqe = &uring.cqes[head & *uring.cq_mask];
+        slot = &uring.slots[cqe->user_data / OP_KINDS];
+
+        switch (cqe->user_data % OP_KINDS)
+        {
+        case OP_READ:
+            slot->read.result = cqe->res;
+            slot->read.pending = 0;
+            break;
+
+        case OP_WRITE:
+            slot->write.result = cqe->res;
+            slot->write.pending = 0;
+            break;
+
+        default:
+            ; /* Timeout fired, or cancelled */
+        }
+        head++;
+    }
+
+    __atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+}
@@ -10,6 +10,10 @@
 * Latest version allows the transmission of raw bytes, to      *
 * support low-level communication.                             *
 *                                                              *
+* Every opened device has its own handle, see rcx_open_dev().  *
+* The rcx_xxx() functions without handle work on a default     *
+* device, opened by rcx_open().                                *
+*                                                              *
 * Debug flags:                                                 *
 * APP_PRINT_DEBUG   Show debug data amd errors                 *
 * APP_PRINT_ERROR   Show errors                                *
@@ -37,60 +41,515 @@
 *         - Split up layers in several files                   *
 *         - Add low-level communication functions              *
 ***************************************************************/
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
 #include "rcx.h"
 #include "lirc.h"
 #include "verbose.h"
 #include "rcxcode.h"
 #include "lirccode.h"
 #include "lircfile.h"
+#include "rcxring.h"
+#include "rcxprofile.h"
+#include "rcxfirm.h"
+#include "lirctransport.h"
 
 /* Defines */
 #define BUFFERSIZE            1024
 
+/* Number of times a packet is sent, if its echo is corrupted */
+#define SEND_ATTEMPTS         3
+
+/* Time the receiver thread waits between checks to stop, in ms */
+#define RECEIVER_POLL_TIME    100
+
+/* Items of the largest packet of an asynchronous command */
+#define ASYNC_ITEMS           ((RCX_ASYNC_SIZE*2+5)*LIRC_BYTE_ITEMS)
+
+/* Link quality of RCX_BAUD_AUTO: the share of failed commands, */
+/* as a moving average over about 2^LINK_SHIFT commands, in     */
+/* units of 1/LINK_ONE. At 4800 baud, the link falls back above */
+/* LINK_FALLBACK. At 2400 baud, 4800 is probed once the share   */
+/* is below LINK_RECOVERED, and probe_after commands have been  */
+/* done. A probe that falls back within LINK_PROBE_WINDOW       */
+/* commands doubles probe_after, up to LINK_PROBE_MAX.          */
+#define LINK_SHIFT            3
+#define LINK_ONE              65536
+#define LINK_FALLBACK         (LINK_ONE/4)
+#define LINK_RECOVERED        (LINK_ONE/20)
+#define LINK_PROBE_MIN        32
+#define LINK_PROBE_MAX        1024
+#define LINK_PROBE_WINDOW     16
+
+/* Calibration: opcode sent, the longest run of a character in */
+/* bits, and the runs kept of each kind                        */
+#define CALIBRATE_OPCODE      0x10
+#define CALIBRATE_BITS_MAX    10
+#define CALIBRATE_RUNS        512
+#define CALIBRATE_ECHO_MARK   0
+#define CALIBRATE_ECHO_SPACE  1
+#define CALIBRATE_REPLY_MARK  2
+#define CALIBRATE_REPLY_SPACE 3
+#define CALIBRATE_KINDS       4
+
+/* Deviations of the runs measured by rcx_calibrate_dev() */
+typedef struct rcx_runs
+{
+    int             count[CALIBRATE_KINDS];
+    int             error[CALIBRATE_KINDS][CALIBRATE_RUNS];
+} rcx_runs_t;
+
+/* Firmware download, see rcx_download_firmware_dev() */
+#define FIRMWARE_DELETE       0x65
+#define FIRMWARE_START        0x75
+#define FIRMWARE_TRANSFER     0x45
+#define FIRMWARE_UNLOCK       0xa5
+#define FIRMWARE_ATTEMPTS     8      /* Sends of a packet, at most */
+#define FIRMWARE_BAD_BLOCK    3      /* Status: block checksum     */
+#define FIRMWARE_GREETING     "Just a bit off the block!"
+
+/* Items of the packet of a transfer with n data bytes */
+#define FIRMWARE_ITEMS(n)     ((2*((n)+6)+5)*LIRC_BYTE_ITEMS)
+
+/* A transfer of a firmware download, encoded before the      */
+/* download starts                                            */
+typedef struct rcx_block
+{
+    int             sequence;     /* From 1 up, 0 for the last  */
+    int             offset;       /* Of the data in the image   */
+    int             length;       /* Number of data bytes       */
+    int             opcode;       /* Opcode encoded             */
+    int             items;        /* Items of the packet, or <0 */
+    lirc_t*         list;         /* The packet                 */
+} rcx_block_t;
+
+/* A command in progress, see raw_command_send(). The packet is */
+/* encoded again when the timing values or the opcode to send   */
+/* change.                                                      */
+typedef struct rcx_pending
+{
+    unsigned char   data[BUFFERSIZE]; /* Command bytes to send  */
+    int             length;       /* Number of command bytes    */
+    int             given;        /* Opcode as given            */
+    int             sent;         /* Opcode of the last attempt */
+    int             attempt;      /* Attempts sent so far       */
+    int             backoff;      /* Wait before the next, in ms*/
+    long            start;        /* Time of the first attempt  */
+    lirc_profile_t* profile;      /* Packet encoded with these  */
+    int             items;        /* Items of the packet, or <0 */
+    int             items_max;    /* Size of list, in items     */
+    lirc_t*         list;         /* The packet                 */
+} rcx_pending_t;
+
+/* An asynchronous command. The completion holds the command  */
+/* bytes until the command is done, and the reply after that. */
+typedef struct rcx_request
+{
+    struct rcx_request* next;
+    rcx_callback_t      callback;
+    rcx_completion_t    completion;
+} rcx_request_t;
+
+/* An opened device. Transmissions are serialized by tx_lock, */
+/* receptions by rx_lock. A command and its reply hold both,  */
+/* always taken in that order. So does sending a packet, to   */
+/* take its echo from the receive stream.                     */
+struct rcx_handle
+{
+    lirc_device_t   device;       /* The LIRC device            */
+    const lirc_transport_t* transport; /* Functions of device   */
+    char*           path;         /* Path the device was opened */
+    lirc_profile_t* profile;      /* Timing values in use       */
+    lirc_profile_t* base;         /* Timing values at 2400 baud */
+    lirc_profile_t* fast;         /* Same at 4800 baud, or NULL */
+    lirc_profile_t* calibrated;   /* Own timing values, or NULL */
+
+    /* Bit rate, see rcx_set_baud_dev(). Changed with both    */
+    /* locks held.                                             */
+    int             baud;         /* RCX_BAUD_xxx asked for     */
+    int             rate;         /* Bit rate in use            */
+    int             link_errors;  /* Failed share, see LINK_ONE */
+    int             link_commands;/* Commands at this rate      */
+    int             probe_after;  /* Commands before a probe    */
+
+    /* Retries, see rcx_set_retry_dev(). Changed with both    */
+    /* locks held.                                             */
+    rcx_retry_t     retry;        /* Policy in use              */
+    int             last_opcode;  /* Sent last, or -1           */
+    int             late_opcode;  /* Reply may come late, or -1 */
+
+    /* LNP, see rcx_lnp_set_handler_dev(). Changed with the    */
+    /* rx_lock held. The last handler takes integrity packets. */
+    int             lnp_host;     /* Host number of this side   */
+    rcx_lnp_handler_t lnp_handlers[RCX_LNP_PORTS+1];
+    void*           lnp_users[RCX_LNP_PORTS+1];
+    rcx_lnp_parser_t lnp_parser;
+
+    /* Packets a command skips, see rcx_set_unsolicited_dev(). */
+    /* Changed with the rx_lock held.                          */
+    rcx_unsolicited_t unsolicited;
+    void*           unsolicited_user;
+    pthread_mutex_t tx_lock;      /* Held while transmitting    */
+    pthread_mutex_t rx_lock;      /* Held while receiving       */
+
+    /* Receive stream: items read from the driver, but not yet */
+    /* decoded, plus the state of the decoder and the parser   */
+    int             recv_item_index;
+    int             recv_item_count;
+    lirc_t          recv_items[BUFFERSIZE];
+    lirc_decoder_t  decoder;
+    rcx_parser_t    parser;
+
+    /* Bytes received, not yet read by rcx_receive_byte_dev() */
+    int             recv_byte_index;
+    int             recv_byte_count;
+    unsigned char   recv_byte_buf[BUFFERSIZE];
+
+    /* Receiver thread, see RCX_OPEN_RECEIVER. It is the only  */
+    /* reader of the device, and the producer of the ring. The */
+    /* consumer holds the rx_lock. The stats are written by    */
+    /* the thread only.                                        */
+    int             receiver;     /* Receiver thread is running */
+    pthread_t       receiver_thread;
+    int             receiver_stop;   /* Set to stop the thread  */
+    int             receiver_result; /* Device error, or RCX_OK */
+    pthread_mutex_t ring_lock;    /* Protects ring_cond only    */
+    pthread_cond_t  ring_cond;    /* Signalled on new bytes     */
+    rcx_ring_t      ring;
+    rcx_receiver_stats_t stats;
+
+    /* Worker thread of the asynchronous commands. Requests of */
+    /* the pool move from the free list to the submission      */
+    /* queue, and from there back to the free list, or to the  */
+    /* completion queue. All lists are protected by queue_lock.*/
+    int             worker;       /* Worker thread is running   */
+    int             worker_stop;  /* Set to stop the thread     */
+    pthread_t       worker_thread;
+    pthread_mutex_t queue_lock;
+    pthread_cond_t  queue_cond;   /* Signalled on submission    */
+    pthread_cond_t  done_cond;    /* Signalled on completion    */
+    rcx_request_t*  pool;
+    rcx_request_t*  free_list;
+    rcx_request_t*  submit_head;
+    rcx_request_t*  submit_tail;
+    rcx_request_t*  done_head;
+    rcx_request_t*  done_tail;
+
+    /* Statistics, see rcx_get_stats(). Any thread adds to them */
+    /* with atomic operations, without taking a lock.           */
+    rcx_stats_t     counters;
+};
+
 /* Prototypes */
-int raw_receive(unsigned char* buf, int buf_size);
-int raw_send(unsigned char tx_byte);
+int raw_send_packet(rcx_handle_t* handle, unsigned char* buf, int buf_len);
+int raw_encode_packet(rcx_handle_t* handle, unsigned char* buf, int buf_len,
+                      lirc_t* list, int items_max);
+int raw_send_encoded(rcx_handle_t* handle, lirc_t* list, int item_count,
+                     int air_len);
+int raw_command_reply(rcx_handle_t* handle, unsigned char opcode,
+                      unsigned char* buf, int buf_size, int* buf_len);
+int raw_command_init(rcx_handle_t* handle, rcx_pending_t* pending,
+                     unsigned char* buf, int buf_len, lirc_t* list,
+                     int items_max);
+int raw_command_send(rcx_handle_t* handle, rcx_pending_t* pending);
+int raw_command_finish(rcx_handle_t* handle, rcx_pending_t* pending,
+                       int result, unsigned char* buf, int buf_size,
+                       int* buf_len);
+int raw_backoff(rcx_handle_t* handle, int wait);
+int raw_toggle(rcx_handle_t* handle, int opcode);
+int raw_firmware_command(rcx_handle_t* handle, unsigned char* buf,
+                         int buf_size, int* buf_len);
+int raw_firmware_encode(rcx_handle_t* handle, const rcx_firmware_t* firmware,
+                        rcx_block_t* block);
+int raw_firmware_transfer(rcx_handle_t* handle,
+                          const rcx_firmware_t* firmware,
+                          rcx_block_t* block, int* retransmits);
+int raw_lnp_packet(rcx_handle_t* handle);
+void raw_count_lnp(rcx_handle_t* handle, int result);
+int raw_lnp_dispatch(rcx_handle_t* handle, int header);
+void* raw_worker(void* arg);
+rcx_request_t* raw_next_request(rcx_handle_t* handle, int wait);
+void raw_complete(rcx_handle_t* handle, rcx_request_t* request, int result);
+int raw_receive_packet(rcx_handle_t* handle, unsigned char* buf,
+                       int buf_size, int* buf_len, int wait);
+int raw_receive_reply(rcx_handle_t* handle, unsigned char opcode,
+                      unsigned char* buf, int buf_size, int* buf_len);
+int raw_packet_out(rcx_handle_t* handle, int length,
+                   unsigned char* buf, int buf_size, int* buf_len);
+int raw_read_items(rcx_handle_t* handle, int timeout);
+int raw_stash_items(rcx_handle_t* handle, lirc_t* list, int item_count);
+int raw_check_echo(rcx_handle_t* handle, lirc_t* list, int item_count);
+void raw_reset_stream(rcx_handle_t* handle);
+void* raw_receiver(void* arg);
+int raw_ring_wait(rcx_handle_t* handle, int timeout);
+int raw_ring_packet(rcx_handle_t* handle, unsigned char* buf,
+                    int buf_size, int* buf_len, int wait);
+int raw_receive(rcx_handle_t* handle, unsigned char* buf, int buf_size);
+int raw_send(rcx_handle_t* handle, unsigned char tx_byte);
+int raw_send_items(rcx_handle_t* handle, lirc_t* list, int item_count);
+void raw_count(unsigned long* counter, unsigned long value);
+unsigned long raw_stat(unsigned long* counter);
+void raw_count_time(rcx_handle_t* handle, unsigned long* histogram,
+                    long start);
+void raw_count_decode(rcx_handle_t* handle, lirc_decoder_t* decoder,
+                      int result);
+void raw_count_parse(rcx_handle_t* handle, rcx_parser_t* parser,
+                     int result);
+int raw_calibrate_round(rcx_handle_t* handle, lirc_t* list, int item_count,
+                        rcx_runs_t* runs);
+void raw_calibrate_add(rcx_runs_t* runs, int kind, int error);
+int raw_median(int* values, int count);
+int raw_compare(const void* a, const void* b);
+int raw_set_rate(rcx_handle_t* handle, int rate);
+void raw_link_update(rcx_handle_t* handle, int result);
+
+/* Globals */
+static rcx_handle_t* rcx_default = NULL;
 
 
 
 /***************************************************************
-* rcx_open:   Initializes the LIRC driver.                     *
+* rcx_open:   Initializes the LIRC driver, with the timing     *
+*             values of the default target.                    *
 *                                                              *
 * Input:   none                                                *
 * Output:  none                                                *
+* Return:  See rcx_open_target()                               *
+***************************************************************/
+int rcx_open(void)
+{
+    return rcx_open_target(RCX_TARGET_DEFAULT);
+}
+
+
+
+/***************************************************************
+* rcx_open_target: Initializes the LIRC driver, and selects    *
+*             the timing values of the host platform.          *
+*                                                              *
+* Input:   target                 RCX_TARGET_xxx platform      *
+* Output:  none                                                *
+* Return:  RCX_E_DEVICE_IS_OPEN   Device is already open       *
+*          See rcx_open_dev() for the other codes              *
+***************************************************************/
+int rcx_open_target(int target)
+{
+    if (rcx_default!=NULL)
+    {
+        APP_ERROR("Device already open");
+        return RCX_E_DEVICE_IS_OPEN;
+    }
+
+    return rcx_open_dev(RCX_DEFAULT_DEVICE, target, &rcx_default);
+}
+
+
+
+/***************************************************************
+* rcx_open_dev: Opens a LIRC device, and selects the timing    *
+*             values of the host platform.                     *
+*                                                              *
+* Input:   device                 Filename of the LIRC device  *
+*          flags                  RCX_TARGET_xxx platform, or'ed*
+*                                 with RCX_OPEN_xxx options    *
+* Output:  handle                 Handle of the opened device  *
 * Return:  RCX_OK                 Device is opened normally    *
 *          RCX_E_DEVICE_NOT_FOUND Cannot open the LIRC driver  *
 *          RCX_E_DEVICE_READONLY  No permissions to write to   *
 *                                 the LIRC driver              *
 *          RCX_E_DEVICE_NO_LIRC   Device is not a LIRC driver  *
-*          RCX_E_DEVICE_IS_OPEN   Device is already open       *
+*          RCX_E_BAD_ARGUMENT     Unknown target               *
 *          RCX_E_PROGRAM_FAILURE  Internal error               *
 ***************************************************************/
-int rcx_open(void)
+int rcx_open_dev(const char* device, int flags, rcx_handle_t** handle)
+{
+    return rcx_open_transport(&lirc_file_transport, device, flags, handle);
+}
+
+
+
+/***************************************************************
+* rcx_open_transport: Opens a device of another transport than *
+*             the LIRC driver, see lirctransport.h.            *
+*                                                              *
+* Input:   transport              Functions of the transport   *
+*          device                 Path, as the transport takes *
+*          flags                  See rcx_open_dev()           *
+* Output:  handle                 Handle of the opened device  *
+* Return:  See rcx_open_dev()                                  *
+***************************************************************/
+int rcx_open_transport(const struct lirc_transport* transport,
+                       const char* device, int flags, rcx_handle_t** handle)
 {
+    int result;
+    int bit_period;
+    int mark_adjust;
+    int space_adjust;
+    lirc_profile_t* profile;
+    rcx_handle_t* h;
+    pthread_condattr_t attr;
+
     APP_DEBUG("");
     APP_FLUSH
 
-    switch (lirc_open())
+    switch (flags&RCX_TARGET_MASK)
     {
-    case LIRC_OK: /* Device has been opened succesfully */
-        return RCX_OK;
+    case RCX_TARGET_DEFAULT:
+        profile = lirc_profile(LIRC_PROFILE_DEFAULT);
+        break;
 
-    case LIRC_E_DEVICE_IS_OPEN: /* Device is already open */
-        return RCX_E_DEVICE_IS_OPEN;
+    case RCX_TARGET_NOMINAL:
+        profile = lirc_profile(LIRC_PROFILE_NOMINAL);
+        break;
+
+    case RCX_TARGET_PC:
+        profile = lirc_profile(LIRC_PROFILE_PC);
+        break;
+
+    case RCX_TARGET_IPAQ:
+        profile = lirc_profile(LIRC_PROFILE_IPAQ);
+        break;
+
+    default:
+        APP_ERROR("Unknown target");
+        return RCX_E_BAD_ARGUMENT;
+    }
+
+    h = (rcx_handle_t*) malloc(sizeof(rcx_handle_t));
+    if (h==NULL)
+    {
+        APP_ERROR("Out of memory");
+        return RCX_E_PROGRAM_FAILURE;
+    }
+    h->device.fd = LIRC_NO_FD;
+    h->device.uring = 0;
+    h->device.data = NULL;
+    h->transport = transport;
+    h->profile = profile;
+    h->fast = NULL;
+    h->calibrated = NULL;
+    h->path = strdup(device);
+    if (h->path==NULL)
+    {
+        free(h);
+        APP_ERROR("Out of memory");
+        return RCX_E_PROGRAM_FAILURE;
+    }
+
+    /* Timing values of an earlier calibration, see rcx_calibrate() */
+    if (((flags&RCX_TARGET_MASK)==RCX_TARGET_DEFAULT) &&
+        rcx_profile_load(device, &bit_period, &mark_adjust, &space_adjust))
+    {
+        h->calibrated = (lirc_profile_t*) malloc(sizeof(lirc_profile_t));
+        if ((h->calibrated!=NULL) &&
+            (lirc_profile_init(h->calibrated, bit_period,
+                               mark_adjust, space_adjust)==LIRC_OK))
+        {
+            h->profile = h->calibrated;
+        }
+    }
+    h->base = h->profile;
+    h->baud = RCX_BAUD_2400;
+    h->rate = RCX_BAUD_2400;
+    h->link_errors = 0;
+    h->link_commands = 0;
+    h->probe_after = LINK_PROBE_MIN;
+    h->retry.attempts = RCX_RETRY_ATTEMPTS;
+    h->retry.backoff = RCX_RETRY_BACKOFF;
+    h->retry.backoff_max = RCX_RETRY_BACKOFF_MAX;
+    h->retry.idempotent = NULL;
+    h->last_opcode = -1;
+    h->late_opcode = -1;
+    h->lnp_host = RCX_LNP_HOST;
+    memset(h->lnp_handlers, 0, sizeof(h->lnp_handlers));
+    memset(h->lnp_users, 0, sizeof(h->lnp_users));
+    rcx_lnp_parser_init(&h->lnp_parser);
+    h->unsolicited = NULL;
+    h->unsolicited_user = NULL;
+
+    memset(&h->counters, 0, sizeof(h->counters));
+    raw_reset_stream(h);
+
+    switch (transport->open(&h->device, device,
+                            (flags&RCX_OPEN_URING) ? LIRC_OPEN_URING : 0))
+    {
+    case LIRC_OK: /* Device has been opened succesfully */
+        result = RCX_OK;
+        break;
 
     case LIRC_E_DEVICE_NOT_FOUND: /* Device cannot be opened */
-        return RCX_E_DEVICE_NOT_FOUND;
+        result = RCX_E_DEVICE_NOT_FOUND;
+        break;
 
     case LIRC_E_DEVICE_READONLY: /* Device is read-only */
-        return RCX_E_DEVICE_READONLY;
+        result = RCX_E_DEVICE_READONLY;
+        break;
 
     case LIRC_E_DEVICE_NO_LIRC: /* Device not a lirc_sir driver */
-        return RCX_E_DEVICE_NO_LIRC;
+        result = RCX_E_DEVICE_NO_LIRC;
+        break;
 
     default:
-        return RCX_E_PROGRAM_FAILURE;
+        result = RCX_E_PROGRAM_FAILURE;
     }
+
+    if (result!=RCX_OK)
+    {
+        free(h->calibrated);
+        free(h->path);
+        free(h);
+        return result;
+    }
+    h->device.bit_period = h->profile->bit_period;
+
+    pthread_mutex_init(&h->tx_lock, NULL);
+    pthread_mutex_init(&h->rx_lock, NULL);
+
+    /* The worker thread is started by the first asynchronous */
+    /* command, see rcx_command_async_dev().                  */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    h->worker = 0;
+    h->pool = NULL;
+    h->free_list = NULL;
+    h->submit_head = NULL;
+    h->submit_tail = NULL;
+    h->done_head = NULL;
+    h->done_tail = NULL;
+    pthread_mutex_init(&h->queue_lock, NULL);
+    pthread_cond_init(&h->queue_cond, NULL);
+    pthread_cond_init(&h->done_cond, &attr);
+
+    /* Start the receiver thread, if asked for */
+    h->receiver = 0;
+    if (flags&RCX_OPEN_RECEIVER)
+    {
+        h->receiver_stop = 0;
+        h->receiver_result = RCX_OK;
+        memset(&h->stats, 0, sizeof(h->stats));
+        rcx_ring_init(&h->ring);
+        pthread_mutex_init(&h->ring_lock, NULL);
+        pthread_cond_init(&h->ring_cond, &attr);
+
+        if (pthread_create(&h->receiver_thread, NULL, raw_receiver, h)!=0)
+        {
+            APP_ERROR("Cannot start receiver thread");
+            pthread_cond_destroy(&h->ring_cond);
+            pthread_mutex_destroy(&h->ring_lock);
+            pthread_condattr_destroy(&attr);
+            rcx_close_dev(h);
+            return RCX_E_PROGRAM_FAILURE;
+        }
+        h->receiver = 1;
+    }
+    pthread_condattr_destroy(&attr);
+
+    *handle = h;
+    return RCX_OK;
 }
 
 
@@ -100,31 +559,82 @@ int rcx_open(void)
 *                                                              *
 * Input:   none                                                *
 * Output:  none                                                *
+* Return:  See rcx_reset_dev()                                 *
+***************************************************************/
+int rcx_reset(void)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_reset_dev(rcx_default);
+}
+
+
+
+/***************************************************************
+* rcx_reset_dev: Resets LIRC driver, and clears input buffers. *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+* Output:  none                                                *
 * Return:  RCX_OK                 Device is opened normally    *
 *          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
 *          RCX_E_DEVICE_ERROR     Error in LIRC device         *
 *          RCX_E_PROGRAM_FAILURE  Internal error               *
 ***************************************************************/
-int rcx_reset(void)
+int rcx_reset_dev(rcx_handle_t* handle)
 {
+    int result;
+
     APP_DEBUG("");
     APP_FLUSH
 
+    pthread_mutex_lock(&handle->tx_lock);
+    pthread_mutex_lock(&handle->rx_lock);
+
+    /* The receiver thread owns the driver. Drop what it has */
+    /* received so far instead.                              */
+    if (handle->receiver)
+    {
+        unsigned char buf[BUFFERSIZE];
+
+        while (rcx_ring_get(&handle->ring, buf, BUFFERSIZE)>0)
+        {
+        }
+        rcx_parser_init(&handle->parser);
+        result = __atomic_load_n(&handle->receiver_result, __ATOMIC_ACQUIRE);
+
+        pthread_mutex_unlock(&handle->rx_lock);
+        pthread_mutex_unlock(&handle->tx_lock);
+        return result;
+    }
+
     /* Reset the LIRC driver */
-    switch (lirc_reset())
+    switch (handle->transport->reset(&handle->device))
     {
     case LIRC_E_DEVICE_NOT_OPEN: /* Device not open */
-        return RCX_E_DEVICE_NOT_OPEN;
+        result = RCX_E_DEVICE_NOT_OPEN;
+        break;
 
     case LIRC_E_DEVICE_ERROR: /* Lirc device errors */
-        return RCX_E_DEVICE_ERROR;
+        result = RCX_E_DEVICE_ERROR;
+        break;
 
     case LIRC_OK: /* Lirc reset ok */
-        return RCX_OK;
+        raw_reset_stream(handle);
+        result = RCX_OK;
+        break;
 
     default: /* Internal error, result code unknown */
-        return RCX_E_PROGRAM_FAILURE;
+        result = RCX_E_PROGRAM_FAILURE;
     }
+
+    pthread_mutex_unlock(&handle->rx_lock);
+    pthread_mutex_unlock(&handle->tx_lock);
+
+    return result;
 }
 
 
@@ -138,9 +648,70 @@ int rcx_reset(void)
 ***************************************************************/
 int rcx_close(void)
 {
+    int result = RCX_OK;
+
+    if (rcx_default!=NULL)
+    {
+        result = rcx_close_dev(rcx_default);
+        rcx_default = NULL;
+    }
+
+    return result;
+}
+
+
+
+/***************************************************************
+* rcx_close_dev: Closes a LIRC device, and frees its handle.   *
+*               No other thread may use the handle anymore.    *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+* Output:  none                                                *
+* Return:  RCX_OK                 Device is closed succesfully *
+***************************************************************/
+int rcx_close_dev(rcx_handle_t* handle)
+{
+    rcx_request_t* request;
+
     APP_DEBUG("");
 
-    lirc_close();
+    /* Let the worker finish the command on the air, and fail */
+    /* the commands still queued                               */
+    if (handle->worker)
+    {
+        pthread_mutex_lock(&handle->queue_lock);
+        handle->worker_stop = 1;
+        pthread_cond_broadcast(&handle->queue_cond);
+        pthread_mutex_unlock(&handle->queue_lock);
+        pthread_join(handle->worker_thread, NULL);
+
+        while ((request = handle->submit_head)!=NULL)
+        {
+            handle->submit_head = request->next;
+            raw_complete(handle, request, RCX_E_DEVICE_NOT_OPEN);
+        }
+        free(handle->pool);
+    }
+    pthread_cond_destroy(&handle->done_cond);
+    pthread_cond_destroy(&handle->queue_cond);
+    pthread_mutex_destroy(&handle->queue_lock);
+
+    if (handle->receiver)
+    {
+        __atomic_store_n(&handle->receiver_stop, 1, __ATOMIC_RELEASE);
+        pthread_join(handle->receiver_thread, NULL);
+        pthread_cond_destroy(&handle->ring_cond);
+        pthread_mutex_destroy(&handle->ring_lock);
+    }
+
+    handle->transport->close(&handle->device);
+
+    pthread_mutex_destroy(&handle->rx_lock);
+    pthread_mutex_destroy(&handle->tx_lock);
+    free(handle->fast);
+    free(handle->calibrated);
+    free(handle->path);
+    free(handle);
 
     APP_FLUSH
 
@@ -153,12 +724,42 @@ int rcx_close(void)
 * rcx_command: Send a command to the LIRC driver, and receive  *
 *              its reply.                                      *
 *                                                              *
+* Input:   buf_len                Number of bytes to send      *
+*          buf                    Send and receive buffer      *
+*          buf_size               Size of send/receive buffer  *
+* Output:  buf_len                Number of bytes received     *
+* Return:  See rcx_command_dev()                               *
+***************************************************************/
+int rcx_command(unsigned char* buf, int buf_size, int* buf_len)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_command_dev(rcx_default, buf, buf_size, buf_len);
+}
+
+
+
+/***************************************************************
+* rcx_command_dev: Send a command to the LIRC driver, and      *
+*              receive its reply.                              *
+*                                                              *
 *              The buffer holds the RCX opcode, plus arguments *
 *              to be sent. The same buffer is also used for    *
 *              receiving input.                                *
 *                                                              *
 *              This is a non-blocking function, but it can     *
-*              take a second before the call returns.          *
+*              take a second before the call returns. If the   *
+*              reply length of the opcode is known, the call   *
+*              returns as soon as the reply is complete. For   *
+*              opcodes without a reply, the call returns right *
+*              after sending, with buf_len set to 0.           *
+*                                                              *
+*              The toggle bit and the retries are managed as   *
+*              rcx.h tells, see rcx_set_retry().               *
 *                                                              *
 *              ------------------Example---------------------- *
 *              int           errorcode;                        *
@@ -169,7 +770,8 @@ int rcx_close(void)
 *              errorcode = rcx_send(buffer, BUF_SIZE, &length);*
 *              ----------------------------------------------- *
 *                                                              *
-* Input:   buf_len                Number of bytes to send      *
+* Input:   handle                 Handle of the device         *
+*          buf_len                Number of bytes to send      *
 *          buf                    Send and receive buffer      *
 *          buf_size               Size of send/receive buffer  *
 * Output:  buf_len                Number of bytes received     *
@@ -179,32 +781,38 @@ int rcx_close(void)
 *          RCX_E_DEVICE_ERROR     Cannot send to LIRC driver   *
 *          RCX_E_RECV_NOTHING     No data received             *
 *          RCX_E_RECV_ERROR       Data received, with errors   *
+*          RCX_E_COLLISION        Every send attempt collided  *
+*          RCX_E_BAD_ARGUMENT     No bytes to send             *
+*          RCX_E_PROGRAM_FAILURE  Internal error               *
 ***************************************************************/
-int rcx_command(unsigned char* buf, int buf_size, int* buf_len)
+int rcx_command_dev(rcx_handle_t* handle, unsigned char* buf,
+                    int buf_size, int* buf_len)
 {
     int result;
-    unsigned char opcode;
+    rcx_pending_t pending;
+    lirc_t list[BUFFERSIZE*LIRC_BYTE_ITEMS];
 
     APP_DEBUG("");
 
-    /* Send data bytes as RCX packet to the LIRC driver */
-    opcode = buf[0];
-    result = rcx_send(buf, *buf_len);
-    if (result!=RCX_OK)
-    {
-        return result;
-    }
-
-    /* Receive reply from LIRC and parse RCX packet */
-    result = rcx_receive(buf, buf_size, buf_len);
+    /* Hold both locks, so no other transmission can disturb */
+    /* the reply, and no other reception can take it.        */
+    pthread_mutex_lock(&handle->tx_lock);
+    pthread_mutex_lock(&handle->rx_lock);
 
-    /* Check if data contains inverted opcode, to */
-    /* check if it complies with the RCX protocol */
-    if (opcode != (unsigned char) (~buf[0]&0xffU) )
+    /* Send data bytes as RCX packet to the LIRC driver, and */
+    /* receive the reply, with the retries                   */
+    result = raw_command_init(handle, &pending, buf, *buf_len, list,
+                              BUFFERSIZE*LIRC_BYTE_ITEMS);
+    if (result==RCX_OK)
     {
-        result = RCX_E_RECV_ERROR;
+        result = raw_command_send(handle, &pending);
+        result = raw_command_finish(handle, &pending, result,
+                                    buf, buf_size, buf_len);
     }
 
+    pthread_mutex_unlock(&handle->rx_lock);
+    pthread_mutex_unlock(&handle->tx_lock);
+
     APP_FLUSH
 
     return result;
@@ -214,261 +822,3350 @@ int rcx_command(unsigned char* buf, int buf_size, int* buf_len)
 
 
 /***************************************************************
-* rcx_send:    Send a RCX packet to the LIRC driver            *
+* rcx_command_async: Queue a command, and return at once.      *
 *                                                              *
-* Input:   buf_len                Number of bytes to send      *
-*          buf                    Send buffer                  *
+* Input:   buf                    Command bytes to send        *
+*          buf_len                Number of bytes to send      *
+*          callback               Called when done, or NULL    *
+*          user                   Passed with the completion   *
 * Output:                                                      *
-* Return:  RCX_OK                 Command has been sent        *
-*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
-*          RCX_E_DEVICE_ERROR     Cannot send to LIRC driver   *
-*          RCX_E_PROGRAM_FAILURE  Internal error               *
+* Return:  See rcx_command_async_dev()                         *
 ***************************************************************/
-int rcx_send(unsigned char* buf, int buf_len)
+int rcx_command_async(unsigned char* buf, int buf_len,
+                      rcx_callback_t callback, void* user)
 {
-    int index = 0;
-    int result = RCX_OK;
-    int rcxlen = 0;
-    unsigned char send_byte_buf[BUFFERSIZE];
-
-    /* Convert byte array to a RCX packet */
-    rcxlen = rcx_encode(buf, buf_len, send_byte_buf, BUFFERSIZE);
-    if (rcxlen==RCX_E_BUFFER)
-    {
-        result = RCX_E_PROGRAM_FAILURE;
-    }
-
-    /* Send a byte at a time to the LIRC driver */
-    while ((result==RCX_OK) && (index<rcxlen))
+    if (rcx_default==NULL)
     {
-        result = rcx_send_byte(send_byte_buf[index]);
-        index++;
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
     }
 
-    APP_FLUSH
-
-    return result;
+    return rcx_command_async_dev(rcx_default, buf, buf_len, callback, user);
 }
 
 
 
 
 /***************************************************************
-* rcx_receive: Receive a RCX packet from the LIRC driver       *
+* rcx_command_async_dev: Queue a command, and return at once.  *
 *                                                              *
-*              This is a non-blocking function, but it can     *
-*              take a second before the call returns.          *
+*              The first call starts the worker thread of the  *
+*              handle. See rcx.h for a full description.       *
 *                                                              *
-* Input:   buf                    Receive buffer               *
-*          buf_size               Size of receive buffer       *
-* Output:  buf_len                Number of bytes received     *
-* Return:  RCX_OK                 Command and reply has been   *
-*                                 send and received succesfully*
-*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
-*          RCX_E_DEVICE_ERROR     Error in LIRC device         *
-*          RCX_E_RECV_NOTHING     No data received             *
-*          RCX_E_RECV_ERROR       Data received, with errors   *
+* Input:   handle                 Handle of the device         *
+*          buf                    Command bytes to send        *
+*          buf_len                Number of bytes to send      *
+*          callback               Called when done, or NULL    *
+*          user                   Passed with the completion   *
+* Output:                                                      *
+* Return:  RCX_OK                 Command queued               *
+*          RCX_E_BAD_ARGUMENT     More than RCX_ASYNC_SIZE     *
+*                                 bytes, or none               *
+*          RCX_E_QUEUE_FULL       Too many commands in progress*
+*          RCX_E_PROGRAM_FAILURE  Cannot start the worker      *
 ***************************************************************/
-int rcx_receive(unsigned char* buf, int buf_size, int* buf_len)
+int rcx_command_async_dev(rcx_handle_t* handle, unsigned char* buf,
+                          int buf_len, rcx_callback_t callback,
+                          void* user)
 {
-    int result;
-    unsigned char recv_byte_buf[BUFFERSIZE];
-
-    APP_DEBUG("");
-    APP_FLUSH
+    int n;
+    rcx_request_t* request;
 
-    /* Receive and decode input LIRC driver */
-    result = raw_receive(recv_byte_buf, BUFFERSIZE);
-    APP_PRINT2("DEBUG:" APP_SOURCE "Function raw_receive() returned %d\n", result);
-    if (result<0)
+    if ((buf_len<1) || (buf_len>RCX_ASYNC_SIZE))
     {
-        return result;
+        APP_ERROR("Bad command length");
+        return RCX_E_BAD_ARGUMENT;
     }
 
-    result = rcx_decode(recv_byte_buf, result, buf, buf_size);
-    APP_PRINT2("DEBUG:" APP_SOURCE "Function rcx_decode() returned %d\n", result);
-    switch (result)
-    {
-    case RCX_E_NO_RCX: /* Error, input is not RCX */
-        return RCX_E_RECV_ERROR;
+    pthread_mutex_lock(&handle->queue_lock);
 
-    case RCX_E_BUFFER: /* Error, buffer size too small */
-        return RCX_E_RECV_ERROR;
+    if (!handle->worker)
+    {
+        handle->pool = (rcx_request_t*)
+                       malloc(RCX_ASYNC_QUEUE*sizeof(rcx_request_t));
+        if (handle->pool==NULL)
+        {
+            pthread_mutex_unlock(&handle->queue_lock);
+            APP_ERROR("Out of memory");
+            return RCX_E_PROGRAM_FAILURE;
+        }
+        for (n=0; n<RCX_ASYNC_QUEUE; n++)
+        {
+            handle->pool[n].next = (n+1<RCX_ASYNC_QUEUE) ?
+                                   &handle->pool[n+1] : NULL;
+        }
+        handle->free_list = handle->pool;
 
-    case 0: /* No data received */
-        return RCX_E_RECV_NOTHING;
+        handle->worker_stop = 0;
+        if (pthread_create(&handle->worker_thread, NULL, raw_worker,
+                           handle)!=0)
+        {
+            free(handle->pool);
+            handle->pool = NULL;
+            pthread_mutex_unlock(&handle->queue_lock);
+            APP_ERROR("Cannot start worker thread");
+            return RCX_E_PROGRAM_FAILURE;
+        }
+        handle->worker = 1;
+    }
 
-    default: /* Succesfully decoded the RCX packet */
-        *buf_len = result;
+    request = handle->free_list;
+    if (request==NULL)
+    {
+        pthread_mutex_unlock(&handle->queue_lock);
+        return RCX_E_QUEUE_FULL;
+    }
+    handle->free_list = request->next;
+
+    request->next = NULL;
+    request->callback = callback;
+    request->completion.user = user;
+    request->completion.result = RCX_OK;
+    request->completion.buf_len = buf_len;
+    memcpy(request->completion.buf, buf, buf_len);
+
+    if (handle->submit_tail==NULL)
+    {
+        handle->submit_head = request;
+    }
+    else
+    {
+        handle->submit_tail->next = request;
+    }
+    handle->submit_tail = request;
+
+    pthread_cond_signal(&handle->queue_cond);
+    pthread_mutex_unlock(&handle->queue_lock);
+
+    return RCX_OK;
+}
+
+
+
+
+/***************************************************************
+* rcx_poll_completion: Take the result of a command queued     *
+*              without callback.                               *
+*                                                              *
+* Input:   timeout                Time to wait in ms, 0 to poll*
+* Output:  completion             Result of the command        *
+* Return:  See rcx_poll_completion_dev()                       *
+***************************************************************/
+int rcx_poll_completion(rcx_completion_t* completion, int timeout)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_poll_completion_dev(rcx_default, completion, timeout);
+}
+
+
+
+
+/***************************************************************
+* rcx_poll_completion_dev: Take the result of a command queued *
+*              without callback.                               *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          timeout                Time to wait in ms, 0 to poll*
+* Output:  completion             Result of the command        *
+* Return:  RCX_OK                 Completion taken             *
+*          RCX_E_RECV_NOTHING     No command completed in time *
+***************************************************************/
+int rcx_poll_completion_dev(rcx_handle_t* handle,
+                            rcx_completion_t* completion, int timeout)
+{
+    rcx_request_t* request;
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000000L;
+    if (deadline.tv_nsec>=1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&handle->queue_lock);
+
+    while ((handle->done_head==NULL) && (timeout>0))
+    {
+        if (pthread_cond_timedwait(&handle->done_cond, &handle->queue_lock,
+                                   &deadline)!=0)
+        {
+            break;
+        }
+    }
+
+    request = handle->done_head;
+    if (request!=NULL)
+    {
+        handle->done_head = request->next;
+        if (handle->done_head==NULL)
+        {
+            handle->done_tail = NULL;
+        }
+
+        *completion = request->completion;
+        request->next = handle->free_list;
+        handle->free_list = request;
+    }
+
+    pthread_mutex_unlock(&handle->queue_lock);
+
+    return (request!=NULL) ? RCX_OK : RCX_E_RECV_NOTHING;
+}
+
+
+
+
+/***************************************************************
+* rcx_send:    Send a RCX packet to the LIRC driver            *
+*                                                              *
+* Input:   buf_len                Number of bytes to send      *
+*          buf                    Send buffer                  *
+* Output:                                                      *
+* Return:  See rcx_send_dev()                                  *
+***************************************************************/
+int rcx_send(unsigned char* buf, int buf_len)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_send_dev(rcx_default, buf, buf_len);
+}
+
+
+
+
+/***************************************************************
+* rcx_send_dev: Send a RCX packet to the LIRC driver           *
+*                                                              *
+*              The whole packet is handed to the driver in a   *
+*              single write, without gaps between the bytes.   *
+*              A packet with a corrupted echo is sent again.   *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          buf_len                Number of bytes to send      *
+*          buf                    Send buffer                  *
+* Output:                                                      *
+* Return:  RCX_OK                 Command has been sent        *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_DEVICE_ERROR     Cannot send to LIRC driver   *
+*          RCX_E_COLLISION        Every attempt collided       *
+*          RCX_E_PROGRAM_FAILURE  Internal error               *
+***************************************************************/
+int rcx_send_dev(rcx_handle_t* handle, unsigned char* buf, int buf_len)
+{
+    int result;
+
+    pthread_mutex_lock(&handle->tx_lock);
+    pthread_mutex_lock(&handle->rx_lock);
+    result = raw_send_packet(handle, buf, buf_len);
+    if ((result==RCX_OK) && (buf_len>0))
+    {
+        handle->last_opcode = buf[0];
+    }
+    pthread_mutex_unlock(&handle->rx_lock);
+    pthread_mutex_unlock(&handle->tx_lock);
+
+    APP_FLUSH
+
+    return result;
+}
+
+
+
+
+/***************************************************************
+* rcx_receive: Receive a RCX packet from the LIRC driver       *
+*                                                              *
+* Input:   buf                    Receive buffer               *
+*          buf_size               Size of receive buffer       *
+* Output:  buf_len                Number of bytes received     *
+* Return:  See rcx_receive_dev()                               *
+***************************************************************/
+int rcx_receive(unsigned char* buf, int buf_size, int* buf_len)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_receive_dev(rcx_default, buf, buf_size, buf_len);
+}
+
+
+
+/***************************************************************
+* rcx_receive_dev: Receive a RCX packet from the LIRC driver   *
+*                                                              *
+*              This is a non-blocking function, but it can     *
+*              take a second before the call returns. It       *
+*              returns as soon as a packet is complete.        *
+*              Packets sent back-to-back are returned by the   *
+*              next calls, and garbage between packets is      *
+*              skipped.                                        *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          buf                    Receive buffer               *
+*          buf_size               Size of receive buffer       *
+* Output:  buf_len                Number of bytes received     *
+* Return:  See rcx_receive_wait_dev()                          *
+***************************************************************/
+int rcx_receive_dev(rcx_handle_t* handle, unsigned char* buf,
+                    int buf_size, int* buf_len)
+{
+    return rcx_receive_wait_dev(handle, buf, buf_size, buf_len,
+                                LIRC_REPLY_TIME);
+}
+
+
+
+/***************************************************************
+* rcx_receive_wait: Receive a RCX packet from the LIRC driver, *
+*              waiting a given time for it to start.           *
+*                                                              *
+* Input:   buf                    Receive buffer               *
+*          buf_size               Size of receive buffer       *
+*          wait                   Time to wait, in ms          *
+* Output:  buf_len                Number of bytes received     *
+* Return:  See rcx_receive_wait_dev()                          *
+***************************************************************/
+int rcx_receive_wait(unsigned char* buf, int buf_size, int* buf_len,
+                     int wait)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_receive_wait_dev(rcx_default, buf, buf_size, buf_len, wait);
+}
+
+
+
+/***************************************************************
+* rcx_receive_wait_dev: Receive a RCX packet from the LIRC     *
+*              driver, like rcx_receive_dev(), waiting 'wait'  *
+*              ms for it to start. Once items come in, the     *
+*              packet ends at silence, as usual.               *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          buf                    Receive buffer               *
+*          buf_size               Size of receive buffer       *
+*          wait                   Time to wait, in ms          *
+* Output:  buf_len                Number of bytes received     *
+* Return:  RCX_OK                 Command and reply has been   *
+*                                 send and received succesfully*
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_DEVICE_ERROR     Error in LIRC device         *
+*          RCX_E_RECV_NOTHING     No data received             *
+*          RCX_E_RECV_ERROR       Data received, with errors   *
+***************************************************************/
+int rcx_receive_wait_dev(rcx_handle_t* handle, unsigned char* buf,
+                         int buf_size, int* buf_len, int wait)
+{
+    int result;
+
+    APP_DEBUG("");
+    APP_FLUSH
+
+    pthread_mutex_lock(&handle->rx_lock);
+    result = raw_receive_packet(handle, buf, buf_size, buf_len, wait);
+    pthread_mutex_unlock(&handle->rx_lock);
+
+    return result;
+}
+
+
+
+
+
+
+/***************************************************************
+* rcx_send_byte:   Send a single byte to the LIRC driver       *
+*                                                              *
+* Input:   tx_byte                Byte to send                 *
+* Output:                                                      *
+* Return:  See rcx_send_byte_dev()                             *
+***************************************************************/
+int rcx_send_byte(unsigned char tx_byte)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_send_byte_dev(rcx_default, tx_byte);
+}
+
+
+
+/***************************************************************
+* rcx_send_byte_dev: Send a single byte to the LIRC driver     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          tx_byte                Byte to send                 *
+* Output:                                                      *
+* Return:  RCX_OK                 Byte has been sent           *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_DEVICE_ERROR     Cannot send to LIRC driver   *
+*          RCX_E_PROGRAM_FAILURE  Internal error               *
+***************************************************************/
+int rcx_send_byte_dev(rcx_handle_t* handle, unsigned char tx_byte)
+{
+    int result;
+
+    APP_PRINT2("Send byte 0x%02x", tx_byte);
+
+    pthread_mutex_lock(&handle->tx_lock);
+    result = raw_send(handle, tx_byte);
+    pthread_mutex_unlock(&handle->tx_lock);
+
+    APP_FLUSH
+    return result;
+}
+
+
+
+/***************************************************************
+* rcx_receive_byte: Receive a byte from the LIRC driver        *
+*                                                              *
+* Input:                                                       *
+* Output:  rx_byte                Pointer to receive byte in   *
+* Return:  See rcx_receive_byte_dev()                          *
+***************************************************************/
+int rcx_receive_byte(unsigned char* rx_byte)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_receive_byte_dev(rcx_default, rx_byte);
+}
+
+
+
+/***************************************************************
+* rcx_receive_byte_dev: Receive a byte from the LIRC driver    *
+*                                                              *
+*              This is a non-blocking function, but it can     *
+*              take a second before the call returns. With a   *
+*              receiver thread it returns at once.             *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+* Output:  rx_byte                Pointer to receive byte in   *
+* Return:  RCX_OK                 A byte has been received     *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_DEVICE_ERROR     Error in LIRC device         *
+*          RCX_E_RECV_NOTHING     No data received             *
+*          RCX_E_RECV_ERROR       Data received, with errors   *
+***************************************************************/
+int rcx_receive_byte_dev(rcx_handle_t* handle, unsigned char* rx_byte)
+{
+    int result = 1;
+
+    APP_DEBUG("");
+
+    pthread_mutex_lock(&handle->rx_lock);
+
+    /* Take a byte the receiver thread has decoded already */
+    if (handle->receiver)
+    {
+        result = rcx_ring_get(&handle->ring, rx_byte, 1);
+        if (result==0)
+        {
+            result = __atomic_load_n(&handle->receiver_result,
+                                     __ATOMIC_ACQUIRE);
+            if (result==RCX_OK)
+            {
+                result = RCX_E_RECV_NOTHING;
+            }
+        }
+        pthread_mutex_unlock(&handle->rx_lock);
+        return (result>0) ? RCX_OK : result;
+    }
+
+    /* Receive and decode byte from LIRC driver input */
+    if (handle->recv_byte_index==handle->recv_byte_count)
+    {
+        result = raw_receive(handle, handle->recv_byte_buf, BUFFERSIZE);
+        APP_PRINT2("Function raw_receive() returned %d", result);
+        if (result>0)
+        {
+            handle->recv_byte_index = 0;
+            handle->recv_byte_count = result;
+        }
+    }
+
+    /* Write a buffer value in byte */
+    if (handle->recv_byte_index<handle->recv_byte_count)
+    {
+        *rx_byte = handle->recv_byte_buf[handle->recv_byte_index];
+        handle->recv_byte_index++;
+    }
+
+    pthread_mutex_unlock(&handle->rx_lock);
+
+    APP_FLUSH
+
+    return (result>0) ? RCX_OK : result;
+}
+
+
+
+/***************************************************************
+* rcx_receive_bytes: Take the bytes the receiver thread has    *
+*              decoded so far, without waiting.                *
+*                                                              *
+* Input:   size                   Size of buf                  *
+* Output:  buf                    Received bytes               *
+* Return:  See rcx_receive_bytes_dev()                         *
+***************************************************************/
+int rcx_receive_bytes(unsigned char* buf, int size)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_receive_bytes_dev(rcx_default, buf, size);
+}
+
+
+
+/***************************************************************
+* rcx_receive_bytes_dev: Take the bytes the receiver thread    *
+*              has decoded so far, without waiting.            *
+*                                                              *
+*              If another thread is receiving, the bytes are   *
+*              its own, and nothing is returned.               *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          size                   Size of buf                  *
+* Output:  buf                    Received bytes               *
+* Return:  >= 0                   Number of bytes in buf       *
+*          RCX_E_DEVICE_ERROR     Receiver thread stopped on a *
+*                                 device error                 *
+*          RCX_E_BAD_ARGUMENT     No receiver thread           *
+***************************************************************/
+int rcx_receive_bytes_dev(rcx_handle_t* handle, unsigned char* buf,
+                          int size)
+{
+    int result;
+
+    if (!handle->receiver)
+    {
+        APP_ERROR("No receiver thread");
+        return RCX_E_BAD_ARGUMENT;
+    }
+
+    /* The ring has a single consumer, the holder of the rx_lock */
+    if (pthread_mutex_trylock(&handle->rx_lock)!=0)
+    {
+        return 0;
+    }
+
+    result = rcx_ring_get(&handle->ring, buf, size);
+    if (result==0)
+    {
+        result = __atomic_load_n(&handle->receiver_result, __ATOMIC_ACQUIRE);
+    }
+
+    pthread_mutex_unlock(&handle->rx_lock);
+
+    return result;
+}
+
+
+
+/***************************************************************
+* rcx_receiver_stats: Statistics of the receiver thread.       *
+*                                                              *
+* Input:                                                       *
+* Output:  stats                  The statistics               *
+* Return:  See rcx_receiver_stats_dev()                        *
+***************************************************************/
+int rcx_receiver_stats(rcx_receiver_stats_t* stats)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_receiver_stats_dev(rcx_default, stats);
+}
+
+
+
+/***************************************************************
+* rcx_receiver_stats_dev: Statistics of the receiver thread.   *
+*              The counters are read while the thread runs, so *
+*              together they are a snapshot, not an exact      *
+*              balance.                                        *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+* Output:  stats                  The statistics               *
+* Return:  RCX_OK                 Statistics copied            *
+*          RCX_E_BAD_ARGUMENT     No receiver thread           *
+***************************************************************/
+int rcx_receiver_stats_dev(rcx_handle_t* handle,
+                           rcx_receiver_stats_t* stats)
+{
+    if (!handle->receiver)
+    {
+        APP_ERROR("No receiver thread");
+        return RCX_E_BAD_ARGUMENT;
+    }
+
+    stats->bytes = __atomic_load_n(&handle->stats.bytes, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&handle->stats.dropped,
+                                     __ATOMIC_RELAXED);
+    stats->overflows = __atomic_load_n(&handle->stats.overflows,
+                                       __ATOMIC_RELAXED);
+    stats->errors = __atomic_load_n(&handle->stats.errors, __ATOMIC_RELAXED);
+    stats->fill = rcx_ring_count(&handle->ring);
+    stats->fill_max = __atomic_load_n(&handle->stats.fill_max,
+                                      __ATOMIC_RELAXED);
+
+    return RCX_OK;
+}
+
+
+
+/***************************************************************
+* rcx_get_stats: Error counters, traffic and timing.           *
+*                                                              *
+* Input:                                                       *
+* Output:  stats                  The statistics               *
+* Return:  See rcx_get_stats_dev()                             *
+***************************************************************/
+int rcx_get_stats(rcx_stats_t* stats)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_get_stats_dev(rcx_default, stats);
+}
+
+
+
+/***************************************************************
+* rcx_get_stats_dev: Error counters, traffic and timing of the *
+*              device. Like rcx_receiver_stats_dev(), the      *
+*              counters are read one by one while the device   *
+*              is in use.                                      *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+* Output:  stats                  The statistics               *
+* Return:  RCX_OK                 Statistics copied            *
+***************************************************************/
+int rcx_get_stats_dev(rcx_handle_t* handle, rcx_stats_t* stats)
+{
+    int n;
+    rcx_stats_t* from = &handle->counters;
+
+    stats->parity_errors = raw_stat(&from->parity_errors);
+    stats->framing_errors = raw_stat(&from->framing_errors);
+    stats->break_errors = raw_stat(&from->break_errors);
+    stats->complement_errors = raw_stat(&from->complement_errors);
+    stats->checksum_errors = raw_stat(&from->checksum_errors);
+    stats->timeouts = raw_stat(&from->timeouts);
+    stats->retries = raw_stat(&from->retries);
+    stats->bytes_sent = raw_stat(&from->bytes_sent);
+    stats->bytes_received = raw_stat(&from->bytes_received);
+    stats->packets_sent = raw_stat(&from->packets_sent);
+    stats->packets_received = raw_stat(&from->packets_received);
+    for (n=0; n<RCX_STATS_BUCKETS; n++)
+    {
+        stats->command_time[n] = raw_stat(&from->command_time[n]);
+        stats->reply_wait[n] = raw_stat(&from->reply_wait[n]);
+    }
+    stats->rate_fallbacks = raw_stat(&from->rate_fallbacks);
+    stats->rate_probes = raw_stat(&from->rate_probes);
+    stats->late_replies = raw_stat(&from->late_replies);
+
+    return RCX_OK;
+}
+
+
+
+/***************************************************************
+* rcx_calibrate: Measure the timing of the IR hardware, and    *
+*              use the timing values that make up for it.      *
+*                                                              *
+* Input:                                                       *
+* Output:  calibration            See rcx_calibration_t        *
+* Return:  See rcx_calibrate_dev()                             *
+***************************************************************/
+int rcx_calibrate(rcx_calibration_t* calibration)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_calibrate_dev(rcx_default, calibration);
+}
+
+
+
+/***************************************************************
+* rcx_calibrate_dev: Measure the timing of the IR hardware of  *
+*              the host, and use the timing values that make   *
+*              up for it, see rcx_calibrate().                 *
+*                                                              *
+* Note:        A run of pulses or spaces is sent as a whole    *
+*              number of bits plus the adjustment of the       *
+*              profile. Its echo comes back with the error of  *
+*              the transmitter and the receiver added, a reply *
+*              of the RCX with the error of the receiver only. *
+*              The new adjustment takes out the error of the   *
+*              transmitter. Medians are used, so a disturbed   *
+*              run does not count.                             *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+* Output:  calibration            See rcx_calibration_t        *
+* Return:  RCX_OK                 Timing values in use, saved  *
+*          RCX_E_PROFILE_FILE     Timing values in use, but    *
+*                                 not saved                    *
+*          RCX_E_NO_ECHO          Too few runs in the echoes   *
+*          RCX_E_RECV_ERROR       Timing out of range          *
+*          RCX_E_BAD_ARGUMENT     A receiver or worker thread  *
+*                                 runs on the device           *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_DEVICE_ERROR     Error in LIRC device         *
+*          RCX_E_PROGRAM_FAILURE  Internal error               *
+***************************************************************/
+int rcx_calibrate_dev(rcx_handle_t* handle, rcx_calibration_t* calibration)
+{
+    int n;
+    int items;
+    int result = RCX_OK;
+    unsigned char opcode;
+    rcx_runs_t* runs;
+    lirc_profile_t* profile;
+    lirc_t list[BUFFERSIZE];
+
+    APP_DEBUG("");
+
+    /* The echo is taken from the driver, so no thread may */
+    /* read the device, or send on it, in between          */
+    if (handle->receiver || handle->worker)
+    {
+        APP_ERROR("Cannot calibrate with a receiver or worker thread");
+        return RCX_E_BAD_ARGUMENT;
+    }
+
+    runs = (rcx_runs_t*) calloc(1, sizeof(rcx_runs_t));
+    if (runs==NULL)
+    {
+        APP_ERROR("Out of memory");
+        return RCX_E_PROGRAM_FAILURE;
+    }
+
+    pthread_mutex_lock(&handle->tx_lock);
+    pthread_mutex_lock(&handle->rx_lock);
+
+    profile = handle->profile;
+    raw_reset_stream(handle);
+    handle->transport->reset(&handle->device);
+
+    /* The RCX ignores a command that equals the one before, */
+    /* unless its toggle bit differs                         */
+    for (n=0; (n<RCX_CALIBRATE_ROUNDS) && (result==RCX_OK); n++)
+    {
+        opcode = (unsigned char) raw_toggle(handle, CALIBRATE_OPCODE);
+        items = raw_encode_packet(handle, &opcode, 1, list, BUFFERSIZE);
+        result = (items<0) ? items : raw_send_items(handle, list, items);
+        if (result==RCX_OK)
+        {
+            handle->last_opcode = opcode;
+            result = raw_calibrate_round(handle, list, items, runs);
+        }
+    }
+    raw_reset_stream(handle);
+
+    if (result==RCX_OK)
+    {
+        calibration->echo_samples = runs->count[CALIBRATE_ECHO_MARK] +
+                                    runs->count[CALIBRATE_ECHO_SPACE];
+        calibration->reply_samples = runs->count[CALIBRATE_REPLY_MARK] +
+                                     runs->count[CALIBRATE_REPLY_SPACE];
+        calibration->rx_mark_error = 0;
+        calibration->rx_space_error = 0;
+        if ((runs->count[CALIBRATE_REPLY_MARK]>=RCX_CALIBRATE_SAMPLES) &&
+            (runs->count[CALIBRATE_REPLY_SPACE]>=RCX_CALIBRATE_SAMPLES))
+        {
+            calibration->rx_mark_error = raw_median(
+                runs->error[CALIBRATE_REPLY_MARK],
+                runs->count[CALIBRATE_REPLY_MARK]);
+            calibration->rx_space_error = raw_median(
+                runs->error[CALIBRATE_REPLY_SPACE],
+                runs->count[CALIBRATE_REPLY_SPACE]);
+        }
+
+        if ((runs->count[CALIBRATE_ECHO_MARK]<RCX_CALIBRATE_SAMPLES) ||
+            (runs->count[CALIBRATE_ECHO_SPACE]<RCX_CALIBRATE_SAMPLES))
+        {
+            APP_ERROR("Too few runs in the echo");
+            result = RCX_E_NO_ECHO;
+        }
+    }
+
+    if (result==RCX_OK)
+    {
+        /* The echo errors are of runs as sent, adjustment included */
+        calibration->tx_mark_error = raw_median(
+            runs->error[CALIBRATE_ECHO_MARK],
+            runs->count[CALIBRATE_ECHO_MARK]) -
+            profile->mark_adjust - calibration->rx_mark_error;
+        calibration->tx_space_error = raw_median(
+            runs->error[CALIBRATE_ECHO_SPACE],
+            runs->count[CALIBRATE_ECHO_SPACE]) -
+            profile->space_adjust - calibration->rx_space_error;
+        calibration->bit_period = handle->base->bit_period;
+        calibration->mark_adjust = -calibration->tx_mark_error;
+        calibration->space_adjust = -calibration->tx_space_error;
+
+        if (handle->calibrated==NULL)
+        {
+            handle->calibrated = (lirc_profile_t*)
+                                 malloc(sizeof(lirc_profile_t));
+        }
+        if (handle->calibrated==NULL)
+        {
+            APP_ERROR("Out of memory");
+            result = RCX_E_PROGRAM_FAILURE;
+        }
+        else if (lirc_profile_init(handle->calibrated,
+                                   calibration->bit_period,
+                                   calibration->mark_adjust,
+                                   calibration->space_adjust)!=LIRC_OK)
+        {
+            /* The profile is left as it was */
+            result = RCX_E_RECV_ERROR;
+        }
+        else
+        {
+            /* The adjustments hold at both bit rates */
+            handle->base = handle->calibrated;
+            free(handle->fast);
+            handle->fast = NULL;
+            if (raw_set_rate(handle, handle->rate)!=RCX_OK)
+            {
+                raw_set_rate(handle, RCX_BAUD_2400);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&handle->rx_lock);
+    pthread_mutex_unlock(&handle->tx_lock);
+
+    free(runs);
+
+    if (result==RCX_OK)
+    {
+        result = rcx_profile_save(handle->path, calibration->bit_period,
+                                  calibration->mark_adjust,
+                                  calibration->space_adjust);
+    }
+
+    return result;
+}
+
+
+
+/***************************************************************
+* rcx_set_baud: Select the bit rate of the link.               *
+*                                                              *
+* Input:   baud                   RCX_BAUD_xxx rate            *
+* Output:                                                      *
+* Return:  See rcx_set_baud_dev()                              *
+***************************************************************/
+int rcx_set_baud(int baud)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_set_baud_dev(rcx_default, baud);
+}
+
+
+
+/***************************************************************
+* rcx_set_baud_dev: Select the bit rate of the link, see       *
+*              rcx_set_baud(). The link quality is forgotten.  *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          baud                   RCX_BAUD_xxx rate            *
+* Output:                                                      *
+* Return:  RCX_OK                 Rate selected                *
+*          RCX_E_BAD_ARGUMENT     Unknown rate, or the timing  *
+*                                 values do not allow 4800     *
+*          RCX_E_PROGRAM_FAILURE  Internal error               *
+***************************************************************/
+int rcx_set_baud_dev(rcx_handle_t* handle, int baud)
+{
+    int result;
+
+    if ((baud!=RCX_BAUD_AUTO) && (baud!=RCX_BAUD_2400) &&
+        (baud!=RCX_BAUD_4800))
+    {
+        APP_ERROR("Unknown bit rate");
+        return RCX_E_BAD_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&handle->tx_lock);
+    pthread_mutex_lock(&handle->rx_lock);
+
+    result = raw_set_rate(handle, (baud==RCX_BAUD_2400) ? RCX_BAUD_2400 :
+                                                          RCX_BAUD_4800);
+    if (result==RCX_OK)
+    {
+        handle->baud = baud;
+        handle->link_errors = 0;
+        handle->link_commands = 0;
+        handle->probe_after = LINK_PROBE_MIN;
+    }
+
+    pthread_mutex_unlock(&handle->rx_lock);
+    pthread_mutex_unlock(&handle->tx_lock);
+
+    return result;
+}
+
+
+
+/***************************************************************
+* rcx_get_baud: The bit rate the link runs at now.             *
+*                                                              *
+* Input:                                                       *
+* Output:                                                      *
+* Return:  See rcx_get_baud_dev()                              *
+***************************************************************/
+int rcx_get_baud(void)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_get_baud_dev(rcx_default);
+}
+
+
+
+/***************************************************************
+* rcx_get_baud_dev: The bit rate the link runs at now. With    *
+*              RCX_BAUD_AUTO, it may change with any command.  *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+* Output:                                                      *
+* Return:  RCX_BAUD_2400 or RCX_BAUD_4800                      *
+***************************************************************/
+int rcx_get_baud_dev(rcx_handle_t* handle)
+{
+    return __atomic_load_n(&handle->rate, __ATOMIC_RELAXED);
+}
+
+
+
+/***************************************************************
+* rcx_get_time: The clock of the device.                       *
+*                                                              *
+* Input:                                                       *
+* Output:                                                      *
+* Return:  See rcx_get_time_dev()                              *
+***************************************************************/
+long rcx_get_time(void)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_get_time_dev(rcx_default);
+}
+
+
+
+/***************************************************************
+* rcx_get_time_dev: The clock of the transport of the device,  *
+*              that times the commands and their statistics.   *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+* Output:                                                      *
+* Return:  Time, in us                                         *
+***************************************************************/
+long rcx_get_time_dev(rcx_handle_t* handle)
+{
+    return handle->transport->now(&handle->device);
+}
+
+
+
+/***************************************************************
+* rcx_set_retry: Select how failed commands are sent again.    *
+*                                                              *
+* Input:   retry                  The policy                   *
+* Output:                                                      *
+* Return:  See rcx_set_retry_dev()                             *
+***************************************************************/
+int rcx_set_retry(const rcx_retry_t* retry)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_set_retry_dev(rcx_default, retry);
+}
+
+
+
+/***************************************************************
+* rcx_set_retry_dev: Select how failed commands are sent       *
+*              again, see rcx_set_retry(). Commands in         *
+*              progress finish with the policy before.         *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          retry                  The policy                   *
+* Output:                                                      *
+* Return:  RCX_OK                 Policy selected              *
+*          RCX_E_BAD_ARGUMENT     Less than one attempt, a     *
+*                                 negative wait, or backoff_max*
+*                                 below backoff                *
+***************************************************************/
+int rcx_set_retry_dev(rcx_handle_t* handle, const rcx_retry_t* retry)
+{
+    if ((retry->attempts<1) || (retry->backoff<0) ||
+        (retry->backoff_max<retry->backoff))
+    {
+        APP_ERROR("Bad retry policy");
+        return RCX_E_BAD_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&handle->tx_lock);
+    pthread_mutex_lock(&handle->rx_lock);
+    handle->retry = *retry;
+    pthread_mutex_unlock(&handle->rx_lock);
+    pthread_mutex_unlock(&handle->tx_lock);
+
+    return RCX_OK;
+}
+
+
+
+/***************************************************************
+* rcx_get_retry: The retry policy in use.                      *
+*                                                              *
+* Input:                                                       *
+* Output:  retry                  The policy                   *
+* Return:  See rcx_get_retry_dev()                             *
+***************************************************************/
+int rcx_get_retry(rcx_retry_t* retry)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_get_retry_dev(rcx_default, retry);
+}
+
+
+
+/***************************************************************
+* rcx_get_retry_dev: The retry policy in use, see              *
+*              rcx_get_retry().                                *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+* Output:  retry                  The policy                   *
+* Return:  RCX_OK                 Policy copied                *
+***************************************************************/
+int rcx_get_retry_dev(rcx_handle_t* handle, rcx_retry_t* retry)
+{
+    pthread_mutex_lock(&handle->tx_lock);
+    pthread_mutex_lock(&handle->rx_lock);
+    *retry = handle->retry;
+    pthread_mutex_unlock(&handle->rx_lock);
+    pthread_mutex_unlock(&handle->tx_lock);
+
+    return RCX_OK;
+}
+
+
+
+/***************************************************************
+* rcx_download_firmware: Replaces the firmware of the RCX.     *
+*                                                              *
+* Input:   firmware               The image                    *
+*          download->block_size   Data bytes per transfer, or 0*
+* Output:  download               Blocks, retransmits, time    *
+* Return:  See rcx_download_firmware_dev()                     *
+***************************************************************/
+int rcx_download_firmware(const struct rcx_firmware* firmware,
+                          rcx_download_t* download)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_download_firmware_dev(rcx_default, firmware, download);
+}
+
+
+
+/***************************************************************
+* rcx_download_firmware_dev: Replaces the firmware of the RCX, *
+*              see rcx_download_firmware().                    *
+*                                                              *
+* Note:        The block size is chosen from the share of bytes*
+*              received with errors so far, see                *
+*              rcx_firmware_block_size(). The rate and retry   *
+*              policy of the handle are put back afterwards.   *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          firmware               The image                    *
+*          download->block_size   Data bytes per transfer, or 0*
+* Output:  download               Blocks, retransmits, time    *
+* Return:  RCX_OK                 Firmware is running          *
+*          RCX_E_BAD_ARGUMENT     Empty image, or bad block    *
+*                                 size                         *
+*          RCX_E_FIRMWARE         The RCX refused the download *
+*          RCX_E_PROGRAM_FAILURE  Out of memory                *
+*          Others                 See rcx_command_dev()        *
+***************************************************************/
+int rcx_download_firmware_dev(rcx_handle_t* handle,
+                              const struct rcx_firmware* firmware,
+                              rcx_download_t* download)
+{
+    int n;
+    int result;
+    int checksum;
+    int size = download->block_size;
+    int count;
+    int items = 0;
+    int buf_len;
+    int old_baud;
+    int old_rate;
+    long start;
+    rcx_stats_t stats;
+    rcx_retry_t old_retry;
+    rcx_block_t* blocks;
+    lirc_t* lists;
+    unsigned char buf[BUFFERSIZE];
+
+    if ((firmware->length<1) || (firmware->length>RCX_FIRMWARE_SIZE) ||
+        ((size!=0) && ((size<RCX_FIRMWARE_BLOCK_MIN) ||
+                       (size>RCX_FIRMWARE_BLOCK_MAX))))
+    {
+        APP_ERROR("Bad firmware image, or block size");
+        return RCX_E_BAD_ARGUMENT;
+    }
+
+    /* Bytes in error, per million received */
+    if (size==0)
+    {
+        rcx_get_stats_dev(handle, &stats);
+        size = rcx_firmware_block_size(firmware->length,
+                   (stats.bytes_received>0) ?
+                   (int) ((stats.parity_errors+stats.framing_errors+
+                           stats.break_errors)*1000000UL/
+                          stats.bytes_received) : 0);
+    }
+    count = (firmware->length+size-1)/size;
+    checksum = rcx_firmware_checksum(firmware);
+
+    download->block_size = size;
+    download->blocks = count;
+    download->retransmits = 0;
+    download->time = 0;
+
+    blocks = (rcx_block_t*) malloc(count*sizeof(rcx_block_t));
+    lists = (lirc_t*) malloc(count*FIRMWARE_ITEMS(size)*sizeof(lirc_t));
+    if ((blocks==NULL) || (lists==NULL))
+    {
+        APP_ERROR("Out of memory");
+        free(blocks);
+        free(lists);
+        return RCX_E_PROGRAM_FAILURE;
+    }
+
+    pthread_mutex_lock(&handle->tx_lock);
+    pthread_mutex_lock(&handle->rx_lock);
+
+    start = handle->transport->now(&handle->device);
+    old_baud = handle->baud;
+    old_rate = handle->rate;
+    old_retry = handle->retry;
+    handle->retry.attempts = FIRMWARE_ATTEMPTS;
+    handle->retry.backoff = 0;
+    handle->retry.backoff_max = 0;
+    handle->retry.idempotent = NULL;
+
+    /* The ROM only talks at 2400 baud */
+    handle->baud = RCX_BAUD_2400;
+    result = raw_set_rate(handle, RCX_BAUD_2400);
+
+    /* Encode all transfers now, so that each one goes out as */
+    /* soon as the reply of the one before is in. Neighbours  */
+    /* differ in the toggle bit.                              */
+    for (n=0; (n<count) && (result==RCX_OK); n++)
+    {
+        blocks[n].sequence = (n==count-1) ? 0 : n+1;
+        blocks[n].offset = n*size;
+        blocks[n].length = (n==count-1) ? firmware->length-n*size : size;
+        blocks[n].opcode = (n%2==0) ? FIRMWARE_TRANSFER :
+                                      FIRMWARE_TRANSFER ^ RCX_TOGGLE;
+        blocks[n].list = &lists[items];
+        items += FIRMWARE_ITEMS(blocks[n].length);
+        result = raw_firmware_encode(handle, firmware, &blocks[n]);
+    }
+
+    if (result==RCX_OK)
+    {
+        buf[0] = FIRMWARE_DELETE;
+        buf[1] = 1;
+        buf[2] = 3;
+        buf[3] = 5;
+        buf[4] = 7;
+        buf[5] = 11;
+        buf_len = 6;
+        result = raw_firmware_command(handle, buf, sizeof(buf), &buf_len);
+    }
+
+    if (result==RCX_OK)
+    {
+        buf[0] = FIRMWARE_START;
+        buf[1] = (unsigned char) (firmware->start & 0xff);
+        buf[2] = (unsigned char) ((firmware->start>>8) & 0xff);
+        buf[3] = (unsigned char) (checksum & 0xff);
+        buf[4] = (unsigned char) ((checksum>>8) & 0xff);
+        buf[5] = 0;
+        buf_len = 6;
+        result = raw_firmware_command(handle, buf, sizeof(buf), &buf_len);
+        if ((result==RCX_OK) && ((buf_len<2) || (buf[1]!=0)))
+        {
+            APP_ERROR("RCX refused the firmware download");
+            result = RCX_E_FIRMWARE;
+        }
+    }
+
+    for (n=0; (n<count) && (result==RCX_OK); n++)
+    {
+        result = raw_firmware_transfer(handle, firmware, &blocks[n],
+                                       &download->retransmits);
+    }
+
+    if (result==RCX_OK)
+    {
+        buf[0] = FIRMWARE_UNLOCK;
+        buf[1] = 'L';
+        buf[2] = 'E';
+        buf[3] = 'G';
+        buf[4] = 'O';
+        buf[5] = 0xae;
+        buf_len = 6;
+        result = raw_firmware_command(handle, buf, sizeof(buf), &buf_len);
+        if ((result==RCX_OK) &&
+            ((buf_len!=1+(int) strlen(FIRMWARE_GREETING)) ||
+             (memcmp(&buf[1], FIRMWARE_GREETING, buf_len-1)!=0)))
+        {
+            APP_ERROR("RCX did not start the firmware");
+            result = RCX_E_FIRMWARE;
+        }
+    }
+
+    raw_set_rate(handle, old_rate);
+    handle->baud = old_baud;
+    handle->retry = old_retry;
+    download->time = handle->transport->now(&handle->device)-start;
+
+    pthread_mutex_unlock(&handle->rx_lock);
+    pthread_mutex_unlock(&handle->tx_lock);
+
+    free(lists);
+    free(blocks);
+
+    APP_PRINT2("Firmware download result %d", result);
+    return result;
+}
+
+
+
+/***************************************************************
+* rcx_lnp_send: Send a LNP packet.                             *
+*                                                              *
+* Input:   dest                   Address to send to, or -1    *
+*          port                   Port sent from               *
+*          buf                    Data bytes                   *
+*          buf_len                Number of data bytes         *
+* Output:                                                      *
+* Return:  See rcx_lnp_send_dev()                              *
+***************************************************************/
+int rcx_lnp_send(int dest, int port, unsigned char* buf, int buf_len)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_lnp_send_dev(rcx_default, dest, port, buf, buf_len);
+}
+
+
+
+/***************************************************************
+* rcx_lnp_send_dev: Send a LNP packet, see rcx_lnp_send(). The *
+*              echo is checked like that of a RCX packet.      *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          dest                   Address to send to, or -1    *
+*          port                   Port sent from               *
+*          buf                    Data bytes                   *
+*          buf_len                Number of data bytes         *
+* Output:                                                      *
+* Return:  RCX_OK                 Packet has been sent         *
+*          RCX_E_BAD_ARGUMENT     Too many bytes, or a bad     *
+*                                 address or port              *
+*          Others                 See raw_send_packet()        *
+***************************************************************/
+int rcx_lnp_send_dev(rcx_handle_t* handle, int dest, int port,
+                     unsigned char* buf, int buf_len)
+{
+    int result;
+    int lnplen;
+    unsigned char lnpbuf[RCX_LNP_SIZE+3];
+    lirc_t list[(RCX_LNP_SIZE+3)*LIRC_BYTE_ITEMS];
+
+    if ((dest>0xff) || (port<0) || (port>=RCX_LNP_PORTS) || (buf_len<0))
+    {
+        APP_ERROR("Bad LNP address");
+        return RCX_E_BAD_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&handle->tx_lock);
+    pthread_mutex_lock(&handle->rx_lock);
+
+    lnplen = rcx_lnp_encode(dest, (handle->lnp_host<<4) | port, buf, buf_len,
+                            lnpbuf, sizeof(lnpbuf));
+    if (lnplen<0)
+    {
+        result = RCX_E_BAD_ARGUMENT;
+    }
+    else
+    {
+        result = lirc_encode(handle->profile, lnpbuf, lnplen, list,
+                             (RCX_LNP_SIZE+3)*LIRC_BYTE_ITEMS);
+        result = (result<0) ? RCX_E_PROGRAM_FAILURE :
+                 raw_send_encoded(handle, list, result, lnplen);
+    }
+
+    pthread_mutex_unlock(&handle->rx_lock);
+    pthread_mutex_unlock(&handle->tx_lock);
+
+    APP_FLUSH
+
+    return result;
+}
+
+
+
+/***************************************************************
+* rcx_lnp_set_host: Select the host number of this side.       *
+*                                                              *
+* Input:   host                   Host number, 0 up to 15      *
+* Output:                                                      *
+* Return:  See rcx_lnp_set_host_dev()                          *
+***************************************************************/
+int rcx_lnp_set_host(int host)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_lnp_set_host_dev(rcx_default, host);
+}
+
+
+
+/***************************************************************
+* rcx_lnp_set_host_dev: Select the host number of this side,   *
+*              see rcx_lnp_set_host().                         *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          host                   Host number, 0 up to 15      *
+* Output:                                                      *
+* Return:  RCX_OK                 Host number selected         *
+*          RCX_E_BAD_ARGUMENT     Host number out of range     *
+***************************************************************/
+int rcx_lnp_set_host_dev(rcx_handle_t* handle, int host)
+{
+    if ((host<0) || (host>(RCX_LNP_HOST_MASK>>4)))
+    {
+        APP_ERROR("Bad LNP host number");
+        return RCX_E_BAD_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&handle->tx_lock);
+    pthread_mutex_lock(&handle->rx_lock);
+    handle->lnp_host = host;
+    pthread_mutex_unlock(&handle->rx_lock);
+    pthread_mutex_unlock(&handle->tx_lock);
+
+    return RCX_OK;
+}
+
+
+
+/***************************************************************
+* rcx_lnp_set_handler: Select the function that takes the LNP  *
+*              packets to a port.                              *
+*                                                              *
+* Input:   port                   Port, or                     *
+*                                 RCX_LNP_INTEGRITY_PORT       *
+*          handler                The function, or NULL        *
+*          user                   Passed to the function       *
+* Output:                                                      *
+* Return:  See rcx_lnp_set_handler_dev()                       *
+***************************************************************/
+int rcx_lnp_set_handler(int port, rcx_lnp_handler_t handler, void* user)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_lnp_set_handler_dev(rcx_default, port, handler, user);
+}
+
+
+
+/***************************************************************
+* rcx_lnp_set_handler_dev: Select the function that takes the  *
+*              LNP packets to a port, see                      *
+*              rcx_lnp_set_handler().                          *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          port                   Port, or                     *
+*                                 RCX_LNP_INTEGRITY_PORT       *
+*          handler                The function, or NULL        *
+*          user                   Passed to the function       *
+* Output:                                                      *
+* Return:  RCX_OK                 Handler selected             *
+*          RCX_E_BAD_ARGUMENT     Unknown port                 *
+***************************************************************/
+int rcx_lnp_set_handler_dev(rcx_handle_t* handle, int port,
+                            rcx_lnp_handler_t handler, void* user)
+{
+    if ((port<RCX_LNP_INTEGRITY_PORT) || (port>=RCX_LNP_PORTS))
+    {
+        APP_ERROR("Bad LNP port");
+        return RCX_E_BAD_ARGUMENT;
+    }
+    if (port==RCX_LNP_INTEGRITY_PORT)
+    {
+        port = RCX_LNP_PORTS;
+    }
+
+    pthread_mutex_lock(&handle->rx_lock);
+    handle->lnp_handlers[port] = handler;
+    handle->lnp_users[port] = user;
+    pthread_mutex_unlock(&handle->rx_lock);
+
+    return RCX_OK;
+}
+
+
+
+/***************************************************************
+* rcx_lnp_poll: Wait for LNP packets, and hand them to the     *
+*              handlers of their ports.                        *
+*                                                              *
+* Input:                                                       *
+* Output:                                                      *
+* Return:  See rcx_lnp_poll_dev()                              *
+***************************************************************/
+int rcx_lnp_poll(void)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_lnp_poll_dev(rcx_default);
+}
+
+
+
+/***************************************************************
+* rcx_lnp_poll_dev: Wait for LNP packets, and hand them to the *
+*              handlers of their ports, see rcx_lnp_poll().    *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+* Output:                                                      *
+* Return:  >=0                    Packets handed to a handler  *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_DEVICE_ERROR     Error in LIRC device         *
+***************************************************************/
+int rcx_lnp_poll_dev(rcx_handle_t* handle)
+{
+    int result;
+    int packets = 0;
+
+    pthread_mutex_lock(&handle->rx_lock);
+
+    /* Go on while more input is at hand */
+    do
+    {
+        result = raw_lnp_packet(handle);
+        if (result>0)
+        {
+            packets += raw_lnp_dispatch(handle, result);
+        }
+    }
+    while ((result>0) &&
+           ((handle->receiver) ? (rcx_ring_count(&handle->ring)>0) :
+            (handle->recv_item_index<handle->recv_item_count)));
+
+    pthread_mutex_unlock(&handle->rx_lock);
+
+    APP_FLUSH
+
+    if ((result>0) || (result==RCX_E_RECV_NOTHING) ||
+        (result==RCX_E_RECV_ERROR) || (packets>0))
+    {
+        return packets;
+    }
+    return result;
+}
+
+
+
+/***************************************************************
+* rcx_set_unsolicited: Select the function that takes the      *
+*              packets a command skips.                        *
+*                                                              *
+* Input:   handler                The function, or NULL        *
+*          user                   Passed to the function       *
+* Output:                                                      *
+* Return:  See rcx_set_unsolicited_dev()                       *
+***************************************************************/
+int rcx_set_unsolicited(rcx_unsolicited_t handler, void* user)
+{
+    if (rcx_default==NULL)
+    {
+        APP_ERROR("Device is not open");
+        return RCX_E_DEVICE_NOT_OPEN;
+    }
+
+    return rcx_set_unsolicited_dev(rcx_default, handler, user);
+}
+
+
+
+/***************************************************************
+* rcx_set_unsolicited_dev: Select the function that takes the  *
+*              packets a command skips, see                    *
+*              rcx_set_unsolicited().                          *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          handler                The function, or NULL        *
+*          user                   Passed to the function       *
+* Output:                                                      *
+* Return:  RCX_OK                 Function selected            *
+***************************************************************/
+int rcx_set_unsolicited_dev(rcx_handle_t* handle, rcx_unsolicited_t handler,
+                            void* user)
+{
+    pthread_mutex_lock(&handle->rx_lock);
+    handle->unsolicited = handler;
+    handle->unsolicited_user = user;
+    pthread_mutex_unlock(&handle->rx_lock);
+
+    return RCX_OK;
+}
+
+
+
+/***************************************************************
+* raw_send_packet: Send a RCX packet to the LIRC driver, in a  *
+*              single write. If the echo shows a collision,    *
+*              the packet is sent again, see raw_check_echo(). *
+*              With a receiver thread the echo is not checked, *
+*              it ends up in the ring like any other input.    *
+*              The caller holds the tx_lock and the rx_lock of *
+*              the handle.                                     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          buf_len                Number of bytes to send      *
+*          buf                    Send buffer                  *
+* Output:                                                      *
+* Return:  RCX_OK                 Command has been sent        *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_DEVICE_ERROR     Cannot send to LIRC driver   *
+*          RCX_E_COLLISION        Every attempt collided       *
+*          RCX_E_PROGRAM_FAILURE  Internal error               *
+***************************************************************/
+int raw_send_packet(rcx_handle_t* handle, unsigned char* buf, int buf_len)
+{
+    int items;
+    lirc_t send_lirc_buf[BUFFERSIZE*LIRC_BYTE_ITEMS];
+
+    items = raw_encode_packet(handle, buf, buf_len, send_lirc_buf,
+                              BUFFERSIZE*LIRC_BYTE_ITEMS);
+    if (items<0)
+    {
+        return items;
+    }
+
+    return raw_send_encoded(handle, send_lirc_buf, items, buf_len*2+5);
+}
+
+
+/***************************************************************
+* raw_encode_packet: Encode data bytes as a RCX packet, in one *
+*              continuous list of pulses and spaces. Sending   *
+*              it with a single write keeps the bytes          *
+*              back-to-back on the air.                        *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          buf                    Data bytes                   *
+*          buf_len                Number of data bytes         *
+*          items_max              Size of list, in items       *
+* Output:  list                   Pulse and space items        *
+* Return:  >0                     Number of items in list      *
+*          RCX_E_PROGRAM_FAILURE  List or buffer too small     *
+***************************************************************/
+int raw_encode_packet(rcx_handle_t* handle, unsigned char* buf, int buf_len,
+                      lirc_t* list, int items_max)
+{
+    int rcxlen;
+    int items;
+    unsigned char send_byte_buf[BUFFERSIZE];
+
+    /* Convert byte array to a RCX packet */
+    rcxlen = rcx_encode(buf, buf_len, send_byte_buf, BUFFERSIZE);
+    if (rcxlen==RCX_E_BUFFER)
+    {
+        return RCX_E_PROGRAM_FAILURE;
+    }
+
+    items = lirc_encode(handle->profile, send_byte_buf, rcxlen,
+                        list, items_max);
+    if (items==LIRC_E_BUF_SIZE)
+    {
+        return RCX_E_PROGRAM_FAILURE;
+    }
+
+    return items;
+}
+
+
+/***************************************************************
+* raw_send_encoded: Send an encoded RCX packet to the LIRC     *
+*              driver, see raw_send_packet().                  *
+*              The caller holds the tx_lock and the rx_lock of *
+*              the handle.                                     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          list                   Pulse and space items        *
+*          item_count             Number of items in list      *
+*          air_len                Number of bytes encoded      *
+* Output:                                                      *
+* Return:  See raw_send_packet()                               *
+***************************************************************/
+int raw_send_encoded(rcx_handle_t* handle, lirc_t* list, int item_count,
+                     int air_len)
+{
+    int result;
+    int attempt;
+
+    if (handle->receiver)
+    {
+        result = raw_send_items(handle, list, item_count);
+        if (result==RCX_OK)
+        {
+            raw_count(&handle->counters.packets_sent, 1);
+            raw_count(&handle->counters.bytes_sent, air_len);
+        }
+        return result;
+    }
+
+    for (attempt=1; attempt<=SEND_ATTEMPTS; attempt++)
+    {
+        if (attempt>1)
+        {
+            raw_count(&handle->counters.retries, 1);
+        }
+
+        /* Keep what was received before, apart from the echo */
+        result = raw_stash_items(handle, NULL, 0);
+        if (result==RCX_OK)
+        {
+            result = raw_send_items(handle, list, item_count);
+        }
+        if (result==RCX_OK)
+        {
+            result = raw_check_echo(handle, list, item_count);
+        }
+        if (result!=RCX_E_COLLISION)
+        {
+            break;
+        }
+        APP_PRINT2("Collision, attempt %d", attempt);
+    }
+
+    if (result==RCX_OK)
+    {
+        raw_count(&handle->counters.packets_sent, 1);
+        raw_count(&handle->counters.bytes_sent, air_len);
+    }
+    return result;
+}
+
+
+
+/***************************************************************
+* raw_command_reply: Receive the reply to a command that has   *
+*              been sent. Don't wait at all, if the RCX does   *
+*              not reply to the opcode.                        *
+*              The caller holds the rx_lock of the handle.     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          opcode                 Opcode that has been sent    *
+*          buf                    Receive buffer               *
+*          buf_size               Size of receive buffer       *
+* Output:  buf_len                Number of bytes received     *
+* Return:  See raw_receive_packet()                            *
+***************************************************************/
+int raw_command_reply(rcx_handle_t* handle, unsigned char opcode,
+                      unsigned char* buf, int buf_size, int* buf_len)
+{
+    int result;
+    long start;
+
+    if (rcx_reply_length(opcode)==0)
+    {
+        *buf_len = 0;
+        return RCX_OK;
+    }
+
+    start = handle->transport->now(&handle->device);
+    result = raw_receive_reply(handle, opcode, buf, buf_size, buf_len);
+    if (result==RCX_OK)
+    {
+        raw_count_time(handle, handle->counters.reply_wait, start);
+    }
+    else if (result==RCX_E_RECV_NOTHING)
+    {
+        raw_count(&handle->counters.timeouts, 1);
+    }
+
+    return result;
+}
+
+
+/***************************************************************
+* raw_command_init: Take a command to send, and encode its     *
+*              packet, with the toggle bit it would be sent    *
+*              with now.                                       *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          buf                    Command bytes                *
+*          buf_len                Number of command bytes      *
+*          list                   Room for the packet          *
+*          items_max              Size of list, in items       *
+* Output:  pending                The command                  *
+* Return:  RCX_OK                 Command taken                *
+*          RCX_E_BAD_ARGUMENT     No bytes, or too many        *
+***************************************************************/
+int raw_command_init(rcx_handle_t* handle, rcx_pending_t* pending,
+                     unsigned char* buf, int buf_len, lirc_t* list,
+                     int items_max)
+{
+    if ((buf_len<1) || (buf_len>BUFFERSIZE))
+    {
+        APP_ERROR("Bad command length");
+        return RCX_E_BAD_ARGUMENT;
+    }
+
+    memcpy(pending->data, buf, buf_len);
+    pending->length = buf_len;
+    pending->given = buf[0];
+    pending->sent = -1;
+    pending->attempt = 0;
+    pending->list = list;
+    pending->items_max = items_max;
+
+    pending->profile = handle->profile;
+    pending->data[0] = (unsigned char) raw_toggle(handle, pending->given);
+    pending->items = raw_encode_packet(handle, pending->data,
+                                       pending->length, list, items_max);
+
+    return RCX_OK;
+}
+
+
+/***************************************************************
+* raw_command_send: Send the next attempt of a command.        *
+*                                                              *
+* Note:        The first attempt flips the toggle bit, if the  *
+*              opcode equals the one sent before. A retry of   *
+*              an idempotent opcode flips it again, so one of  *
+*              two retries runs whether or not the RCX ran the *
+*              attempt before. Other opcodes keep it, so the   *
+*              RCX runs them at most once.                     *
+*              The caller holds the tx_lock and the rx_lock of *
+*              the handle.                                     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+* In/Out:  pending                The command                  *
+* Return:  See raw_send_packet()                               *
+***************************************************************/
+int raw_command_send(rcx_handle_t* handle, rcx_pending_t* pending)
+{
+    int result;
+    int opcode;
+    int (*idempotent)(unsigned char opcode);
+
+    if (pending->attempt==0)
+    {
+        opcode = raw_toggle(handle, pending->given);
+        pending->backoff = handle->retry.backoff;
+        pending->start = handle->transport->now(&handle->device);
+    }
+    else
+    {
+        idempotent = (handle->retry.idempotent!=NULL) ?
+                     handle->retry.idempotent : rcx_idempotent;
+        opcode = idempotent((unsigned char) pending->given) ?
+                 pending->sent ^ RCX_TOGGLE : pending->sent;
+        raw_count(&handle->counters.retries, 1);
+    }
+    pending->sent = opcode;
+    pending->attempt++;
+
+    /* Encoded for another bit rate, or toggle bit */
+    if ((pending->profile!=handle->profile) ||
+        (pending->data[0]!=(unsigned char) opcode))
+    {
+        pending->profile = handle->profile;
+        pending->data[0] = (unsigned char) opcode;
+        pending->items = raw_encode_packet(handle, pending->data,
+                                           pending->length, pending->list,
+                                           pending->items_max);
+    }
+
+    result = pending->items;
+    if (result>0)
+    {
+        result = raw_send_encoded(handle, pending->list, pending->items,
+                                  pending->length*2+5);
+    }
+    if (result==RCX_OK)
+    {
+        handle->last_opcode = opcode;
+    }
+
+    return result;
+}
+
+
+/***************************************************************
+* raw_command_finish: Receive the reply to a command that has  *
+*              been sent, and send it again while the retry    *
+*              policy allows. The reply is returned as if to   *
+*              the opcode given, whatever the toggle bit sent. *
+*              The caller holds the tx_lock and the rx_lock of *
+*              the handle.                                     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          result                 Result of raw_command_send() *
+*          buf                    Receive buffer               *
+*          buf_size               Size of receive buffer       *
+* In/Out:  pending                The command                  *
+* Output:  buf_len                Number of bytes received     *
+* Return:  See rcx_command_dev()                               *
+***************************************************************/
+int raw_command_finish(rcx_handle_t* handle, rcx_pending_t* pending,
+                       int result, unsigned char* buf, int buf_size,
+                       int* buf_len)
+{
+    int attempts = handle->retry.attempts;
+
+    /* Nothing tells whether a command without reply got lost */
+    if (rcx_reply_length((unsigned char) pending->given)==0)
+    {
+        attempts = 1;
+    }
+
+    while (1)
+    {
+        if (result==RCX_OK)
+        {
+            result = raw_command_reply(handle, (unsigned char) pending->sent,
+                                       buf, buf_size, buf_len);
+        }
+        raw_link_update(handle, result);
+
+        if ((result==RCX_E_RECV_NOTHING) || (result==RCX_E_RECV_ERROR))
+        {
+            handle->late_opcode = pending->sent;
+        }
+        /* A collision has been sent again already, see */
+        /* raw_send_encoded()                            */
+        if (((result!=RCX_E_RECV_NOTHING) && (result!=RCX_E_RECV_ERROR)) ||
+            (pending->attempt>=attempts))
+        {
+            break;
+        }
+
+        APP_PRINT2("Command failed, attempt %d", pending->attempt);
+        result = raw_backoff(handle, pending->backoff);
+        pending->backoff = (pending->backoff*2<handle->retry.backoff_max) ?
+                           pending->backoff*2 : handle->retry.backoff_max;
+        if (result==RCX_OK)
+        {
+            result = raw_command_send(handle, pending);
+        }
+    }
+
+    if (result==RCX_OK)
+    {
+        raw_count_time(handle, handle->counters.command_time,
+                       pending->start);
+        if (*buf_len>0)
+        {
+            buf[0] = (unsigned char) ~pending->given;
+        }
+    }
+
+    return result;
+}
+
+
+/***************************************************************
+* raw_backoff: Wait before a retry. What the driver receives   *
+*              meanwhile, like a late reply, is added to the   *
+*              receive stream, to be skipped there.            *
+*              The caller holds the rx_lock of the handle.     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          wait                   Time to wait, in ms          *
+* Output:                                                      *
+* Return:  RCX_OK                 Time has passed              *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_DEVICE_ERROR     Error in LIRC device         *
+***************************************************************/
+int raw_backoff(rcx_handle_t* handle, int wait)
+{
+    int result;
+    long left;
+    long deadline;
+    struct timespec delay;
+
+    if (wait<=0)
+    {
+        return RCX_OK;
+    }
+
+    /* The receiver thread takes the input meanwhile */
+    if (handle->receiver)
+    {
+        delay.tv_sec = wait / 1000;
+        delay.tv_nsec = (wait % 1000) * 1000000L;
+        nanosleep(&delay, NULL);
+        return RCX_OK;
+    }
+
+    deadline = handle->transport->now(&handle->device) + wait*1000L;
+    result = raw_stash_items(handle, NULL, 0);
+    while ((result==RCX_OK) && (handle->recv_item_count<BUFFERSIZE) &&
+           ((left = deadline-handle->transport->now(&handle->device))>0))
+    {
+        result = handle->transport->receive(&handle->device,
+                           &handle->recv_items[handle->recv_item_count],
+                           BUFFERSIZE-handle->recv_item_count,
+                           (int) ((left+999)/1000));
+        switch (result)
+        {
+        case LIRC_E_DEVICE_NOT_OPEN: /* Device not open */
+            return RCX_E_DEVICE_NOT_OPEN;
+
+        case LIRC_E_DEVICE_ERROR: /* Lirc device errors */
+            return RCX_E_DEVICE_ERROR;
+
+        default:
+            handle->recv_item_count += result;
+            result = RCX_OK;
+        }
+    }
+
+    return result;
+}
+
+
+/***************************************************************
+* raw_toggle:  The opcode to send, so that the RCX does not    *
+*              take it for a repeat of the one sent before.    *
+*              The caller holds the tx_lock of the handle.     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          opcode                 Opcode as given              *
+* Output:                                                      *
+* Return:  The opcode, with the toggle bit flipped if needed   *
+***************************************************************/
+int raw_toggle(rcx_handle_t* handle, int opcode)
+{
+    return (opcode==handle->last_opcode) ? opcode ^ RCX_TOGGLE : opcode;
+}
+
+
+/***************************************************************
+* raw_firmware_command: Run a command of a firmware download,  *
+*              with the retry policy of the handle, like       *
+*              rcx_command_dev().                              *
+*              The caller holds the tx_lock and the rx_lock of *
+*              the handle.                                     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          buf                    Command bytes                *
+*          buf_size               Size of buf                  *
+*          buf_len                Number of command bytes      *
+* Output:  buf                    The reply                    *
+*          buf_len                Number of reply bytes        *
+* Return:  See rcx_command_dev()                               *
+***************************************************************/
+int raw_firmware_command(rcx_handle_t* handle, unsigned char* buf,
+                         int buf_size, int* buf_len)
+{
+    int result;
+    rcx_pending_t pending;
+    lirc_t list[BUFFERSIZE*LIRC_BYTE_ITEMS];
+
+    result = raw_command_init(handle, &pending, buf, *buf_len, list,
+                              BUFFERSIZE*LIRC_BYTE_ITEMS);
+    if (result==RCX_OK)
+    {
+        result = raw_command_send(handle, &pending);
+        result = raw_command_finish(handle, &pending, result,
+                                    buf, buf_size, buf_len);
+    }
+
+    return result;
+}
+
+
+/***************************************************************
+* raw_firmware_encode: Encode the packet of a transfer: the    *
+*              opcode, sequence number, length, the data, and  *
+*              the sum of the data bytes.                      *
+*              The caller holds the tx_lock of the handle.     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          firmware               The image                    *
+* In/Out:  block                  The transfer                 *
+* Return:  RCX_OK                 Packet encoded               *
+*          RCX_E_PROGRAM_FAILURE  List too small               *
+***************************************************************/
+int raw_firmware_encode(rcx_handle_t* handle, const rcx_firmware_t* firmware,
+                        rcx_block_t* block)
+{
+    int n;
+    int sum = 0;
+    unsigned char data[RCX_FIRMWARE_BLOCK_MAX+6];
+
+    data[0] = (unsigned char) block->opcode;
+    data[1] = (unsigned char) (block->sequence & 0xff);
+    data[2] = (unsigned char) ((block->sequence>>8) & 0xff);
+    data[3] = (unsigned char) (block->length & 0xff);
+    data[4] = (unsigned char) ((block->length>>8) & 0xff);
+    for (n=0; n<block->length; n++)
+    {
+        data[5+n] = firmware->image[block->offset+n];
+        sum += data[5+n];
+    }
+    data[5+n] = (unsigned char) (sum & 0xff);
+
+    block->items = raw_encode_packet(handle, data, block->length+6,
+                                     block->list,
+                                     FIRMWARE_ITEMS(block->length));
+
+    return (block->items<0) ? block->items : RCX_OK;
+}
+
+
+/***************************************************************
+* raw_firmware_transfer: Send a block of a firmware download,  *
+*              until the RCX has taken it.                     *
+*                                                              *
+* Note:        A lost block and a lost reply look the same, so *
+*              every retry flips the toggle bit, as for an     *
+*              idempotent command: the RCX takes a block again *
+*              when it repeats the sequence number. A block    *
+*              the RCX got corrupted is sent again the same    *
+*              way. There is no backoff; the reply timeout has *
+*              passed already.                                 *
+*              The caller holds the tx_lock and the rx_lock of *
+*              the handle.                                     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          firmware               The image                    *
+* In/Out:  block                  The transfer                 *
+*          retransmits            Counted up for each retry    *
+* Return:  RCX_OK                 Block taken                  *
+*          RCX_E_FIRMWARE         RCX refused the block        *
+*          Others                 See raw_send_packet() and    *
+*                                 raw_receive_packet()         *
+***************************************************************/
+int raw_firmware_transfer(rcx_handle_t* handle,
+                          const rcx_firmware_t* firmware,
+                          rcx_block_t* block, int* retransmits)
+{
+    int result = RCX_OK;
+    int attempt;
+    int opcode = -1;
+    int reply_len;
+    unsigned char reply[BUFFERSIZE];
+
+    for (attempt=1; attempt<=FIRMWARE_ATTEMPTS; attempt++)
+    {
+        if (attempt==1)
+        {
+            opcode = raw_toggle(handle, block->opcode);
+        }
+        else
+        {
+            opcode ^= RCX_TOGGLE;
+            (*retransmits)++;
+            raw_count(&handle->counters.retries, 1);
+            APP_PRINT2("Block sent again, sequence %d", block->sequence);
+        }
+
+        /* Only a retry needs another packet */
+        if (opcode!=block->opcode)
+        {
+            block->opcode = opcode;
+            result = raw_firmware_encode(handle, firmware, block);
+            if (result!=RCX_OK)
+            {
+                return result;
+            }
+        }
+
+        result = raw_send_encoded(handle, block->list, block->items,
+                                  (block->length+6)*2+5);
+        if (result==RCX_OK)
+        {
+            handle->last_opcode = opcode;
+            result = raw_command_reply(handle, (unsigned char) opcode,
+                                       reply, sizeof(reply), &reply_len);
+        }
+
+        if (result==RCX_OK)
+        {
+            if ((reply_len>=2) && (reply[1]==0))
+            {
+                return RCX_OK;
+            }
+            if ((reply_len<2) || (reply[1]!=FIRMWARE_BAD_BLOCK))
+            {
+                APP_ERROR("RCX refused the block");
+                return RCX_E_FIRMWARE;
+            }
+            result = RCX_E_RECV_ERROR;
+        }
+        else if ((result==RCX_E_RECV_NOTHING) || (result==RCX_E_RECV_ERROR))
+        {
+            handle->late_opcode = opcode;
+        }
+        else if (result!=RCX_E_COLLISION)
+        {
+            break;
+        }
+    }
+
+    return result;
+}
+
+
+/***************************************************************
+* raw_lnp_packet: Receive the next LNP packet, from the ring   *
+*              of the receiver thread, or from the driver like *
+*              raw_receive_packet() does.                      *
+*              The caller holds the rx_lock of the handle.     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+* Output:                                                      *
+* Return:  >0                     RCX_LNP_xxx header; the      *
+*                                 packet is in the LNP parser  *
+*          RCX_E_RECV_NOTHING     No data received             *
+*          RCX_E_RECV_ERROR       Data received, no packet     *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_DEVICE_ERROR     Error in LIRC device         *
+***************************************************************/
+int raw_lnp_packet(rcx_handle_t* handle)
+{
+    int result;
+    int received = 0;
+    unsigned char byte;
+    lirc_decoder_t decoder;
+    rcx_lnp_parser_t parser;
+
+    while (handle->receiver)
+    {
+        while (rcx_ring_get(&handle->ring, &byte, 1)==1)
+        {
+            received = 1;
+            result = rcx_lnp_parser_push(&handle->lnp_parser, byte);
+            raw_count_lnp(handle, result);
+            if (result>0)
+            {
+                return result;
+            }
+        }
+
+        result = raw_ring_wait(handle, LIRC_REPLY_TIME);
+        if (result<0)
+        {
+            return result;
+        }
+        if (result==0)
+        {
+            break;
+        }
+    }
+
+    while (!handle->receiver)
+    {
+        while (handle->recv_item_index<handle->recv_item_count)
+        {
+            received = 1;
+            result = lirc_byte_decode(&handle->decoder,
+                handle->recv_items[handle->recv_item_index++], &byte);
+            raw_count_decode(handle, &handle->decoder, result);
+            if (result==1)
+            {
+                result = rcx_lnp_parser_push(&handle->lnp_parser, byte);
+            }
+            else if (result<0)
+            {
+                /* A byte is lost, so a packet cannot go on */
+                result = rcx_lnp_parser_flush(&handle->lnp_parser);
+            }
+            raw_count_lnp(handle, result);
+
+            if (result>0)
+            {
+                return result;
+            }
+        }
+
+        /* Complete a last byte that ends with mark bits on a   */
+        /* copy, see raw_receive_packet()                        */
+        if (received)
+        {
+            decoder = handle->decoder;
+            parser = handle->lnp_parser;
+            if ((lirc_byte_decode(&decoder, decoder.bit_period*10U,
+                                  &byte)==1) &&
+                ((result = rcx_lnp_parser_push(&parser, byte))>0))
+            {
+                handle->decoder = decoder;
+                handle->lnp_parser = parser;
+                raw_count_decode(handle, &decoder, 1);
+                raw_count_lnp(handle, result);
+                return result;
+            }
+        }
+
+        result = raw_read_items(handle, LIRC_REPLY_TIME);
+        if (result<0)
+        {
+            return result;
+        }
+        if (result==0)
+        {
+            raw_reset_stream(handle);
+            break;
+        }
+    }
+
+    /* The line is silent, which ends a packet */
+    raw_count_lnp(handle, rcx_lnp_parser_flush(&handle->lnp_parser));
+
+    return (received) ? RCX_E_RECV_ERROR : RCX_E_RECV_NOTHING;
+}
+
+
+/***************************************************************
+* raw_count_lnp: Count the result of the LNP parser in the     *
+*              statistics of the handle. Its bytes are counted *
+*              already, as they are decoded.                   *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          result                 Of rcx_lnp_parser_push()     *
+* Output:                                                      *
+* Return:  none                                                *
+***************************************************************/
+void raw_count_lnp(rcx_handle_t* handle, int result)
+{
+    if (result>0)
+    {
+        raw_count(&handle->counters.packets_received, 1);
+    }
+    else if (result<0)
+    {
+        raw_count(&handle->counters.checksum_errors, 1);
+    }
+}
+
+
+/***************************************************************
+* raw_lnp_dispatch: Hand the packet the LNP parser completed   *
+*              to the handler of its port. The handler runs    *
+*              without the rx_lock, so it can use the device.  *
+*              The caller holds the rx_lock of the handle.     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          header                 RCX_LNP_xxx of the packet    *
+* Output:                                                      *
+* Return:  1 if a handler took the packet, 0 if not            *
+***************************************************************/
+int raw_lnp_dispatch(rcx_handle_t* handle, int header)
+{
+    int port = RCX_LNP_PORTS;
+    int src = -1;
+    int skip = 0;
+    int length = handle->lnp_parser.length;
+    void* user;
+    rcx_lnp_handler_t handler;
+    unsigned char data[RCX_LNP_SIZE];
+
+    if (header==RCX_LNP_ADDRESSING)
+    {
+        if ((handle->lnp_parser.buf[0]>>4)!=handle->lnp_host)
+        {
+            return 0;
+        }
+        port = handle->lnp_parser.buf[0] & RCX_LNP_PORT_MASK;
+        src = handle->lnp_parser.buf[1];
+        skip = 2;
+    }
+
+    handler = handle->lnp_handlers[port];
+    user = handle->lnp_users[port];
+    if (handler==NULL)
+    {
+        APP_PRINT2("No LNP handler, port %d", port);
+        return 0;
+    }
+    memcpy(data, &handle->lnp_parser.buf[skip], length-skip);
+
+    pthread_mutex_unlock(&handle->rx_lock);
+    handler(user, data, length-skip, src);
+    pthread_mutex_lock(&handle->rx_lock);
+
+    return 1;
+}
+
+
+/***************************************************************
+* raw_worker:  The worker thread of the asynchronous commands. *
+*              Runs the queued commands one by one, until      *
+*              rcx_close_dev() stops it.                       *
+*                                                              *
+* Note:        After a command has been sent, the next one is  *
+*              taken from the queue and encoded while the      *
+*              reply is on the air. The device is held for     *
+*              each command, like rcx_command_dev() does, so   *
+*              other calls on the handle can go in between.    *
+*                                                              *
+* Input:   arg                    Handle of the device         *
+* Output:                                                      *
+* Return:  NULL                                                *
+***************************************************************/
+void* raw_worker(void* arg)
+{
+    int result;
+    int current = 0;
+    rcx_handle_t* handle = (rcx_handle_t*) arg;
+    rcx_request_t* request;
+    rcx_request_t* next;
+    rcx_pending_t pending[2];
+    lirc_t lists[2][ASYNC_ITEMS];
+
+    request = raw_next_request(handle, 1);
+    if (request!=NULL)
+    {
+        raw_command_init(handle, &pending[current], request->completion.buf,
+            request->completion.buf_len, lists[current], ASYNC_ITEMS);
+    }
+
+    while (request!=NULL)
+    {
+        pthread_mutex_lock(&handle->tx_lock);
+        pthread_mutex_lock(&handle->rx_lock);
+
+        /* Encoded again, if the bit rate or the toggle bit changed */
+        result = raw_command_send(handle, &pending[current]);
+
+        /* Encode the next command while the reply is on the air */
+        next = raw_next_request(handle, 0);
+        if (next!=NULL)
+        {
+            raw_command_init(handle, &pending[!current], next->completion.buf,
+                next->completion.buf_len, lists[!current], ASYNC_ITEMS);
+        }
+
+        result = raw_command_finish(handle, &pending[current], result,
+                                    request->completion.buf, RCX_ASYNC_SIZE,
+                                    &request->completion.buf_len);
+
+        pthread_mutex_unlock(&handle->rx_lock);
+        pthread_mutex_unlock(&handle->tx_lock);
+
+        raw_complete(handle, request, result);
+
+        request = next;
+        current = !current;
+        if (request==NULL)
+        {
+            request = raw_next_request(handle, 1);
+            if (request!=NULL)
+            {
+                raw_command_init(handle, &pending[current],
+                    request->completion.buf, request->completion.buf_len,
+                    lists[current], ASYNC_ITEMS);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+/***************************************************************
+* raw_next_request: Take the next command from the submission  *
+*              queue of the device.                            *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          wait                   Wait for a command, if none  *
+*                                 is queued                    *
+* Output:                                                      *
+* Return:  The command, or NULL if none is queued, or if the   *
+*          worker has to stop                                  *
+***************************************************************/
+rcx_request_t* raw_next_request(rcx_handle_t* handle, int wait)
+{
+    rcx_request_t* request = NULL;
+
+    pthread_mutex_lock(&handle->queue_lock);
+
+    while (wait && (handle->submit_head==NULL) && !handle->worker_stop)
+    {
+        pthread_cond_wait(&handle->queue_cond, &handle->queue_lock);
+    }
+
+    if (!handle->worker_stop)
+    {
+        request = handle->submit_head;
+    }
+    if (request!=NULL)
+    {
+        handle->submit_head = request->next;
+        if (handle->submit_head==NULL)
+        {
+            handle->submit_tail = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&handle->queue_lock);
+
+    return request;
+}
+
+
+/***************************************************************
+* raw_complete: Deliver the result of a command, to its        *
+*              callback, or to the completion queue.           *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          request                The command                  *
+*          result                 Its result code              *
+* Output:                                                      *
+* Return:  none                                                *
+***************************************************************/
+void raw_complete(rcx_handle_t* handle, rcx_request_t* request, int result)
+{
+    request->completion.result = result;
+    if (result!=RCX_OK)
+    {
+        request->completion.buf_len = 0;
+    }
+    request->next = NULL;
+
+    if (request->callback!=NULL)
+    {
+        request->callback(&request->completion);
+
+        pthread_mutex_lock(&handle->queue_lock);
+        request->next = handle->free_list;
+        handle->free_list = request;
+        pthread_mutex_unlock(&handle->queue_lock);
+        return;
+    }
+
+    pthread_mutex_lock(&handle->queue_lock);
+    if (handle->done_tail==NULL)
+    {
+        handle->done_head = request;
+    }
+    else
+    {
+        handle->done_tail->next = request;
+    }
+    handle->done_tail = request;
+    pthread_cond_broadcast(&handle->done_cond);
+    pthread_mutex_unlock(&handle->queue_lock);
+}
+
+
+/***************************************************************
+* raw_receive_packet: Receive the next RCX packet from the     *
+*              receive stream of the device.                   *
+*                                                              *
+* Note:        The items are decoded and parsed while they     *
+*              arrive, see rcx_parser_push(). The function     *
+*              returns as soon as a packet is complete. Items  *
+*              after it are kept for the next call, so packets *
+*              sent back-to-back are all received. Garbage     *
+*              before a packet is skipped.                     *
+*              The caller holds the rx_lock of the handle.     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          buf                    Receive buffer               *
+*          buf_size               Size of receive buffer       *
+*          wait                   Time to wait for the first   *
+*                                 items, in ms; after them the *
+*                                 packet ends at LIRC_REPLY_   *
+*                                 TIME of silence              *
+* Output:  buf_len                Number of bytes received     *
+* Return:  RCX_OK                 A packet has been received   *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_DEVICE_ERROR     Error in LIRC device         *
+*          RCX_E_RECV_NOTHING     No data received             *
+*          RCX_E_RECV_ERROR       Data received, with errors   *
+***************************************************************/
+int raw_receive_packet(rcx_handle_t* handle, unsigned char* buf,
+                       int buf_size, int* buf_len, int wait)
+{
+    int result;
+    int received = 0;
+    unsigned char byte;
+    lirc_decoder_t decoder;
+    rcx_parser_t parser;
+
+    if (handle->receiver)
+    {
+        return raw_ring_packet(handle, buf, buf_size, buf_len, wait);
+    }
+
+    while (1)
+    {
+        /* Decode and parse the items at hand */
+        while (handle->recv_item_index<handle->recv_item_count)
+        {
+            received = 1;
+            result = lirc_byte_decode(&handle->decoder,
+                handle->recv_items[handle->recv_item_index++], &byte);
+            raw_count_decode(handle, &handle->decoder, result);
+            if (result==1)
+            {
+                result = rcx_parser_push(&handle->parser, byte);
+            }
+            else if (result<0)
+            {
+                /* A byte is lost, so a packet cannot go on */
+                result = rcx_parser_flush(&handle->parser);
+            }
+            raw_count_parse(handle, &handle->parser, result);
+
+            if (result>0)
+            {
+                return raw_packet_out(handle, result, buf, buf_size, buf_len);
+            }
+        }
+
+        /* The last byte may end with mark bits, which the driver */
+        /* only reports at the next pulse. Complete it on a copy  */
+        /* of the stream, and use it only if that completes a     */
+        /* packet.                                                */
+        if (received)
+        {
+            decoder = handle->decoder;
+            parser = handle->parser;
+            if ((lirc_byte_decode(&decoder, decoder.bit_period*10U,
+                                  &byte)==1) &&
+                ((result = rcx_parser_push(&parser, byte))>0))
+            {
+                handle->decoder = decoder;
+                handle->parser = parser;
+                raw_count_decode(handle, &decoder, 1);
+                raw_count_parse(handle, &parser, result);
+                return raw_packet_out(handle, result, buf, buf_size, buf_len);
+            }
+        }
+
+        /* Wait for more items; once some came, the packet ends */
+        /* at silence                                           */
+        result = raw_read_items(handle, (received) ? LIRC_REPLY_TIME : wait);
+        if (result<0)
+        {
+            return result;
+        }
+        if (result==0)
+        {
+            break;
+        }
+    }
+
+    /* The line is silent, which ends the stream. Complete a */
+    /* half received character, like lirc_receive() does.    */
+    result = lirc_byte_decode(&handle->decoder,
+                              handle->decoder.bit_period*10U, &byte);
+    raw_count_decode(handle, &handle->decoder, result);
+    if (result==1)
+    {
+        result = rcx_parser_push(&handle->parser, byte);
+        raw_count_parse(handle, &handle->parser, result);
+    }
+    if (result<=0)
+    {
+        result = rcx_parser_flush(&handle->parser);
+        raw_count_parse(handle, &handle->parser, result);
+    }
+    raw_reset_stream(handle);
+
+    if (result>0)
+    {
+        return raw_packet_out(handle, result, buf, buf_size, buf_len);
+    }
+
+    return (received) ? RCX_E_RECV_ERROR : RCX_E_RECV_NOTHING;
+}
+
+
+/***************************************************************
+* raw_receive_reply: Receive the reply to an opcode            *
+*                                                              *
+* Note:        Packets that are not a reply to the opcode, so  *
+*              that do not start with the inverted opcode, are *
+*              skipped, and handed to the function selected    *
+*              with rcx_set_unsolicited_dev(). A late reply to *
+*              an earlier attempt is counted, and does not make*
+*              the result an error.                            *
+*              The caller holds the rx_lock of the handle.     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          opcode                 Opcode that has been sent    *
+*          buf                    Receive buffer               *
+*          buf_size               Size of receive buffer       *
+* Output:  buf_len                Number of bytes received     *
+* Return:  See raw_receive_packet()                            *
+***************************************************************/
+int raw_receive_reply(rcx_handle_t* handle, unsigned char opcode,
+                      unsigned char* buf, int buf_size, int* buf_len)
+{
+    int result;
+    int skipped = 0;
+
+    while (1)
+    {
+        result = raw_receive_packet(handle, buf, buf_size, buf_len,
+                                    LIRC_REPLY_TIME);
+        if (result!=RCX_OK)
+        {
+            break;
+        }
+
+        /* Check if data contains inverted opcode, to */
+        /* check if it complies with the RCX protocol */
+        if (opcode == (unsigned char) (~buf[0]&0xffU))
+        {
+            return RCX_OK;
+        }
+
+        /* The reply to an attempt that timed out */
+        if (handle->late_opcode == (~buf[0]&0xff))
+        {
+            APP_PRINT2("Late reply 0x%02x, skipped", buf[0]);
+            raw_count(&handle->counters.late_replies, 1);
+            continue;
+        }
+
+        APP_PRINT2("Packet 0x%02x is no reply, skipped", buf[0]);
+        if (handle->unsolicited!=NULL)
+        {
+            handle->unsolicited(handle->unsolicited_user, buf, *buf_len);
+        }
+        skipped = 1;
+    }
+
+    return ((result==RCX_E_RECV_NOTHING) && skipped) ?
+           RCX_E_RECV_ERROR : result;
+}
+
+
+/***************************************************************
+* raw_packet_out: Copy a packet completed by the parser to the *
+*              buffer of the caller.                           *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          length                 Number of data bytes         *
+*          buf                    Receive buffer               *
+*          buf_size               Size of receive buffer       *
+* Output:  buf_len                Number of bytes received     *
+* Return:  RCX_OK                 Packet copied                *
+*          RCX_E_RECV_ERROR       Buffer too small             *
+***************************************************************/
+int raw_packet_out(rcx_handle_t* handle, int length,
+                   unsigned char* buf, int buf_size, int* buf_len)
+{
+    if (length>buf_size)
+    {
+        APP_ERROR("RCX number of data bytes exceed buffer size");
+        return RCX_E_RECV_ERROR;
+    }
+
+    memcpy(buf, handle->parser.buf, length);
+    *buf_len = length;
+
+    return RCX_OK;
+}
+
+
+/***************************************************************
+* raw_read_items: Wait for items from the LIRC driver, and     *
+*              read all that are available into the receive    *
+*              stream of the device.                           *
+*              The caller holds the rx_lock of the handle.     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          timeout                Time to wait, in ms          *
+* Output:                                                      *
+* Return:  >0                     Number of items read         *
+*          0                      Timeout, the line is silent  *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_DEVICE_ERROR     Error in LIRC device         *
+***************************************************************/
+int raw_read_items(rcx_handle_t* handle, int timeout)
+{
+    int result;
+
+    result = handle->transport->receive(&handle->device, handle->recv_items,
+                                        BUFFERSIZE, timeout);
+    APP_PRINT2("Transport receive returned %d", result);
+    switch (result)
+    {
+    case LIRC_E_DEVICE_NOT_OPEN: /* Device not open */
+        return RCX_E_DEVICE_NOT_OPEN;
+
+    case LIRC_E_DEVICE_ERROR: /* Lirc device errors */
+        return RCX_E_DEVICE_ERROR;
+
+    default:
+        ; /* Timeout, or one or more items received */
+    }
+
+    handle->recv_item_index = 0;
+    handle->recv_item_count = result;
+
+    return result;
+}
+
+
+/***************************************************************
+* raw_stash_items: Add items to the receive stream of the      *
+*              device, after the items not decoded yet. Without*
+*              a list, the items the driver has available are  *
+*              added, without waiting.                         *
+*              The caller holds the rx_lock of the handle.     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          list                   Items to add, or NULL        *
+*          item_count             Number of items in list      *
+* Output:                                                      *
+* Return:  RCX_OK                 Items added                  *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_DEVICE_ERROR     Error in LIRC device         *
+***************************************************************/
+int raw_stash_items(rcx_handle_t* handle, lirc_t* list, int item_count)
+{
+    int result;
+    int count;
+
+    /* Move the items not decoded yet to the front */
+    count = handle->recv_item_count - handle->recv_item_index;
+    memmove(handle->recv_items, &handle->recv_items[handle->recv_item_index],
+            count*sizeof(lirc_t));
+    handle->recv_item_index = 0;
+    handle->recv_item_count = count;
+
+    if (list!=NULL)
+    {
+        if (item_count>BUFFERSIZE-count)
+        {
+            APP_ERROR("Buffersize exceeded");
+            item_count = BUFFERSIZE-count;
+        }
+        memcpy(&handle->recv_items[count], list, item_count*sizeof(lirc_t));
+        handle->recv_item_count += item_count;
+        return RCX_OK;
+    }
+
+    while (handle->recv_item_count<BUFFERSIZE)
+    {
+        result = handle->transport->receive(&handle->device,
+                           &handle->recv_items[handle->recv_item_count],
+                           BUFFERSIZE-handle->recv_item_count, 0);
+        switch (result)
+        {
+        case LIRC_E_DEVICE_NOT_OPEN: /* Device not open */
+            return RCX_E_DEVICE_NOT_OPEN;
+
+        case LIRC_E_DEVICE_ERROR: /* Lirc device errors */
+            return RCX_E_DEVICE_ERROR;
+
+        case 0: /* Nothing available */
+            return RCX_OK;
+
+        default:
+            handle->recv_item_count += result;
+        }
     }
 
     return RCX_OK;
 }
 
 
+/***************************************************************
+* raw_check_echo: Take the echo of a transmission from the     *
+*              LIRC driver, and compare it with the items sent.*
+*                                                              *
+* Note:        The write to the driver returns when the items  *
+*              have been sent, so an echo is available at      *
+*              once. If nothing is, the receiver does not hear *
+*              the transmissions. Runs of pulses and spaces are*
+*              compared in whole bits, as they would be sent   *
+*              without the fine tuning of the profile. The     *
+*              last run, the stop bit, is not reported until   *
+*              the next pulse, so it is not compared. Items    *
+*              after the echo are added to the receive stream. *
+*              The caller holds the rx_lock of the handle.     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          list                   Items that have been sent    *
+*          item_count             Number of items in list      *
+* Output:                                                      *
+* Return:  RCX_OK                 Echo correct, or no echo     *
+*          RCX_E_COLLISION        Echo corrupted or incomplete *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_DEVICE_ERROR     Error in LIRC device         *
+***************************************************************/
+int raw_check_echo(rcx_handle_t* handle, lirc_t* list, int item_count)
+{
+    int n;
+    int items;
+    int pulse;
+    int adjust;
+    int timeout = 0;
+    int position = 0;
+    int bit_period = handle->profile->bit_period;
+    lirc_t echo[BUFFERSIZE];
+
+    while (1)
+    {
+        items = handle->transport->receive(&handle->device, echo,
+                                           BUFFERSIZE, timeout);
+        switch (items)
+        {
+        case LIRC_E_DEVICE_NOT_OPEN: /* Device not open */
+            return RCX_E_DEVICE_NOT_OPEN;
+
+        case LIRC_E_DEVICE_ERROR: /* Lirc device errors */
+            return RCX_E_DEVICE_ERROR;
+
+        case 0:
+            if (position==0)
+            {
+                /* No echo */
+                return RCX_OK;
+            }
+            APP_ERROR("Echo not complete");
+            return RCX_E_COLLISION;
+
+        default:
+            ; /* One or more items received */
+        }
+
+        /* Once the echo started, wait for the rest of it */
+        timeout = LIRC_REPLY_TIME;
+
+        for (n=0; n<items; n++)
+        {
+            /* Marks before the echo are the idle line. The items */
+            /* sent start with a pulse, and alternate.            */
+            pulse = (echo[n]&PULSE_BIT) ? 1 : 0;
+            if ((position==0) && !pulse)
+            {
+                continue;
+            }
+
+            /* Runs are compared without the fine tuning of the */
+            /* profile, which makes up for the hardware         */
+            adjust = pulse ? handle->profile->space_adjust :
+                             handle->profile->mark_adjust;
+            if ((pulse != ((position%2)==0)) ||
+                (((echo[n]&PULSE_MASK)+bit_period/2)/bit_period !=
+                 (list[position]-adjust+bit_period/2)/bit_period))
+            {
+                APP_ERROR("Echo corrupted, collision");
+
+                /* Drop the rest of the corrupted transmission */
+                while (handle->transport->receive(&handle->device, echo,
+                                                  BUFFERSIZE, 0)>0)
+                {
+                }
+                return RCX_E_COLLISION;
+            }
+
+            position++;
+            if (position>=item_count-1)
+            {
+                return raw_stash_items(handle, &echo[n+1], items-n-1);
+            }
+        }
+    }
+}
+
+
+/***************************************************************
+* raw_reset_stream: Forget everything received so far, and     *
+*              start a new receive stream.                     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+* Output:                                                      *
+* Return:  none                                                *
+***************************************************************/
+void raw_reset_stream(rcx_handle_t* handle)
+{
+    handle->recv_item_index = 0;
+    handle->recv_item_count = 0;
+    lirc_decoder_init(&handle->decoder, handle->profile->bit_period);
+    rcx_parser_init(&handle->parser);
+}
+
+
+/***************************************************************
+* raw_receiver: The receiver thread. Decodes everything the    *
+*              LIRC driver reports into the ring of the device,*
+*              until rcx_close_dev() stops it.                 *
+*                                                              *
+* Note:        A character that ends with mark bits is only    *
+*              complete at the next pulse. Once the line has   *
+*              been silent for a character time, it is         *
+*              completed, so it does not wait for the next one.*
+*              Bytes that do not fit in the ring are dropped,  *
+*              and counted.                                    *
+*                                                              *
+* Input:   arg                    Handle of the device         *
+* Output:                                                      *
+* Return:  NULL                                                *
+***************************************************************/
+void* raw_receiver(void* arg)
+{
+    int n;
+    int items;
+    int result;
+    int timeout;
+    int byte_count;
+    int added;
+    int fill;
+    rcx_handle_t* handle = (rcx_handle_t*) arg;
+    lirc_decoder_t decoder;
+    lirc_t list[BUFFERSIZE];
+    unsigned char bytes[BUFFERSIZE];
+
+    lirc_decoder_init(&decoder, handle->profile->bit_period);
+
+    while (!__atomic_load_n(&handle->receiver_stop, __ATOMIC_ACQUIRE))
+    {
+        /* Follow a change of the bit rate, see raw_set_rate() */
+        n = __atomic_load_n(&handle->device.bit_period, __ATOMIC_RELAXED);
+        if (n!=decoder.bit_period)
+        {
+            lirc_decoder_init(&decoder, n);
+        }
+
+        /* Within a character, silence means it has ended */
+        timeout = RECEIVER_POLL_TIME;
+        if (decoder.total_bits>0)
+        {
+            timeout = (decoder.bit_period*12 + 999) / 1000;
+        }
+
+        items = handle->transport->receive(&handle->device, list,
+                                           BUFFERSIZE, timeout);
+        if (items<0)
+        {
+            APP_ERROR("Receiver thread stopped");
+            __atomic_store_n(&handle->receiver_result,
+                             (items==LIRC_E_DEVICE_NOT_OPEN) ?
+                             RCX_E_DEVICE_NOT_OPEN : RCX_E_DEVICE_ERROR,
+                             __ATOMIC_RELEASE);
+            break;
+        }
+
+        byte_count = 0;
+        for (n=0; n<items; n++)
+        {
+            result = lirc_byte_decode(&decoder, list[n], &bytes[byte_count]);
+            raw_count_decode(handle, &decoder, result);
+            switch (result)
+            {
+            case 1:
+                byte_count++;
+                break;
+
+            case 0:
+                break;
+
+            default:
+                __atomic_add_fetch(&handle->stats.errors, 1, __ATOMIC_RELAXED);
+            }
+        }
+        if ((items==0) && (decoder.total_bits>0) &&
+            (lirc_byte_decode(&decoder, decoder.bit_period*10U,
+                              &bytes[0])==1))
+        {
+            raw_count_decode(handle, &decoder, 1);
+            byte_count = 1;
+        }
+        if (byte_count==0)
+        {
+            continue;
+        }
+
+        added = rcx_ring_put(&handle->ring, bytes, byte_count);
+        __atomic_add_fetch(&handle->stats.bytes, added, __ATOMIC_RELAXED);
+        if (added<byte_count)
+        {
+            __atomic_add_fetch(&handle->stats.dropped, byte_count-added,
+                               __ATOMIC_RELAXED);
+            __atomic_add_fetch(&handle->stats.overflows, 1,
+                               __ATOMIC_RELAXED);
+        }
+        fill = rcx_ring_count(&handle->ring);
+        if (fill>handle->stats.fill_max)
+        {
+            __atomic_store_n(&handle->stats.fill_max, fill, __ATOMIC_RELAXED);
+        }
+
+        pthread_mutex_lock(&handle->ring_lock);
+        pthread_cond_broadcast(&handle->ring_cond);
+        pthread_mutex_unlock(&handle->ring_lock);
+    }
 
+    /* Wake up a consumer, to see the error */
+    pthread_mutex_lock(&handle->ring_lock);
+    pthread_cond_broadcast(&handle->ring_cond);
+    pthread_mutex_unlock(&handle->ring_lock);
 
+    return NULL;
+}
 
 
 /***************************************************************
-* rcx_send_byte:   Send a single byte to the LIRC driver       *
+* raw_ring_wait: Wait until the ring of the device holds bytes.*
+*              The caller holds the rx_lock of the handle.     *
 *                                                              *
-* Input:   tx_byte                Byte to send                 *
+* Input:   handle                 Handle of the device         *
+*          timeout                Maximum time to wait, in ms  *
 * Output:                                                      *
-* Return:  RCX_OK                 Byte has been sent           *
+* Return:  >0                     Number of bytes in the ring  *
+*          0                      Timeout, the line is silent  *
 *          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
-*          RCX_E_DEVICE_ERROR     Cannot send to LIRC driver   *
-*          RCX_E_PROGRAM_FAILURE  Internal error               *
+*          RCX_E_DEVICE_ERROR     Error in LIRC device         *
 ***************************************************************/
-int rcx_send_byte(unsigned char tx_byte)
+int raw_ring_wait(rcx_handle_t* handle, int timeout)
 {
     int result;
+    struct timespec deadline;
+
+    result = rcx_ring_count(&handle->ring);
+    if (result>0)
+    {
+        return result;
+    }
 
-    APP_PRINT2("DEBUG:" APP_SOURCE "0x%02x\n", tx_byte);
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000000L;
+    if (deadline.tv_nsec>=1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
 
-    result = raw_send(tx_byte);
+    pthread_mutex_lock(&handle->ring_lock);
+    while (((result = rcx_ring_count(&handle->ring))==0) &&
+           (__atomic_load_n(&handle->receiver_result,
+                            __ATOMIC_ACQUIRE)==RCX_OK))
+    {
+        if (pthread_cond_timedwait(&handle->ring_cond, &handle->ring_lock,
+                                   &deadline)!=0)
+        {
+            result = rcx_ring_count(&handle->ring);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&handle->ring_lock);
+
+    if (result==0)
+    {
+        result = __atomic_load_n(&handle->receiver_result, __ATOMIC_ACQUIRE);
+    }
 
-    APP_FLUSH
     return result;
 }
 
 
-
 /***************************************************************
-* rcx_receive_byte: Receive a byte from the LIRC driver        *
+* raw_ring_packet: Receive the next RCX packet from the ring   *
+*              of the device, see raw_receive_packet().        *
+*              The caller holds the rx_lock of the handle.     *
 *                                                              *
-*              This is a non-blocking function, but it can     *
-*              take a second before the call returns.          *
-*                                                              *
-* Input:                                                       *
-* Output:  rx_byte                Pointer to receive byte in   *
-* Return:  RCX_OK                 A byte has been received     *
-*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
-*          RCX_E_DEVICE_ERROR     Error in LIRC device         *
-*          RCX_E_RECV_NOTHING     No data received             *
-*          RCX_E_RECV_ERROR       Data received, with errors   *
+* Input:   handle                 Handle of the device         *
+*          buf                    Receive buffer               *
+*          buf_size               Size of receive buffer       *
+*          wait                   See raw_receive_packet()     *
+* Output:  buf_len                Number of bytes received     *
+* Return:  See raw_receive_packet()                            *
 ***************************************************************/
-int rcx_receive_byte(unsigned char* rx_byte)
+int raw_ring_packet(rcx_handle_t* handle, unsigned char* buf,
+                    int buf_size, int* buf_len, int wait)
 {
-    int result = 1;
-    static int recv_byte_index = 0;
-    static int recv_byte_count = 0;
-    static unsigned char recv_byte_buf[BUFFERSIZE];
-
-    APP_DEBUG("");
+    int result;
+    int received = 0;
+    unsigned char byte;
 
-    /* Receive and decode byte from LIRC driver input */
-    if (recv_byte_index==recv_byte_count)
+    while (1)
     {
-        result = raw_receive(recv_byte_buf, BUFFERSIZE);
-        APP_PRINT2("DEBUG:" APP_SOURCE "Function raw_receive() returned %d\n", result);
-        if (result>0)
+        result = raw_ring_wait(handle, (received) ? LIRC_REPLY_TIME : wait);
+        if (result<0)
+        {
+            return result;
+        }
+        if (result==0)
         {
-            recv_byte_index = 0;
-            recv_byte_count = result;
+            break;
+        }
+
+        while (rcx_ring_get(&handle->ring, &byte, 1)==1)
+        {
+            received = 1;
+            result = rcx_parser_push(&handle->parser, byte);
+            raw_count_parse(handle, &handle->parser, result);
+            if (result>0)
+            {
+                return raw_packet_out(handle, result, buf, buf_size, buf_len);
+            }
         }
     }
 
-    /* Write a buffer value in byte */
-    if (recv_byte_index<recv_byte_count)
+    /* The line is silent, which ends the stream */
+    result = rcx_parser_flush(&handle->parser);
+    raw_count_parse(handle, &handle->parser, result);
+    if (result>0)
     {
-        *rx_byte = recv_byte_buf[recv_byte_index];
-        recv_byte_index++;
+        return raw_packet_out(handle, result, buf, buf_size, buf_len);
     }
 
-    APP_FLUSH
-
-    return (result>0) ? RCX_OK : result;
+    return (received) ? RCX_E_RECV_ERROR : RCX_E_RECV_NOTHING;
 }
 
 
-
 /***************************************************************
-* raw_receive: Receive raw bytes from the LIRC driver          *
+* raw_receive: Receive raw bytes from the receive stream of    *
+*              the device.                                     *
 *                                                              *
 * Note:        This is a non-blocking function, but it can     *
-*              take a second before the call returns.          *
+*              take a second before the call returns. It       *
+*              returns as soon as one or more bytes have been  *
+*              decoded.                                        *
+*              The caller holds the rx_lock of the handle.     *
 *                                                              *
-* Input:   buf                    Receive buffer               *
+* Input:   handle                 Handle of the device         *
+*          buf                    Receive buffer               *
 *          buf_size               Size of receive buffer       *
-* Output:  buf_len                Number of bytes received     *
-* Return:  >0                     No bytes received and decoded*
+* Output:                                                      *
+* Return:  >0                     Number of bytes received     *
 *          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
 *          RCX_E_DEVICE_ERROR     Error in LIRC device         *
 *          RCX_E_RECV_NOTHING     No data received             *
 *          RCX_E_RECV_ERROR       Data received, with errors   *
 ***************************************************************/
-int raw_receive(unsigned char* buf, int buf_size)
+int raw_receive(rcx_handle_t* handle, unsigned char* buf, int buf_size)
 {
     int result;
-    lirc_t recv_lirc_buf[BUFFERSIZE];
+    int error = 0;
+    int byte_count = 0;
 
-    /* Receive input from LIRC driver */
-    result = lirc_receive(recv_lirc_buf, BUFFERSIZE);
-    APP_PRINT2("DEBUG:" APP_SOURCE "Function lirc_receive() returned %d\n", result);
-    switch (result)
+    while (1)
     {
-    case LIRC_E_DEVICE_NOT_OPEN: /* Device not open */
-        return RCX_E_DEVICE_NOT_OPEN;
-
-    case LIRC_E_DEVICE_ERROR: /* Lirc device errors */
-        return RCX_E_DEVICE_ERROR;
+        /* Decode the items at hand */
+        while ((handle->recv_item_index<handle->recv_item_count) &&
+               (byte_count<buf_size))
+        {
+            result = lirc_byte_decode(&handle->decoder,
+                handle->recv_items[handle->recv_item_index++],
+                &buf[byte_count]);
+            raw_count_decode(handle, &handle->decoder, result);
+            if (result==1)
+            {
+                byte_count++;
+            }
+            else if (result<0)
+            {
+                error = 1;
+            }
+        }
+        if (byte_count>0)
+        {
+            return byte_count;
+        }
 
-    case LIRC_E_BUF_SIZE: /* No items exceed items_max */
-        return RCX_E_RECV_ERROR;
+        /* Wait for more items */
+        result = raw_read_items(handle, LIRC_REPLY_TIME);
+        if (result<0)
+        {
+            return result;
+        }
+        if (result==0)
+        {
+            break;
+        }
+    }
 
-    case 0:
-        return RCX_E_RECV_NOTHING;
+    /* The line is silent. Complete a half received character, */
+    /* like lirc_receive() does.                               */
+    if (lirc_byte_decode(&handle->decoder, handle->decoder.bit_period*10U,
+                         &buf[0])==1)
+    {
+        raw_count_decode(handle, &handle->decoder, 1);
+        byte_count++;
+    }
+    raw_reset_stream(handle);
 
-    default:
-        ; /* Successful, one or more items received */
+    if (byte_count>0)
+    {
+        return byte_count;
     }
 
+    return (error) ? RCX_E_RECV_ERROR : RCX_E_RECV_NOTHING;
+}
 
-    /* Decode received LIRC items */
-    result = lirc_decode(recv_lirc_buf, result, buf, buf_size);
-    APP_PRINT2("DEBUG:" APP_SOURCE "Function lirc_decode() returned %d\n", result);
-    switch (result)
-    {
-    case LIRC_E_NO_RS232: /* Decoded signal not 2400 8O1 signal */
-        return RCX_E_RECV_ERROR;
 
-    case LIRC_E_BUF_SIZE: /* Number of chars exceed buf_size */
-        return RCX_E_RECV_ERROR;
+/***************************************************************
+* raw_send:    Send a single byte to the LIRC driver           *
+*              The caller holds the tx_lock of the handle.     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          tx_byte                Byte to send                 *
+* Output:                                                      *
+* Return:  RCX_OK                 Byte has been sent           *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_DEVICE_ERROR     Cannot send to LIRC driver   *
+*          RCX_E_PROGRAM_FAILURE  Internal error               *
+***************************************************************/
+int raw_send(rcx_handle_t* handle, unsigned char tx_byte)
+{
+    int result;
+    lirc_t list[LIRC_BYTE_ITEMS];
 
-    case 0:
-        return RCX_E_RECV_NOTHING;
+    /* This function cannot fail. LIRC_BYTE_ITEMS items */
+    /* are always enough for a single byte.             */
+    result = lirc_encode(handle->profile, &tx_byte, 1, list,
+                         LIRC_BYTE_ITEMS);
 
-    default:
-        ; /* Succesfully decoded, one or more items */
+    /* Send the list */
+    result = raw_send_items(handle, list, result);
+    if (result==RCX_OK)
+    {
+        raw_count(&handle->counters.bytes_sent, 1);
     }
-
     return result;
 }
 
 
 /***************************************************************
-* raw_send:    Send a single byte to the LIRC driver           *
+* raw_send_items: Send a list of lirc_t items to the LIRC      *
+*              driver, in a single write.                      *
+*              The caller holds the tx_lock of the handle.     *
 *                                                              *
-* Input:   tx_byte                Byte to send                 *
+* Input:   handle                 Handle of the device         *
+*          list                   Pulse and space items        *
+*          item_count             Number of items in list      *
 * Output:                                                      *
-* Return:  RCX_OK                 Byte has been sent           *
+* Return:  RCX_OK                 Items have been sent         *
 *          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
 *          RCX_E_DEVICE_ERROR     Cannot send to LIRC driver   *
 *          RCX_E_PROGRAM_FAILURE  Internal error               *
 ***************************************************************/
-int raw_send(unsigned char tx_byte)
+int raw_send_items(rcx_handle_t* handle, lirc_t* list, int item_count)
 {
     int ret;
     int result;
-    lirc_t list[16];
-
-    /* This function cannot fail. 16 items should */
-    /* always be enough for a single byte.        */
-    result = lirc_encode(&tx_byte, 1, list, 16);
 
     /* Send the list */
-    result = lirc_send(list, result);
+    result = handle->transport->send(&handle->device, list, item_count);
     switch (result)
     {
     case LIRC_OK: /* All items sent succesfully */
@@ -490,3 +4187,408 @@ int raw_send(unsigned char tx_byte)
     return ret;
 }
 
+
+
+/***************************************************************
+* raw_count:   Add to a statistics counter. Any thread may     *
+*              count, without holding a lock.                  *
+*                                                              *
+* Input:   counter                The counter, see rcx_stats_t *
+*          value                  Value to add                 *
+* Output:                                                      *
+* Return:  none                                                *
+***************************************************************/
+void raw_count(unsigned long* counter, unsigned long value)
+{
+    __atomic_add_fetch(counter, value, __ATOMIC_RELAXED);
+}
+
+
+/***************************************************************
+* raw_stat:    Read a statistics counter, while other threads  *
+*              may count, see raw_count().                     *
+*                                                              *
+* Input:   counter                The counter, see rcx_stats_t *
+* Output:                                                      *
+* Return:  Value of the counter                                *
+***************************************************************/
+unsigned long raw_stat(unsigned long* counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+
+/***************************************************************
+* raw_count_time: Count the time since start in a histogram,   *
+*              in the bucket of its power of two in ms, see    *
+*              RCX_STATS_BUCKETS.                              *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          histogram              The buckets                  *
+*          start                  Start time, from the 'now'   *
+*                                 function of the transport    *
+* Output:                                                      *
+* Return:  none                                                *
+***************************************************************/
+void raw_count_time(rcx_handle_t* handle, unsigned long* histogram,
+                    long start)
+{
+    int bucket = 0;
+    long ms;
+
+    ms = (handle->transport->now(&handle->device) - start) / 1000;
+    while ((ms>0) && (bucket<RCX_STATS_BUCKETS-1))
+    {
+        ms >>= 1;
+        bucket++;
+    }
+    raw_count(&histogram[bucket], 1);
+}
+
+
+/***************************************************************
+* raw_count_decode: Count a result of lirc_byte_decode().      *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          decoder                The decoder that returned it *
+*          result                 The result                   *
+* Output:                                                      *
+* Return:  none                                                *
+***************************************************************/
+void raw_count_decode(rcx_handle_t* handle, lirc_decoder_t* decoder,
+                      int result)
+{
+    if (result==1)
+    {
+        raw_count(&handle->counters.bytes_received, 1);
+    }
+    else if (result<0)
+    {
+        switch (decoder->error)
+        {
+        case LIRC_ERROR_PARITY:
+            raw_count(&handle->counters.parity_errors, 1);
+            break;
+
+        case LIRC_ERROR_FRAMING:
+            raw_count(&handle->counters.framing_errors, 1);
+            break;
+
+        default: /* LIRC_ERROR_BREAK */
+            raw_count(&handle->counters.break_errors, 1);
+        }
+    }
+}
+
+
+/***************************************************************
+* raw_count_parse: Count a result of rcx_parser_push() or      *
+*              rcx_parser_flush().                             *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          parser                 The parser that returned it  *
+*          result                 The result                   *
+* Output:                                                      *
+* Return:  none                                                *
+***************************************************************/
+void raw_count_parse(rcx_handle_t* handle, rcx_parser_t* parser,
+                     int result)
+{
+    if (result>0)
+    {
+        raw_count(&handle->counters.packets_received, 1);
+    }
+    else if (result<0)
+    {
+        if (parser->error==RCX_PARSE_CHECKSUM)
+        {
+            raw_count(&handle->counters.checksum_errors, 1);
+        }
+        else
+        {
+            raw_count(&handle->counters.complement_errors, 1);
+        }
+    }
+}
+
+
+/***************************************************************
+* raw_calibrate_round: Take the echo of a packet sent by       *
+*              rcx_calibrate_dev(), and the reply of the RCX,  *
+*              and measure the deviation of each run from      *
+*              whole bits.                                     *
+*                                                              *
+* Note:        The echo is available as soon as the packet has *
+*              been sent, see raw_check_echo(). The bits of an *
+*              echoed run are known from the items sent, those *
+*              of a reply are rounded. Marks before the first  *
+*              pulse of the echo and of the reply are the idle *
+*              line, and are not measured.                     *
+*              The caller holds the tx_lock and the rx_lock of *
+*              the handle.                                     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          list                   Items that have been sent    *
+*          item_count             Number of items in list      *
+* In/Out:  runs                   Deviations measured          *
+* Return:  RCX_OK                 Line silent again            *
+*          RCX_E_DEVICE_NOT_OPEN  Device has not been opened   *
+*          RCX_E_DEVICE_ERROR     Error in LIRC device         *
+***************************************************************/
+int raw_calibrate_round(rcx_handle_t* handle, lirc_t* list, int item_count,
+                        rcx_runs_t* runs)
+{
+    int n;
+    int bits;
+    int items;
+    int pulse;
+    int adjust;
+    int duration;
+    int position = 0;
+    int reply = 0;
+    int timeout = 0;
+    int bit_period = handle->profile->bit_period;
+    lirc_t buf[BUFFERSIZE];
+
+    while (1)
+    {
+        items = handle->transport->receive(&handle->device, buf,
+                                           BUFFERSIZE, timeout);
+        switch (items)
+        {
+        case LIRC_E_DEVICE_NOT_OPEN: /* Device not open */
+            return RCX_E_DEVICE_NOT_OPEN;
+
+        case LIRC_E_DEVICE_ERROR: /* Lirc device errors */
+            return RCX_E_DEVICE_ERROR;
+
+        default:
+            ; /* Silence, or one or more items received */
+        }
+
+        /* Nothing at once: the receiver does not hear the echo */
+        if (timeout==0)
+        {
+            if (items==0)
+            {
+                position = item_count;
+            }
+            timeout = LIRC_REPLY_TIME;
+        }
+        else if (items==0)
+        {
+            return RCX_OK;
+        }
+
+        for (n=0; n<items; n++)
+        {
+            pulse = (buf[n]&PULSE_BIT) ? 1 : 0;
+            duration = buf[n]&PULSE_MASK;
+
+            if (position<item_count-1)
+            {
+                /* The echo. The items sent start with a pulse, */
+                /* and alternate.                               */
+                if ((position==0) && !pulse)
+                {
+                    continue;
+                }
+                if (pulse != ((position%2)==0))
+                {
+                    /* Disturbed, measure the reply only */
+                    position = item_count;
+                    continue;
+                }
+
+                adjust = pulse ? handle->profile->space_adjust :
+                                 handle->profile->mark_adjust;
+                bits = (list[position]-adjust+bit_period/2)/bit_period;
+                raw_calibrate_add(runs, pulse ? CALIBRATE_ECHO_SPACE :
+                                                CALIBRATE_ECHO_MARK,
+                                  duration - bits*bit_period);
+                position++;
+                continue;
+            }
+
+            /* The reply */
+            if (!reply && !pulse)
+            {
+                continue;
+            }
+            reply = 1;
+
+            bits = (duration+bit_period/2)/bit_period;
+            if ((bits>=1) && (bits<=CALIBRATE_BITS_MAX))
+            {
+                raw_calibrate_add(runs, pulse ? CALIBRATE_REPLY_SPACE :
+                                                CALIBRATE_REPLY_MARK,
+                                  duration - bits*bit_period);
+            }
+        }
+    }
+}
+
+
+/***************************************************************
+* raw_calibrate_add: Keep the deviation of a run. Runs that    *
+*              do not fit are not kept.                        *
+*                                                              *
+* Input:   kind                   CALIBRATE_xxx kind of run    *
+*          error                  Deviation, in us             *
+* In/Out:  runs                   Deviations measured          *
+* Return:  none                                                *
+***************************************************************/
+void raw_calibrate_add(rcx_runs_t* runs, int kind, int error)
+{
+    if (runs->count[kind]<CALIBRATE_RUNS)
+    {
+        runs->error[kind][runs->count[kind]++] = error;
+    }
+}
+
+
+/***************************************************************
+* raw_median:  The median of a list of values, which is sorted *
+*              in place.                                       *
+*                                                              *
+* Input:   values                 The values                   *
+*          count                  Number of values, >0         *
+* Return:  The median                                          *
+***************************************************************/
+int raw_median(int* values, int count)
+{
+    qsort(values, count, sizeof(int), raw_compare);
+    return values[count/2];
+}
+
+
+/***************************************************************
+* raw_compare: Order of two ints, for qsort().                 *
+***************************************************************/
+int raw_compare(const void* a, const void* b)
+{
+    int va = *(const int*) a;
+    int vb = *(const int*) b;
+
+    return (va<vb) ? -1 : (va>vb) ? 1 : 0;
+}
+
+
+/***************************************************************
+* raw_set_rate: Switch the link to another bit rate. The       *
+*              profile of 4800 baud is made on first use, with *
+*              the adjustments of the one of 2400 baud. What   *
+*              has been received, but not decoded, is dropped. *
+*              The caller holds the tx_lock and the rx_lock of *
+*              the handle.                                     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          rate                   RCX_BAUD_2400 or 4800        *
+* Output:                                                      *
+* Return:  RCX_OK                 Rate in use                  *
+*          RCX_E_BAD_ARGUMENT     Timing values do not allow   *
+*                                 the rate, nothing changed    *
+*          RCX_E_PROGRAM_FAILURE  Out of memory                *
+***************************************************************/
+int raw_set_rate(rcx_handle_t* handle, int rate)
+{
+    lirc_profile_t* profile = handle->base;
+
+    if (rate==RCX_BAUD_4800)
+    {
+        if (handle->fast==NULL)
+        {
+            profile = (lirc_profile_t*) malloc(sizeof(lirc_profile_t));
+            if (profile==NULL)
+            {
+                APP_ERROR("Out of memory");
+                return RCX_E_PROGRAM_FAILURE;
+            }
+            if (lirc_profile_init(profile, handle->base->bit_period/2,
+                                  handle->base->mark_adjust,
+                                  handle->base->space_adjust)!=LIRC_OK)
+            {
+                APP_ERROR("Timing values do not allow 4800 baud");
+                free(profile);
+                return RCX_E_BAD_ARGUMENT;
+            }
+            handle->fast = profile;
+        }
+        profile = handle->fast;
+    }
+
+    if (profile!=handle->profile)
+    {
+        APP_PRINT2("Bit rate %d baud", rate);
+    }
+    handle->profile = profile;
+    __atomic_store_n(&handle->rate, rate, __ATOMIC_RELAXED);
+    __atomic_store_n(&handle->device.bit_period, profile->bit_period,
+                     __ATOMIC_RELAXED);
+    raw_reset_stream(handle);
+
+    return RCX_OK;
+}
+
+
+/***************************************************************
+* raw_link_update: Follow the quality of the link after a      *
+*              command, and change the bit rate if needed, see *
+*              rcx_set_baud(). Only failures of the link count:*
+*              no reply, a corrupted one, or a collision.      *
+*              The caller holds the tx_lock and the rx_lock of *
+*              the handle.                                     *
+*                                                              *
+* Input:   handle                 Handle of the device         *
+*          result                 Result of the command        *
+* Output:                                                      *
+* Return:  none                                                *
+***************************************************************/
+void raw_link_update(rcx_handle_t* handle, int result)
+{
+    int failed;
+
+    if (handle->baud!=RCX_BAUD_AUTO)
+    {
+        return;
+    }
+
+    failed = (result==RCX_E_RECV_NOTHING) || (result==RCX_E_RECV_ERROR) ||
+             (result==RCX_E_COLLISION);
+    handle->link_errors += ((failed ? LINK_ONE : 0) - handle->link_errors)
+                           / (1<<LINK_SHIFT);
+    handle->link_commands++;
+
+    if ((handle->rate==RCX_BAUD_4800) &&
+        (handle->link_errors>LINK_FALLBACK))
+    {
+        /* A probe that failed at once waits twice as long */
+        if (handle->link_commands<=LINK_PROBE_WINDOW)
+        {
+            handle->probe_after *= 2;
+            if (handle->probe_after>LINK_PROBE_MAX)
+            {
+                handle->probe_after = LINK_PROBE_MAX;
+            }
+        }
+        else
+        {
+            handle->probe_after = LINK_PROBE_MIN;
+        }
+
+        raw_set_rate(handle, RCX_BAUD_2400);
+        raw_count(&handle->counters.rate_fallbacks, 1);
+        handle->link_commands = 0;
+    }
+    else if ((handle->rate==RCX_BAUD_2400) &&
+             (handle->link_errors<LINK_RECOVERED) &&
+             (handle->link_commands>=handle->probe_after))
+    {
+        if (raw_set_rate(handle, RCX_BAUD_4800)==RCX_OK)
+        {
+            raw_count(&handle->counters.rate_probes, 1);
+            handle->link_errors = 0;
+        }
+        handle->link_commands = 0;
+    }
+}
@@ -21,9 +21,24 @@
 * v 0.1   20 Nov 2002   Henk Dekker <henk.dekker@ordina.nl>    *
 *         Initial version                                      *
 ***************************************************************/
+#include <string.h>
+
 #include "verbose.h"
 #include "rcxcode.h"
 
+/* States of the streaming parser */
+#define PARSE_HEADER_55       0   /* Looking for 0x55             */
+#define PARSE_HEADER_FF       1   /* Header 0x55 found            */
+#define PARSE_HEADER_00       2   /* Header 0x55 0xff found       */
+#define PARSE_DATA            3   /* Expecting a data byte        */
+#define PARSE_COMPLEMENT      4   /* Expecting its complement     */
+
+/* States of the LNP parser */
+#define LNP_HEADER            0   /* Looking for 0xf0 or 0xf1     */
+#define LNP_LENGTH            1   /* Expecting the length         */
+#define LNP_DATA              2   /* Expecting a byte of buf      */
+#define LNP_CHECKSUM          3   /* Expecting the checksum       */
+
 
 
 /*************************************************************
@@ -170,3 +185,519 @@ int rcx_encode(unsigned char* databuf, int datalen,
     return (int) (prcx - &rcxbuf[0]);
 }
 
+
+
+
+/*************************************************************
+* rcx_reply_length returns the number of data bytes in the   *
+* reply of the RCX to an opcode, including the inverted      *
+* opcode at the start of the reply. The toggle bit (0x08) of *
+* the opcode is ignored.                                     *
+*                                                            *
+* Input:  opcode    Opcode sent to the RCX                   *
+*                                                            *
+* Return: > 0               Number of data bytes in reply    *
+*         0                 The RCX does not reply           *
+*         RCX_REPLY_UNKNOWN Length of the reply is not known *
+*************************************************************/
+int rcx_reply_length(unsigned char opcode)
+{
+    switch (opcode & 0xf7)
+    {
+    case 0xd2: /* Remote command */
+    case 0xf7: /* Set message */
+        return 0;
+
+    case 0x10: /* Alive */
+    case 0x13: /* Set motor power */
+    case 0x14: /* Set variable */
+    case 0x17: /* Call subroutine */
+    case 0x21: /* Set motor on/off */
+    case 0x22: /* Set time */
+    case 0x23: /* Play tone */
+    case 0x24: /* Add to variable */
+    case 0x31: /* Set transmitter range */
+    case 0x32: /* Set sensor type */
+    case 0x33: /* Set display */
+    case 0x34: /* Subtract from variable */
+    case 0x40: /* Delete all tasks */
+    case 0x42: /* Set sensor mode */
+    case 0x44: /* Divide variable */
+    case 0x50: /* Stop all tasks */
+    case 0x51: /* Play sound */
+    case 0x54: /* Multiply variable */
+    case 0x60: /* Power off */
+    case 0x61: /* Delete task */
+    case 0x64: /* Sign variable */
+    case 0x65: /* Delete firmware */
+    case 0x70: /* Delete all subroutines */
+    case 0x71: /* Start task */
+    case 0x74: /* Absolute value variable */
+    case 0x81: /* Stop task */
+    case 0x84: /* AND variable */
+    case 0x90: /* Clear message */
+    case 0x91: /* Select program */
+    case 0x94: /* OR variable */
+    case 0xb1: /* Set power down delay */
+    case 0xc1: /* Delete subroutine */
+    case 0xd1: /* Clear sensor value */
+    case 0xe1: /* Set motor direction */
+        return 1;
+
+    case 0x25: /* Begin of task */
+    case 0x35: /* Begin of subroutine */
+    case 0x45: /* Transfer data */
+    case 0x52: /* Set datalog size */
+    case 0x62: /* Datalog next */
+    case 0x75: /* Start firmware download */
+        return 2;
+
+    case 0x12: /* Get value */
+    case 0x30: /* Get battery power */
+        return 3;
+
+    case 0x15: /* Get versions */
+        return 9;
+
+    case 0xa5: /* Unlock firmware */
+        return 26;
+
+    case 0x20: /* Get memory map */
+        return 189;
+
+    default:   /* Unknown, or variable length like upload datalog */
+        return RCX_REPLY_UNKNOWN;
+    }
+}
+
+
+
+
+/*************************************************************
+* rcx_idempotent tells if running an opcode twice has the    *
+* same effect as running it once. Arithmetic on variables,   *
+* sounds, starting tasks and downloads are not.              *
+*                                                            *
+* Input:  opcode    Opcode sent to the RCX                   *
+*                                                            *
+* Return: 1         Safe to run again                        *
+*         0         Not safe, or not known                   *
+*************************************************************/
+int rcx_idempotent(unsigned char opcode)
+{
+    switch (opcode & 0xf7)
+    {
+    case 0x10: /* Alive */
+    case 0x12: /* Get value */
+    case 0x13: /* Set motor power */
+    case 0x14: /* Set variable */
+    case 0x15: /* Get versions */
+    case 0x20: /* Get memory map */
+    case 0x21: /* Set motor on/off */
+    case 0x22: /* Set time */
+    case 0x30: /* Get battery power */
+    case 0x31: /* Set transmitter range */
+    case 0x32: /* Set sensor type */
+    case 0x33: /* Set display */
+    case 0x40: /* Delete all tasks */
+    case 0x42: /* Set sensor mode */
+    case 0x50: /* Stop all tasks */
+    case 0x60: /* Power off */
+    case 0x61: /* Delete task */
+    case 0x64: /* Sign variable */
+    case 0x65: /* Delete firmware */
+    case 0x70: /* Delete all subroutines */
+    case 0x74: /* Absolute value variable */
+    case 0x81: /* Stop task */
+    case 0x90: /* Clear message */
+    case 0x91: /* Select program */
+    case 0xb1: /* Set power down delay */
+    case 0xc1: /* Delete subroutine */
+    case 0xd1: /* Clear sensor value */
+    case 0xe1: /* Set motor direction */
+        return 1;
+
+    default:   /* Counting, sounds, tasks, downloads, unknown */
+        return 0;
+    }
+}
+
+
+
+
+/*************************************************************
+* rcx_parser_init prepares a parser for a new stream of RCX  *
+* bytes. The parser holds all state, and needs no other      *
+* memory, so streams can be of any length.                   *
+*                                                            *
+* Output: parser    The parser to initialize                 *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_parser_init(rcx_parser_t* parser)
+{
+    parser->state = PARSE_HEADER_55;
+    parser->count = 0;
+    parser->expect = 0;
+    parser->candidate = 0;
+    parser->sum = 0;
+    parser->last = 0;
+    parser->error = RCX_PARSE_OK;
+}
+
+
+
+/*************************************************************
+* rcx_parser_push feeds the next received byte to the        *
+* parser. Bytes before a 55 ff 00 header are skipped, and    *
+* after a broken packet the parser looks for the next        *
+* header.                                                    *
+*                                                            *
+* The end of a packet is found at the checksum. If the       *
+* reply length of the opcode is known (see                   *
+* rcx_reply_length()), the packet is complete as soon as its *
+* checksum arrives. Otherwise a checksum might just as well  *
+* be data, and the packet ends at the first byte that does   *
+* not continue it, like the header of the next packet.       *
+*                                                            *
+* Input:  byte      The received byte                        *
+*                                                            *
+* In/Out: parser    Parser state, see rcx_parser_init()      *
+*                                                            *
+* Return: > 0           A packet is complete. The data bytes *
+*                       are in parser->buf, until the next   *
+*                       call. The value is the number of     *
+*                       data bytes.                          *
+*         0             No packet complete yet               *
+*         RCX_E_NO_RCX  A packet was broken, and skipped     *
+*************************************************************/
+int rcx_parser_push(rcx_parser_t* parser, unsigned char byte)
+{
+    int result;
+    int length;
+
+    switch (parser->state)
+    {
+    case PARSE_HEADER_55:
+        if (byte==0x55)
+        {
+            parser->state = PARSE_HEADER_FF;
+        }
+        return 0;
+
+    case PARSE_HEADER_FF:
+        if (byte!=0x55)
+        {
+            parser->state = (byte==0xff) ? PARSE_HEADER_00 : PARSE_HEADER_55;
+        }
+        return 0;
+
+    case PARSE_HEADER_00:
+        if (byte==0x00)
+        {
+            parser->state = PARSE_DATA;
+            parser->count = 0;
+            parser->expect = 0;
+            parser->candidate = 0;
+            parser->sum = 0;
+        }
+        else
+        {
+            parser->state = (byte==0x55) ? PARSE_HEADER_FF : PARSE_HEADER_55;
+        }
+        return 0;
+
+    case PARSE_DATA:
+        parser->last = byte;
+        parser->state = PARSE_COMPLEMENT;
+        return 0;
+
+    default: /* PARSE_COMPLEMENT */
+        break;
+    }
+
+    /* The byte does not continue the packet. The packet ends at */
+    /* the last checksum, if any. Look for the next header, the  */
+    /* last two bytes can be the start of it.                    */
+    if (byte != (~parser->last&0xff))
+    {
+        result = (parser->candidate>0) ? parser->candidate : RCX_E_NO_RCX;
+        if (result<0)
+        {
+            /* Past the known length, the checksum did not match */
+            APP_ERROR("RCX packet data value complement not correct");
+            parser->error = ((parser->expect>0) &&
+                             (parser->count>=parser->expect)) ?
+                            RCX_PARSE_CHECKSUM : RCX_PARSE_COMPLEMENT;
+        }
+
+        if ((parser->last==0x55) && (byte==0xff))
+        {
+            parser->state = PARSE_HEADER_00;
+        }
+        else
+        {
+            parser->state = (byte==0x55) ? PARSE_HEADER_FF : PARSE_HEADER_55;
+        }
+        return result;
+    }
+
+    /* A correct checksum ends the packet, if its length is    */
+    /* known. Otherwise remember it, the checksum can be data. */
+    /* Short of a known length, it is data for sure.           */
+    if ((parser->count>0) && (parser->last==parser->sum))
+    {
+        if (parser->count==parser->expect)
+        {
+            parser->state = PARSE_HEADER_55;
+            return parser->count;
+        }
+        if (parser->count>parser->expect)
+        {
+            parser->candidate = parser->count;
+        }
+    }
+
+    if (parser->count==RCX_PARSER_SIZE)
+    {
+        APP_ERROR("RCX number of data bytes exceed buffer size");
+        parser->state = PARSE_HEADER_55;
+        parser->error = RCX_PARSE_CHECKSUM;
+        return (parser->candidate>0) ? parser->candidate : RCX_E_NO_RCX;
+    }
+
+    /* Add the data byte. The first one is the opcode, which */
+    /* tells the length of a reply.                          */
+    parser->buf[parser->count++] = parser->last;
+    parser->sum += parser->last;
+    if (parser->count==1)
+    {
+        length = rcx_reply_length(~parser->last&0xff);
+        parser->expect = (length>0) ? length : 0;
+    }
+    parser->state = PARSE_DATA;
+
+    return 0;
+}
+
+
+
+/*************************************************************
+* rcx_parser_flush tells the parser that the stream has      *
+* ended, for example when the line became silent. A packet   *
+* of unknown length completes here, and the parser looks for *
+* a new header afterwards.                                   *
+*                                                            *
+* In/Out: parser    Parser state, see rcx_parser_init()      *
+*                                                            *
+* Return: See rcx_parser_push()                              *
+*************************************************************/
+int rcx_parser_flush(rcx_parser_t* parser)
+{
+    int result = 0;
+
+    if ((parser->state==PARSE_DATA) || (parser->state==PARSE_COMPLEMENT))
+    {
+        result = (parser->candidate>0) ? parser->candidate : RCX_E_NO_RCX;
+        if (result<0)
+        {
+            APP_ERROR("RCX packet not complete");
+            parser->error = RCX_PARSE_CHECKSUM;
+        }
+    }
+    parser->state = PARSE_HEADER_55;
+
+    return result;
+}
+
+
+
+/*************************************************************
+* rcx_lnp_encode encodes a LNP packet.                       *
+*                                                            *
+* Return: >= 0          Ok, number of bytes in lnp buffer    *
+*         RCX_E_BUFFER  Too many data bytes, or buffer size  *
+*                       too small                            *
+*************************************************************/
+int rcx_lnp_encode(int dest, int src, unsigned char* databuf, int datalen,
+                   unsigned char* lnpbuf, int lnpsize)
+{
+    int n;
+    int length = (dest<0) ? datalen : datalen+2;
+    unsigned char sum = 0xff;
+    unsigned char* plnp = &lnpbuf[0];
+
+    if ((length>RCX_LNP_SIZE) || (length+3>lnpsize))
+    {
+        APP_ERROR("LNP packet exceeds buffer size");
+        return RCX_E_BUFFER;
+    }
+
+    *plnp++ = (dest<0) ? RCX_LNP_INTEGRITY : RCX_LNP_ADDRESSING;
+    *plnp++ = (unsigned char) length;
+    if (dest>=0)
+    {
+        *plnp++ = (unsigned char) dest;
+        *plnp++ = (unsigned char) src;
+    }
+    memcpy(plnp, databuf, datalen);
+    plnp += datalen;
+
+    for (n=0; n<length+2; n++)
+    {
+        sum += lnpbuf[n];
+    }
+    *plnp++ = sum;
+
+    return (int) (plnp - &lnpbuf[0]);
+}
+
+
+
+/*************************************************************
+* rcx_lnp_decode decodes a LNP packet to a data byte buffer. *
+*                                                            *
+* Return: >= 0            Decoding ok, number of data bytes  *
+*         RCX_E_NO_RCX    Error, input is not a LNP packet   *
+*         RCX_E_BUFFER    Error, buffer size too small       *
+*************************************************************/
+int rcx_lnp_decode(unsigned char* lnpbuf, int lnplen,
+                   unsigned char* databuf, int datasize,
+                   int* dest, int* src)
+{
+    int n;
+    int result = 0;
+    int skip = 0;
+    rcx_lnp_parser_t parser;
+
+    rcx_lnp_parser_init(&parser);
+    for (n=0; (n<lnplen) && (result==0); n++)
+    {
+        result = rcx_lnp_parser_push(&parser, lnpbuf[n]);
+    }
+    if (result<=0)
+    {
+        APP_ERROR("LNP packet not correct");
+        return RCX_E_NO_RCX;
+    }
+
+    *dest = -1;
+    *src = -1;
+    if (result==RCX_LNP_ADDRESSING)
+    {
+        *dest = parser.buf[0];
+        *src = parser.buf[1];
+        skip = 2;
+    }
+
+    if (parser.length-skip>datasize)
+    {
+        APP_ERROR("LNP number of data bytes exceed buffer size");
+        return RCX_E_BUFFER;
+    }
+    memcpy(databuf, &parser.buf[skip], parser.length-skip);
+
+    return parser.length-skip;
+}
+
+
+
+/*************************************************************
+* rcx_lnp_parser_init prepares a parser for a new stream of  *
+* LNP bytes.                                                 *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_lnp_parser_init(rcx_lnp_parser_t* parser)
+{
+    parser->state = LNP_HEADER;
+    parser->header = 0;
+    parser->length = 0;
+    parser->count = 0;
+    parser->sum = 0;
+    parser->error = RCX_PARSE_OK;
+}
+
+
+
+/*************************************************************
+* rcx_lnp_parser_push feeds the next received byte to the    *
+* parser.                                                    *
+*                                                            *
+* Return: > 0           A packet is complete, its header     *
+*         0             No packet complete yet               *
+*         RCX_E_NO_RCX  A packet was broken, and skipped     *
+*************************************************************/
+int rcx_lnp_parser_push(rcx_lnp_parser_t* parser, unsigned char byte)
+{
+    switch (parser->state)
+    {
+    case LNP_HEADER:
+        if ((byte==RCX_LNP_INTEGRITY) || (byte==RCX_LNP_ADDRESSING))
+        {
+            parser->header = byte;
+            parser->sum = 0xff + byte;
+            parser->state = LNP_LENGTH;
+        }
+        return 0;
+
+    case LNP_LENGTH:
+        /* An addressing packet holds two addresses at least */
+        if ((parser->header==RCX_LNP_ADDRESSING) && (byte<2))
+        {
+            parser->state = LNP_HEADER;
+            parser->error = RCX_PARSE_CHECKSUM;
+            return RCX_E_NO_RCX;
+        }
+        parser->length = byte;
+        parser->count = 0;
+        parser->sum += byte;
+        parser->state = (byte>0) ? LNP_DATA : LNP_CHECKSUM;
+        return 0;
+
+    case LNP_DATA:
+        parser->buf[parser->count++] = byte;
+        parser->sum += byte;
+        if (parser->count==parser->length)
+        {
+            parser->state = LNP_CHECKSUM;
+        }
+        return 0;
+
+    default: /* LNP_CHECKSUM */
+        break;
+    }
+
+    parser->state = LNP_HEADER;
+    if (byte!=parser->sum)
+    {
+        APP_ERROR("LNP packet checksum not correct");
+        parser->error = RCX_PARSE_CHECKSUM;
+        return RCX_E_NO_RCX;
+    }
+
+    return parser->header;
+}
+
+
+
+/*************************************************************
+* rcx_lnp_parser_flush tells the parser that the stream has  *
+* ended.                                                     *
+*                                                            *
+* Return: 0, or RCX_E_NO_RCX if a packet was broken off      *
+*************************************************************/
+int rcx_lnp_parser_flush(rcx_lnp_parser_t* parser)
+{
+    int result = 0;
+
+    if (parser->state!=LNP_HEADER)
+    {
+        APP_ERROR("LNP packet not complete");
+        parser->error = RCX_PARSE_CHECKSUM;
+        result = RCX_E_NO_RCX;
+    }
+    parser->state = LNP_HEADER;
+
+    return result;
+}
@@ -0,0 +1,364 @@
+/***************************************************************
+*                                                              *
+* rcxfirm.c                                                    *
+*                                                              *
+* Description:                                                 *
+* Firmware images from S-record files, see rcxfirm.h.          *
+*                                                              *
+* Debug flags:                                                 *
+* APP_PRINT_DEBUG   Show debug data and errors                 *
+* APP_PRINT_ERROR   Show errors                                *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "verbose.h"
+#include "rcx.h"
+#include "rcxfirm.h"
+#include "lirc.h"
+#include "lirccode.h"
+#include "lircfile.h"
+
+/* Bytes of a transfer beside its data: the packet header,    */
+/* opcode, sequence, length and checksum, each with its       */
+/* complement, the 2 byte reply packet, and the turnarounds   */
+#define FIRM_PACKET_BYTES     (5+2*6)
+#define FIRM_REPLY_BYTES      (5+2*2)
+#define FIRM_GAP_BYTES        (2)
+
+/* Bytes sent in LIRC_REPLY_TIME at 2400 baud, 11 bits each */
+#define FIRM_TIMEOUT_BYTES    (LIRC_REPLY_TIME*1000/(11*LIRC_BIT_PERIOD_2400))
+
+/* Prototypes */
+static int firm_hex(const char* text, int digits, int* value);
+static int firm_record(const char* line, int length,
+                       rcx_firmware_t* firmware);
+
+
+
+/*************************************************************
+* rcx_firmware_parse reads an image from S-records.          *
+*                                                            *
+* Return: RCX_OK, or RCX_E_FIRMWARE_FILE                     *
+*************************************************************/
+int rcx_firmware_parse(const char* text, int size,
+                       rcx_firmware_t* firmware)
+{
+    int length;
+    int line = 1;
+    const char* end;
+    const char* stop = text+size;
+
+    memset(firmware->image, 0, sizeof(firmware->image));
+    firmware->start = RCX_FIRMWARE_START;
+    firmware->length = 0;
+
+    while (text<stop)
+    {
+        end = memchr(text, '\n', stop-text);
+        if (end==NULL)
+        {
+            end = stop;
+        }
+
+        length = end-text;
+        if ((length>0) && (text[length-1]=='\r'))
+        {
+            length--;
+        }
+        if ((length>0) && (firm_record(text, length, firmware)!=RCX_OK))
+        {
+            APP_PRINT2("Bad S-record in line %d", line);
+            APP_ERROR("Bad S-record");
+            return RCX_E_FIRMWARE_FILE;
+        }
+
+        text = end+1;
+        line++;
+    }
+
+    if (firmware->length==0)
+    {
+        APP_ERROR("No data in S-records");
+        return RCX_E_FIRMWARE_FILE;
+    }
+
+    APP_PRINT2("Firmware bytes: %d", firmware->length);
+    return RCX_OK;
+}
+
+
+
+/*************************************************************
+* rcx_firmware_load reads an image from an S-record file.    *
+*                                                            *
+* Return: RCX_OK, or RCX_E_FIRMWARE_FILE                     *
+*************************************************************/
+int rcx_firmware_load(const char* path, rcx_firmware_t* firmware)
+{
+    int result;
+    long size;
+    char* text;
+    FILE* file;
+
+    file = fopen(path, "rb");
+    if (file==NULL)
+    {
+        APP_ERROR("Cannot open firmware file");
+        return RCX_E_FIRMWARE_FILE;
+    }
+
+    /* Hex digits take over twice the room of the image */
+    text = (char*) malloc(4*RCX_FIRMWARE_SIZE);
+    if (text==NULL)
+    {
+        fclose(file);
+        return RCX_E_FIRMWARE_FILE;
+    }
+
+    size = fread(text, 1, 4*RCX_FIRMWARE_SIZE, file);
+    if (ferror(file) || !feof(file))
+    {
+        APP_ERROR("Cannot read firmware file");
+        result = RCX_E_FIRMWARE_FILE;
+    }
+    else
+    {
+        result = rcx_firmware_parse(text, size, firmware);
+    }
+
+    free(text);
+    fclose(file);
+    return result;
+}
+
+
+
+/*************************************************************
+* rcx_firmware_checksum returns the checksum the RCX checks  *
+* the downloaded image with.                                 *
+*                                                            *
+* Return: The checksum                                       *
+*************************************************************/
+int rcx_firmware_checksum(const rcx_firmware_t* firmware)
+{
+    int n;
+    int sum = 0;
+    int length = firmware->length;
+
+    if (length>RCX_FIRMWARE_SUM_END-RCX_FIRMWARE_START)
+    {
+        length = RCX_FIRMWARE_SUM_END-RCX_FIRMWARE_START;
+    }
+
+    for (n=0; n<length; n++)
+    {
+        sum += firmware->image[n];
+    }
+
+    return sum&0xffff;
+}
+
+
+
+/*************************************************************
+* rcx_firmware_block_size chooses the data bytes per         *
+* transfer that make a download the shortest.                *
+*                                                            *
+* A transfer of n bytes takes k = 2n+FIRM_PACKET_BYTES+      *
+* FIRM_REPLY_BYTES byte times on the air. It gets through    *
+* with p = (1-error)^k; when it does not, the reply timeout  *
+* passes before it is sent again. So a block costs           *
+* k + (1/p-1)*(k+timeout) on average, and the size with the  *
+* least cost per data byte is taken.                         *
+*                                                            *
+* Return: Block size                                         *
+*************************************************************/
+int rcx_firmware_block_size(int length, int error_ppm)
+{
+    int n;
+    int blocks;
+    int best = RCX_FIRMWARE_BLOCK_MIN;
+    double bytes;
+    double cost;
+    double best_cost = -1.0;
+    double good = 1.0-error_ppm/1000000.0;
+    double pass = 1.0;
+
+    if (good<=0.0)
+    {
+        return RCX_FIRMWARE_BLOCK_MIN;
+    }
+
+    for (n=0; n<2*RCX_FIRMWARE_BLOCK_MIN+FIRM_PACKET_BYTES+FIRM_REPLY_BYTES;
+         n++)
+    {
+        pass *= good;
+    }
+
+    for (n=RCX_FIRMWARE_BLOCK_MIN; n<=RCX_FIRMWARE_BLOCK_MAX; n++)
+    {
+        bytes = 2*n+FIRM_PACKET_BYTES+FIRM_REPLY_BYTES+FIRM_GAP_BYTES;
+        if (pass>0.0)
+        {
+            cost = (bytes+(1.0/pass-1.0)*(bytes+FIRM_TIMEOUT_BYTES))/n;
+            if ((best_cost<0.0) || (cost<best_cost))
+            {
+                best = n;
+                best_cost = cost;
+            }
+        }
+        pass *= good*good;
+    }
+
+    /* Split the image evenly over as many blocks */
+    if (length>0)
+    {
+        blocks = (length+best-1)/best;
+        best = (length+blocks-1)/blocks;
+        if (best<RCX_FIRMWARE_BLOCK_MIN)
+        {
+            best = RCX_FIRMWARE_BLOCK_MIN;
+        }
+    }
+
+    APP_PRINT2("Firmware block size: %d", best);
+    return best;
+}
+
+
+
+/*************************************************************
+* firm_hex reads a hex number.                               *
+*                                                            *
+* Return: 1 if read, 0 if not hex digits                     *
+*************************************************************/
+static int firm_hex(const char* text, int digits, int* value)
+{
+    int n;
+    int digit;
+
+    *value = 0;
+    for (n=0; n<digits; n++)
+    {
+        if ((text[n]>='0') && (text[n]<='9'))
+        {
+            digit = text[n]-'0';
+        }
+        else if ((text[n]>='a') && (text[n]<='f'))
+        {
+            digit = text[n]-'a'+10;
+        }
+        else if ((text[n]>='A') && (text[n]<='F'))
+        {
+            digit = text[n]-'A'+10;
+        }
+        else
+        {
+            return 0;
+        }
+        *value = (*value<<4) | digit;
+    }
+
+    return 1;
+}
+
+
+
+/*************************************************************
+* firm_record takes an S-record into the image.              *
+*                                                            *
+* Return: RCX_OK, or RCX_E_FIRMWARE_FILE                     *
+*************************************************************/
+static int firm_record(const char* line, int length,
+                       rcx_firmware_t* firmware)
+{
+    int n;
+    int type;
+    int count;
+    int value;
+    int address;
+    int address_bytes;
+    int sum;
+    int end;
+
+    if ((length<4) || (line[0]!='S') || (line[1]<'0') || (line[1]>'9') ||
+        !firm_hex(&line[2], 2, &count) || (length!=4+2*count))
+    {
+        return RCX_E_FIRMWARE_FILE;
+    }
+
+    /* Count, address, data and checksum add up to 0xff */
+    sum = count;
+    for (n=0; n<count; n++)
+    {
+        if (!firm_hex(&line[4+2*n], 2, &value))
+        {
+            return RCX_E_FIRMWARE_FILE;
+        }
+        sum += value;
+    }
+    if ((sum&0xff)!=0xff)
+    {
+        return RCX_E_FIRMWARE_FILE;
+    }
+
+    type = line[1]-'0';
+    switch (type)
+    {
+    case 1: case 9:
+        address_bytes = 2;
+        break;
+    case 2: case 8:
+        address_bytes = 3;
+        break;
+    case 3: case 7:
+        address_bytes = 4;
+        break;
+    case 0: case 5: case 6:
+        return RCX_OK;
+    default:
+        return RCX_E_FIRMWARE_FILE;
+    }
+
+    if (count<address_bytes+1)
+    {
+        return RCX_E_FIRMWARE_FILE;
+    }
+    firm_hex(&line[4], 2*address_bytes, &address);
+
+    /* Start address */
+    if (type>=7)
+    {
+        firmware->start = address;
+        return RCX_OK;
+    }
+
+    /* Data */
+    count -= address_bytes+1;
+    end = address+count-RCX_FIRMWARE_START;
+    if ((address<RCX_FIRMWARE_START) || (end>RCX_FIRMWARE_SIZE))
+    {
+        return RCX_E_FIRMWARE_FILE;
+    }
+
+    for (n=0; n<count; n++)
+    {
+        firm_hex(&line[4+2*(address_bytes+n)], 2, &value);
+        firmware->image[address-RCX_FIRMWARE_START+n] = (unsigned char) value;
+    }
+    if (end>firmware->length)
+    {
+        firmware->length = end;
+    }
+
+    return RCX_OK;
+}
@@ -0,0 +1,1112 @@
+/***************************************************************
+*                                                              *
+* rcxird.c                                                     *
+*                                                              *
+* Description:                                                 *
+* Server that shares a device among local clients, and the     *
+* client side of its socket, see rcxird.h.                     *
+*                                                              *
+* The thread of rcx_ird_server_run() only moves frames: it     *
+* accepts clients, reads their requests into a queue per       *
+* client, and answers what needs no device. A device thread    *
+* takes the queues in turn, one request at a time, and sends   *
+* the replies. Between requests it listens for packets to the  *
+* subscribers, RCX_IRD_LISTEN_TIME ms at a time.               *
+*                                                              *
+* Sockets of clients are written without blocking. A client    *
+* that does not read its socket is dropped, or, for a packet   *
+* nobody asked for, misses it.                                 *
+*                                                              *
+* Debug flags:                                                 *
+* APP_PRINT_DEBUG   Show debug data and errors                 *
+* APP_PRINT_ERROR   Show errors                                *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "verbose.h"
+#include "rcx.h"
+#include "rcxird.h"
+
+/* Largest frame */
+#define IRD_FRAME             (RCX_IRD_HEADER+RCX_IRD_PAYLOAD)
+
+/* A request of a client, waiting for the device */
+typedef struct ird_request
+{
+    int           type;         /* RCX_IRD_COMMAND or _SEND       */
+    int           tag;
+    int           length;       /* Bytes in data                  */
+    unsigned char data[RCX_IRD_PAYLOAD];
+} ird_request_t;
+
+/* A client of the server. The server thread reads the socket, */
+/* and frees the slot; while the device thread runs a request  */
+/* of the client, it frees the slot after it instead.          */
+typedef struct ird_slot
+{
+    int           fd;           /* Socket, -1 if the slot is free */
+    int           busy;         /* Request running on the device  */
+    int           closing;      /* Socket ended while busy        */
+    int           subscribed;   /* Gets the packets nobody asked  */
+    int           head;         /* First request in queue         */
+    int           count;        /* Requests in queue              */
+    ird_request_t queue[RCX_IRD_QUEUE];
+    int           in_len;       /* Bytes of a frame read so far   */
+    unsigned char in[IRD_FRAME];
+    pthread_mutex_t write_lock; /* One frame at a time            */
+} ird_slot_t;
+
+struct rcx_ird_server
+{
+    rcx_handle_t*   handle;
+    int             fd;         /* Listening socket               */
+    int             wake[2];    /* Pipe that ends the server loop */
+    int             stop;
+    int             next;       /* Slot served last               */
+    int             subscribers;
+    char            path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+    pthread_mutex_t lock;       /* Queues, slots and subscribers  */
+    pthread_cond_t  cond;       /* A request came, or stop        */
+    pthread_t       device;
+    ird_slot_t      slots[RCX_IRD_CLIENTS];
+
+    /* Packets a command skipped, for the subscribers after it; */
+    /* only the device thread uses them                          */
+    int             skipped;
+    int             skipped_len[RCX_IRD_STASH];
+    unsigned char   skipped_buf[RCX_IRD_STASH][RCX_IRD_PAYLOAD];
+};
+
+struct rcx_ird_client
+{
+    int           fd;
+    int           tag;          /* Of the last request            */
+    int           in_len;       /* Bytes of a frame read so far   */
+    unsigned char in[IRD_FRAME];
+    int           stash_head;   /* Oldest packet kept             */
+    int           stash_count;  /* Packets kept                   */
+    int           stash_len[RCX_IRD_STASH];
+    unsigned char stash[RCX_IRD_STASH][RCX_IRD_PAYLOAD];
+};
+
+/* Prototypes */
+static int ird_address(const char* path, struct sockaddr_un* address);
+static void* ird_device(void* arg);
+static ird_slot_t* ird_next(rcx_ird_server_t* server);
+static void ird_run(rcx_ird_server_t* server, ird_slot_t* slot,
+                    ird_request_t* request);
+static void ird_fan_out(rcx_ird_server_t* server, unsigned char* buf,
+                        int len);
+static void ird_unsolicited(void* user, const unsigned char* data,
+                            int length);
+static void ird_accept(rcx_ird_server_t* server);
+static void ird_read(rcx_ird_server_t* server, ird_slot_t* slot);
+static void ird_request(rcx_ird_server_t* server, ird_slot_t* slot,
+                        int type, int tag, unsigned char* data, int length);
+static void ird_drop(rcx_ird_server_t* server, ird_slot_t* slot);
+static int ird_write(ird_slot_t* slot, int type, int tag, int result,
+                     const unsigned char* data, int length);
+static int ird_frame(rcx_ird_client_t* client, int timeout, int* type,
+                     int* tag, unsigned char* payload, int* length);
+static int ird_call(rcx_ird_client_t* client, int type,
+                    unsigned char* data, int length,
+                    unsigned char* buf, int buf_size, int* buf_len);
+static void ird_stash(rcx_ird_client_t* client, unsigned char* packet,
+                      int length);
+
+
+
+/*************************************************************
+* rcx_ird_server_create binds the socket of a server.        *
+*                                                            *
+* Return: RCX_OK, or RCX_E_xxx                               *
+*************************************************************/
+int rcx_ird_server_create(rcx_handle_t* handle, const char* path,
+                          rcx_ird_server_t** server)
+{
+    int n;
+    int probe;
+    struct stat status;
+    struct sockaddr_un address;
+    rcx_ird_server_t* ird;
+
+    if (!ird_address(path, &address))
+    {
+        APP_ERROR("Socket path too long");
+        return RCX_E_BAD_ARGUMENT;
+    }
+
+    ird = (rcx_ird_server_t*) calloc(1, sizeof(rcx_ird_server_t));
+    if (ird==NULL)
+    {
+        return RCX_E_PROGRAM_FAILURE;
+    }
+
+    ird->handle = handle;
+    ird->next = RCX_IRD_CLIENTS-1;
+    strcpy(ird->path, address.sun_path);
+    pthread_mutex_init(&ird->lock, NULL);
+    pthread_cond_init(&ird->cond, NULL);
+    for (n=0; n<RCX_IRD_CLIENTS; n++)
+    {
+        ird->slots[n].fd = -1;
+        pthread_mutex_init(&ird->slots[n].write_lock, NULL);
+    }
+
+    ird->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (ird->fd<0)
+    {
+        APP_ERROR("Cannot create socket");
+        free(ird);
+        return RCX_E_DEVICE_ERROR;
+    }
+
+    /* A server that ended without removing it leaves the file, */
+    /* which refuses connections; a running server answers      */
+    probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((probe>=0) &&
+        (connect(probe, (struct sockaddr*) &address, sizeof(address))==0))
+    {
+        APP_ERROR("Another server runs on the socket");
+        close(probe);
+        close(ird->fd);
+        free(ird);
+        return RCX_E_DEVICE_IS_OPEN;
+    }
+    if ((probe>=0) && (errno==ECONNREFUSED) &&
+        (lstat(address.sun_path, &status)==0) && S_ISSOCK(status.st_mode))
+    {
+        unlink(address.sun_path);
+    }
+    if (probe>=0)
+    {
+        close(probe);
+    }
+
+    if (bind(ird->fd, (struct sockaddr*) &address, sizeof(address))!=0)
+    {
+        APP_ERROR("Cannot bind socket");
+        close(ird->fd);
+        free(ird);
+        return RCX_E_DEVICE_ERROR;
+    }
+    if ((listen(ird->fd, RCX_IRD_CLIENTS)!=0) || (pipe(ird->wake)!=0))
+    {
+        APP_ERROR("Cannot listen on socket");
+        close(ird->fd);
+        unlink(address.sun_path);
+        free(ird);
+        return RCX_E_DEVICE_ERROR;
+    }
+    fcntl(ird->wake[1], F_SETFL, O_NONBLOCK);
+
+    APP_PRINT("Server socket bound");
+    *server = ird;
+    return RCX_OK;
+}
+
+
+
+/*************************************************************
+* rcx_ird_server_run serves the clients until stopped.       *
+*                                                            *
+* Return: RCX_OK, or RCX_E_xxx                               *
+*************************************************************/
+int rcx_ird_server_run(rcx_ird_server_t* server)
+{
+    int n;
+    int count;
+    int result = RCX_OK;
+    char drain[16];
+    int index[RCX_IRD_CLIENTS];
+    struct pollfd fds[RCX_IRD_CLIENTS+2];
+
+    rcx_set_unsolicited_dev(server->handle, ird_unsolicited, server);
+    if (pthread_create(&server->device, NULL, ird_device, server)!=0)
+    {
+        rcx_set_unsolicited_dev(server->handle, NULL, NULL);
+        return RCX_E_PROGRAM_FAILURE;
+    }
+
+    while (!__atomic_load_n(&server->stop, __ATOMIC_ACQUIRE))
+    {
+        fds[0].fd = server->wake[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = server->fd;
+        fds[1].events = POLLIN;
+        count = 2;
+
+        /* The slots only change in this thread, or when closing */
+        pthread_mutex_lock(&server->lock);
+        for (n=0; n<RCX_IRD_CLIENTS; n++)
+        {
+            if ((server->slots[n].fd>=0) && !server->slots[n].closing)
+            {
+                index[count-2] = n;
+                fds[count].fd = server->slots[n].fd;
+                fds[count].events = POLLIN;
+                count++;
+            }
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        if (poll(fds, count, -1)<0)
+        {
+            if (errno==EINTR)
+            {
+                continue;
+            }
+            APP_ERROR("Poll of sockets failed");
+            result = RCX_E_DEVICE_ERROR;
+            break;
+        }
+
+        if (fds[0].revents)
+        {
+            read(server->wake[0], drain, sizeof(drain));
+        }
+        if (fds[1].revents)
+        {
+            ird_accept(server);
+        }
+        for (n=2; n<count; n++)
+        {
+            if (fds[n].revents)
+            {
+                ird_read(server, &server->slots[index[n-2]]);
+            }
+        }
+    }
+
+    pthread_mutex_lock(&server->lock);
+    server->stop = 1;
+    pthread_cond_broadcast(&server->cond);
+    pthread_mutex_unlock(&server->lock);
+    pthread_join(server->device, NULL);
+    rcx_set_unsolicited_dev(server->handle, NULL, NULL);
+
+    return result;
+}
+
+
+
+/*************************************************************
+* rcx_ird_server_stop makes rcx_ird_server_run() return.     *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_ird_server_stop(rcx_ird_server_t* server)
+{
+    __atomic_store_n(&server->stop, 1, __ATOMIC_RELEASE);
+
+    /* Only calls that may be made from a signal handler */
+    write(server->wake[1], "", 1);
+}
+
+
+
+/*************************************************************
+* rcx_ird_server_destroy closes the clients and the socket.  *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_ird_server_destroy(rcx_ird_server_t* server)
+{
+    int n;
+
+    for (n=0; n<RCX_IRD_CLIENTS; n++)
+    {
+        if (server->slots[n].fd>=0)
+        {
+            close(server->slots[n].fd);
+        }
+        pthread_mutex_destroy(&server->slots[n].write_lock);
+    }
+
+    close(server->fd);
+    close(server->wake[0]);
+    close(server->wake[1]);
+    unlink(server->path);
+
+    pthread_cond_destroy(&server->cond);
+    pthread_mutex_destroy(&server->lock);
+    free(server);
+}
+
+
+
+/*************************************************************
+* rcx_ird_connect connects to a server.                      *
+*                                                            *
+* Return: RCX_OK, or RCX_E_xxx                               *
+*************************************************************/
+int rcx_ird_connect(const char* path, rcx_ird_client_t** client)
+{
+    struct sockaddr_un address;
+    rcx_ird_client_t* ird;
+
+    if (!ird_address(path, &address))
+    {
+        return RCX_E_DEVICE_NOT_FOUND;
+    }
+
+    ird = (rcx_ird_client_t*) calloc(1, sizeof(rcx_ird_client_t));
+    if (ird==NULL)
+    {
+        return RCX_E_PROGRAM_FAILURE;
+    }
+
+    ird->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((ird->fd<0) ||
+        (connect(ird->fd, (struct sockaddr*) &address, sizeof(address))!=0))
+    {
+        APP_ERROR("Cannot connect to server");
+        if (ird->fd>=0)
+        {
+            close(ird->fd);
+        }
+        free(ird);
+        return RCX_E_DEVICE_NOT_FOUND;
+    }
+
+    *client = ird;
+    return RCX_OK;
+}
+
+
+
+/*************************************************************
+* rcx_ird_command runs a command on the device of the        *
+* server.                                                    *
+*                                                            *
+* Return: See rcx_command()                                  *
+*************************************************************/
+int rcx_ird_command(rcx_ird_client_t* client, unsigned char* buf,
+                    int buf_size, int* buf_len)
+{
+    return ird_call(client, RCX_IRD_COMMAND, buf, *buf_len,
+                    buf, buf_size, buf_len);
+}
+
+
+
+/*************************************************************
+* rcx_ird_send sends a packet on the device of the server.   *
+*                                                            *
+* Return: See rcx_send()                                     *
+*************************************************************/
+int rcx_ird_send(rcx_ird_client_t* client, unsigned char* buf,
+                 int buf_len)
+{
+    return ird_call(client, RCX_IRD_SEND, buf, buf_len, NULL, 0, NULL);
+}
+
+
+
+/*************************************************************
+* rcx_ird_subscribe selects whether the client gets the      *
+* packets nobody asked for.                                  *
+*                                                            *
+* Return: RCX_OK, or RCX_E_DEVICE_ERROR                      *
+*************************************************************/
+int rcx_ird_subscribe(rcx_ird_client_t* client, int on)
+{
+    unsigned char flag = (on) ? 1 : 0;
+
+    return ird_call(client, RCX_IRD_SUBSCRIBE, &flag, 1, NULL, 0, NULL);
+}
+
+
+
+/*************************************************************
+* rcx_ird_receive takes the next packet nobody asked for.    *
+*                                                            *
+* Return: RCX_OK, RCX_E_RECV_NOTHING or RCX_E_DEVICE_ERROR   *
+*************************************************************/
+int rcx_ird_receive(rcx_ird_client_t* client, unsigned char* buf,
+                    int buf_size, int* buf_len, int timeout)
+{
+    int type;
+    int tag;
+    int length;
+    int result;
+    unsigned char payload[RCX_IRD_PAYLOAD];
+
+    while (client->stash_count==0)
+    {
+        result = ird_frame(client, timeout, &type, &tag, payload, &length);
+        if (result!=RCX_OK)
+        {
+            return result;
+        }
+        if (type==RCX_IRD_PACKET)
+        {
+            ird_stash(client, payload, length);
+        }
+    }
+
+    length = client->stash_len[client->stash_head];
+    if (length>buf_size)
+    {
+        length = buf_size;
+    }
+    memcpy(buf, client->stash[client->stash_head], length);
+    *buf_len = length;
+
+    client->stash_head = (client->stash_head+1) % RCX_IRD_STASH;
+    client->stash_count--;
+    return RCX_OK;
+}
+
+
+
+/*************************************************************
+* rcx_ird_close closes a connection.                         *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_ird_close(rcx_ird_client_t* client)
+{
+    close(client->fd);
+    free(client);
+}
+
+
+
+/*************************************************************
+* ird_address makes the address of a socket.                 *
+*                                                            *
+* Return: 1 if done, 0 if the path is too long               *
+*************************************************************/
+static int ird_address(const char* path, struct sockaddr_un* address)
+{
+    if (path==NULL)
+    {
+        path = getenv(RCX_IRD_ENV);
+        if ((path==NULL) || (path[0]=='\0'))
+        {
+            path = RCX_IRD_SOCKET;
+        }
+    }
+
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    return snprintf(address->sun_path, sizeof(address->sun_path),
+                    "%s", path)<(int) sizeof(address->sun_path);
+}
+
+
+
+/*************************************************************
+* ird_device is the device thread: it runs the requests of   *
+* the clients in turn, and listens for packets between them. *
+*                                                            *
+* Return: NULL                                               *
+*************************************************************/
+static void* ird_device(void* arg)
+{
+    int n;
+    int len;
+    int result;
+    ird_slot_t* slot;
+    ird_request_t request;
+    unsigned char buf[RCX_IRD_PAYLOAD];
+    rcx_ird_server_t* server = (rcx_ird_server_t*) arg;
+
+    pthread_mutex_lock(&server->lock);
+    while (!server->stop)
+    {
+        slot = ird_next(server);
+        if (slot!=NULL)
+        {
+            request = slot->queue[slot->head];
+            slot->head = (slot->head+1) % RCX_IRD_QUEUE;
+            slot->count--;
+            slot->busy = 1;
+            pthread_mutex_unlock(&server->lock);
+
+            ird_run(server, slot, &request);
+
+            pthread_mutex_lock(&server->lock);
+            slot->busy = 0;
+            if (slot->closing)
+            {
+                close(slot->fd);
+                slot->fd = -1;
+                slot->closing = 0;
+            }
+
+            /* What came while the command waited for its reply */
+            for (n=0; n<server->skipped; n++)
+            {
+                ird_fan_out(server, server->skipped_buf[n],
+                            server->skipped_len[n]);
+            }
+            server->skipped = 0;
+        }
+        else if (server->subscribers>0)
+        {
+            pthread_mutex_unlock(&server->lock);
+            result = rcx_receive_wait_dev(server->handle, buf, sizeof(buf),
+                                          &len, RCX_IRD_LISTEN_TIME);
+            pthread_mutex_lock(&server->lock);
+            if (result==RCX_OK)
+            {
+                ird_fan_out(server, buf, len);
+            }
+        }
+        else
+        {
+            pthread_cond_wait(&server->cond, &server->lock);
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    return NULL;
+}
+
+
+
+/*************************************************************
+* ird_next picks the client served next: the first one with  *
+* a request after the one served last. The caller holds the  *
+* lock of the server.                                        *
+*                                                            *
+* Return: The slot of the client, or NULL                    *
+*************************************************************/
+static ird_slot_t* ird_next(rcx_ird_server_t* server)
+{
+    int n;
+    int k;
+    ird_slot_t* slot;
+
+    for (n=1; n<=RCX_IRD_CLIENTS; n++)
+    {
+        k = (server->next+n) % RCX_IRD_CLIENTS;
+        slot = &server->slots[k];
+        if ((slot->fd>=0) && !slot->closing && (slot->count>0))
+        {
+            server->next = k;
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+
+
+/*************************************************************
+* ird_run runs a request on the device, and sends the reply  *
+* to the client.                                             *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+static void ird_run(rcx_ird_server_t* server, ird_slot_t* slot,
+                    ird_request_t* request)
+{
+    int len = request->length;
+    int result;
+
+    if (request->type==RCX_IRD_COMMAND)
+    {
+        /* The reply takes the place of the command */
+        result = rcx_command_dev(server->handle, request->data,
+                                 RCX_IRD_PAYLOAD-1, &len);
+    }
+    else
+    {
+        result = rcx_send_dev(server->handle, request->data, len);
+    }
+
+    if (result!=RCX_OK || request->type!=RCX_IRD_COMMAND)
+    {
+        len = 0;
+    }
+    ird_write(slot, RCX_IRD_REPLY, request->tag, result,
+              request->data, len);
+}
+
+
+
+/*************************************************************
+* ird_fan_out sends a packet nobody asked for to the         *
+* subscribers. The caller holds the lock of the server.      *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+static void ird_fan_out(rcx_ird_server_t* server, unsigned char* buf,
+                        int len)
+{
+    int n;
+    ird_slot_t* slot;
+
+    for (n=0; n<RCX_IRD_CLIENTS; n++)
+    {
+        slot = &server->slots[n];
+        if ((slot->fd>=0) && !slot->closing && slot->subscribed)
+        {
+            ird_write(slot, RCX_IRD_PACKET, 0, RCX_OK, buf, len);
+        }
+    }
+}
+
+
+
+/*************************************************************
+* ird_unsolicited keeps a packet a command skipped, see      *
+* rcx_set_unsolicited(). ird_device() hands it to the        *
+* subscribers once the command is done.                      *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+static void ird_unsolicited(void* user, const unsigned char* data,
+                            int length)
+{
+    rcx_ird_server_t* server = (rcx_ird_server_t*) user;
+
+    if ((server->skipped==RCX_IRD_STASH) || (length>RCX_IRD_PAYLOAD))
+    {
+        APP_ERROR("Packet skipped by a command dropped");
+        return;
+    }
+    memcpy(server->skipped_buf[server->skipped], data, length);
+    server->skipped_len[server->skipped] = length;
+    server->skipped++;
+}
+
+
+
+/*************************************************************
+* ird_accept takes a new client, if there is a free slot.    *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+static void ird_accept(rcx_ird_server_t* server)
+{
+    int n;
+    int fd;
+    ird_slot_t* slot;
+
+    fd = accept(server->fd, NULL, NULL);
+    if (fd<0)
+    {
+        return;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    pthread_mutex_lock(&server->lock);
+    for (n=0; n<RCX_IRD_CLIENTS; n++)
+    {
+        slot = &server->slots[n];
+        if (slot->fd<0)
+        {
+            slot->fd = fd;
+            slot->busy = 0;
+            slot->closing = 0;
+            slot->subscribed = 0;
+            slot->head = 0;
+            slot->count = 0;
+            slot->in_len = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    if (n==RCX_IRD_CLIENTS)
+    {
+        APP_ERROR("Too many clients");
+        close(fd);
+    }
+}
+
+
+
+/*************************************************************
+* ird_read reads the frames a client has sent.               *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+static void ird_read(rcx_ird_server_t* server, ird_slot_t* slot)
+{
+    int n;
+    int length;
+
+    n = recv(slot->fd, &slot->in[slot->in_len],
+             sizeof(slot->in)-slot->in_len, 0);
+    if (n<=0)
+    {
+        if ((n<0) && ((errno==EAGAIN) || (errno==EINTR)))
+        {
+            return;
+        }
+        ird_drop(server, slot);
+        return;
+    }
+    slot->in_len += n;
+
+    while (slot->in_len>=RCX_IRD_HEADER)
+    {
+        length = slot->in[2] | (slot->in[3]<<8);
+        if (length>RCX_IRD_PAYLOAD)
+        {
+            APP_ERROR("Bad frame from client");
+            ird_drop(server, slot);
+            return;
+        }
+        if (slot->in_len<RCX_IRD_HEADER+length)
+        {
+            break;
+        }
+
+        ird_request(server, slot, slot->in[0], slot->in[1],
+                    &slot->in[RCX_IRD_HEADER], length);
+
+        slot->in_len -= RCX_IRD_HEADER+length;
+        memmove(slot->in, &slot->in[RCX_IRD_HEADER+length], slot->in_len);
+    }
+}
+
+
+
+/*************************************************************
+* ird_request queues a request of a client for the device,   *
+* or answers it at once.                                     *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+static void ird_request(rcx_ird_server_t* server, ird_slot_t* slot,
+                        int type, int tag, unsigned char* data, int length)
+{
+    int result = RCX_OK;
+    ird_request_t* request;
+
+    pthread_mutex_lock(&server->lock);
+    switch (type)
+    {
+    case RCX_IRD_SUBSCRIBE:
+        if ((length==1) && ((data[0]!=0)!=slot->subscribed))
+        {
+            slot->subscribed = (data[0]!=0);
+            server->subscribers += (slot->subscribed) ? 1 : -1;
+            pthread_cond_broadcast(&server->cond);
+        }
+        else if (length!=1)
+        {
+            result = RCX_E_BAD_ARGUMENT;
+        }
+        break;
+
+    case RCX_IRD_COMMAND:
+    case RCX_IRD_SEND:
+        if ((length==0) || (length>=RCX_IRD_PAYLOAD))
+        {
+            result = RCX_E_BAD_ARGUMENT;
+        }
+        else if (slot->count==RCX_IRD_QUEUE)
+        {
+            result = RCX_E_QUEUE_FULL;
+        }
+        else
+        {
+            request = &slot->queue[(slot->head+slot->count) % RCX_IRD_QUEUE];
+            request->type = type;
+            request->tag = tag;
+            request->length = length;
+            memcpy(request->data, data, length);
+            slot->count++;
+            pthread_cond_broadcast(&server->cond);
+            pthread_mutex_unlock(&server->lock);
+            return;
+        }
+        break;
+
+    default:
+        result = RCX_E_BAD_ARGUMENT;
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    ird_write(slot, RCX_IRD_REPLY, tag, result, NULL, 0);
+}
+
+
+
+/*************************************************************
+* ird_drop ends a client. Its requests in the queue are      *
+* dropped; one that runs on the device is finished first.    *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+static void ird_drop(rcx_ird_server_t* server, ird_slot_t* slot)
+{
+    pthread_mutex_lock(&server->lock);
+    if (slot->subscribed)
+    {
+        slot->subscribed = 0;
+        server->subscribers--;
+    }
+    slot->count = 0;
+    if (slot->busy)
+    {
+        slot->closing = 1;
+    }
+    else
+    {
+        close(slot->fd);
+        slot->fd = -1;
+    }
+    pthread_mutex_unlock(&server->lock);
+}
+
+
+
+/*************************************************************
+* ird_write sends a frame to a client, without blocking. A   *
+* frame that does not fit in the socket as a whole ends the  *
+* client, unless it is a packet nobody asked for and none of *
+* it was sent.                                               *
+*                                                            *
+* Return: 1 if sent, 0 if not                                *
+*************************************************************/
+static int ird_write(ird_slot_t* slot, int type, int tag, int result,
+                     const unsigned char* data, int length)
+{
+    int n;
+    int size = 0;
+    unsigned char frame[IRD_FRAME];
+
+    /* A reply starts with the result */
+    if (type==RCX_IRD_REPLY)
+    {
+        frame[RCX_IRD_HEADER] = (unsigned char) (signed char) result;
+        size = 1;
+    }
+    memcpy(&frame[RCX_IRD_HEADER+size], data, length);
+    size += length;
+
+    frame[0] = (unsigned char) type;
+    frame[1] = (unsigned char) tag;
+    frame[2] = (unsigned char) (size & 0xff);
+    frame[3] = (unsigned char) (size >> 8);
+
+    pthread_mutex_lock(&slot->write_lock);
+    n = send(slot->fd, frame, RCX_IRD_HEADER+size,
+             MSG_DONTWAIT | MSG_NOSIGNAL);
+    if ((n!=RCX_IRD_HEADER+size) &&
+        ((type!=RCX_IRD_PACKET) || (n>0)))
+    {
+        /* The server thread sees the end, and drops the client */
+        APP_ERROR("Client does not keep up");
+        shutdown(slot->fd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&slot->write_lock);
+
+    return n==RCX_IRD_HEADER+size;
+}
+
+
+
+/*************************************************************
+* ird_frame reads the next frame from the server.            *
+*                                                            *
+* Return: RCX_OK, RCX_E_RECV_NOTHING if no frame came in     *
+*         time, or RCX_E_DEVICE_ERROR                        *
+*************************************************************/
+static int ird_frame(rcx_ird_client_t* client, int timeout, int* type,
+                     int* tag, unsigned char* payload, int* length)
+{
+    int n;
+    int size;
+    long wait;
+    struct pollfd fd;
+    struct timespec now;
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000000L;
+    if (deadline.tv_nsec>=1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    while (1)
+    {
+        if (client->in_len>=RCX_IRD_HEADER)
+        {
+            size = client->in[2] | (client->in[3]<<8);
+            if (size>RCX_IRD_PAYLOAD)
+            {
+                return RCX_E_DEVICE_ERROR;
+            }
+            if (client->in_len>=RCX_IRD_HEADER+size)
+            {
+                *type = client->in[0];
+                *tag = client->in[1];
+                *length = size;
+                memcpy(payload, &client->in[RCX_IRD_HEADER], size);
+
+                client->in_len -= RCX_IRD_HEADER+size;
+                memmove(client->in, &client->in[RCX_IRD_HEADER+size],
+                        client->in_len);
+                return RCX_OK;
+            }
+        }
+
+        /* A negative timeout waits for ever */
+        if (timeout>=0)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            wait = (deadline.tv_sec-now.tv_sec)*1000L +
+                   (deadline.tv_nsec-now.tv_nsec)/1000000L;
+            fd.fd = client->fd;
+            fd.events = POLLIN;
+            n = poll(&fd, 1, (wait>0) ? (int) wait : 0);
+            if ((n<0) && (errno==EINTR))
+            {
+                continue;
+            }
+            if (n==0)
+            {
+                return RCX_E_RECV_NOTHING;
+            }
+        }
+
+        n = recv(client->fd, &client->in[client->in_len],
+                 sizeof(client->in)-client->in_len, 0);
+        if (n<=0)
+        {
+            if ((n<0) && (errno==EINTR))
+            {
+                continue;
+            }
+            return RCX_E_DEVICE_ERROR;
+        }
+        client->in_len += n;
+    }
+}
+
+
+
+/*************************************************************
+* ird_call sends a request to the server, and waits for its  *
+* reply. Packets nobody asked for that come first are kept.  *
+*                                                            *
+* Return: The result in the reply, or RCX_E_DEVICE_ERROR     *
+*************************************************************/
+static int ird_call(rcx_ird_client_t* client, int type,
+                    unsigned char* data, int length,
+                    unsigned char* buf, int buf_size, int* buf_len)
+{
+    int n;
+    int sent;
+    int reply_type;
+    int reply_tag;
+    int result;
+    unsigned char frame[IRD_FRAME];
+
+    if ((length<=0) || (length>=RCX_IRD_PAYLOAD))
+    {
+        return RCX_E_BAD_ARGUMENT;
+    }
+
+    client->tag = (client->tag+1) & 0xff;
+    frame[0] = (unsigned char) type;
+    frame[1] = (unsigned char) client->tag;
+    frame[2] = (unsigned char) (length & 0xff);
+    frame[3] = (unsigned char) (length >> 8);
+    memcpy(&frame[RCX_IRD_HEADER], data, length);
+
+    for (sent=0; sent<RCX_IRD_HEADER+length; sent+=n)
+    {
+        n = send(client->fd, &frame[sent], RCX_IRD_HEADER+length-sent,
+                 MSG_NOSIGNAL);
+        if (n<0)
+        {
+            if (errno==EINTR)
+            {
+                n = 0;
+                continue;
+            }
+            return RCX_E_DEVICE_ERROR;
+        }
+    }
+
+    while (1)
+    {
+        result = ird_frame(client, -1, &reply_type, &reply_tag,
+                           frame, &length);
+        if (result!=RCX_OK)
+        {
+            return result;
+        }
+
+        if (reply_type==RCX_IRD_PACKET)
+        {
+            ird_stash(client, frame, length);
+        }
+        else if ((reply_type==RCX_IRD_REPLY) &&
+                 (reply_tag==client->tag) && (length>=1))
+        {
+            break;
+        }
+    }
+
+    result = (signed char) frame[0];
+    if (buf_len!=NULL)
+    {
+        length--;
+        if (length>buf_size)
+        {
+            length = buf_size;
+        }
+        memcpy(buf, &frame[1], length);
+        *buf_len = length;
+    }
+
+    return result;
+}
+
+
+
+/*************************************************************
+* ird_stash keeps a packet nobody asked for, in place of the *
+* oldest one if there is no room.                            *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+static void ird_stash(rcx_ird_client_t* client, unsigned char* packet,
+                      int length)
+{
+    int n;
+
+    if (client->stash_count==RCX_IRD_STASH)
+    {
+        client->stash_head = (client->stash_head+1) % RCX_IRD_STASH;
+        client->stash_count--;
+    }
+
+    n = (client->stash_head+client->stash_count) % RCX_IRD_STASH;
+    memcpy(client->stash[n], packet, length);
+    client->stash_len[n] = length;
+    client->stash_count++;
+}
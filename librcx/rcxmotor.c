@@ -0,0 +1,455 @@
+/***************************************************************
+*                                                              *
+* rcxmotor.c                                                   *
+*                                                              *
+* Description:                                                 *
+* Queue of commands that supersede, see rcxmotor.h.            *
+*                                                              *
+* A motor command is split into an entry per output in its     *
+* motor list, each holding the command with only that output   *
+* in the list. A newer command replaces the entry of the same  *
+* output and opcode, searched from the end of the queue back   *
+* to the first entry that is not a motor command.              *
+*                                                              *
+* The thread of the queue takes the first entry, and merges    *
+* the motor entries after it that have the same command for    *
+* another output, up to the next other command. An entry is    *
+* not merged past one for the same output, so the commands     *
+* for an output keep their order.                              *
+*                                                              *
+* Debug flags:                                                 *
+* APP_PRINT_DEBUG   Show debug data and errors                 *
+* APP_PRINT_ERROR   Show errors                                *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "verbose.h"
+#include "rcx.h"
+#include "rcxcode.h"
+#include "rcxmotor.h"
+
+/* Bits of the motor list, and of the mode in it */
+#define MOTOR_OUTPUTS         (0x07)
+#define MOTOR_MODE            (0xc0)
+
+/* A command in the queue */
+typedef struct motor_entry
+{
+    int           motor;        /* Motor command for one output   */
+    int           output;       /* Its bit in the motor list      */
+    int           length;       /* Bytes in data                  */
+    unsigned char data[RCX_MOTOR_SIZE];
+    long          submitted;    /* Time of the input, in us       */
+} motor_entry_t;
+
+struct rcx_motor
+{
+    rcx_handle_t*     handle;
+    pthread_t         thread;
+    pthread_mutex_t   lock;
+    pthread_cond_t    cond;     /* Queue or sending changed       */
+    int               stop;
+    int               sending;  /* Command on the air             */
+    int               count;    /* Entries in the queue           */
+    rcx_motor_stats_t stats;
+    motor_entry_t     entries[RCX_MOTOR_QUEUE];
+};
+
+/* Prototypes */
+static int motor_is_motor(const unsigned char* buf, int buf_len);
+static int motor_same(const motor_entry_t* a, const motor_entry_t* b);
+static motor_entry_t* motor_find(rcx_motor_t* motor,
+                                 const unsigned char* buf, int output);
+static int motor_take(rcx_motor_t* motor, unsigned char* buf,
+                      long* submitted);
+static void* motor_thread(void* arg);
+
+
+
+/*************************************************************
+* rcx_motor_create creates an empty queue for a device, and  *
+* starts its thread.                                         *
+*                                                            *
+* Return: RCX_OK, or RCX_E_PROGRAM_FAILURE                   *
+*************************************************************/
+int rcx_motor_create(rcx_handle_t* handle, rcx_motor_t** motor)
+{
+    rcx_motor_t* queue;
+
+    queue = (rcx_motor_t*) calloc(1, sizeof(rcx_motor_t));
+    if (queue==NULL)
+    {
+        return RCX_E_PROGRAM_FAILURE;
+    }
+
+    queue->handle = handle;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+
+    if (pthread_create(&queue->thread, NULL, motor_thread, queue)!=0)
+    {
+        pthread_cond_destroy(&queue->cond);
+        pthread_mutex_destroy(&queue->lock);
+        free(queue);
+        return RCX_E_PROGRAM_FAILURE;
+    }
+
+    *motor = queue;
+    return RCX_OK;
+}
+
+
+
+/*************************************************************
+* rcx_motor_destroy stops the thread of a queue, and frees   *
+* it.                                                        *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_motor_destroy(rcx_motor_t* motor)
+{
+    pthread_mutex_lock(&motor->lock);
+    motor->stop = 1;
+    pthread_cond_broadcast(&motor->cond);
+    pthread_mutex_unlock(&motor->lock);
+    pthread_join(motor->thread, NULL);
+
+    pthread_cond_destroy(&motor->cond);
+    pthread_mutex_destroy(&motor->lock);
+    free(motor);
+}
+
+
+
+/*************************************************************
+* rcx_motor_submit puts a command in the queue, or replaces  *
+* the commands it supersedes.                                *
+*                                                            *
+* Return: RCX_OK, RCX_E_BAD_ARGUMENT or RCX_E_QUEUE_FULL     *
+*************************************************************/
+int rcx_motor_submit(rcx_motor_t* motor, const unsigned char* buf,
+                     int buf_len)
+{
+    int n;
+    int output;
+    int needed = 0;
+    long now;
+    motor_entry_t* entry;
+    motor_entry_t* found[RCX_MOTOR_OUTPUTS];
+
+    if ((buf_len<1) || (buf_len>RCX_MOTOR_SIZE))
+    {
+        return RCX_E_BAD_ARGUMENT;
+    }
+
+    now = rcx_get_time_dev(motor->handle);
+    pthread_mutex_lock(&motor->lock);
+
+    if (!motor_is_motor(buf, buf_len))
+    {
+        if (motor->count==RCX_MOTOR_QUEUE)
+        {
+            pthread_mutex_unlock(&motor->lock);
+            return RCX_E_QUEUE_FULL;
+        }
+        entry = &motor->entries[motor->count++];
+        entry->motor = 0;
+        entry->output = 0;
+        entry->length = buf_len;
+        memcpy(entry->data, buf, buf_len);
+        entry->submitted = now;
+        motor->stats.submitted++;
+        pthread_cond_broadcast(&motor->cond);
+        pthread_mutex_unlock(&motor->lock);
+        return RCX_OK;
+    }
+
+    /* Find all entries it replaces first: none, or all, change */
+    for (n=0; n<RCX_MOTOR_OUTPUTS; n++)
+    {
+        found[n] = NULL;
+        if (buf[1] & (1<<n))
+        {
+            found[n] = motor_find(motor, buf, 1<<n);
+            if (found[n]==NULL)
+            {
+                needed++;
+            }
+        }
+    }
+    if (motor->count+needed>RCX_MOTOR_QUEUE)
+    {
+        pthread_mutex_unlock(&motor->lock);
+        return RCX_E_QUEUE_FULL;
+    }
+
+    for (n=0; n<RCX_MOTOR_OUTPUTS; n++)
+    {
+        output = 1<<n;
+        if (!(buf[1] & output))
+        {
+            continue;
+        }
+        entry = found[n];
+        if (entry!=NULL)
+        {
+            motor->stats.dropped++;
+        }
+        else
+        {
+            entry = &motor->entries[motor->count++];
+        }
+        entry->motor = 1;
+        entry->output = output;
+        entry->length = buf_len;
+        memcpy(entry->data, buf, buf_len);
+        entry->data[0] &= ~RCX_TOGGLE;
+        entry->data[1] = (buf[1] & ~MOTOR_OUTPUTS) | output;
+        entry->submitted = now;
+        motor->stats.submitted++;
+    }
+
+    pthread_cond_broadcast(&motor->cond);
+    pthread_mutex_unlock(&motor->lock);
+    return RCX_OK;
+}
+
+
+
+/*************************************************************
+* rcx_motor_flush waits until the queue is empty, and the    *
+* last command answered.                                     *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_motor_flush(rcx_motor_t* motor)
+{
+    pthread_mutex_lock(&motor->lock);
+    while (((motor->count>0) || motor->sending) && !motor->stop)
+    {
+        pthread_cond_wait(&motor->cond, &motor->lock);
+    }
+    pthread_mutex_unlock(&motor->lock);
+}
+
+
+
+/*************************************************************
+* rcx_motor_get_stats returns the counters of a queue.       *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_motor_get_stats(rcx_motor_t* motor, rcx_motor_stats_t* stats)
+{
+    pthread_mutex_lock(&motor->lock);
+    *stats = motor->stats;
+    pthread_mutex_unlock(&motor->lock);
+}
+
+
+
+/*************************************************************
+* motor_is_motor tells whether a command is a motor command  *
+* that supersedes: on/off/float, a direction that is not a   *
+* flip, or a power from any source, for at least one output. *
+*                                                            *
+* Return: 1 if it is, 0 if not                               *
+*************************************************************/
+static int motor_is_motor(const unsigned char* buf, int buf_len)
+{
+    if ((buf_len<2) || !(buf[1] & MOTOR_OUTPUTS))
+    {
+        return 0;
+    }
+
+    switch (buf[0] & ~RCX_TOGGLE)
+    {
+    case RCX_MOTOR_ONOFF:
+        return (buf_len==2);
+
+    case RCX_MOTOR_DIRECTION:
+        return (buf_len==2) && ((buf[1] & MOTOR_MODE)!=RCX_MOTOR_FLIP);
+
+    case RCX_MOTOR_POWER:
+        return (buf_len==4);
+
+    default:
+        return 0;
+    }
+}
+
+
+
+/*************************************************************
+* motor_same tells whether two motor entries have the same   *
+* command, for their outputs.                                *
+*                                                            *
+* Return: 1 if they have, 0 if not                           *
+*************************************************************/
+static int motor_same(const motor_entry_t* a, const motor_entry_t* b)
+{
+    return (a->length==b->length) && (a->data[0]==b->data[0]) &&
+           ((a->data[1] & ~MOTOR_OUTPUTS)==(b->data[1] & ~MOTOR_OUTPUTS)) &&
+           (memcmp(&a->data[2], &b->data[2], a->length-2)==0);
+}
+
+
+
+/*************************************************************
+* motor_find finds the entry a motor command replaces for an *
+* output: of the same opcode, after the last entry that is   *
+* not a motor command. The caller holds the lock of the      *
+* queue.                                                     *
+*                                                            *
+* Return: The entry, or NULL                                 *
+*************************************************************/
+static motor_entry_t* motor_find(rcx_motor_t* motor,
+                                 const unsigned char* buf, int output)
+{
+    int n;
+    motor_entry_t* entry;
+
+    for (n=motor->count-1; n>=0; n--)
+    {
+        entry = &motor->entries[n];
+        if (!entry->motor)
+        {
+            break;
+        }
+        if ((entry->output==output) &&
+            (entry->data[0]==(buf[0] & ~RCX_TOGGLE)))
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+
+
+/*************************************************************
+* motor_take takes the first command out of the queue, with  *
+* the entries merged into it. The caller holds the lock of   *
+* the queue, which is not empty.                             *
+*                                                            *
+* Output: buf           The command, RCX_MOTOR_SIZE bytes    *
+*         submitted     Time of the oldest input in it       *
+*                                                            *
+* Return: Number of command bytes                            *
+*************************************************************/
+static int motor_take(rcx_motor_t* motor, unsigned char* buf,
+                      long* submitted)
+{
+    int n;
+    int kept = 1;
+    int merging;
+    int passed = 0;
+    motor_entry_t* first = &motor->entries[0];
+    motor_entry_t* entry;
+
+    memcpy(buf, first->data, first->length);
+    *submitted = first->submitted;
+
+    merging = first->motor;
+    for (n=1; n<motor->count; n++)
+    {
+        entry = &motor->entries[n];
+        if (!entry->motor)
+        {
+            merging = 0;
+        }
+        else if (merging && !(entry->output & passed) &&
+                 motor_same(first, entry))
+        {
+            buf[1] |= entry->output;
+            if (entry->submitted<*submitted)
+            {
+                *submitted = entry->submitted;
+            }
+            motor->stats.merged++;
+            continue;
+        }
+        passed |= entry->output;
+        if (kept!=n)
+        {
+            motor->entries[kept] = *entry;
+        }
+        kept++;
+    }
+
+    n = first->length;
+    motor->count = kept-1;
+    memmove(&motor->entries[0], &motor->entries[1],
+            motor->count*sizeof(motor_entry_t));
+    return n;
+}
+
+
+
+/*************************************************************
+* motor_thread sends the commands of the queue, until it is  *
+* destroyed.                                                 *
+*                                                            *
+* Return: NULL                                               *
+*************************************************************/
+static void* motor_thread(void* arg)
+{
+    int len;
+    int length;
+    int result;
+    long latency;
+    long submitted;
+    rcx_motor_t* motor = (rcx_motor_t*) arg;
+    unsigned char buf[RCX_MOTOR_SIZE];
+
+    pthread_mutex_lock(&motor->lock);
+    while (1)
+    {
+        while ((motor->count==0) && !motor->stop)
+        {
+            pthread_cond_wait(&motor->cond, &motor->lock);
+        }
+        if (motor->stop)
+        {
+            break;
+        }
+
+        length = motor_take(motor, buf, &submitted);
+        motor->sending = 1;
+        pthread_mutex_unlock(&motor->lock);
+
+        /* rcx_command() sets the toggle bit of a repeated opcode */
+        len = length;
+        result = rcx_command_dev(motor->handle, buf, sizeof(buf), &len);
+        latency = rcx_get_time_dev(motor->handle)-submitted;
+
+        pthread_mutex_lock(&motor->lock);
+        motor->sending = 0;
+        motor->stats.sent++;
+        if (result!=RCX_OK)
+        {
+            APP_PRINT2("Command of queue failed: %d", result);
+            motor->stats.errors++;
+        }
+        motor->stats.latency_total += latency;
+        if (latency>motor->stats.latency_max)
+        {
+            motor->stats.latency_max = latency;
+        }
+        pthread_cond_broadcast(&motor->cond);
+    }
+    pthread_mutex_unlock(&motor->lock);
+
+    return NULL;
+}
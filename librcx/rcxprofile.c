@@ -0,0 +1,223 @@
+/***************************************************************
+*                                                              *
+* rcxprofile.c                                                 *
+*                                                              *
+* Description:                                                 *
+* Profile file with the calibrated timing values per host and  *
+* device, see rcxprofile.h.                                    *
+*                                                              *
+* Debug flags:                                                 *
+* APP_PRINT_DEBUG   Show debug data and errors                 *
+* APP_PRINT_ERROR   Show errors                                *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "verbose.h"
+#include "rcx.h"
+#include "rcxprofile.h"
+
+/* Longest line, path and host name handled */
+#define PROFILE_LINE          512
+#define PROFILE_PATH          512
+#define PROFILE_HOST          256
+
+/* Prototypes */
+static int profile_path(char* path, int size);
+static int profile_host(char* host, int size);
+static int profile_parse(const char* line, const char* host,
+                         const char* device, int* values);
+
+
+
+/*************************************************************
+* rcx_profile_load looks up the timing values of this host   *
+* and a device.                                              *
+*                                                            *
+* Return: 1 if found, 0 if not                               *
+*************************************************************/
+int rcx_profile_load(const char* device, int* bit_period,
+                     int* mark_adjust, int* space_adjust)
+{
+    int found = 0;
+    int values[3];
+    char path[PROFILE_PATH];
+    char host[PROFILE_HOST];
+    char line[PROFILE_LINE];
+    FILE* file;
+
+    if (!profile_path(path, sizeof(path)) ||
+        !profile_host(host, sizeof(host)))
+    {
+        return 0;
+    }
+
+    file = fopen(path, "r");
+    if (file==NULL)
+    {
+        return 0;
+    }
+
+    /* The last line of the host and device counts */
+    while (fgets(line, sizeof(line), file)!=NULL)
+    {
+        if (profile_parse(line, host, device, values))
+        {
+            *bit_period = values[0];
+            *mark_adjust = values[1];
+            *space_adjust = values[2];
+            found = 1;
+        }
+    }
+    fclose(file);
+
+    APP_PRINT2("Profile found: %d", found);
+    return found;
+}
+
+
+
+/*************************************************************
+* rcx_profile_save stores the timing values of this host and *
+* a device, in place of the old ones.                        *
+*                                                            *
+* Return: RCX_OK, or RCX_E_PROFILE_FILE                      *
+*************************************************************/
+int rcx_profile_save(const char* device, int bit_period,
+                     int mark_adjust, int space_adjust)
+{
+    int values[3];
+    int failed;
+    char path[PROFILE_PATH];
+    char temp[PROFILE_PATH+8];
+    char host[PROFILE_HOST];
+    char line[PROFILE_LINE];
+    FILE* file;
+    FILE* old;
+
+    if (!profile_path(path, sizeof(path)) ||
+        !profile_host(host, sizeof(host)) ||
+        (strchr(device, ' ')!=NULL))
+    {
+        APP_ERROR("No profile file for this host and device");
+        return RCX_E_PROFILE_FILE;
+    }
+
+    snprintf(temp, sizeof(temp), "%s.new", path);
+    file = fopen(temp, "w");
+    if (file==NULL)
+    {
+        APP_ERROR("Cannot write profile file");
+        return RCX_E_PROFILE_FILE;
+    }
+
+    /* Keep all lines, apart from the old values */
+    old = fopen(path, "r");
+    if (old!=NULL)
+    {
+        while (fgets(line, sizeof(line), old)!=NULL)
+        {
+            if (!profile_parse(line, host, device, values))
+            {
+                fputs(line, file);
+            }
+        }
+        fclose(old);
+    }
+    else
+    {
+        fprintf(file, "# host device bit_period mark_adjust space_adjust\n");
+    }
+
+    fprintf(file, "%s %s %d %d %d\n", host, device,
+            bit_period, mark_adjust, space_adjust);
+
+    failed = ferror(file);
+    if ((fclose(file)!=0) || failed || (rename(temp, path)!=0))
+    {
+        APP_ERROR("Cannot write profile file");
+        remove(temp);
+        return RCX_E_PROFILE_FILE;
+    }
+
+    return RCX_OK;
+}
+
+
+
+/*************************************************************
+* profile_path returns the path of the profile file.         *
+*                                                            *
+* Return: 1 if there is one, 0 if not                        *
+*************************************************************/
+static int profile_path(char* path, int size)
+{
+    const char* name;
+
+    name = getenv(RCX_PROFILE_ENV);
+    if ((name!=NULL) && (name[0]!='\0'))
+    {
+        return snprintf(path, size, "%s", name)<size;
+    }
+
+    name = getenv("HOME");
+    if (name==NULL)
+    {
+        return 0;
+    }
+    return snprintf(path, size, "%s/%s", name, RCX_PROFILE_FILE)<size;
+}
+
+
+
+/*************************************************************
+* profile_host returns the name of this host.                *
+*                                                            *
+* Return: 1 if known, 0 if not                               *
+*************************************************************/
+static int profile_host(char* host, int size)
+{
+    if (gethostname(host, size)!=0)
+    {
+        return 0;
+    }
+    host[size-1] = '\0';
+
+    /* The name separates the fields of a line */
+    return (host[0]!='\0') && (strchr(host, ' ')==NULL);
+}
+
+
+
+/*************************************************************
+* profile_parse takes the timing values from a line, if it   *
+* is one of the host and device.                             *
+*                                                            *
+* Output: values    bit_period, mark_adjust, space_adjust    *
+*                                                            *
+* Return: 1 if the line is of the host and device, 0 if not  *
+*************************************************************/
+static int profile_parse(const char* line, const char* host,
+                         const char* device, int* values)
+{
+    char line_host[PROFILE_HOST];
+    char line_device[PROFILE_LINE];
+
+    if ((line[0]=='#') ||
+        (sscanf(line, "%255s %511s %d %d %d", line_host, line_device,
+                &values[0], &values[1], &values[2])!=5))
+    {
+        return 0;
+    }
+
+    return (strcmp(line_host, host)==0) && (strcmp(line_device, device)==0);
+}
@@ -0,0 +1,146 @@
+/***************************************************************
+*                                                              *
+* rcxring.c                                                    *
+*                                                              *
+* Description:                                                 *
+* Lock-free byte ring for a single producer and a single       *
+* consumer thread, see rcxring.h.                              *
+*                                                              *
+* The producer publishes bytes with a release store of 'head', *
+* after copying them. The consumer reads 'head' with an        *
+* acquire load, so it sees the bytes, and frees space with a   *
+* release store of 'tail'.                                     *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <string.h>
+
+#include "rcxring.h"
+
+#define RING_MASK             (RCX_RING_SIZE-1)
+
+
+
+/*************************************************************
+* rcx_ring_init empties a ring. No thread may use the ring   *
+* at the same time.                                          *
+*                                                            *
+* Output: ring      The ring to initialize                   *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_ring_init(rcx_ring_t* ring)
+{
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+
+
+/*************************************************************
+* rcx_ring_put adds bytes to the ring. Only the producer     *
+* thread may call this function.                             *
+*                                                            *
+* Input:  buf       Bytes to add                             *
+*         len       Number of bytes in buf                   *
+*                                                            *
+* In/Out: ring      The ring                                 *
+*                                                            *
+* Return: >= 0      Number of bytes added. Less than len if  *
+*                   the ring is full.                        *
+*************************************************************/
+int rcx_ring_put(rcx_ring_t* ring, const unsigned char* buf, int len)
+{
+    int free;
+    int first;
+    unsigned int head;
+    unsigned int tail;
+
+    head = ring->head;
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    free = RCX_RING_SIZE - (int) (head-tail);
+    if (len>free)
+    {
+        len = free;
+    }
+
+    /* Copy in at most two parts, around the end of the buffer */
+    first = RCX_RING_SIZE - (head&RING_MASK);
+    if (first>len)
+    {
+        first = len;
+    }
+    memcpy(&ring->buf[head&RING_MASK], buf, first);
+    memcpy(&ring->buf[0], &buf[first], len-first);
+
+    __atomic_store_n(&ring->head, head+len, __ATOMIC_RELEASE);
+
+    return len;
+}
+
+
+
+/*************************************************************
+* rcx_ring_get takes bytes from the ring, without waiting.   *
+* Only the consumer thread may call this function.           *
+*                                                            *
+* Input:  size      Size of buf                              *
+*                                                            *
+* Output: buf       The bytes taken from the ring            *
+*                                                            *
+* In/Out: ring      The ring                                 *
+*                                                            *
+* Return: >= 0      Number of bytes taken, 0 if the ring is  *
+*                   empty                                    *
+*************************************************************/
+int rcx_ring_get(rcx_ring_t* ring, unsigned char* buf, int size)
+{
+    int len;
+    int first;
+    unsigned int head;
+    unsigned int tail;
+
+    tail = ring->tail;
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    len = (int) (head-tail);
+    if (len>size)
+    {
+        len = size;
+    }
+
+    /* Copy out in at most two parts, around the end of the buffer */
+    first = RCX_RING_SIZE - (tail&RING_MASK);
+    if (first>len)
+    {
+        first = len;
+    }
+    memcpy(buf, &ring->buf[tail&RING_MASK], first);
+    memcpy(&buf[first], &ring->buf[0], len-first);
+
+    __atomic_store_n(&ring->tail, tail+len, __ATOMIC_RELEASE);
+
+    return len;
+}
+
+
+
+/*************************************************************
+* rcx_ring_count returns the number of bytes in the ring.    *
+* Seen from the other thread, it is a snapshot.              *
+*                                                            *
+* Input:  ring      The ring                                 *
+*                                                            *
+* Return: >= 0      Number of bytes in the ring              *
+*************************************************************/
+int rcx_ring_count(rcx_ring_t* ring)
+{
+    return (int) (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) -
+                  __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE));
+}
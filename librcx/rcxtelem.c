@@ -0,0 +1,515 @@
+/***************************************************************
+*                                                              *
+* rcxtelem.c                                                   *
+*                                                              *
+* Description:                                                 *
+* Cache of the values of an RCX, see rcxtelem.h.               *
+*                                                              *
+* A value has an entry in a small table, found by a linear     *
+* search. An entry that is being polled is busy: the threads   *
+* that want it wait on the condition of the cache until the    *
+* generation of the entry changes, and take the result of that *
+* poll. Busy entries are not dropped, neither by a flush nor   *
+* to make room; a flush only keeps their poll from being       *
+* cached.                                                      *
+*                                                              *
+* Debug flags:                                                 *
+* APP_PRINT_DEBUG   Show debug data and errors                 *
+* APP_PRINT_ERROR   Show errors                                *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "verbose.h"
+#include "rcx.h"
+#include "rcxtelem.h"
+
+/* Commands of the RCX, and the bytes of their replies */
+#define TELEM_GET_VALUE       (0x12)
+#define TELEM_GET_BATTERY     (0x30)
+#define TELEM_REPLY_BYTES     (3)
+#define TELEM_BUFFER          (16)
+
+/* A value in the cache */
+typedef struct telem_entry
+{
+    int           used;         /* Entry holds a source           */
+    int           source;
+    int           argument;
+    int           valid;        /* Value may be taken             */
+    int           busy;         /* Poll in progress               */
+    int           flushed;      /* Flushed while busy             */
+    unsigned long generation;   /* Polls finished in the entry    */
+    unsigned long polls;        /* Of this value                  */
+    unsigned long last_use;     /* Of the cache, when asked for   */
+    int           value;
+    int           result;       /* Of the last poll               */
+    int           ttl;          /* Time to live, in ms            */
+    long          polled;       /* Time of the last poll, in us   */
+} telem_entry_t;
+
+struct rcx_telem
+{
+    rcx_handle_t*     handle;
+    pthread_mutex_t   lock;
+    pthread_cond_t    cond;     /* A poll finished                */
+    unsigned long     uses;     /* Clock of last_use              */
+    int               ttl_min[RCX_TELEM_SOURCES];
+    int               ttl_max[RCX_TELEM_SOURCES];
+    rcx_telem_stats_t stats;
+    telem_entry_t     entries[RCX_TELEM_ENTRIES];
+};
+
+/* Prototypes */
+static telem_entry_t* telem_find(rcx_telem_t* telem, int source,
+                                 int argument);
+static telem_entry_t* telem_take(rcx_telem_t* telem, int source,
+                                 int argument);
+static int telem_poll(rcx_telem_t* telem, int source, int argument,
+                      int* value);
+static void telem_update(rcx_telem_t* telem, telem_entry_t* entry,
+                         int result, int value);
+
+
+
+/*************************************************************
+* rcx_telem_create creates an empty cache for a device.      *
+*                                                            *
+* Return: RCX_OK, or RCX_E_PROGRAM_FAILURE                   *
+*************************************************************/
+int rcx_telem_create(rcx_handle_t* handle, rcx_telem_t** telem)
+{
+    int n;
+    rcx_telem_t* cache;
+
+    cache = (rcx_telem_t*) calloc(1, sizeof(rcx_telem_t));
+    if (cache==NULL)
+    {
+        return RCX_E_PROGRAM_FAILURE;
+    }
+
+    cache->handle = handle;
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->cond, NULL);
+
+    for (n=0; n<RCX_TELEM_SOURCES; n++)
+    {
+        cache->ttl_min[n] = RCX_TELEM_TTL_MIN;
+        cache->ttl_max[n] = RCX_TELEM_TTL_MAX;
+    }
+    for (n=RCX_TELEM_SENSOR; n<=RCX_TELEM_SENSOR_BOOL; n++)
+    {
+        cache->ttl_min[n] = RCX_TELEM_SENSOR_MIN;
+        cache->ttl_max[n] = RCX_TELEM_SENSOR_MAX;
+    }
+    cache->ttl_min[RCX_TELEM_BATTERY] = RCX_TELEM_BATTERY_MIN;
+    cache->ttl_max[RCX_TELEM_BATTERY] = RCX_TELEM_BATTERY_MAX;
+
+    *telem = cache;
+    return RCX_OK;
+}
+
+
+
+/*************************************************************
+* rcx_telem_destroy frees a cache.                           *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_telem_destroy(rcx_telem_t* telem)
+{
+    pthread_cond_destroy(&telem->cond);
+    pthread_mutex_destroy(&telem->lock);
+    free(telem);
+}
+
+
+
+/*************************************************************
+* rcx_telem_set_ttl sets the range of the time to live of    *
+* the values of a source.                                    *
+*                                                            *
+* Return: RCX_OK, or RCX_E_BAD_ARGUMENT                      *
+*************************************************************/
+int rcx_telem_set_ttl(rcx_telem_t* telem, int source, int ttl_min,
+                      int ttl_max)
+{
+    if ((source<0) || (source>=RCX_TELEM_SOURCES) ||
+        (ttl_min<0) || (ttl_max<ttl_min))
+    {
+        return RCX_E_BAD_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&telem->lock);
+    telem->ttl_min[source] = ttl_min;
+    telem->ttl_max[source] = ttl_max;
+    pthread_mutex_unlock(&telem->lock);
+
+    return RCX_OK;
+}
+
+
+
+/*************************************************************
+* rcx_telem_get takes a value from the cache, or polls it.   *
+*                                                            *
+* Return: RCX_OK, or RCX_E_xxx                               *
+*************************************************************/
+int rcx_telem_get(rcx_telem_t* telem, int source, int argument,
+                  int* value)
+{
+    int result;
+    int polled = 0;
+    long now;
+    unsigned long generation;
+    telem_entry_t* entry;
+
+    if ((source<0) || (source>=RCX_TELEM_SOURCES) ||
+        (argument<0) || (argument>0xff) ||
+        ((source==RCX_TELEM_BATTERY) && (argument!=0)))
+    {
+        return RCX_E_BAD_ARGUMENT;
+    }
+
+    pthread_mutex_lock(&telem->lock);
+    while (1)
+    {
+        entry = telem_find(telem, source, argument);
+        if (entry==NULL)
+        {
+            entry = telem_take(telem, source, argument);
+        }
+        if (entry==NULL)
+        {
+            /* Each entry is busy: poll without the cache */
+            telem->stats.polls++;
+            pthread_mutex_unlock(&telem->lock);
+            return telem_poll(telem, source, argument, value);
+        }
+        entry->last_use = ++telem->uses;
+
+        now = rcx_get_time_dev(telem->handle);
+        if (entry->valid && !entry->busy &&
+            (now-entry->polled < entry->ttl*1000L))
+        {
+            telem->stats.hits++;
+            *value = entry->value;
+            pthread_mutex_unlock(&telem->lock);
+            return RCX_OK;
+        }
+
+        if (!entry->busy)
+        {
+            break;
+        }
+
+        /* Another thread polls it: take its result, unless the */
+        /* entry was given to another value in the meantime     */
+        telem->stats.merged++;
+        generation = entry->generation;
+        while (entry->generation==generation)
+        {
+            pthread_cond_wait(&telem->cond, &telem->lock);
+        }
+        if (entry->used && (entry->source==source) &&
+            (entry->argument==argument))
+        {
+            result = entry->result;
+            if (result==RCX_OK)
+            {
+                *value = entry->value;
+            }
+            pthread_mutex_unlock(&telem->lock);
+            return result;
+        }
+        telem->stats.merged--;
+    }
+
+    entry->busy = 1;
+    entry->flushed = 0;
+    telem->stats.polls++;
+    pthread_mutex_unlock(&telem->lock);
+
+    result = telem_poll(telem, source, argument, &polled);
+
+    pthread_mutex_lock(&telem->lock);
+    telem_update(telem, entry, result, polled);
+    if (result==RCX_OK)
+    {
+        *value = polled;
+    }
+    pthread_cond_broadcast(&telem->cond);
+    pthread_mutex_unlock(&telem->lock);
+
+    return result;
+}
+
+
+
+/*************************************************************
+* rcx_telem_ttl returns the time to live a value has now.    *
+*                                                            *
+* Return: Time to live in ms, or RCX_E_BAD_ARGUMENT          *
+*************************************************************/
+int rcx_telem_ttl(rcx_telem_t* telem, int source, int argument)
+{
+    int ttl = RCX_E_BAD_ARGUMENT;
+    telem_entry_t* entry;
+
+    pthread_mutex_lock(&telem->lock);
+    entry = telem_find(telem, source, argument);
+    if ((entry!=NULL) && (entry->polls>0))
+    {
+        ttl = entry->ttl;
+    }
+    pthread_mutex_unlock(&telem->lock);
+
+    return ttl;
+}
+
+
+
+/*************************************************************
+* rcx_telem_flush drops all values.                          *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_telem_flush(rcx_telem_t* telem)
+{
+    int n;
+    telem_entry_t* entry;
+
+    pthread_mutex_lock(&telem->lock);
+    for (n=0; n<RCX_TELEM_ENTRIES; n++)
+    {
+        entry = &telem->entries[n];
+        if (entry->busy)
+        {
+            entry->flushed = 1;
+        }
+        else
+        {
+            entry->used = 0;
+        }
+        entry->valid = 0;
+    }
+    pthread_mutex_unlock(&telem->lock);
+}
+
+
+
+/*************************************************************
+* rcx_telem_get_stats returns the counters of a cache.       *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_telem_get_stats(rcx_telem_t* telem, rcx_telem_stats_t* stats)
+{
+    pthread_mutex_lock(&telem->lock);
+    *stats = telem->stats;
+    pthread_mutex_unlock(&telem->lock);
+}
+
+
+
+/*************************************************************
+* telem_find finds the entry of a value. The caller holds    *
+* the lock of the cache.                                     *
+*                                                            *
+* Return: The entry, or NULL                                 *
+*************************************************************/
+static telem_entry_t* telem_find(rcx_telem_t* telem, int source,
+                                 int argument)
+{
+    int n;
+    telem_entry_t* entry;
+
+    for (n=0; n<RCX_TELEM_ENTRIES; n++)
+    {
+        entry = &telem->entries[n];
+        if (entry->used && (entry->source==source) &&
+            (entry->argument==argument))
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+
+
+/*************************************************************
+* telem_take gives an entry to a value: a free one, or else  *
+* the one asked for the longest ago that is not busy. The    *
+* caller holds the lock of the cache.                        *
+*                                                            *
+* Return: The entry, or NULL if all are busy                 *
+*************************************************************/
+static telem_entry_t* telem_take(rcx_telem_t* telem, int source,
+                                 int argument)
+{
+    int n;
+    telem_entry_t* entry;
+    telem_entry_t* oldest = NULL;
+
+    for (n=0; n<RCX_TELEM_ENTRIES; n++)
+    {
+        entry = &telem->entries[n];
+        if (!entry->used)
+        {
+            oldest = entry;
+            break;
+        }
+        if (!entry->busy &&
+            ((oldest==NULL) || (entry->last_use<oldest->last_use)))
+        {
+            oldest = entry;
+        }
+    }
+
+    if (oldest==NULL)
+    {
+        APP_ERROR("All cache entries busy");
+        return NULL;
+    }
+    if (oldest->used)
+    {
+        telem->stats.evictions++;
+    }
+
+    /* The generation goes on, for threads that still wait */
+    oldest->used = 1;
+    oldest->source = source;
+    oldest->argument = argument;
+    oldest->valid = 0;
+    oldest->busy = 0;
+    oldest->flushed = 0;
+    oldest->polls = 0;
+    oldest->value = 0;
+    oldest->result = RCX_OK;
+    oldest->ttl = telem->ttl_min[source];
+    oldest->polled = 0;
+    return oldest;
+}
+
+
+
+/*************************************************************
+* telem_poll asks the RCX for a value, without the lock of   *
+* the cache.                                                 *
+*                                                            *
+* Return: See rcx_command(), or RCX_E_RECV_ERROR if the      *
+*         reply is too short                                 *
+*************************************************************/
+static int telem_poll(rcx_telem_t* telem, int source, int argument,
+                      int* value)
+{
+    int len;
+    int result;
+    unsigned char buf[TELEM_BUFFER];
+
+    if (source==RCX_TELEM_BATTERY)
+    {
+        buf[0] = TELEM_GET_BATTERY;
+        len = 1;
+    }
+    else
+    {
+        buf[0] = TELEM_GET_VALUE;
+        buf[1] = (unsigned char) source;
+        buf[2] = (unsigned char) argument;
+        len = 3;
+    }
+
+    result = rcx_command_dev(telem->handle, buf, sizeof(buf), &len);
+    if (result!=RCX_OK)
+    {
+        APP_PRINT2("Poll failed: %d", result);
+        return result;
+    }
+    if (len<TELEM_REPLY_BYTES)
+    {
+        APP_ERROR("Reply of poll too short");
+        return RCX_E_RECV_ERROR;
+    }
+
+    /* The battery is in mV, the other values are signed */
+    if (source==RCX_TELEM_BATTERY)
+    {
+        *value = buf[1] | (buf[2]<<8);
+    }
+    else
+    {
+        *value = (short) (buf[1] | (buf[2]<<8));
+    }
+    return RCX_OK;
+}
+
+
+
+/*************************************************************
+* telem_update takes the result of a poll into its entry,    *
+* and adapts the time to live: halved if the value changed,  *
+* doubled if not. The caller holds the lock of the cache.    *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+static void telem_update(rcx_telem_t* telem, telem_entry_t* entry,
+                         int result, int value)
+{
+    int ttl_min = telem->ttl_min[entry->source];
+    int ttl_max = telem->ttl_max[entry->source];
+
+    entry->busy = 0;
+    entry->generation++;
+    entry->result = result;
+
+    /* A flushed value is not kept */
+    entry->valid = (result==RCX_OK) && !entry->flushed;
+    if (entry->flushed)
+    {
+        entry->used = 0;
+    }
+
+    if (result!=RCX_OK)
+    {
+        telem->stats.errors++;
+        return;
+    }
+
+    entry->polls++;
+    if (entry->polls==1)
+    {
+        entry->ttl = ttl_min;
+    }
+    else if (value!=entry->value)
+    {
+        telem->stats.changes++;
+        entry->ttl /= 2;
+    }
+    else
+    {
+        entry->ttl = (entry->ttl>0) ? entry->ttl*2 : 1;
+    }
+    if (entry->ttl<ttl_min)
+    {
+        entry->ttl = ttl_min;
+    }
+    if (entry->ttl>ttl_max)
+    {
+        entry->ttl = ttl_max;
+    }
+
+    entry->value = value;
+    entry->polled = rcx_get_time_dev(telem->handle);
+}
@@ -0,0 +1,305 @@
+/***************************************************************
+*                                                              *
+* rcxtrace.c                                                   *
+*                                                              *
+* Description:                                                 *
+* Binary trace rings, see rcxtrace.h.                          *
+*                                                              *
+* Each thread writes to a ring of its own, found through a     *
+* thread-local pointer, so recording needs no lock. Only the   *
+* owner writes: the event first, then the head with release    *
+* order. A reader copies the events below the head, and drops  *
+* those the owner may have overwritten while it copied.        *
+*                                                              *
+* The rings are kept in a list that only grows. When a thread  *
+* ends, its ring is released, and taken over by the next new   *
+* thread; the events in it can still be dumped until then.     *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+***************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "rcxtrace.h"
+
+/* Ring of a thread */
+struct trace_ring
+{
+    struct trace_ring* next;      /* All rings                  */
+    int                owned;     /* In use by a thread         */
+    int                thread;    /* Number, for the dump       */
+    unsigned long      head;      /* Events written, ever       */
+    rcx_trace_event_t  events[RCX_TRACE_EVENTS];
+};
+
+/* An event copied for the dump, with its thread */
+struct trace_copy
+{
+    rcx_trace_event_t  event;
+    int                thread;
+};
+
+int rcx_trace_current = RCX_TRACE_ERROR;
+
+static struct trace_ring* trace_rings = NULL;
+static int trace_threads = 0;
+static __thread struct trace_ring* trace_mine = NULL;
+static pthread_key_t trace_key;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+
+/* Prototypes */
+static void trace_init(void);
+static void trace_load(void) __attribute__((constructor));
+static void trace_release(void* ring);
+static struct trace_ring* trace_attach(void);
+static int trace_compare(const void* a, const void* b);
+
+
+
+/*************************************************************
+* rcx_trace_level selects the events that are recorded.      *
+*                                                            *
+* Input:  level     RCX_TRACE_xxx level                      *
+*                                                            *
+* Return: The previous level                                 *
+*************************************************************/
+int rcx_trace_level(int level)
+{
+    /* The environment is read first, so the call takes precedence */
+    pthread_once(&trace_once, trace_init);
+    return __atomic_exchange_n(&rcx_trace_current, level, __ATOMIC_RELAXED);
+}
+
+
+
+/*************************************************************
+* rcx_trace_event records an event in the ring of the        *
+* calling thread. An event is dropped if there is no memory  *
+* for a ring.                                                *
+*                                                            *
+* Return: none                                               *
+*************************************************************/
+void rcx_trace_event(int level, const char* file, int line,
+                     const char* function, const char* format, int arg)
+{
+    unsigned long head;
+    rcx_trace_event_t* event;
+    struct trace_ring* ring = trace_mine;
+    struct timespec ts;
+
+    if (ring==NULL)
+    {
+        ring = trace_attach();
+        if (ring==NULL)
+        {
+            return;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    head = ring->head;
+    event = &ring->events[head % RCX_TRACE_EVENTS];
+    event->time = ts.tv_sec*1000000000LL + ts.tv_nsec;
+    event->file = file;
+    event->function = function;
+    event->format = format;
+    event->arg = arg;
+    event->line = (short) line;
+    event->level = (short) level;
+
+    __atomic_store_n(&ring->head, head+1, __ATOMIC_RELEASE);
+}
+
+
+
+/*************************************************************
+* rcx_trace_dump formats the events of all threads, oldest   *
+* first.                                                     *
+*                                                            *
+* Input:  out       Stream to write to                       *
+*                                                            *
+* Return: Number of events written                           *
+*************************************************************/
+int rcx_trace_dump(FILE* out)
+{
+    static const char* levels[] = { "", "ERROR", "DEBUG", "DATA" };
+    int n;
+    int rings = 0;
+    int count = 0;
+    unsigned long first;
+    unsigned long head;
+    unsigned long index;
+    unsigned long skip;
+    struct trace_copy* copies;
+    struct trace_copy* copy;
+    struct trace_ring* ring;
+
+    for (ring=__atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); ring!=NULL;
+         ring=ring->next)
+    {
+        rings++;
+    }
+
+    copies = (struct trace_copy*)
+             malloc(rings*RCX_TRACE_EVENTS*sizeof(struct trace_copy));
+    if (copies==NULL)
+    {
+        return 0;
+    }
+
+    ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE);
+    for (n=0; n<rings; n++, ring=ring->next)
+    {
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        first = (head>RCX_TRACE_EVENTS) ? head-RCX_TRACE_EVENTS : 0;
+        for (index=first; index<head; index++)
+        {
+            copy = &copies[count+index-first];
+            copy->event = ring->events[index % RCX_TRACE_EVENTS];
+            copy->thread = ring->thread;
+        }
+
+        /* Drop what the owner has overwritten while we copied, */
+        /* and the slot of head, which it may be writing now    */
+        index = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) + 1;
+        skip = (index>first+RCX_TRACE_EVENTS) ?
+               index-first-RCX_TRACE_EVENTS : 0;
+        if (skip>head-first)
+        {
+            skip = head-first;
+        }
+        memmove(&copies[count], &copies[count+skip],
+                (head-first-skip)*sizeof(struct trace_copy));
+        count += head-first-skip;
+    }
+
+    qsort(copies, count, sizeof(struct trace_copy), trace_compare);
+
+    for (n=0; n<count; n++)
+    {
+        copy = &copies[n];
+        fprintf(out, "%lld.%09lld T%d %-5s %s:%d %s(): ",
+                copy->event.time/1000000000LL, copy->event.time%1000000000LL,
+                copy->thread, levels[copy->event.level&3],
+                copy->event.file, copy->event.line, copy->event.function);
+        fprintf(out, copy->event.format, copy->event.arg);
+        fprintf(out, "\n");
+    }
+
+    free(copies);
+    return count;
+}
+
+
+
+/*************************************************************
+* trace_compare orders copied events by time.                *
+*************************************************************/
+static int trace_compare(const void* a, const void* b)
+{
+    long long ta = ((const struct trace_copy*) a)->event.time;
+    long long tb = ((const struct trace_copy*) b)->event.time;
+
+    return (ta<tb) ? -1 : (ta>tb) ? 1 : 0;
+}
+
+
+
+/*************************************************************
+* trace_load runs trace_init() when the library is loaded,   *
+* before any event is checked against the level.             *
+*************************************************************/
+static void trace_load(void)
+{
+    pthread_once(&trace_once, trace_init);
+}
+
+
+
+/*************************************************************
+* trace_init sets up the key that releases the ring of an    *
+* ending thread, and takes the level from the environment.   *
+*************************************************************/
+static void trace_init(void)
+{
+    const char* level;
+
+    pthread_key_create(&trace_key, trace_release);
+
+    level = getenv("RCX_TRACE");
+    if (level!=NULL)
+    {
+        __atomic_store_n(&rcx_trace_current, atoi(level), __ATOMIC_RELAXED);
+    }
+}
+
+
+
+/*************************************************************
+* trace_release gives the ring of an ending thread to the    *
+* next new one.                                              *
+*************************************************************/
+static void trace_release(void* ring)
+{
+    __atomic_store_n(&((struct trace_ring*) ring)->owned, 0,
+                     __ATOMIC_RELEASE);
+}
+
+
+
+/*************************************************************
+* trace_attach gives the calling thread a ring: a released   *
+* one if there is, or a new one.                             *
+*                                                            *
+* Return: The ring, or NULL if out of memory                 *
+*************************************************************/
+static struct trace_ring* trace_attach(void)
+{
+    int expected;
+    struct trace_ring* ring;
+
+    pthread_once(&trace_once, trace_init);
+
+    for (ring=__atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); ring!=NULL;
+         ring=ring->next)
+    {
+        expected = 0;
+        if (__atomic_compare_exchange_n(&ring->owned, &expected, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            break;
+        }
+    }
+
+    if (ring==NULL)
+    {
+        ring = (struct trace_ring*) malloc(sizeof(struct trace_ring));
+        if (ring==NULL)
+        {
+            return NULL;
+        }
+        ring->owned = 1;
+        ring->head = 0;
+        ring->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&trace_rings, &ring->next, ring,
+                                            0, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED))
+        {
+            ;
+        }
+    }
+
+    ring->thread = __atomic_add_fetch(&trace_threads, 1, __ATOMIC_RELAXED);
+    pthread_setspecific(trace_key, ring);
+    trace_mine = ring;
+    return ring;
+}
@@ -34,13 +34,24 @@
 /* Includes */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "rcx.h"
+#include "rcxtrace.h"
+#include "rcxfirm.h"
+#include "rcxird.h"
+#include "options.h"
 
 #define LEGO_BUFFER_LENGTH   1024
 
 /* Prototypes */
 int parse_cmd_line(unsigned char* pbuf, int argc, char** argv);
 void display_rcx_reply(unsigned char* sbuf, int slen);
+void display_rcx_stats(void);
+void display_calibration(int result, rcx_calibration_t* cal);
+void display_histogram(const char* name, unsigned long* buckets);
+void display_trace(void);
+int download_firmware(char* path);
+int daemon_command(char* name, unsigned char* buffer, int count);
 
 
 /***************************************************************
@@ -57,18 +68,104 @@ int main(int argc,char **argv)
 {
     int count;
     int result;
+    int stats = 0;
+    int calibrate = 0;
+    int use_daemon = 0;
+    int target = RCX_TARGET_DEFAULT;
+    int baud = RCX_BAUD_2400;
+    char* firmware = NULL;
     unsigned char buffer[LEGO_BUFFER_LENGTH];
+    rcx_calibration_t cal;
+
+    /* Send the command through rcxird, which owns the device */
+    if ((argc>=2) && (strcmp(argv[1], "-d")==0))
+    {
+        use_daemon = 1;
+        argv[1] = argv[0];
+        argv += 1;
+        argc -= 1;
+    }
+
+    /* Calibrate the timing of the host before the command */
+    if ((argc>=2) && (strcmp(argv[1], "-c")==0))
+    {
+        calibrate = 1;
+        argv[1] = argv[0];
+        argv += 1;
+        argc -= 1;
+    }
+
+    /* Show the statistics of the link at the end */
+    if ((argc>=2) && (strcmp(argv[1], "-s")==0))
+    {
+        stats = 1;
+        argv[1] = argv[0];
+        argv += 1;
+        argc -= 1;
+    }
+
+    /* Trace the library at the given level, and show the */
+    /* trace when the program ends                         */
+    if ((argc>=3) && (strcmp(argv[1], "-v")==0))
+    {
+        rcx_trace_level(atoi(argv[2]));
+        atexit(display_trace);
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+
+    /* Select the timing values of the host */
+    if ((argc>=3) && (strcmp(argv[1], "-t")==0))
+    {
+        target = parse_target(argv[2]);
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+
+    /* Select the bit rate of the link */
+    if ((argc>=3) && (strcmp(argv[1], "-b")==0))
+    {
+        baud = parse_baud(argv[2]);
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+
+    /* Download a firmware before the command */
+    if ((argc>=3) && (strcmp(argv[1], "-f")==0))
+    {
+        firmware = argv[2];
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
 
     /* Pre-parse command arguments */	
-    if ((argc==2) && (argv[1][0]=='-'))
+    if ((target<0) || (baud<0) || ((argc==2) && (argv[1][0]=='-')))
     {
-        printf("Usage: %s [byte ...]  (bytes in hex)\n", argv[0]);
+        printf("Usage: %s [-d] [-c] [-s] [-v level] " OPTIONS_USAGE " [-f firmware.srec] [byte ...]  (bytes in hex)\n", argv[0]);
         printf("Note: If no bytes are given, then nothing is transmitted.\n");
+        printf("      -d sends the command through rcxird, see %s;\n", RCX_IRD_ENV);
+        printf("         -c, -t, -b and -f are then up to rcxird.\n");
+        printf("      -c calibrates the timing, and saves it for this host.\n");
+        printf("      " OPTIONS_NOTE_BAUD "\n");
+        printf("      -f downloads the firmware in an S-record file.\n");
+        printf("      -s shows the statistics of the link.\n");
+        printf("      -v traces the library: 1 errors, 2 debug, 3 data.\n");
     	return EXIT_SUCCESS;
     }
 
+    /* The daemon has the device open and set up already */
+    if (use_daemon)
+    {
+        count = parse_cmd_line(buffer, argc, argv);
+        return daemon_command(argv[0], buffer, count);
+    }
+
     /* Open the LIRC driver */
-    result = rcx_open();
+    result = rcx_open_target(target);
     switch (result)
     {
         case RCX_OK:
@@ -121,13 +218,43 @@ int main(int argc,char **argv)
         return EXIT_FAILURE;
     }
 
+    if (rcx_set_baud(baud)!=RCX_OK)
+    {
+        printf("%s error: Bit rate not possible with this timing!\n",argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* Measure the timing, best with the RCX in range */
+    if (calibrate)
+    {
+        result = rcx_calibrate(&cal);
+        display_calibration(result, &cal);
+        if ((result!=RCX_OK) && (result!=RCX_E_PROFILE_FILE))
+        {
+            return EXIT_FAILURE;
+        }
+    }
+
+    if ((firmware!=NULL) && (download_firmware(firmware)!=RCX_OK))
+    {
+        if (stats)
+        {
+            display_rcx_stats();
+        }
+        return EXIT_FAILURE;
+    }
 
     /* Parse command line and send data to RCX */
     count = parse_cmd_line(buffer, argc, argv);
     if (count>0)
     {
         /* Send bytes to RCX */
-        switch (rcx_command(buffer, LEGO_BUFFER_LENGTH, &count))
+        result = rcx_command(buffer, LEGO_BUFFER_LENGTH, &count);
+        if (stats)
+        {
+            display_rcx_stats();
+        }
+        switch (result)
         {
             case RCX_OK:
             printf("%s ok: RCX command processed succesfully.\n",argv[0]);
@@ -148,6 +275,10 @@ int main(int argc,char **argv)
             case RCX_E_RECV_ERROR:
             printf("%s error: RCX reply received with errors!\n",argv[0]);
             return EXIT_FAILURE;
+
+            case RCX_E_COLLISION:
+            printf("%s error: RCX command collided with another transmission!\n",argv[0]);
+            return EXIT_FAILURE;
             
             default:
             printf("%s error: Unknown return code of rcx_send() call!\n",argv[0]);
@@ -195,6 +326,219 @@ void display_rcx_reply(unsigned char* sbuf, int slen)
 
 
 
+/*************************************************************
+* display_rcx_stats dumps the statistics of the link to      *
+* console, see rcx_get_stats()                               *
+*                                                            *
+* Return: none                                               *
+*                                                            *
+*************************************************************/
+void display_rcx_stats(void)
+{
+    rcx_stats_t stats;
+
+    if (rcx_get_stats(&stats)!=RCX_OK)
+    {
+        return;
+    }
+
+    printf("Errors:   parity %lu, framing %lu, break %lu, complement %lu,"
+           " checksum %lu\n", stats.parity_errors, stats.framing_errors,
+           stats.break_errors, stats.complement_errors,
+           stats.checksum_errors);
+    printf("Commands: timeouts %lu, retries %lu, late replies %lu\n",
+           stats.timeouts, stats.retries, stats.late_replies);
+    printf("Rate:     %d baud, %lu fallbacks, %lu probes\n",
+           rcx_get_baud(), stats.rate_fallbacks, stats.rate_probes);
+    printf("Sent:     %lu bytes, %lu packets\n",
+           stats.bytes_sent, stats.packets_sent);
+    printf("Received: %lu bytes, %lu packets\n",
+           stats.bytes_received, stats.packets_received);
+    display_histogram("Round trip", stats.command_time);
+    display_histogram("Reply wait", stats.reply_wait);
+}
+
+
+
+/*************************************************************
+* display_calibration dumps the result of rcx_calibrate() to *
+* console                                                    *
+*                                                            *
+* Input:  result    Return code of rcx_calibrate()           *
+*         cal       What was measured                        *
+*                                                            *
+* Return: none                                               *
+*                                                            *
+*************************************************************/
+void display_calibration(int result, rcx_calibration_t* cal)
+{
+    switch (result)
+    {
+        case RCX_OK:
+        case RCX_E_PROFILE_FILE:
+        printf("Calibrated: bit period %d us, mark adjust %d us,"
+               " space adjust %d us\n", cal->bit_period,
+               cal->mark_adjust, cal->space_adjust);
+        printf("Measured:   transmitter %d/%d us, receiver %d/%d us"
+               " (mark/space), %d echo and %d reply runs\n",
+               cal->tx_mark_error, cal->tx_space_error,
+               cal->rx_mark_error, cal->rx_space_error,
+               cal->echo_samples, cal->reply_samples);
+        if (result==RCX_E_PROFILE_FILE)
+        {
+            printf("Calibration error: profile file cannot be written!\n");
+        }
+        break;
+
+        case RCX_E_NO_ECHO:
+        printf("Calibration error: the receiver does not hear the"
+               " transmissions!\n");
+        break;
+
+        case RCX_E_RECV_ERROR:
+        printf("Calibration error: timing out of range!\n");
+        break;
+
+        default:
+        printf("Calibration error: return code %d\n", result);
+    }
+}
+
+
+
+/*************************************************************
+* display_histogram dumps the non-empty buckets of a time    *
+* histogram to console                                       *
+*                                                            *
+* Input:  name      Name of the histogram                    *
+*         buckets   RCX_STATS_BUCKETS counters               *
+*                                                            *
+* Return: none                                               *
+*                                                            *
+*************************************************************/
+void display_histogram(const char* name, unsigned long* buckets)
+{
+    int n;
+
+    printf("%s:", name);
+    for (n=0; n<RCX_STATS_BUCKETS; n++)
+    {
+        if ((buckets[n]>0) && (n<RCX_STATS_BUCKETS-1))
+        {
+            printf(" <%ldms:%lu", 1L<<n, buckets[n]);
+        }
+        else if (buckets[n]>0)
+        {
+            printf(" >=%ldms:%lu", 1L<<(n-1), buckets[n]);
+        }
+    }
+    printf("\n");
+}
+
+
+
+/*************************************************************
+* display_trace dumps the trace of the library to stderr     *
+*                                                            *
+* Return: none                                               *
+*                                                            *
+*************************************************************/
+void display_trace(void)
+{
+    rcx_trace_dump(stderr);
+}
+
+
+
+/*************************************************************
+* download_firmware reads an S-record file, and downloads    *
+* it to the RCX.                                             *
+*                                                            *
+* Input:  path      Path of the S-record file                *
+*                                                            *
+* Return: RCX_OK, or the error of the download               *
+*************************************************************/
+int download_firmware(char* path)
+{
+    int result;
+    rcx_download_t download;
+    static rcx_firmware_t firmware;
+
+    result = rcx_firmware_load(path, &firmware);
+    if (result!=RCX_OK)
+    {
+        printf("lego error: %s is not an S-record file of a firmware!\n", path);
+        return result;
+    }
+
+    download.block_size = 0;
+    result = rcx_download_firmware(&firmware, &download);
+    if (result==RCX_OK)
+    {
+        printf("lego ok: Firmware of %d bytes downloaded in %ld.%03ld s.\n",
+               firmware.length, download.time/1000000,
+               (download.time/1000)%1000);
+    }
+    else if (result==RCX_E_FIRMWARE)
+    {
+        printf("lego error: RCX refused the firmware!\n");
+    }
+    else
+    {
+        printf("lego error: Firmware download failed (%d)!\n", result);
+    }
+    printf("Download: %d blocks of %d bytes, %d sent again\n",
+           download.blocks, download.block_size, download.retransmits);
+
+    return result;
+}
+
+
+/*************************************************************
+* daemon_command sends a command to the RCX through rcxird,  *
+* and dumps the reply to console                             *
+*                                                            *
+* Input:  name      Name of the program                      *
+*         buffer    Command bytes                            *
+*         count     Number of command bytes                  *
+*                                                            *
+* Return: EXIT_SUCCESS, or EXIT_FAILURE                      *
+*************************************************************/
+int daemon_command(char* name, unsigned char* buffer, int count)
+{
+    int result;
+    rcx_ird_client_t* client;
+
+    if (rcx_ird_connect(NULL, &client)!=RCX_OK)
+    {
+        printf("%s error: rcxird is not running!\n", name);
+        return EXIT_FAILURE;
+    }
+
+    result = RCX_OK;
+    if (count>0)
+    {
+        result = rcx_ird_command(client, buffer, LEGO_BUFFER_LENGTH, &count);
+    }
+    rcx_ird_close(client);
+
+    if (result!=RCX_OK)
+    {
+        printf("%s error: RCX command through rcxird failed (%d)!\n",
+               name, result);
+        return EXIT_FAILURE;
+    }
+
+    if (count>0)
+    {
+        printf("%s ok: RCX command processed succesfully.\n", name);
+        display_rcx_reply(buffer, count);
+    }
+    return EXIT_SUCCESS;
+}
+
+
+
 /*************************************************************
 * parse_cmd_line converts the hex bytes given on the command *
 * line to an list of bytes                                   *
@@ -0,0 +1,69 @@
+/***************************************************************
+*                                                              *
+* Description:                                                 *
+* The command line options that LEGO and RCXIRD share, see     *
+* options.h.                                                   *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+*                                                              *
+***************************************************************/
+
+/* Includes */
+#include <string.h>
+#include "rcx.h"
+#include "options.h"
+
+
+
+/*************************************************************
+* parse_target converts a target name to RCX_TARGET_xxx      *
+*                                                            *
+* Return: RCX_TARGET_xxx value, or -1                        *
+*                                                            *
+*************************************************************/
+int parse_target(char* name)
+{
+    if (strcmp(name, "nominal")==0)
+    {
+        return RCX_TARGET_NOMINAL;
+    }
+    if (strcmp(name, "pc")==0)
+    {
+        return RCX_TARGET_PC;
+    }
+    if (strcmp(name, "ipaq")==0)
+    {
+        return RCX_TARGET_IPAQ;
+    }
+    return -1;
+}
+
+
+
+/*************************************************************
+* parse_baud converts a bit rate to RCX_BAUD_xxx             *
+*                                                            *
+* Return: RCX_BAUD_xxx value, or -1                          *
+*                                                            *
+*************************************************************/
+int parse_baud(char* name)
+{
+    if (strcmp(name, "2400")==0)
+    {
+        return RCX_BAUD_2400;
+    }
+    if (strcmp(name, "4800")==0)
+    {
+        return RCX_BAUD_4800;
+    }
+    if (strcmp(name, "auto")==0)
+    {
+        return RCX_BAUD_AUTO;
+    }
+    return -1;
+}
@@ -0,0 +1,50 @@
+/***************************************************************
+*                                                              *
+* options.h                                                    *
+*                                                              *
+* Description:                                                 *
+* Command line options that LEGO and RCXIRD share: the target  *
+* (-t) and the bit rate (-b) of the link.                      *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+*                                                              *
+***************************************************************/
+#ifndef _OPTIONS_H
+#define _OPTIONS_H
+
+/* The options in the usage line, and the note on -b */
+#define OPTIONS_USAGE       "[-t nominal|pc|ipaq] [-b 2400|4800|auto]"
+#define OPTIONS_NOTE_BAUD   "-b auto runs at 4800 baud, and at 2400 on a bad link."
+
+/*************************************************************
+* parse_target converts a target name given on the command   *
+* line to a RCX_TARGET_xxx value                             *
+*                                                            *
+* Input:  name      Target name                              *
+*                                                            *
+* Return: >=0       RCX_TARGET_xxx value                     *
+*         -1        Unknown target name                      *
+*                                                            *
+*************************************************************/
+int parse_target(char* name);
+
+/*************************************************************
+* parse_baud converts a bit rate given on the command line   *
+* to a RCX_BAUD_xxx value                                    *
+*                                                            *
+* Input:  name      Bit rate, or "auto"                      *
+*                                                            *
+* Return: >=0       RCX_BAUD_xxx value                       *
+*         -1        Unknown bit rate                         *
+*                                                            *
+*************************************************************/
+int parse_baud(char* name);
+
+#else
+#error -- options.h -- included twice, or more...
+#endif /* _OPTIONS_H */
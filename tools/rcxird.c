@@ -0,0 +1,155 @@
+/***************************************************************
+*                                                              *
+* Description:                                                 *
+* RCXIRD owns the LIRC device, and shares it among the         *
+* programs of this host. They connect to a Unix domain socket, *
+* see rcxird.h, e.g. with 'lego -d'. The daemon runs until it  *
+* gets SIGINT or SIGTERM.                                      *
+*                                                              *
+* Dependencies:                                                *
+* - 'librcx.so' must be installed on your system               *
+* - Driver 'lirc_sir.o' must be installed and loaded. For      *
+*   details see LIRC project's website www.lirc.org            *
+*                                                              *
+* License:                                                     *
+* This program is free software; you can redistribute it       *
+* and/or modify it under the terms of the GNU General Public   *
+* License as published by the Free Software Foundation; either *
+* version 2 of the License, or (at your option) any later      *
+* version.                                                     *
+*                                                              *
+***************************************************************/
+
+/* Includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "rcx.h"
+#include "rcxird.h"
+#include "options.h"
+
+/* Prototypes */
+void stop_server(int signal);
+
+/* The server, for the signal handler */
+static rcx_ird_server_t* server = NULL;
+
+
+/***************************************************************
+* main:                                                        *
+*                                                              *
+* Input:  argc      Number of arguments                        *
+*         argv      List of pointers to the arguments          *
+*                                                              *
+* Return: EXIT_SUCCESS when stopped by a signal                *
+*         EXIT_FAILURE on failure accessing the device or the  *
+*                      socket                                  *
+*                                                              *
+***************************************************************/
+int main(int argc, char **argv)
+{
+    int n;
+    int result;
+    int target = RCX_TARGET_DEFAULT;
+    int baud = RCX_BAUD_2400;
+    char* device = RCX_DEFAULT_DEVICE;
+    char* path = NULL;
+    rcx_handle_t* handle;
+
+    for (n=1; n<argc; n+=2)
+    {
+        if ((n+1<argc) && (strcmp(argv[n], "-d")==0))
+        {
+            device = argv[n+1];
+        }
+        else if ((n+1<argc) && (strcmp(argv[n], "-s")==0))
+        {
+            path = argv[n+1];
+        }
+        else if ((n+1<argc) && (strcmp(argv[n], "-t")==0))
+        {
+            target = parse_target(argv[n+1]);
+        }
+        else if ((n+1<argc) && (strcmp(argv[n], "-b")==0))
+        {
+            baud = parse_baud(argv[n+1]);
+        }
+        else
+        {
+            target = -1;
+        }
+    }
+
+    if ((target<0) || (baud<0))
+    {
+        printf("Usage: %s [-d device] [-s socket] " OPTIONS_USAGE "\n", argv[0]);
+        printf("Note: The socket is $%s, or %s if not set.\n",
+               RCX_IRD_ENV, RCX_IRD_SOCKET);
+        printf("      " OPTIONS_NOTE_BAUD "\n");
+        return EXIT_SUCCESS;
+    }
+
+    result = rcx_open_dev(device, target, &handle);
+    if (result!=RCX_OK)
+    {
+        printf("%s error: LIRC device %s cannot be opened (%d)!\n",
+               argv[0], device, result);
+        return EXIT_FAILURE;
+    }
+
+    if ((rcx_reset_dev(handle)!=RCX_OK) ||
+        (rcx_set_baud_dev(handle, baud)!=RCX_OK))
+    {
+        printf("%s error: LIRC device cannot be set up!\n", argv[0]);
+        rcx_close_dev(handle);
+        return EXIT_FAILURE;
+    }
+
+    result = rcx_ird_server_create(handle, path, &server);
+    if (result==RCX_E_DEVICE_IS_OPEN)
+    {
+        printf("%s error: Another rcxird serves %s!\n", argv[0],
+               (path!=NULL) ? path : "the socket");
+        rcx_close_dev(handle);
+        return EXIT_FAILURE;
+    }
+    if (result!=RCX_OK)
+    {
+        printf("%s error: Socket cannot be bound (%d)!\n", argv[0], result);
+        rcx_close_dev(handle);
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, stop_server);
+    signal(SIGTERM, stop_server);
+
+    printf("%s ok: Serving %s.\n", argv[0], device);
+    result = rcx_ird_server_run(server);
+
+    rcx_ird_server_destroy(server);
+    rcx_close_dev(handle);
+
+    if (result!=RCX_OK)
+    {
+        printf("%s error: Server failed (%d)!\n", argv[0], result);
+        return EXIT_FAILURE;
+    }
+    printf("%s ok: Stopped.\n", argv[0]);
+    return EXIT_SUCCESS;
+}
+
+
+
+/*************************************************************
+* stop_server makes the server return, on SIGINT or SIGTERM  *
+*                                                            *
+* Input:  signal    Number of the signal                     *
+*                                                            *
+* Return: none                                               *
+*                                                            *
+*************************************************************/
+void stop_server(int signal)
+{
+    rcx_ird_server_stop(server);
+}